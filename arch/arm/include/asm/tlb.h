@@ -47,6 +47,13 @@
 
 #define MMU_GATHER_BUNDLE	8
 
+/*
+ * Gathered ranges larger than this are flushed by ASID instead of one
+ * entry at a time: the flush loop would cost more than refilling the TLB,
+ * and on CPUs that broadcast TLB operations with IPIs both take one IPI.
+ */
+#define MMU_GATHER_RANGE_MAX	(64 * PAGE_SIZE)
+
 /*
  * TLB handling.  This allows us to remove pages from the page
  * tables, and efficiently handle the TLB issues.
@@ -83,7 +90,11 @@ static inline void tlb_flush(struct mmu_gather *tlb)
 	if (tlb->fullmm || !tlb->vma)
 		flush_tlb_mm(tlb->mm);
 	else if (tlb->range_end > 0) {
-		flush_tlb_range(tlb->vma, tlb->range_start, tlb->range_end);
+		if (tlb->range_end - tlb->range_start > MMU_GATHER_RANGE_MAX)
+			flush_tlb_mm(tlb->mm);
+		else
+			flush_tlb_range(tlb->vma, tlb->range_start,
+					tlb->range_end);
 		tlb->range_start = TASK_SIZE;
 		tlb->range_end = 0;
 	}
@@ -126,6 +137,8 @@ tlb_gather_mmu(struct mmu_gather *tlb, struct mm_struct *mm, unsigned int fullmm
 	tlb->mm = mm;
 	tlb->fullmm = fullmm;
 	tlb->vma = NULL;
+	tlb->range_start = TASK_SIZE;
+	tlb->range_end = 0;
 	tlb->max = ARRAY_SIZE(tlb->local);
 	tlb->pages = tlb->local;
 	tlb->nr = 0;
@@ -157,23 +170,26 @@ tlb_remove_tlb_entry(struct mmu_gather *tlb, pte_t *ptep, unsigned long addr)
  * In the case of tlb vma handling, we can optimise these away in the
  * case where we're doing a full MM flush.  When we're doing a munmap,
  * the vmas are adjusted to only cover the region to be torn down.
+ *
+ * The TLB is not flushed per vma: the ranges of all the vmas torn down
+ * are merged and flushed once, by tlb_flush_mmu(), before any of their
+ * pages are freed.  flush_tlb_range() only looks at the vma for its mm
+ * and, on CPUs with split TLBs, for VM_EXEC, so keep an executable one
+ * if there is any.
  */
 static inline void
 tlb_start_vma(struct mmu_gather *tlb, struct vm_area_struct *vma)
 {
 	if (!tlb->fullmm) {
 		flush_cache_range(vma, vma->vm_start, vma->vm_end);
-		tlb->vma = vma;
-		tlb->range_start = TASK_SIZE;
-		tlb->range_end = 0;
+		if (!tlb->vma || (vma->vm_flags & VM_EXEC))
+			tlb->vma = vma;
 	}
 }
 
 static inline void
 tlb_end_vma(struct mmu_gather *tlb, struct vm_area_struct *vma)
 {
-	if (!tlb->fullmm)
-		tlb_flush(tlb);
 }
 
 static inline int __tlb_remove_page(struct mmu_gather *tlb, struct page *page)
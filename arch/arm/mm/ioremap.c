@@ -31,17 +31,10 @@
 #include <asm/mmu_context.h>
 #include <asm/pgalloc.h>
 #include <asm/tlbflush.h>
-#include <asm/sizes.h>
 
 #include <asm/mach/map.h>
 #include "mm.h"
 
-/*
- * Used by ioremap() and iounmap() code to mark (super)section-mapped
- * I/O regions in vm_struct->flags field.
- */
-#define VM_ARM_SECTION_MAPPING	0x80000000
-
 int ioremap_page(unsigned long virt, unsigned long phys,
 		 const struct mem_type *mtype)
 {
@@ -64,49 +57,26 @@ void __check_kvm_seq(struct mm_struct *mm)
 	} while (seq != init_mm.context.kvm_seq);
 }
 
-#ifndef CONFIG_SMP
+#ifdef CONFIG_HAVE_ARCH_HUGE_VMAP
 /*
- * Section support is unsafe on SMP - If you iounmap and ioremap a region,
- * the other CPUs will not see this change until their next context switch.
- * Meanwhile, (eg) if an interrupt comes in on one of those other CPUs
- * which requires the new ioremap'd region to be referenced, the CPU will
- * reference the _old_ region.
+ * Section mappings in the vmalloc area.
  *
- * Note that get_vm_area_caller() allocates a guard 4K page, so we need to
- * mask the size back to 1MB aligned or we will overflow in the loop below.
+ * Every mm carries its own copy of the kernel's first level entries for
+ * the vmalloc area, brought up to date by __check_kvm_seq() whenever its
+ * kvm_seq lags behind init_mm's.  Entries pointing to page tables never
+ * change once populated, so a stale copy is harmless.  An entry that
+ * becomes a section, or stops being one, is reloaded into the current mm
+ * straight away; every other mm picks it up at its next switch_mm().
+ *
+ * This is only safe on UP: on SMP, another CPU could keep walking the old
+ * entry until it switches mm, and reaching it by IPI is not possible from
+ * the vunmap() and iounmap() paths, which may run with interrupts off.
+ * Only the vmalloc area proper is copied by __check_kvm_seq(), so the
+ * module area is left to ptes.
  */
-static void unmap_area_sections(unsigned long virt, unsigned long size)
+static void sync_kernel_sections(unsigned long addr, unsigned long end)
 {
-	unsigned long addr = virt, end = virt + (size & ~(SZ_1M - 1));
-	pgd_t *pgd;
-
-	flush_cache_vunmap(addr, end);
-	pgd = pgd_offset_k(addr);
-	do {
-		pmd_t pmd, *pmdp = pmd_offset(pgd, addr);
-
-		pmd = *pmdp;
-		if (!pmd_none(pmd)) {
-			/*
-			 * Clear the PMD from the page table, and
-			 * increment the kvm sequence so others
-			 * notice this change.
-			 *
-			 * Note: this is still racy on SMP machines.
-			 */
-			pmd_clear(pmdp);
-			init_mm.context.kvm_seq++;
-
-			/*
-			 * Free the page table, if there was one.
-			 */
-			if ((pmd_val(pmd) & PMD_TYPE_MASK) == PMD_TYPE_TABLE)
-				pte_free_kernel(&init_mm, pmd_page_vaddr(pmd));
-		}
-
-		addr += PGDIR_SIZE;
-		pgd++;
-	} while (addr < end);
+	init_mm.context.kvm_seq++;
 
 	/*
 	 * Ensure that the active_mm is up to date - we want to
@@ -114,38 +84,88 @@ static void unmap_area_sections(unsigned long virt, unsigned long size)
 	 */
 	if (current->active_mm->context.kvm_seq != init_mm.context.kvm_seq)
 		__check_kvm_seq(current->active_mm);
+	flush_tlb_kernel_range(addr, end);
+}
+
+/*
+ * Point the first level entries of the PMD_SIZE range at @addr, which the
+ * caller owns entirely, to @val0 and @val1.  A page table left there by an
+ * earlier mapping of the range is freed once no CPU can reach it anymore.
+ */
+static int set_kernel_sections(unsigned long addr, unsigned long val0,
+			       unsigned long val1)
+{
+	pmd_t *pmd = pmd_off_k(addr);
+	pte_t *table = NULL;
+
+	if (!pmd_none(*pmd)) {
+		int i;
+
+		if ((pmd_val(*pmd) & PMD_TYPE_MASK) != PMD_TYPE_TABLE)
+			return -EBUSY;
+		table = pmd_page_vaddr(*pmd);
+		for (i = 0; i < PTRS_PER_PTE; i++)
+			if (!pte_none(table[i]))
+				return -EBUSY;
+	}
+
+	pmd[0] = __pmd(val0);
+	pmd[1] = __pmd(val1);
+	flush_pmd_entry(pmd);
 
-	flush_tlb_kernel_range(virt, end);
+	if (table) {
+		sync_kernel_sections(addr, addr + PMD_SIZE);
+		pte_free_kernel(&init_mm, table);
+	}
+	return 0;
 }
 
-static int
-remap_area_sections(unsigned long virt, unsigned long pfn,
-		    size_t size, const struct mem_type *type)
+int arch_vmap_pmd(pmd_t *pmd, unsigned long addr, phys_addr_t phys,
+		  pgprot_t prot)
 {
-	unsigned long addr = virt, end = virt + size;
-	pgd_t *pgd;
+	unsigned int prot_sect;
 
-	/*
-	 * Remove and free any PTE-based mapping, and
-	 * sync the current kernel mapping.
-	 */
-	unmap_area_sections(virt, size);
+	if (addr < VMALLOC_START || addr + PMD_SIZE > VMALLOC_END)
+		return 0;
 
-	pgd = pgd_offset_k(addr);
-	do {
-		pmd_t *pmd = pmd_offset(pgd, addr);
+	prot_sect = pte_prot_to_sect(prot);
+	if (!prot_sect)
+		return 0;
+	return !set_kernel_sections(addr, phys | prot_sect,
+				    (phys + SECTION_SIZE) | prot_sect);
+}
 
-		pmd[0] = __pmd(__pfn_to_phys(pfn) | type->prot_sect);
-		pfn += SZ_1M >> PAGE_SHIFT;
-		pmd[1] = __pmd(__pfn_to_phys(pfn) | type->prot_sect);
-		pfn += SZ_1M >> PAGE_SHIFT;
-		flush_pmd_entry(pmd);
+int arch_vunmap_pmd(pmd_t *pmd, unsigned long addr)
+{
+	if (addr < VMALLOC_START ||
+	    (pmd_val(*pmd) & PMD_TYPE_MASK) != PMD_TYPE_SECT)
+		return 0;
 
-		addr += PGDIR_SIZE;
-		pgd++;
-	} while (addr < end);
+	pmd_clear(pmd);
+	sync_kernel_sections(addr, addr + PMD_SIZE);
+	return 1;
+}
 
-	return 0;
+int arch_vmap_pmd_page(pmd_t *pmd, unsigned long addr, struct page **page)
+{
+	unsigned long sect = pmd_val(pmd[(addr >> SECTION_SHIFT) & 1]);
+	unsigned long phys;
+
+	if ((sect & PMD_TYPE_MASK) != PMD_TYPE_SECT)
+		return 0;
+
+	*page = NULL;
+	if (sect & PMD_SECT_SUPER) {
+		/* base address bits 35:32 live in bits 23:20 */
+		if (sect & (0xf << 20))
+			return 1;
+		phys = (sect & SUPERSECTION_MASK) | (addr & ~SUPERSECTION_MASK);
+	} else {
+		phys = (sect & SECTION_MASK) | (addr & ~SECTION_MASK);
+	}
+	if (pfn_valid(__phys_to_pfn(phys)))
+		*page = pfn_to_page(__phys_to_pfn(phys));
+	return 1;
 }
 
 static int
@@ -153,31 +173,21 @@ remap_area_supersections(unsigned long virt, unsigned long pfn,
 			 size_t size, const struct mem_type *type)
 {
 	unsigned long addr = virt, end = virt + size;
-	pgd_t *pgd;
-
-	/*
-	 * Remove and free any PTE-based mapping, and
-	 * sync the current kernel mapping.
-	 */
-	unmap_area_sections(virt, size);
 
-	pgd = pgd_offset_k(virt);
 	do {
 		unsigned long super_pmd_val, i;
+		int err;
 
 		super_pmd_val = __pfn_to_phys(pfn) | type->prot_sect |
 				PMD_SECT_SUPER;
 		super_pmd_val |= ((pfn >> (32 - PAGE_SHIFT)) & 0xf) << 20;
 
 		for (i = 0; i < 8; i++) {
-			pmd_t *pmd = pmd_offset(pgd, addr);
-
-			pmd[0] = __pmd(super_pmd_val);
-			pmd[1] = __pmd(super_pmd_val);
-			flush_pmd_entry(pmd);
-
+			err = set_kernel_sections(addr, super_pmd_val,
+						  super_pmd_val);
+			if (err)
+				return err;
 			addr += PGDIR_SIZE;
-			pgd++;
 		}
 
 		pfn += SUPERSECTION_SIZE >> PAGE_SHIFT;
@@ -185,6 +195,7 @@ remap_area_supersections(unsigned long virt, unsigned long pfn,
 
 	return 0;
 }
+
 #endif
 
 void __iomem * __arm_ioremap_pfn_caller(unsigned long pfn,
@@ -221,16 +232,17 @@ void __iomem * __arm_ioremap_pfn_caller(unsigned long pfn,
  		return NULL;
  	addr = (unsigned long)area->addr;
 
-#ifndef CONFIG_SMP
+#ifdef CONFIG_HAVE_ARCH_HUGE_VMAP
+	/*
+	 * Supersections are only used for high mappings, which cannot be
+	 * reached otherwise.  ioremap_page_range() maps the PMD_SIZE
+	 * aligned parts of everything else with sections.
+	 */
 	if (DOMAIN_IO == 0 &&
 	    (((cpu_architecture() >= CPU_ARCH_ARMv6) && (get_cr() & CR_XP)) ||
 	       cpu_is_xsc3()) && pfn >= 0x100000 &&
 	       !((__pfn_to_phys(pfn) | size | addr) & ~SUPERSECTION_MASK)) {
-		area->flags |= VM_ARM_SECTION_MAPPING;
 		err = remap_area_supersections(addr, pfn, size, type);
-	} else if (!((__pfn_to_phys(pfn) | size | addr) & ~PMD_MASK)) {
-		area->flags |= VM_ARM_SECTION_MAPPING;
-		err = remap_area_sections(addr, pfn, size, type);
 	} else
 #endif
 		err = ioremap_page_range(addr, addr + size, __pfn_to_phys(pfn),
@@ -292,28 +304,6 @@ EXPORT_SYMBOL(__arm_ioremap);
 void __iounmap(volatile void __iomem *io_addr)
 {
 	void *addr = (void *)(PAGE_MASK & (unsigned long)io_addr);
-#ifndef CONFIG_SMP
-	struct vm_struct **p, *tmp;
-
-	/*
-	 * If this is a section based mapping we need to handle it
-	 * specially as the VM subsystem does not know how to handle
-	 * such a beast. We need the lock here b/c we need to clear
-	 * all the mappings before the area can be reclaimed
-	 * by someone else.
-	 */
-	write_lock(&vmlist_lock);
-	for (p = &vmlist ; (tmp = *p) ; p = &tmp->next) {
-		if ((tmp->flags & VM_IOREMAP) && (tmp->addr == addr)) {
-			if (tmp->flags & VM_ARM_SECTION_MAPPING) {
-				unmap_area_sections((unsigned long)tmp->addr,
-						    tmp->size);
-			}
-			break;
-		}
-	}
-	write_unlock(&vmlist_lock);
-#endif
 
 	vunmap(addr);
 }
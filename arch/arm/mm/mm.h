@@ -18,6 +18,7 @@ struct mem_type {
 };
 
 const struct mem_type *get_mem_type(unsigned int type);
+unsigned int pte_prot_to_sect(pgprot_t prot);
 
 extern void __flush_dcache_page(struct address_space *mapping, struct page *page);
 
@@ -281,6 +281,42 @@ const struct mem_type *get_mem_type(unsigned int type)
 }
 EXPORT_SYMBOL(get_mem_type);
 
+#ifdef CONFIG_HAVE_ARCH_HUGE_VMAP
+/*
+ * Return the section protection bits for a kernel mapping made with PTE
+ * protection @prot, or 0 if @prot does not correspond to a memory type
+ * that can be mapped with sections.  Used to map PMD_SIZE aligned parts
+ * of the vmalloc area with sections.
+ */
+unsigned int pte_prot_to_sect(pgprot_t prot)
+{
+	static const unsigned int types[] = {
+		MT_DEVICE, MT_DEVICE_NONSHARED, MT_DEVICE_CACHED,
+		MT_DEVICE_WC, MT_MEMORY, MT_MEMORY_NONCACHED,
+	};
+	pteval_t pte = pgprot_val(prot);
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(types); i++) {
+		const struct mem_type *t = &mem_types[types[i]];
+
+		if (t->prot_pte == pte)
+			return t->prot_sect;
+		if ((t->prot_pte | L_PTE_XN) != pte)
+			continue;
+		/*
+		 * PAGE_KERNEL is MT_MEMORY plus execute-never, which only
+		 * ARMv6+ with extended page tables can express in a section.
+		 */
+		if (cpu_architecture() >= CPU_ARCH_ARMv6 &&
+		    (get_cr() & CR_XP) && !cpu_is_xsc3())
+			return t->prot_sect | PMD_SECT_XN;
+		return t->prot_sect;
+	}
+	return 0;
+}
+#endif
+
 /*
  * Adjust the PMD section entries according to the CPU in use.
  */
@@ -25,9 +25,13 @@
 #include <linux/highmem.h>
 #include <linux/random.h>
 #include <linux/cryptodev.h>
+#include <linux/kref.h>
+#include <linux/slab.h>
+#include <linux/completion.h>
 #include <asm/uaccess.h>
 #include <asm/ioctl.h>
 #include <linux/scatterlist.h>
+#include <crypto/scatterwalk.h>
 
 MODULE_AUTHOR("Michal Ludvig <mludvig@suse.cz>");
 MODULE_DESCRIPTION("CryptoDev driver");
@@ -37,12 +41,31 @@ MODULE_LICENSE("Dual BSD/GPL");
 
 #define CRYPTODEV_STATS
 
+/*
+ * Operations are handed to the cipher in segments of at most this
+ * many pages, which bounds the memory pinned or allocated per
+ * operation.  Longer operations run segment by segment with the IV
+ * carried over.
+ */
+#define CRYPTODEV_SEG_PAGES	64
+#define CRYPTODEV_SEG_SIZE	(CRYPTODEV_SEG_PAGES * PAGE_SIZE)
+
+/*
+ * Pages pinned or allocated at once by one ioctl.  The operations of a
+ * batch which do not fit wait for the next round.
+ */
+#define CRYPTODEV_MAX_PAGES	(4 * CRYPTODEV_SEG_PAGES)
+
 /* ====== Module parameters ====== */
 
 static int verbosity = 0;
 module_param(verbosity, int, 0644);
 MODULE_PARM_DESC(verbosity, "0: normal, 1: verbose, 2: debug");
 
+static int zero_copy = 1;
+module_param(zero_copy, int, 0644);
+MODULE_PARM_DESC(zero_copy, "1: run on pinned user pages, 0: copy through kernel pages");
+
 #ifdef CRYPTODEV_STATS
 static int enable_stats = 0;
 module_param(enable_stats, int, 0644);
@@ -64,18 +87,42 @@ MODULE_PARM_DESC(enable_stats, "collect statictics about cryptodev usage");
 
 struct csession {
 	struct list_head entry;
-	struct semaphore sem;
-	struct crypto_blkcipher *tfm;
+	struct kref ref;
+	struct crypto_ablkcipher *tfm;
+	unsigned int mode;	/* CRYPTO_FLAG_ECB etc */
 	uint32_t sid;
 #ifdef CRYPTODEV_STATS
 #if ! ((COP_ENCRYPT < 2) && (COP_DECRYPT < 2))
 #error Struct csession.stat uses COP_{ENCRYPT,DECRYPT} as indices. Do something!
 #endif
+	spinlock_t stat_lock;
 	unsigned long long stat[2];
 	size_t stat_max_size, stat_count;
 #endif
 };
 
+/*
+ * One crypt_op in flight.  The current segment is described by src_sg
+ * and dst_sg, which point either at the pinned user pages or at bounce
+ * pages holding a copy of the data.
+ */
+struct cjob {
+	struct crypt_op *cop;
+	struct csession *ses;
+	struct ablkcipher_request *req;
+	struct completion done;
+	int err;
+	char *ivp;		/* IV, then room for the next one */
+	size_t offset;		/* bytes of the op already processed */
+	size_t seg_len;
+	int nr_src, nr_dst;	/* pages pinned or allocated */
+	int bounce;
+	struct page *src_pages[CRYPTODEV_SEG_PAGES + 1];
+	struct page *dst_pages[CRYPTODEV_SEG_PAGES + 1];
+	struct scatterlist src_sg[CRYPTODEV_SEG_PAGES + 1];
+	struct scatterlist dst_sg[CRYPTODEV_SEG_PAGES + 1];
+};
+
 struct fcrypt {
 	struct list_head list;
 	struct semaphore sem;
@@ -86,7 +133,7 @@ static int
 crypto_create_session(struct fcrypt *fcr, struct session_op *sop)
 {
 	struct csession	*ses_new, *ses_ptr;
-	struct crypto_blkcipher *tfm;
+	struct crypto_ablkcipher *tfm;
 	int ret = 0;
 	char alg_name[MAX_ALG_NAME_LEN+1];
 	char alg_full_name[MAX_ALG_NAME_LEN+1];
@@ -135,8 +182,8 @@ crypto_create_session(struct fcrypt *fcr, struct session_op *sop)
 	snprintf(alg_full_name, sizeof(alg_full_name) - 1, "%s(%s)", mode, alg_name);
 
 	/* Set-up crypto transform. */
-	tfm = crypto_alloc_blkcipher(alg_full_name, 0, 0);
-	if (!tfm) {
+	tfm = crypto_alloc_ablkcipher(alg_full_name, 0, 0);
+	if (IS_ERR(tfm)) {
 		dprintk(1, KERN_DEBUG, "Failed to load transform for %s %s\n",
 		       alg_name, mode);
 		return -EINVAL;
@@ -150,7 +197,7 @@ crypto_create_session(struct fcrypt *fcr, struct session_op *sop)
 			"Wrong keylen '%zu' for algorithm '%s'. Use %u to %u.\n",
 		       sop->keylen, alg_name, crypto_tfm_alg_min_keysize(tfm),
 		       crypto_tfm_alg_max_keysize(tfm));
-		crypto_free_blkcipher(tfm);
+		crypto_free_ablkcipher(tfm);
 		return -EINVAL;
 	}
 #endif
@@ -160,31 +207,37 @@ crypto_create_session(struct fcrypt *fcr, struct session_op *sop)
 	if (keyp == NULL) {
 		dprintk(1, KERN_ERR,
 			"Unable to allocate key buffer.\n");
-		crypto_free_blkcipher(tfm);
+		crypto_free_ablkcipher(tfm);
 		return -ENOMEM;
 	}
 	copy_from_user(keyp, sop->key, sop->keylen);
-	ret = crypto_blkcipher_setkey(tfm, keyp, sop->keylen);
+	ret = crypto_ablkcipher_setkey(tfm, keyp, sop->keylen);
 	kfree(keyp);
 	if (ret) {
 		dprintk(2, KERN_DEBUG,
 			"Setting key failed for %s-%zu-%s: flags=0x%X\n",
-			alg_name, sop->keylen*8, mode, crypto_blkcipher_tfm(tfm)->crt_flags);
+			alg_name, sop->keylen*8, mode, crypto_ablkcipher_tfm(tfm)->crt_flags);
 		dprintk(2, KERN_DEBUG,
 			"(see CRYPTO_TFM_RES_* in <linux/crypto.h> for details)\n");
-		crypto_free_blkcipher(tfm);
+		crypto_free_ablkcipher(tfm);
 		return -EINVAL;
 	}
 
 	/* Create a session and put it to the list. */
 	ses_new = kmalloc(sizeof(*ses_new), GFP_KERNEL);
-	if(!ses_new)
+	if(!ses_new) {
+		crypto_free_ablkcipher(tfm);
 		return -ENOMEM;
+	}
 
 	memset(ses_new, 0, sizeof(*ses_new));
 	get_random_bytes(&ses_new->sid, sizeof(ses_new->sid));
 	ses_new->tfm = tfm;
-	sema_init(&ses_new->sem, 1);
+	ses_new->mode = sop->cipher & CRYPTO_FLAG_MASK;
+	kref_init(&ses_new->ref);
+#ifdef CRYPTODEV_STATS
+	spin_lock_init(&ses_new->stat_lock);
+#endif
 
 	down(&fcr->sem);
 restart:
@@ -206,20 +259,18 @@ restart:
 
 	/* Fill in some values for the user. */
 	sop->ses = ses_new->sid;
-	sop->blocksize = crypto_blkcipher_blocksize(tfm);
+	sop->blocksize = crypto_ablkcipher_blocksize(tfm);
 
 	return 0;
 }
 
-/* Everything that needs to be done when remowing a session. */
-static inline void
-crypto_destroy_session(struct csession *ses_ptr)
+/* Everything that needs to be done when remowing a session.
+   Called when the last reference is dropped. */
+static void
+crypto_destroy_session(struct kref *ref)
 {
-	if(down_trylock(&ses_ptr->sem)) {
-		dprintk(2, KERN_DEBUG, "Waiting for semaphore of sid=0x%08X\n",
-			ses_ptr->sid);
-		down(&ses_ptr->sem);
-	}
+	struct csession *ses_ptr = container_of(ref, struct csession, ref);
+
 	dprintk(2, KERN_DEBUG, "Removed session 0x%08X\n", ses_ptr->sid);
 #if defined(CRYPTODEV_STATS)
 	if(enable_stats)
@@ -232,17 +283,23 @@ crypto_destroy_session(struct csession *ses_ptr)
 				   ses_ptr->stat_count) : 0,
 			ses_ptr->stat_count);
 #endif
-	crypto_free_blkcipher(ses_ptr->tfm);
+	crypto_free_ablkcipher(ses_ptr->tfm);
 	ses_ptr->tfm = NULL;
-	up(&ses_ptr->sem);
 	kfree(ses_ptr);
 }
 
-/* Look up a session by ID and remove. */
+static inline void
+crypto_put_session(struct csession *ses_ptr)
+{
+	kref_put(&ses_ptr->ref, crypto_destroy_session);
+}
+
+/* Look up a session by ID and remove. Operations still running
+   on it keep it alive until they finish. */
 static int
 crypto_finish_session(struct fcrypt *fcr, uint32_t sid)
 {
-	struct csession *tmp, *ses_ptr;
+	struct csession *tmp, *ses_ptr, *found = NULL;
 	struct list_head *head;
 	int ret = 0;
 
@@ -251,16 +308,17 @@ crypto_finish_session(struct fcrypt *fcr, uint32_t sid)
 	list_for_each_entry_safe(ses_ptr, tmp, head, entry) {
 		if(ses_ptr->sid == sid) {
 			list_del(&ses_ptr->entry);
-			crypto_destroy_session(ses_ptr);
+			found = ses_ptr;
 			break;
 		}
 	}
+	up(&fcr->sem);
 
-	if (!ses_ptr) {
+	if (!found) {
 		dprintk(1, KERN_ERR, "Session with sid=0x%08X not found!\n", sid);
 		ret = -ENOENT;
-	}
-	up(&fcr->sem);
+	} else
+		crypto_put_session(found);
 
 	return ret;
 }
@@ -274,138 +332,491 @@ crypto_finish_all_sessions(struct fcrypt *fcr)
 	down(&fcr->sem);
 	list_for_each_entry_safe(ses_ptr, tmp, &fcr->list, entry) {
 		list_del(&ses_ptr->entry);
-		crypto_destroy_session(ses_ptr);
+		crypto_put_session(ses_ptr);
 	}
 	up(&fcr->sem);
 
 	return 0;
 }
 
-/* Look up session by session ID. The returned session is locked. */
+/* Look up session by session ID. The returned session holds a
+   reference, drop it with crypto_put_session(). Any number of
+   operations may run on a session at the same time. */
 static struct csession *
 crypto_get_session_by_sid(struct fcrypt *fcr, uint32_t sid)
 {
-	struct csession *ses_ptr;
+	struct csession *ses_ptr, *found = NULL;
 
 	down(&fcr->sem);
 	list_for_each_entry(ses_ptr, &fcr->list, entry) {
 		if(ses_ptr->sid == sid) {
-			down(&ses_ptr->sem);
+			kref_get(&ses_ptr->ref);
+			found = ses_ptr;
 			break;
 		}
 	}
 	up(&fcr->sem);
 
-	return ses_ptr;
+	return found;
 }
 
-/* This is the main crypto function - feed it with plaintext
-   and get a ciphertext (or vice versa :-) */
+static void
+crypto_job_complete(struct crypto_async_request *areq, int err)
+{
+	struct cjob *job = areq->data;
+
+	/* Backlogged request was started, the real completion follows */
+	if (err == -EINPROGRESS)
+		return;
+
+	job->err = err;
+	complete(&job->done);
+}
+
+/* Look up the session, check the request and set up the cipher
+   request for it. */
 static int
-crypto_run(struct fcrypt *fcr, struct crypt_op *cop)
+crypto_job_init(struct fcrypt *fcr, struct cjob *job, struct crypt_op *cop)
 {
-	char *data, *ivp;
-	char __user *src, __user *dst;
-	struct scatterlist sg;
-	struct csession *ses_ptr;
 	unsigned int ivsize;
-	size_t nbytes, bufsize;
-	int ret = 0;
-	struct blkcipher_desc desc;
 
-	nbytes = cop->len;
+	job->cop = cop;
 
 	if (cop->op != COP_ENCRYPT && cop->op != COP_DECRYPT) {
 		dprintk(1, KERN_DEBUG, "invalid operation op=%u\n", cop->op);
 		return -EINVAL;
 	}
 
-	ses_ptr = crypto_get_session_by_sid(fcr, cop->ses);
-	if (!ses_ptr) {
+	job->ses = crypto_get_session_by_sid(fcr, cop->ses);
+	if (!job->ses) {
 		dprintk(1, KERN_ERR, "invalid session ID=0x%08X\n", cop->ses);
 		return -EINVAL;
 	}
 
-	if (nbytes % crypto_blkcipher_blocksize(ses_ptr->tfm)) {
+	if (cop->len % crypto_ablkcipher_blocksize(job->ses->tfm)) {
 		dprintk(1, KERN_ERR,
 			"data size (%zu) isn't a multiple of block size (%u)\n",
-			nbytes, crypto_blkcipher_blocksize(ses_ptr->tfm));
-		ret = -EINVAL;
-		goto out_unlock;
+			cop->len, crypto_ablkcipher_blocksize(job->ses->tfm));
+		return -EINVAL;
+	}
+
+	ivsize = crypto_ablkcipher_ivsize(job->ses->tfm);
+	job->ivp = kzalloc(2 * ivsize, GFP_KERNEL);
+	if (unlikely(!job->ivp && ivsize))
+		return -ENOMEM;
+
+	if (cop->iv && copy_from_user(job->ivp, cop->iv, ivsize))
+		return -EFAULT;
+
+	job->req = ablkcipher_request_alloc(job->ses->tfm, GFP_KERNEL);
+	if (unlikely(!job->req))
+		return -ENOMEM;
+
+	ablkcipher_request_set_callback(job->req,
+		CRYPTO_TFM_REQ_MAY_BACKLOG | CRYPTO_TFM_REQ_MAY_SLEEP,
+		crypto_job_complete, job);
+
+	job->bounce = !zero_copy;
+
+	return 0;
+}
+
+static void
+crypto_job_release(struct cjob *job)
+{
+	if (job->req)
+		ablkcipher_request_free(job->req);
+	kfree(job->ivp);
+
+	if (!job->ses)
+		return;
+
+#if defined(CRYPTODEV_STATS)
+	if (enable_stats && !job->err) {
+		struct csession *ses_ptr = job->ses;
+
+		spin_lock(&ses_ptr->stat_lock);
+		/* this is safe - we check cop->op in crypto_job_init() */
+		ses_ptr->stat[job->cop->op] += job->cop->len;
+		if (ses_ptr->stat_max_size < job->cop->len)
+			ses_ptr->stat_max_size = job->cop->len;
+		ses_ptr->stat_count++;
+		spin_unlock(&ses_ptr->stat_lock);
 	}
+#endif
+	crypto_put_session(job->ses);
+}
+
+/* Pin nr pages of user memory starting at addr and describe len
+   bytes of them in sg. */
+static int
+crypto_pin_user(unsigned long addr, size_t len, int write,
+		struct page **pages, struct scatterlist *sg)
+{
+	unsigned int off = addr & ~PAGE_MASK;
+	int i, nr, pinned;
+
+	nr = DIV_ROUND_UP(off + len, PAGE_SIZE);
 
-	bufsize = PAGE_SIZE < nbytes ? PAGE_SIZE : nbytes;
-	data = (char*)__get_free_page(GFP_KERNEL);
+	down_read(&current->mm->mmap_sem);
+	pinned = get_user_pages(current, current->mm, addr & PAGE_MASK, nr,
+				write, 0, pages, NULL);
+	up_read(&current->mm->mmap_sem);
 
-	if (unlikely(!data)) {
-		ret = -ENOMEM;
-		goto out_unlock;
+	if (pinned != nr) {
+		for (i = 0; i < pinned; i++)
+			put_page(pages[i]);
+		return pinned < 0 ? pinned : -EFAULT;
 	}
 
-	ivsize = crypto_blkcipher_ivsize(ses_ptr->tfm);
+	sg_init_table(sg, nr);
+	for (i = 0; i < nr; i++) {
+		unsigned int chunk = min_t(size_t, len, PAGE_SIZE - off);
 
-	ivp = kmalloc(ivsize, GFP_KERNEL);
-	if (unlikely(!ivp)) {
-		free_page((unsigned long)data);
-		ret = -ENOMEM;
-		goto out_unlock;
+		sg_set_page(&sg[i], pages[i], chunk, off);
+		len -= chunk;
+		off = 0;
 	}
 
-	if (cop->iv) {
-		copy_from_user(ivp, cop->iv, ivsize);
-		crypto_blkcipher_set_iv(ses_ptr->tfm, ivp, ivsize);
+	return nr;
+}
+
+/* Copy the next segment of the source into freshly allocated pages. */
+static int
+crypto_bounce_in(struct cjob *job, char __user *src)
+{
+	size_t len = job->seg_len;
+	int i, nr = DIV_ROUND_UP(len, PAGE_SIZE);
+
+	sg_init_table(job->src_sg, nr);
+	for (i = 0; i < nr; i++) {
+		unsigned int chunk = min_t(size_t, len, PAGE_SIZE);
+
+		job->src_pages[i] = alloc_page(GFP_KERNEL);
+		if (unlikely(!job->src_pages[i]))
+			return -ENOMEM;
+		job->nr_src++;
+
+		if (copy_from_user(page_address(job->src_pages[i]), src, chunk))
+			return -EFAULT;
+
+		sg_set_page(&job->src_sg[i], job->src_pages[i], chunk, 0);
+		src += chunk;
+		len -= chunk;
 	}
 
-	src = cop->src;
-	dst = cop->dst;
+	return 0;
+}
+
+/* Size up the next segment of the operation and return how many
+   pages crypto_job_map() will pin or allocate for it. */
+static int
+crypto_job_next_seg(struct cjob *job)
+{
+	struct crypt_op *cop = job->cop;
+	unsigned long src = (unsigned long)cop->src + job->offset;
+	unsigned long dst = (unsigned long)cop->dst + job->offset;
+	int nr;
+
+	job->seg_len = min_t(size_t, cop->len - job->offset,
+				CRYPTODEV_SEG_SIZE);
+
+	if (job->bounce)
+		return DIV_ROUND_UP(job->seg_len, PAGE_SIZE);
+
+	nr = DIV_ROUND_UP((src & ~PAGE_MASK) + job->seg_len, PAGE_SIZE);
+	if (src != dst)
+		nr += DIV_ROUND_UP((dst & ~PAGE_MASK) + job->seg_len,
+				   PAGE_SIZE);
+	return nr;
+}
 
-	desc.tfm = ses_ptr->tfm;
-	desc.info = NULL;
-	desc.flags = 0;
+/* Prepare the segment sized up by crypto_job_next_seg(). */
+static int
+crypto_job_map(struct cjob *job)
+{
+	struct crypt_op *cop = job->cop;
+	unsigned long src = (unsigned long)cop->src + job->offset;
+	unsigned long dst = (unsigned long)cop->dst + job->offset;
+	int ret;
 
-	while (nbytes > 0) {
-		size_t current_len = nbytes > bufsize ? bufsize : nbytes;
+	if (job->bounce)
+		return crypto_bounce_in(job, (char __user *)src);
 
-		copy_from_user(data, src, current_len);
+	ret = crypto_pin_user(src, job->seg_len, src == dst,
+				job->src_pages, job->src_sg);
+	if (ret < 0)
+		return ret;
+	job->nr_src = ret;
 
-		sg_set_buf(&sg, data, current_len);
+	if (src == dst)
+		return 0;
 
-		if (cop->op == COP_DECRYPT)
-			ret = crypto_blkcipher_decrypt(&desc, &sg, &sg, current_len);
-		else
-			ret = crypto_blkcipher_encrypt(&desc, &sg, &sg, current_len);
+	ret = crypto_pin_user(dst, job->seg_len, 1,
+				job->dst_pages, job->dst_sg);
+	if (ret < 0)
+		return ret;
+	job->nr_dst = ret;
 
-		if (unlikely(ret)) {
-			dprintk(0, KERN_ERR, "CryptoAPI failure: flags=0x%x\n",
-				crypto_blkcipher_tfm(ses_ptr->tfm)->crt_flags);
-			goto out;
+	return 0;
+}
+
+/* Finish the current segment: copy out or dirty the destination
+   and release the pages. */
+static int
+crypto_job_unmap(struct cjob *job)
+{
+	char __user *dst = job->cop->dst + job->offset;
+	size_t len = job->seg_len;
+	int i, ret = 0;
+
+	if (job->bounce) {
+		for (i = 0; i < job->nr_src; i++) {
+			unsigned int chunk = min_t(size_t, len, PAGE_SIZE);
+
+			if (!job->err && !ret &&
+			    copy_to_user(dst, page_address(job->src_pages[i]),
+					 chunk))
+				ret = -EFAULT;
+			__free_page(job->src_pages[i]);
+			dst += chunk;
+			len -= chunk;
 		}
+	} else {
+		struct page **pages = job->nr_dst ? job->dst_pages :
+						job->src_pages;
+		int nr = job->nr_dst ? job->nr_dst : job->nr_src;
+
+		for (i = 0; i < nr && !job->err; i++)
+			set_page_dirty_lock(pages[i]);
+
+		for (i = 0; i < job->nr_src; i++)
+			put_page(job->src_pages[i]);
+		for (i = 0; i < job->nr_dst; i++)
+			put_page(job->dst_pages[i]);
+	}
+
+	job->nr_src = job->nr_dst = 0;
+	job->offset += job->seg_len;
+
+	return ret;
+}
+
+/*
+ * The IV of the next segment is worked out here rather than taken from
+ * req->info, which asynchronous drivers need not update.  For CBC and
+ * CFB it is the last ciphertext block of this segment: saved from the
+ * input before decrypting, since that may run in place, and from the
+ * output after encrypting.
+ */
+static int
+crypto_job_chains(struct cjob *job)
+{
+	return (job->ses->mode == CRYPTO_FLAG_CBC ||
+		job->ses->mode == CRYPTO_FLAG_CFB) &&
+		job->offset + job->seg_len < job->cop->len;
+}
+
+static void
+crypto_job_save_iv(struct cjob *job, struct scatterlist *sg)
+{
+	unsigned int ivsize = crypto_ablkcipher_ivsize(job->ses->tfm);
+
+	scatterwalk_map_and_copy(job->ivp + ivsize, sg,
+				 job->seg_len - ivsize, ivsize, 0);
+}
 
-		copy_to_user(dst, data, current_len);
+/* Add n to the big endian counter ctr of size bytes. */
+static void
+crypto_ctr_add(u8 *ctr, unsigned int size, size_t n)
+{
+	unsigned int c;
 
-		nbytes -= current_len;
-		src += current_len;
-		dst += current_len;
+	while (size-- && n) {
+		c = ctr[size] + (n & 0xff);
+		ctr[size] = c;
+		n = (n >> 8) + (c >> 8);
 	}
+}
 
-#if defined(CRYPTODEV_STATS)
-	if (enable_stats) {
-		/* this is safe - we check cop->op at the function entry */
-		ses_ptr->stat[cop->op] += cop->len;
-		if (ses_ptr->stat_max_size < cop->len)
-			ses_ptr->stat_max_size = cop->len;
-		ses_ptr->stat_count++;
+/* Set up the IV for the segment after the one just completed. */
+static void
+crypto_job_next_iv(struct cjob *job)
+{
+	unsigned int ivsize = crypto_ablkcipher_ivsize(job->ses->tfm);
+
+	if (job->offset + job->seg_len == job->cop->len)
+		return;
+
+	if (job->ses->mode == CRYPTO_FLAG_CTR && ivsize)
+		crypto_ctr_add((u8 *)job->ivp, ivsize,
+			       job->seg_len / ivsize);
+	else if (crypto_job_chains(job))
+		memcpy(job->ivp, job->ivp + ivsize, ivsize);
+}
+
+static void
+crypto_job_submit(struct cjob *job)
+{
+	struct scatterlist *dst_sg = job->nr_dst ? job->dst_sg : job->src_sg;
+	int ret;
+
+	if (job->cop->op == COP_DECRYPT && crypto_job_chains(job))
+		crypto_job_save_iv(job, job->src_sg);
+
+	init_completion(&job->done);
+	ablkcipher_request_set_crypt(job->req, job->src_sg, dst_sg,
+				     job->seg_len, job->ivp);
+
+	if (job->cop->op == COP_DECRYPT)
+		ret = crypto_ablkcipher_decrypt(job->req);
+	else
+		ret = crypto_ablkcipher_encrypt(job->req);
+
+	if (ret != -EINPROGRESS && ret != -EBUSY) {
+		job->err = ret;
+		complete(&job->done);
 	}
-#endif
+}
 
-out:
-	free_page((unsigned long)data);
+/* Run a set of operations. Each round submits the next segment of
+   as many unfinished operations as CRYPTODEV_MAX_PAGES allows before
+   waiting for any of them, so an asynchronous driver gets the batch
+   queued at once. */
+static void
+crypto_run_jobs(struct fcrypt *fcr, struct cjob **jobs, struct crypt_op *cops,
+		int count)
+{
+	struct cjob *job;
+	int i, nr, pages, ret, active = 0;
+
+	for (i = 0; i < count; i++) {
+		job = jobs[i];
+		job->err = crypto_job_init(fcr, job, &cops[i]);
+		if (!job->err && job->offset < cops[i].len)
+			active++;
+	}
+
+	while (active) {
+		pages = 0;
+		for (i = 0; i < count; i++) {
+			job = jobs[i];
+			if (job->err || job->offset == job->cop->len)
+				continue;
+
+			/* A segment never needs more than the limit, so the
+			   first one of a round always goes. */
+			nr = crypto_job_next_seg(job);
+			if (pages && pages + nr > CRYPTODEV_MAX_PAGES) {
+				job->seg_len = 0;
+				continue;
+			}
+			pages += nr;
+
+			job->err = crypto_job_map(job);
+			if (job->err) {
+				crypto_job_unmap(job);
+				job->seg_len = 0;
+				continue;
+			}
+			crypto_job_submit(job);
+		}
+
+		for (i = 0; i < count; i++) {
+			job = jobs[i];
+			if (!job->seg_len)
+				continue;
+
+			wait_for_completion(&job->done);
+			if (job->err)
+				dprintk(0, KERN_ERR, "CryptoAPI failure: flags=0x%x\n",
+					crypto_ablkcipher_get_flags(job->ses->tfm));
+			else {
+				if (job->cop->op == COP_ENCRYPT &&
+				    crypto_job_chains(job))
+					crypto_job_save_iv(job, job->nr_dst ?
+						job->dst_sg : job->src_sg);
+				crypto_job_next_iv(job);
+			}
+
+			ret = crypto_job_unmap(job);
+			if (!job->err)
+				job->err = ret;
+			job->seg_len = 0;
+		}
+
+		active = 0;
+		for (i = 0; i < count; i++) {
+			job = jobs[i];
+			if (!job->err && job->offset < job->cop->len)
+				active++;
+		}
+	}
+
+	for (i = 0; i < count; i++)
+		crypto_job_release(jobs[i]);
+}
+
+/* This is the main crypto function - feed it with plaintext
+   and get a ciphertext (or vice versa :-) */
+static int
+crypto_run(struct fcrypt *fcr, struct crypt_op *cop)
+{
+	struct cjob *job;
+	int ret;
+
+	job = kzalloc(sizeof(*job), GFP_KERNEL);
+	if (unlikely(!job))
+		return -ENOMEM;
 
-	kfree(ivp);
+	crypto_run_jobs(fcr, &job, cop, 1);
+	ret = job->err;
 
-out_unlock:
-	up(&ses_ptr->sem);
+	kfree(job);
+	return ret;
+}
+
+/* Run up to CRYPTODEV_MAX_BATCH operations at once and report
+   the result of each one. */
+static int
+crypto_run_multi(struct fcrypt *fcr, struct crypt_mop *mop)
+{
+	struct crypt_op *cops;
+	struct cjob *jobs[CRYPTODEV_MAX_BATCH] = { NULL };
+	int i, ret = 0;
+
+	if (!mop->count || mop->count > CRYPTODEV_MAX_BATCH)
+		return -EINVAL;
+
+	cops = kcalloc(mop->count, sizeof(*cops), GFP_KERNEL);
+	if (unlikely(!cops))
+		return -ENOMEM;
+
+	/* One at a time: a job is too big to ask for a batch of them */
+	for (i = 0; i < mop->count; i++) {
+		jobs[i] = kzalloc(sizeof(*jobs[i]), GFP_KERNEL);
+		if (unlikely(!jobs[i])) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	if (copy_from_user(cops, mop->ops, mop->count * sizeof(*cops))) {
+		ret = -EFAULT;
+		goto out;
+	}
 
+	crypto_run_jobs(fcr, jobs, cops, mop->count);
+
+	for (i = 0; i < mop->count; i++) {
+		if (put_user(jobs[i]->err, &mop->status[i]))
+			ret = -EFAULT;
+	}
+
+out:
+	for (i = 0; i < mop->count; i++)
+		kfree(jobs[i]);
+	kfree(cops);
 	return ret;
 }
 
@@ -461,6 +872,7 @@ cryptodev_ioctl(struct file *filp,
 {
 	struct session_op sop;
 	struct crypt_op cop;
+	struct crypt_mop mop;
 	struct fcrypt *fcr = filp->private_data;
 	uint32_t ses;
 	int ret, fd;
@@ -493,6 +905,11 @@ cryptodev_ioctl(struct file *filp,
 			copy_to_user((void*)arg, &cop, sizeof(cop));
 			return ret;
 
+		case CIOCCRYPTMULTI:
+			if (copy_from_user(&mop, (void*)arg, sizeof(mop)))
+				return -EFAULT;
+			return crypto_run_multi(fcr, &mop);
+
 		default:
 			return -EINVAL;
 	}
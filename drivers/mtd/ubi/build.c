@@ -564,6 +564,7 @@ static void free_internal_volumes(struct ubi_device *ubi)
 	for (i = ubi->vtbl_slots;
 	     i < ubi->vtbl_slots + UBI_INT_VOL_COUNT; i++) {
 		kfree(ubi->volumes[i]->eba_tbl);
+		kfree(ubi->volumes[i]->checkmap);
 		kfree(ubi->volumes[i]);
 	}
 }
@@ -582,10 +583,11 @@ static void free_internal_volumes(struct ubi_device *ubi)
  */
 static int attach_by_scanning(struct ubi_device *ubi)
 {
-	int err;
+	int i, err, use_cp = 1;
 	struct ubi_scan_info *si;
 
-	si = ubi_scan(ubi);
+rescan:
+	si = ubi_scan(ubi, use_cp);
 	if (IS_ERR(si))
 		return PTR_ERR(si);
 
@@ -614,9 +616,31 @@ static int attach_by_scanning(struct ubi_device *ubi)
 out_wl:
 	ubi_wl_close(ubi);
 out_vtbl:
+	for (i = 0; i < ubi->vtbl_slots; i++) {
+		if (!ubi->volumes[i])
+			continue;
+		kfree(ubi->volumes[i]->eba_tbl);
+		kfree(ubi->volumes[i]->checkmap);
+		kfree(ubi->volumes[i]);
+		ubi->volumes[i] = NULL;
+	}
 	free_internal_volumes(ubi);
 	vfree(ubi->vtbl);
 out_si:
+	if (si->checkpoint && err != -ENOMEM) {
+		/*
+		 * The checkpoint does not add up with the volume table or with
+		 * itself, forget about it and scan the whole flash.
+		 */
+		ubi_warn("the checkpoint is inconsistent, error %d", err);
+		ubi_scan_destroy_si(si);
+		ubi->image_seq = 0;
+		ubi->vol_count = 0;
+		ubi->avail_pebs = ubi->rsvd_pebs = 0;
+		ubi->beb_rsvd_pebs = ubi->beb_rsvd_level = 0;
+		use_cp = 0;
+		goto rescan;
+	}
 	ubi_scan_destroy_si(si);
 	return err;
 }
@@ -944,6 +968,10 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	if (err)
 		goto out_free;
 
+	err = ubi_cp_init(ubi);
+	if (err)
+		goto out_free;
+
 	err = -ENOMEM;
 	ubi->peb_buf1 = vmalloc(ubi->peb_size);
 	if (!ubi->peb_buf1)
@@ -1011,10 +1039,12 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 out_uif:
 	uif_close(ubi);
 out_detach:
+	ubi_cp_close(ubi);
 	ubi_wl_close(ubi);
 	free_internal_volumes(ubi);
 	vfree(ubi->vtbl);
 out_free:
+	ubi_cp_close(ubi);
 	vfree(ubi->peb_buf1);
 	vfree(ubi->peb_buf2);
 	if (ref)
@@ -1081,6 +1111,8 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	get_device(&ubi->dev);
 
 	uif_close(ubi);
+	ubi_update_checkpoint(ubi, 0);
+	ubi_cp_close(ubi);
 	ubi_wl_close(ubi);
 	free_internal_volumes(ubi);
 	vfree(ubi->vtbl);
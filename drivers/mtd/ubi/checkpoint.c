@@ -0,0 +1,463 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+ * the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * UBI checkpoint sub-system.
+ *
+ * Attaching an MTD device normally requires reading the EC and VID headers of
+ * every physical eraseblock, which takes long on large flashes. To avoid this,
+ * UBI may store a checkpoint - a snapshot of the erase counters, of the state
+ * of every physical eraseblock and of the EBA tables of all volumes. The
+ * on-flash format is described at &struct ubi_cp_hdr.
+ *
+ * The checkpoint is written to one of the first %UBI_CP_MAX_START physical
+ * eraseblocks, which are always scanned when attaching. While checkpoints are
+ * enabled, physical eraseblocks are only taken from the checkpoint pool, which
+ * is recorded in the checkpoint, so only the pool has to be scanned on top of
+ * the first physical eraseblocks. When the pool runs out, a new checkpoint is
+ * written, which also re-fills the pool. See 'ubi_wl_cp_prepare()'.
+ *
+ * The checkpoint may become stale in one respect only: physical eraseblocks
+ * it lists as used may have been un-mapped and erased before a power cut.
+ * Such mappings are verified when the logical eraseblock is first accessed,
+ * see 'check_mapping()' in eba.c. Any other inconsistency means the checkpoint
+ * cannot be trusted: when attaching, the whole flash is scanned instead, and
+ * if it is only found later, the checkpoint is dropped, so that the next
+ * attach scans the whole flash.
+ */
+
+#include <linux/crc32.h>
+#include <linux/vmalloc.h>
+#include "ubi.h"
+
+/* Limits for the number of physical eraseblocks in the checkpoint pool */
+#define CP_MIN_POOL 8
+#define CP_MAX_POOL 256
+
+/**
+ * cp_size - calculate the maximum size of a checkpoint.
+ * @ubi: UBI device description object
+ *
+ * All EBA tables together cannot be longer than the count of physical
+ * eraseblocks, because no more than that can be reserved for volumes.
+ */
+static int cp_size(const struct ubi_device *ubi)
+{
+	return sizeof(struct ubi_cp_hdr) + ubi->peb_count * sizeof(__be32) +
+	       ALIGN(ubi->peb_count, 4) +
+	       (UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT) *
+	       sizeof(struct ubi_cp_vol) + ubi->peb_count * sizeof(__be32);
+}
+
+/**
+ * cp_worker - write a checkpoint in process context.
+ * @work: the work object
+ *
+ * The WL worker schedules this when the checkpoint pool runs out, and
+ * 'ubi_cp_invalidate()' when the checkpoint has to be dropped.
+ */
+static void cp_worker(struct work_struct *work)
+{
+	struct ubi_device *ubi = container_of(work, struct ubi_device, cp_work);
+
+	ubi_update_checkpoint(ubi, 1);
+}
+
+/**
+ * ubi_cp_init - initialize the checkpoint sub-system.
+ * @ubi: UBI device description object
+ *
+ * If the flash is too large for the checkpoint to fit into one logical
+ * eraseblock, checkpoints are not used. Returns zero in case of success and a
+ * negative error code in case of failure.
+ */
+int ubi_cp_init(struct ubi_device *ubi)
+{
+	if (cp_size(ubi) > ubi->leb_size) {
+		ubi_msg("checkpoint does not fit one LEB, not using checkpoints");
+		return 0;
+	}
+
+	ubi->cp_buf = vmalloc(ubi->leb_size);
+	if (!ubi->cp_buf)
+		return -ENOMEM;
+
+	ubi->cp_pool_max = clamp(ubi->peb_count / 20, CP_MIN_POOL, CP_MAX_POOL);
+	mutex_init(&ubi->cp_mutex);
+	mutex_init(&ubi->cp_check_mutex);
+	INIT_WORK(&ubi->cp_work, cp_worker);
+	return 0;
+}
+
+/**
+ * ubi_cp_close - close the checkpoint sub-system.
+ * @ubi: UBI device description object
+ */
+void ubi_cp_close(struct ubi_device *ubi)
+{
+	if (!ubi->cp_buf)
+		return;
+
+	cancel_work_sync(&ubi->cp_work);
+	vfree(ubi->cp_buf);
+	ubi->cp_buf = NULL;
+}
+
+/**
+ * fill_checkpoint - build the checkpoint in @ubi->cp_buf.
+ * @ubi: UBI device description object
+ *
+ * This function has to be called with @ubi->cp_sem and @ubi->work_sem locked
+ * in write mode, so that neither EBA tables nor the WL trees change. Returns
+ * the length of the checkpoint in case of success and %-EINVAL if it does not
+ * fit.
+ */
+static int fill_checkpoint(struct ubi_device *ubi)
+{
+	int i, lnum, len, vol_count = 0;
+	struct ubi_cp_hdr *hdr = ubi->cp_buf;
+	__be32 *ecs = (void *)(hdr + 1);
+	u8 *state = (void *)(ecs + ubi->peb_count);
+	void *p = state + ALIGN(ubi->peb_count, 4);
+	struct ubi_wl_entry *e;
+	struct rb_node *rb;
+
+	memset(ubi->cp_buf, 0, p - ubi->cp_buf);
+	hdr->magic = cpu_to_be32(UBI_CP_HDR_MAGIC);
+	hdr->version = UBI_CP_FORMAT_VERSION;
+	hdr->peb_count = cpu_to_be32(ubi->peb_count);
+	hdr->image_seq = cpu_to_be32(ubi->image_seq);
+
+	spin_lock(&ubi->wl_lock);
+	/*
+	 * Everything the WL sub-system knows about and which is not free or
+	 * mapped is about to be erased. Bad and corrupted PEBs are not known,
+	 * so they are scanned.
+	 */
+	for (i = 0; i < ubi->peb_count; i++) {
+		e = ubi->lookuptbl[i];
+		if (e) {
+			ecs[i] = cpu_to_be32(e->ec);
+			state[i] = UBI_CP_PEB_ERASE;
+		} else
+			state[i] = UBI_CP_PEB_SCAN;
+	}
+
+	ubi_rb_for_each_entry(rb, e, &ubi->free, u.rb)
+		state[e->pnum] = UBI_CP_PEB_FREE;
+	if (ubi->cp_anchor)
+		state[ubi->cp_anchor->pnum] = UBI_CP_PEB_FREE;
+	ubi_rb_for_each_entry(rb, e, &ubi->cp_pool, u.rb) {
+		ecs[e->pnum] = 0;
+		state[e->pnum] = UBI_CP_PEB_SCAN;
+	}
+	spin_unlock(&ubi->wl_lock);
+
+	len = p - ubi->cp_buf;
+	spin_lock(&ubi->volumes_lock);
+	for (i = 0; i < ubi->vtbl_slots + UBI_INT_VOL_COUNT; i++) {
+		struct ubi_volume *vol = ubi->volumes[i];
+		struct ubi_cp_vol *cv = p;
+		__be32 *tbl = (void *)(cv + 1);
+
+		if (!vol || !vol->eba_tbl)
+			continue;
+
+		len += sizeof(struct ubi_cp_vol) +
+		       vol->reserved_pebs * sizeof(__be32);
+		if (len > ubi->leb_size) {
+			spin_unlock(&ubi->volumes_lock);
+			ubi_err("checkpoint does not fit one LEB");
+			return -EINVAL;
+		}
+
+		memset(cv, 0, sizeof(struct ubi_cp_vol));
+		cv->vol_id = cpu_to_be32(vol->vol_id);
+		cv->leb_count = cpu_to_be32(vol->reserved_pebs);
+		cv->data_pad = cpu_to_be32(vol->data_pad);
+		if (vol->vol_type == UBI_STATIC_VOLUME) {
+			cv->vol_type = UBI_VID_STATIC;
+			cv->used_ebs = cpu_to_be32(vol->used_ebs);
+			cv->last_data_size = cpu_to_be32(vol->last_eb_bytes);
+		} else
+			cv->vol_type = UBI_VID_DYNAMIC;
+		if (vol->vol_id == UBI_LAYOUT_VOLUME_ID)
+			cv->compat = UBI_LAYOUT_VOLUME_COMPAT;
+
+		for (lnum = 0; lnum < vol->reserved_pebs; lnum++) {
+			int pnum = vol->eba_tbl[lnum];
+
+			if (pnum < 0) {
+				tbl[lnum] = cpu_to_be32(UBI_CP_UNMAPPED);
+				continue;
+			}
+			tbl[lnum] = cpu_to_be32(pnum);
+			state[pnum] = UBI_CP_PEB_USED;
+		}
+
+		p = tbl + vol->reserved_pebs;
+		vol_count += 1;
+	}
+	spin_unlock(&ubi->volumes_lock);
+
+	hdr->vol_count = cpu_to_be32(vol_count);
+	return len;
+}
+
+/**
+ * write_checkpoint - write the checkpoint to a physical eraseblock.
+ * @ubi: UBI device description object
+ * @e: the physical eraseblock to write to
+ *
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+static int write_checkpoint(struct ubi_device *ubi, struct ubi_wl_entry *e)
+{
+	int err, len, aligned_len;
+	unsigned long long sqnum;
+	struct ubi_vid_hdr *vid_hdr;
+	struct ubi_cp_hdr *hdr = ubi->cp_buf;
+	uint32_t crc;
+
+	len = fill_checkpoint(ubi);
+	if (len < 0)
+		return len;
+
+	aligned_len = ALIGN(len, ubi->min_io_size);
+	if (aligned_len > ubi->leb_size)
+		return -EINVAL;
+	memset(ubi->cp_buf + len, 0xFF, aligned_len - len);
+
+	sqnum = ubi_next_sqnum(ubi);
+	hdr->sqnum = cpu_to_be64(sqnum);
+	crc = crc32(UBI_CRC32_INIT, ubi->cp_buf, len);
+
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_NOFS);
+	if (!vid_hdr)
+		return -ENOMEM;
+
+	vid_hdr->vol_type = UBI_CP_VOLUME_TYPE;
+	vid_hdr->compat = UBI_CP_VOLUME_COMPAT;
+	vid_hdr->sqnum = cpu_to_be64(sqnum);
+	vid_hdr->vol_id = cpu_to_be32(UBI_CP_VOLUME_ID);
+	vid_hdr->lnum = 0;
+	vid_hdr->data_size = cpu_to_be32(len);
+	vid_hdr->used_ebs = cpu_to_be32(1);
+	vid_hdr->data_crc = cpu_to_be32(crc);
+
+	dbg_gen("write %d bytes of checkpoint to PEB %d, sqnum %llu",
+		len, e->pnum, sqnum);
+
+	err = ubi_io_write_vid_hdr(ubi, e->pnum, vid_hdr);
+	if (!err)
+		err = ubi_io_write_data(ubi, ubi->cp_buf, e->pnum, 0,
+					aligned_len);
+
+	ubi_free_vid_hdr(ubi, vid_hdr);
+	return err;
+}
+
+/**
+ * ubi_update_checkpoint - write a new checkpoint.
+ * @ubi: UBI device description object
+ * @refill: non-zero if the checkpoint pool has to be re-filled
+ *
+ * If @refill is not zero, this function does nothing when the pool is not
+ * empty, which happens if somebody else has just written a checkpoint, unless
+ * the current checkpoint was found to be inconsistent. In that case the
+ * checkpoint is erased and checkpoints are disabled instead.
+ * Otherwise the pool is re-filled and a new checkpoint is written. If @refill
+ * is zero, the pool is emptied, so that the checkpoint describes everything,
+ * which is what we want when detaching.
+ *
+ * If the checkpoint cannot be written, checkpoints are disabled until the
+ * next attach. Returns zero in case of success and a negative error code in
+ * case of failure, which only happens if UBI is in read-only mode.
+ */
+int ubi_update_checkpoint(struct ubi_device *ubi, int refill)
+{
+	int err = 0;
+	struct ubi_wl_entry *e;
+
+	if (!ubi->cp_buf)
+		return 0;
+
+	mutex_lock(&ubi->cp_mutex);
+	if (!ubi->cp_enabled)
+		goto out_unlock;
+	if (ubi->ro_mode) {
+		err = -EROFS;
+		goto out_unlock;
+	}
+
+	down_write(&ubi->work_sem);
+	down_write(&ubi->cp_sem);
+
+	if (ubi->cp_invalid) {
+		ubi_warn("drop the inconsistent checkpoint, the next attach "
+			 "scans the whole flash");
+		ubi_wl_cp_disable(ubi, NULL);
+		err = ubi->ro_mode ? -EROFS : 0;
+		goto out_sem;
+	}
+
+	if (refill && ubi->cp_pool.rb_node)
+		goto out_sem;
+
+	e = ubi_wl_cp_prepare(ubi, refill);
+	if (!e) {
+		ubi_warn("no free PEB for the checkpoint");
+		err = -ENOSPC;
+	} else
+		err = write_checkpoint(ubi, e);
+
+	if (!err)
+		ubi_wl_cp_commit(ubi, e);
+	else {
+		ubi_warn("cannot write checkpoint, error %d, disable "
+			 "checkpoints", err);
+		ubi_wl_cp_disable(ubi, e);
+		err = ubi->ro_mode ? -EROFS : 0;
+	}
+
+out_sem:
+	up_write(&ubi->cp_sem);
+	up_write(&ubi->work_sem);
+out_unlock:
+	mutex_unlock(&ubi->cp_mutex);
+	return err;
+}
+
+/**
+ * ubi_cp_read - read and validate a checkpoint.
+ * @ubi: UBI device description object
+ * @pnum: the physical eraseblock to read the checkpoint from
+ *
+ * This function reads the checkpoint to @ubi->cp_buf and checks that it is
+ * intact and describes this MTD device, so that the caller may walk it without
+ * further bounds checking. Returns zero if the checkpoint is all right, %1 if
+ * it cannot be used, and a negative error code in case of failure.
+ */
+int ubi_cp_read(struct ubi_device *ubi, int pnum)
+{
+	int err, i, len, vol_count, peb_count;
+	struct ubi_vid_hdr *vid_hdr;
+	const struct ubi_cp_hdr *hdr = ubi->cp_buf;
+	const void *p;
+	uint32_t crc;
+
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vid_hdr)
+		return -ENOMEM;
+
+	err = ubi_io_read_vid_hdr(ubi, pnum, vid_hdr, 0);
+	if (err && err != UBI_IO_BITFLIPS) {
+		if (err > 0)
+			err = 1;
+		goto out_free;
+	}
+
+	len = be32_to_cpu(vid_hdr->data_size);
+	crc = be32_to_cpu(vid_hdr->data_crc);
+	err = 1;
+	if (be32_to_cpu(vid_hdr->vol_id) != UBI_CP_VOLUME_ID ||
+	    be32_to_cpu(vid_hdr->lnum) != 0 ||
+	    len < sizeof(struct ubi_cp_hdr) || len > ubi->leb_size)
+		goto out_free;
+
+	err = ubi_io_read_data(ubi, ubi->cp_buf, pnum, 0, len);
+	if (err && err != UBI_IO_BITFLIPS) {
+		if (err == -EBADMSG)
+			err = 1;
+		goto out_free;
+	}
+
+	err = 1;
+	if (crc32(UBI_CRC32_INIT, ubi->cp_buf, len) != crc) {
+		dbg_bld("bad checkpoint data CRC in PEB %d", pnum);
+		goto out_free;
+	}
+
+	peb_count = be32_to_cpu(hdr->peb_count);
+	vol_count = be32_to_cpu(hdr->vol_count);
+	if (be32_to_cpu(hdr->magic) != UBI_CP_HDR_MAGIC ||
+	    hdr->version != UBI_CP_FORMAT_VERSION ||
+	    peb_count != ubi->peb_count ||
+	    vol_count > UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT) {
+		ubi_err("unsupported checkpoint in PEB %d", pnum);
+		goto out_free;
+	}
+
+	/* The erase counter and state arrays have an entry for every PEB */
+	p = (const void *)(hdr + 1) + peb_count * sizeof(__be32) +
+	    ALIGN(peb_count, 4);
+	if (p > ubi->cp_buf + len)
+		goto out_short;
+
+	for (i = 0; i < vol_count; i++) {
+		const struct ubi_cp_vol *cv = p;
+		int vol_id, leb_count;
+
+		if (p + sizeof(struct ubi_cp_vol) > ubi->cp_buf + len)
+			goto out_bad;
+
+		vol_id = be32_to_cpu(cv->vol_id);
+		leb_count = be32_to_cpu(cv->leb_count);
+		if ((vol_id < 0 || vol_id >= UBI_MAX_VOLUMES) &&
+		    vol_id != UBI_LAYOUT_VOLUME_ID)
+			goto out_bad;
+		if (leb_count < 0 || leb_count > peb_count)
+			goto out_bad;
+		if (cv->vol_type != UBI_VID_DYNAMIC &&
+		    cv->vol_type != UBI_VID_STATIC)
+			goto out_bad;
+
+		p = (const __be32 *)(cv + 1) + leb_count;
+		if (p > ubi->cp_buf + len)
+			goto out_bad;
+	}
+
+	err = 0;
+out_free:
+	ubi_free_vid_hdr(ubi, vid_hdr);
+	return err;
+
+out_short:
+	ubi_err("checkpoint in PEB %d is too short for %d PEBs", pnum,
+		peb_count);
+	goto out_free;
+
+out_bad:
+	ubi_err("bad volume record %d in checkpoint in PEB %d", i, pnum);
+	goto out_free;
+}
+
+/**
+ * ubi_cp_invalidate - drop a checkpoint which turned out to be inconsistent.
+ * @ubi: UBI device description object
+ *
+ * This function is called when a mapping taken from the checkpoint does not
+ * match the flash. The whole flash cannot be re-scanned while the device is
+ * in use, so the checkpoint is erased and checkpoints are disabled from the
+ * checkpoint work, which makes the next attach scan the whole flash. This
+ * function may be called with a LEB lock held.
+ */
+void ubi_cp_invalidate(struct ubi_device *ubi)
+{
+	ubi->cp_invalid = 1;
+	schedule_work(&ubi->cp_work);
+}
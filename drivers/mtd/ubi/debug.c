@@ -34,7 +34,7 @@ unsigned int ubi_chk_flags;
 unsigned int ubi_tst_flags;
 
 module_param_named(debug_chks, ubi_chk_flags, uint, S_IRUGO | S_IWUSR);
-module_param_named(debug_tsts, ubi_chk_flags, uint, S_IRUGO | S_IWUSR);
+module_param_named(debug_tsts, ubi_tst_flags, uint, S_IRUGO | S_IWUSR);
 
 MODULE_PARM_DESC(debug_chks, "Debug check flags");
 MODULE_PARM_DESC(debug_tsts, "Debug special test flags");
@@ -239,4 +239,29 @@ out:
 	return;
 }
 
+/**
+ * ubi_dbg_is_power_cut - if it is time to emulate a power cut.
+ * @ubi: UBI device description object
+ *
+ * When power cut emulation is enabled, the power is cut after a random number
+ * of writes and erasures. The caller then switches to read-only mode, so that
+ * nothing more reaches the flash, and the next attach has to cope with what is
+ * left there. Returns non-zero if the power has to be cut.
+ */
+int ubi_dbg_is_power_cut(struct ubi_device *ubi)
+{
+	static atomic_t countdown = ATOMIC_INIT(0);
+	int left;
+
+	if (!(ubi_tst_flags & UBI_TST_EMULATE_POWER_CUTS))
+		return 0;
+
+	left = atomic_dec_return(&countdown);
+	if (left > 0)
+		return 0;
+
+	atomic_set(&countdown, random32() % 1000 + 2);
+	return left == 0;
+}
+
 #endif /* CONFIG_MTD_UBI_DEBUG */
@@ -98,14 +98,18 @@ extern unsigned int ubi_tst_flags;
  * UBI_TST_EMULATE_BITFLIPS: emulate bit-flips
  * UBI_TST_EMULATE_WRITE_FAILURES: emulate write failures
  * UBI_TST_EMULATE_ERASE_FAILURES: emulate erase failures
+ * UBI_TST_EMULATE_POWER_CUTS: emulate power cuts
  */
 enum {
 	UBI_TST_DISABLE_BGT            = 0x1,
 	UBI_TST_EMULATE_BITFLIPS       = 0x2,
 	UBI_TST_EMULATE_WRITE_FAILURES = 0x4,
 	UBI_TST_EMULATE_ERASE_FAILURES = 0x8,
+	UBI_TST_EMULATE_POWER_CUTS     = 0x10,
 };
 
+int ubi_dbg_is_power_cut(struct ubi_device *ubi);
+
 /**
  * ubi_dbg_is_bgt_disabled - if the background thread is disabled.
  *
@@ -206,6 +210,7 @@ static inline int ubi_dbg_is_bgt_disabled(void)                    { return 0; }
 static inline int ubi_dbg_is_bitflip(void)                         { return 0; }
 static inline int ubi_dbg_is_write_failure(void)                   { return 0; }
 static inline int ubi_dbg_is_erase_failure(void)                   { return 0; }
+static inline int ubi_dbg_is_power_cut(struct ubi_device *ubi)     { return 0; }
 static inline int ubi_dbg_check_all_ff(struct ubi_device *ubi,
 				       int pnum, int offset,
 				       int len)                    { return 0; }
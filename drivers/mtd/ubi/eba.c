@@ -50,14 +50,14 @@
 #define EBA_RESERVED_PEBS 1
 
 /**
- * next_sqnum - get next sequence number.
+ * ubi_next_sqnum - get next sequence number.
  * @ubi: UBI device description object
  *
  * This function returns next sequence number to use, which is just the current
  * global sequence counter value. It also increases the global sequence
  * counter.
  */
-static unsigned long long next_sqnum(struct ubi_device *ubi)
+unsigned long long ubi_next_sqnum(struct ubi_device *ubi)
 {
 	unsigned long long sqnum;
 
@@ -311,6 +311,150 @@ static void leb_write_unlock(struct ubi_device *ubi, int vol_id, int lnum)
 	spin_unlock(&ubi->ltree_lock);
 }
 
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+
+/**
+ * check_mapping - verify a mapping taken from the checkpoint.
+ * @ubi: UBI device description object
+ * @vol: volume description object
+ * @lnum: logical eraseblock number
+ * @pnum: where to store the physical eraseblock the LEB is mapped to
+ *
+ * The physical eraseblock a logical eraseblock was mapped to when the
+ * checkpoint was written might have been erased before the power cut. Such
+ * mappings are verified when the logical eraseblock is accessed for the first
+ * time. If the VID header is gone, the logical eraseblock is un-mapped. If the
+ * physical eraseblock holds another logical eraseblock, the checkpoint is
+ * dropped, see 'ubi_cp_invalidate()'.
+ *
+ * The caller has to hold the LEB lock, which may be a read lock, so another
+ * reader may have just un-mapped the logical eraseblock. This is why @pnum is
+ * always set from the EBA table once the mapping is known to be verified.
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+static int check_mapping(struct ubi_device *ubi, struct ubi_volume *vol,
+			 int lnum, int *pnum)
+{
+	int err = 0;
+	struct ubi_vid_hdr *vid_hdr;
+
+	if (lnum >= vol->checkmap_lebs)
+		goto out_pnum;
+	if (!test_bit(lnum, vol->checkmap)) {
+		/* Pairs with 'smp_mb__before_clear_bit()' below */
+		smp_rmb();
+		goto out_pnum;
+	}
+
+	mutex_lock(&ubi->cp_check_mutex);
+	if (!test_bit(lnum, vol->checkmap))
+		goto out_unlock;
+
+	*pnum = vol->eba_tbl[lnum];
+	if (*pnum < 0)
+		goto out_clear;
+
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_NOFS);
+	if (!vid_hdr) {
+		err = -ENOMEM;
+		goto out_unlock;
+	}
+
+	err = ubi_io_read_vid_hdr(ubi, *pnum, vid_hdr, 0);
+	if (err < 0 && err != -EBADMSG)
+		goto out_free;
+
+	if (err && err != UBI_IO_BITFLIPS) {
+		dbg_eba("LEB %d:%d, PEB %d was erased", vol->vol_id, lnum,
+			*pnum);
+		vol->eba_tbl[lnum] = UBI_LEB_UNMAPPED;
+		err = ubi_wl_put_peb(ubi, *pnum, 0);
+		if (err)
+			goto out_free;
+	} else if (be32_to_cpu(vid_hdr->vol_id) != vol->vol_id ||
+		   be32_to_cpu(vid_hdr->lnum) != lnum) {
+		ubi_err("PEB %d contains LEB %d:%d instead of LEB %d:%d",
+			*pnum, be32_to_cpu(vid_hdr->vol_id),
+			be32_to_cpu(vid_hdr->lnum), vol->vol_id, lnum);
+		ubi_cp_invalidate(ubi);
+		err = -EINVAL;
+		goto out_free;
+	}
+	err = 0;
+
+	ubi_free_vid_hdr(ubi, vid_hdr);
+out_clear:
+	smp_mb__before_clear_bit();
+	clear_bit(lnum, vol->checkmap);
+out_unlock:
+	mutex_unlock(&ubi->cp_check_mutex);
+	if (err)
+		return err;
+out_pnum:
+	*pnum = vol->eba_tbl[lnum];
+	return 0;
+
+out_free:
+	ubi_free_vid_hdr(ubi, vid_hdr);
+	mutex_unlock(&ubi->cp_check_mutex);
+	return err;
+}
+
+/**
+ * checked_mapping - mark a mapping as up-to-date.
+ * @vol: volume description object
+ * @lnum: logical eraseblock number
+ */
+static void checked_mapping(struct ubi_volume *vol, int lnum)
+{
+	if (lnum < vol->checkmap_lebs) {
+		smp_mb__before_clear_bit();
+		clear_bit(lnum, vol->checkmap);
+	}
+}
+
+#else
+
+static inline int check_mapping(struct ubi_device *ubi, struct ubi_volume *vol,
+				int lnum, int *pnum)
+{
+	*pnum = vol->eba_tbl[lnum];
+	return 0;
+}
+
+static inline void checked_mapping(struct ubi_volume *vol, int lnum)
+{
+}
+
+#endif /* CONFIG_MTD_UBI_CHECKPOINT */
+
+/**
+ * ubi_eba_is_mapped - check if a logical eraseblock is mapped.
+ * @ubi: UBI device description object
+ * @vol: volume description object
+ * @lnum: logical eraseblock number
+ *
+ * Unlike looking at the EBA table directly, this verifies a mapping taken
+ * from the checkpoint first. Returns %1 if the logical eraseblock is mapped,
+ * %0 if not, and a negative error code in case of failure.
+ */
+int ubi_eba_is_mapped(struct ubi_device *ubi, struct ubi_volume *vol,
+		      int lnum)
+{
+	int err, pnum;
+
+	err = leb_read_lock(ubi, vol->vol_id, lnum);
+	if (err)
+		return err;
+
+	err = check_mapping(ubi, vol, lnum, &pnum);
+	leb_read_unlock(ubi, vol->vol_id, lnum);
+	if (err)
+		return err;
+	return pnum >= 0;
+}
+
 /**
  * ubi_eba_unmap_leb - un-map logical eraseblock.
  * @ubi: UBI device description object
@@ -341,6 +485,7 @@ int ubi_eba_unmap_leb(struct ubi_device *ubi, struct ubi_volume *vol,
 	dbg_eba("erase LEB %d:%d, PEB %d", vol_id, lnum, pnum);
 
 	vol->eba_tbl[lnum] = UBI_LEB_UNMAPPED;
+	checked_mapping(vol, lnum);
 	err = ubi_wl_put_peb(ubi, pnum, 0);
 
 out_unlock:
@@ -378,7 +523,12 @@ int ubi_eba_read_leb(struct ubi_device *ubi, struct ubi_volume *vol, int lnum,
 	if (err)
 		return err;
 
-	pnum = vol->eba_tbl[lnum];
+	err = check_mapping(ubi, vol, lnum, &pnum);
+	if (err) {
+		leb_read_unlock(ubi, vol_id, lnum);
+		return err;
+	}
+
 	if (pnum < 0) {
 		/*
 		 * The logical eraseblock is not mapped, fill the whole buffer
@@ -522,7 +672,7 @@ retry:
 		goto out_put;
 	}
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 	err = ubi_io_write_vid_hdr(ubi, new_pnum, vid_hdr);
 	if (err)
 		goto write_error;
@@ -550,6 +700,7 @@ retry:
 	ubi_free_vid_hdr(ubi, vid_hdr);
 
 	vol->eba_tbl[lnum] = new_pnum;
+	up_read(&ubi->cp_sem);
 	ubi_wl_put_peb(ubi, pnum, 1);
 
 	ubi_msg("data was successfully recovered");
@@ -558,6 +709,7 @@ retry:
 out_unlock:
 	mutex_unlock(&ubi->buf_mutex);
 out_put:
+	up_read(&ubi->cp_sem);
 	ubi_wl_put_peb(ubi, new_pnum, 1);
 	ubi_free_vid_hdr(ubi, vid_hdr);
 	return err;
@@ -567,6 +719,7 @@ write_error:
 	 * Bad luck? This physical eraseblock is bad too? Crud. Let's try to
 	 * get another one.
 	 */
+	up_read(&ubi->cp_sem);
 	ubi_warn("failed to write to PEB %d", new_pnum);
 	ubi_wl_put_peb(ubi, new_pnum, 1);
 	if (++tries > UBI_IO_RETRIES) {
@@ -605,7 +758,12 @@ int ubi_eba_write_leb(struct ubi_device *ubi, struct ubi_volume *vol, int lnum,
 	if (err)
 		return err;
 
-	pnum = vol->eba_tbl[lnum];
+	err = check_mapping(ubi, vol, lnum, &pnum);
+	if (err) {
+		leb_write_unlock(ubi, vol_id, lnum);
+		return err;
+	}
+
 	if (pnum >= 0) {
 		dbg_eba("write %d bytes at offset %d of LEB %d:%d, PEB %d",
 			len, offset, vol_id, lnum, pnum);
@@ -634,7 +792,7 @@ int ubi_eba_write_leb(struct ubi_device *ubi, struct ubi_volume *vol, int lnum,
 	}
 
 	vid_hdr->vol_type = UBI_VID_DYNAMIC;
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 	vid_hdr->vol_id = cpu_to_be32(vol_id);
 	vid_hdr->lnum = cpu_to_be32(lnum);
 	vid_hdr->compat = ubi_get_compat(ubi, vol_id);
@@ -669,12 +827,14 @@ retry:
 	}
 
 	vol->eba_tbl[lnum] = pnum;
+	up_read(&ubi->cp_sem);
 
 	leb_write_unlock(ubi, vol_id, lnum);
 	ubi_free_vid_hdr(ubi, vid_hdr);
 	return 0;
 
 write_error:
+	up_read(&ubi->cp_sem);
 	if (err != -EIO || !ubi->bad_allowed) {
 		ubi_ro_mode(ubi);
 		leb_write_unlock(ubi, vol_id, lnum);
@@ -695,7 +855,7 @@ write_error:
 		return err;
 	}
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 	ubi_msg("try another PEB");
 	goto retry;
 }
@@ -750,7 +910,7 @@ int ubi_eba_write_leb_st(struct ubi_device *ubi, struct ubi_volume *vol,
 		return err;
 	}
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 	vid_hdr->vol_id = cpu_to_be32(vol_id);
 	vid_hdr->lnum = cpu_to_be32(lnum);
 	vid_hdr->compat = ubi_get_compat(ubi, vol_id);
@@ -789,12 +949,14 @@ retry:
 
 	ubi_assert(vol->eba_tbl[lnum] < 0);
 	vol->eba_tbl[lnum] = pnum;
+	up_read(&ubi->cp_sem);
 
 	leb_write_unlock(ubi, vol_id, lnum);
 	ubi_free_vid_hdr(ubi, vid_hdr);
 	return 0;
 
 write_error:
+	up_read(&ubi->cp_sem);
 	if (err != -EIO || !ubi->bad_allowed) {
 		/*
 		 * This flash device does not admit of bad eraseblocks or
@@ -815,7 +977,7 @@ write_error:
 		return err;
 	}
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 	ubi_msg("try another PEB");
 	goto retry;
 }
@@ -868,7 +1030,7 @@ int ubi_eba_atomic_leb_change(struct ubi_device *ubi, struct ubi_volume *vol,
 	if (err)
 		goto out_mutex;
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 	vid_hdr->vol_id = cpu_to_be32(vol_id);
 	vid_hdr->lnum = cpu_to_be32(lnum);
 	vid_hdr->compat = ubi_get_compat(ubi, vol_id);
@@ -906,11 +1068,15 @@ retry:
 
 	if (vol->eba_tbl[lnum] >= 0) {
 		err = ubi_wl_put_peb(ubi, vol->eba_tbl[lnum], 0);
-		if (err)
+		if (err) {
+			up_read(&ubi->cp_sem);
 			goto out_leb_unlock;
+		}
 	}
 
 	vol->eba_tbl[lnum] = pnum;
+	checked_mapping(vol, lnum);
+	up_read(&ubi->cp_sem);
 
 out_leb_unlock:
 	leb_write_unlock(ubi, vol_id, lnum);
@@ -920,6 +1086,7 @@ out_mutex:
 	return err;
 
 write_error:
+	up_read(&ubi->cp_sem);
 	if (err != -EIO || !ubi->bad_allowed) {
 		/*
 		 * This flash device does not admit of bad eraseblocks or
@@ -936,7 +1103,7 @@ write_error:
 		goto out_leb_unlock;
 	}
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 	ubi_msg("try another PEB");
 	goto retry;
 }
@@ -1094,7 +1261,7 @@ int ubi_eba_copy_leb(struct ubi_device *ubi, int from, int to,
 		vid_hdr->data_size = cpu_to_be32(data_size);
 		vid_hdr->data_crc = cpu_to_be32(crc);
 	}
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 
 	err = ubi_io_write_vid_hdr(ubi, to, vid_hdr);
 	if (err) {
@@ -1157,6 +1324,7 @@ int ubi_eba_copy_leb(struct ubi_device *ubi, int from, int to,
 
 	ubi_assert(vol->eba_tbl[lnum] == from);
 	vol->eba_tbl[lnum] = to;
+	checked_mapping(vol, lnum);
 
 out_unlock_buf:
 	mutex_unlock(&ubi->buf_mutex);
@@ -1248,18 +1416,34 @@ int ubi_eba_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 		for (j = 0; j < vol->reserved_pebs; j++)
 			vol->eba_tbl[j] = UBI_LEB_UNMAPPED;
 
+		if (si->checkpoint) {
+			/* Mappings taken from the checkpoint have sqnum 0 */
+			vol->checkmap = kcalloc(BITS_TO_LONGS(vol->reserved_pebs),
+						sizeof(unsigned long),
+						GFP_KERNEL);
+			if (!vol->checkmap) {
+				err = -ENOMEM;
+				goto out_free;
+			}
+			vol->checkmap_lebs = vol->reserved_pebs;
+		}
+
 		sv = ubi_scan_find_sv(si, idx2vol_id(ubi, i));
 		if (!sv)
 			continue;
 
 		ubi_rb_for_each_entry(rb, seb, &sv->root, u.rb) {
-			if (seb->lnum >= vol->reserved_pebs)
+			if (seb->lnum >= vol->reserved_pebs) {
 				/*
 				 * This may happen in case of an unclean reboot
 				 * during re-size.
 				 */
 				ubi_scan_move_to_list(sv, seb, &si->erase);
+				continue;
+			}
 			vol->eba_tbl[seb->lnum] = seb->pnum;
+			if (vol->checkmap && seb->sqnum == 0)
+				set_bit(seb->lnum, vol->checkmap);
 		}
 	}
 
@@ -1298,6 +1482,9 @@ out_free:
 			continue;
 		kfree(ubi->volumes[i]->eba_tbl);
 		ubi->volumes[i]->eba_tbl = NULL;
+		kfree(ubi->volumes[i]->checkmap);
+		ubi->volumes[i]->checkmap = NULL;
+		ubi->volumes[i]->checkmap_lebs = 0;
 	}
 	return err;
 }
@@ -288,6 +288,13 @@ int ubi_io_write(struct ubi_device *ubi, const void *buf, int pnum, int offset,
 		return -EIO;
 	}
 
+	if (ubi_dbg_is_power_cut(ubi)) {
+		ubi_warn("emulating a power cut before writing to PEB %d:%d",
+			 pnum, offset);
+		ubi_ro_mode(ubi);
+		return -EROFS;
+	}
+
 	addr = (loff_t)pnum * ubi->peb_size + offset;
 	err = ubi->mtd->write(ubi->mtd, addr, len, &written, buf);
 	if (err) {
@@ -611,6 +618,12 @@ int ubi_io_sync_erase(struct ubi_device *ubi, int pnum, int torture)
 			return ret;
 	}
 
+	if (ubi_dbg_is_power_cut(ubi)) {
+		ubi_warn("emulating a power cut before erasing PEB %d", pnum);
+		ubi_ro_mode(ubi);
+		return -EROFS;
+	}
+
 	err = do_sync_erase(ubi, pnum);
 	if (err)
 		return err;
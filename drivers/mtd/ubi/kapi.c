@@ -641,6 +641,7 @@ EXPORT_SYMBOL_GPL(ubi_leb_unmap);
  */
 int ubi_leb_map(struct ubi_volume_desc *desc, int lnum, int dtype)
 {
+	int err;
 	struct ubi_volume *vol = desc->vol;
 	struct ubi_device *ubi = vol->ubi;
 
@@ -659,8 +660,9 @@ int ubi_leb_map(struct ubi_volume_desc *desc, int lnum, int dtype)
 	if (vol->upd_marker)
 		return -EBADF;
 
-	if (vol->eba_tbl[lnum] >= 0)
-		return -EBADMSG;
+	err = ubi_eba_is_mapped(ubi, vol, lnum);
+	if (err)
+		return err < 0 ? err : -EBADMSG;
 
 	return ubi_eba_write_leb(ubi, vol, lnum, NULL, 0, 0, dtype);
 }
@@ -694,7 +696,7 @@ int ubi_is_mapped(struct ubi_volume_desc *desc, int lnum)
 	if (vol->upd_marker)
 		return -EBADF;
 
-	return vol->eba_tbl[lnum] >= 0;
+	return ubi_eba_is_mapped(vol->ubi, vol, lnum);
 }
 EXPORT_SYMBOL_GPL(ubi_is_mapped);
 
@@ -39,6 +39,12 @@
  * eraseblocks are put to the @free list and the physical eraseblock to be
  * erased are put to the @erase list.
  *
+ * If checkpoints are enabled, only the first %UBI_CP_MAX_START physical
+ * eraseblocks are scanned to find the newest checkpoint, and the state of the
+ * other physical eraseblocks is taken from it. Only those which may have been
+ * written to after the checkpoint was written are scanned. If there is no
+ * usable checkpoint, the whole flash is scanned.
+ *
  * About corruptions
  * ~~~~~~~~~~~~~~~~~
  *
@@ -86,6 +92,10 @@
 #include <linux/crc32.h>
 #include <linux/math64.h>
 #include <linux/random.h>
+#include <linux/jiffies.h>
+#include <linux/completion.h>
+#include <linux/workqueue.h>
+#include <linux/moduleparam.h>
 #include "ubi.h"
 
 #ifdef CONFIG_MTD_UBI_DEBUG
@@ -98,6 +108,24 @@ static int paranoid_check_si(struct ubi_device *ubi, struct ubi_scan_info *si);
 static struct ubi_ec_hdr *ech;
 static struct ubi_vid_hdr *vidh;
 
+/*
+ * How many physical eraseblocks to read at a time when scanning. Reading is
+ * done by an unbound workqueue, so whether this speeds attaching up depends on
+ * how much of the read time the MTD driver spends waiting for the flash and
+ * computing ECC rather than holding the chip.
+ */
+static int scan_threads = 1;
+module_param(scan_threads, int, 0644);
+MODULE_PARM_DESC(scan_threads, "Number of physical eraseblocks read "
+			       "concurrently when scanning an MTD device "
+			       "(default: 1, i.e. serial scanning)");
+
+/*
+ * How many physical eraseblocks each scanning thread may read ahead of the
+ * one being added to the scanning information.
+ */
+#define SCAN_READAHEAD 8
+
 /**
  * add_to_list - add physical eraseblock to a list.
  * @si: scanning information
@@ -106,7 +134,8 @@ static struct ubi_vid_hdr *vidh;
  * @to_head: if not zero, add to the head of the list
  * @list: the list to add to
  *
- * This function adds physical eraseblock @pnum to free, erase, or alien lists.
+ * This function adds physical eraseblock @pnum to free, erase, alien, or
+ * checkpoint lists.
  * If @to_head is not zero, PEB will be added to the head of the list, which
  * basically means it will be processed first later. E.g., we add corrupted
  * PEBs (corrupted due to power cuts) to the head of the erase list to make
@@ -126,6 +155,8 @@ static int add_to_list(struct ubi_scan_info *si, int pnum, int ec, int to_head,
 	} else if (list == &si->alien) {
 		dbg_bld("add to alien: PEB %d, EC %d", pnum, ec);
 		si->alien_peb_count += 1;
+	} else if (list == &si->cp_pebs) {
+		dbg_bld("add to checkpoints: PEB %d, EC %d", pnum, ec);
 	} else
 		BUG();
 
@@ -827,24 +858,92 @@ out_unlock:
 }
 
 /**
- * process_eb - read, check UBI headers, and add them to scanning information.
+ * struct scan_slot - UBI headers of a physical eraseblock being scanned.
+ * @work: the work which reads the headers in parallel scanning mode
+ * @done: completed when the headers have been read
  * @ubi: UBI device description object
- * @si: scanning information
  * @pnum: the physical eraseblock number
+ * @bad: what 'ubi_io_is_bad()' returned
+ * @ec_err: what 'ubi_io_read_ec_hdr()' returned
+ * @vid_err: what 'ubi_io_read_vid_hdr()' returned
+ * @ech: EC header buffer
+ * @vidh: VID header buffer
+ *
+ * Scanning is split into reading the headers, which is pure I/O and may be
+ * done for several physical eraseblocks at a time, and adding them to the
+ * scanning information, which is always done in order of @pnum.
+ */
+struct scan_slot {
+	struct work_struct work;
+	struct completion done;
+	struct ubi_device *ubi;
+	int pnum;
+	int bad;
+	int ec_err;
+	int vid_err;
+	struct ubi_ec_hdr *ech;
+	struct ubi_vid_hdr *vidh;
+};
+
+/**
+ * read_headers - read UBI headers of a physical eraseblock.
+ * @ubi: UBI device description object
+ * @slot: where to read the headers to, @slot->pnum is the eraseblock to read
+ *
+ * This function does not check anything, it only stores what the I/O
+ * sub-system returned in @slot. The VID header is not read if the EC header
+ * says the eraseblock is empty, because 'process_eb()' does not look at it in
+ * this case.
+ */
+static void read_headers(struct ubi_device *ubi, struct scan_slot *slot)
+{
+	int pnum = slot->pnum;
+
+	slot->ec_err = slot->vid_err = 0;
+
+	slot->bad = ubi_io_is_bad(ubi, pnum);
+	if (slot->bad)
+		return;
+
+	slot->ec_err = ubi_io_read_ec_hdr(ubi, pnum, slot->ech, 0);
+	if (slot->ec_err < 0 || slot->ec_err == UBI_IO_FF ||
+	    slot->ec_err == UBI_IO_FF_BITFLIPS)
+		return;
+
+	slot->vid_err = ubi_io_read_vid_hdr(ubi, pnum, slot->vidh, 0);
+}
+
+/**
+ * scan_worker - read UBI headers of a physical eraseblock in background.
+ * @work: the work object embedded in &struct scan_slot
+ */
+static void scan_worker(struct work_struct *work)
+{
+	struct scan_slot *slot = container_of(work, struct scan_slot, work);
+
+	read_headers(slot->ubi, slot);
+	complete(&slot->done);
+}
+
+/**
+ * process_eb - check UBI headers and add them to scanning information.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ * @slot: UBI headers of the physical eraseblock read by 'read_headers()'
  *
  * This function returns a zero if the physical eraseblock was successfully
  * handled and a negative error code in case of failure.
  */
 static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
-		      int pnum)
+		      const struct scan_slot *slot)
 {
 	long long uninitialized_var(ec);
-	int err, bitflips = 0, vol_id, ec_err = 0;
+	int err, bitflips = 0, vol_id, ec_err = 0, pnum = slot->pnum;
 
 	dbg_bld("scan PEB %d", pnum);
 
 	/* Skip bad physical eraseblocks */
-	err = ubi_io_is_bad(ubi, pnum);
+	err = slot->bad;
 	if (err < 0)
 		return err;
 	else if (err) {
@@ -857,7 +956,7 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 		return 0;
 	}
 
-	err = ubi_io_read_ec_hdr(ubi, pnum, ech, 0);
+	err = slot->ec_err;
 	if (err < 0)
 		return err;
 	switch (err) {
@@ -894,13 +993,13 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 		int image_seq;
 
 		/* Make sure UBI version is OK */
-		if (ech->version != UBI_VERSION) {
+		if (slot->ech->version != UBI_VERSION) {
 			ubi_err("this UBI version is %d, image version is %d",
-				UBI_VERSION, (int)ech->version);
+				UBI_VERSION, (int)slot->ech->version);
 			return -EINVAL;
 		}
 
-		ec = be64_to_cpu(ech->ec);
+		ec = be64_to_cpu(slot->ech->ec);
 		if (ec > UBI_MAX_ERASECOUNTER) {
 			/*
 			 * Erase counter overflow. The EC headers have 64 bits
@@ -911,7 +1010,7 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 			 */
 			ubi_err("erase counter overflow, max is %d",
 				UBI_MAX_ERASECOUNTER);
-			ubi_dbg_dump_ec_hdr(ech);
+			ubi_dbg_dump_ec_hdr(slot->ech);
 			return -EINVAL;
 		}
 
@@ -926,21 +1025,21 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 		 * sequence number, while other PEBs have non-zero sequence
 		 * number.
 		 */
-		image_seq = be32_to_cpu(ech->image_seq);
+		image_seq = be32_to_cpu(slot->ech->image_seq);
 		if (!ubi->image_seq && image_seq)
 			ubi->image_seq = image_seq;
 		if (ubi->image_seq && image_seq &&
 		    ubi->image_seq != image_seq) {
 			ubi_err("bad image sequence number %d in PEB %d, "
 				"expected %d", image_seq, pnum, ubi->image_seq);
-			ubi_dbg_dump_ec_hdr(ech);
+			ubi_dbg_dump_ec_hdr(slot->ech);
 			return -EINVAL;
 		}
 	}
 
 	/* OK, we've done with the EC header, let's look at the VID header */
 
-	err = ubi_io_read_vid_hdr(ubi, pnum, vidh, 0);
+	err = slot->vid_err;
 	if (err < 0)
 		return err;
 	switch (err) {
@@ -978,7 +1077,7 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 			 * The EC was OK, but the VID header is corrupted. We
 			 * have to check what is in the data area.
 			 */
-			err = check_corruption(ubi, vidh, pnum);
+			err = check_corruption(ubi, slot->vidh, pnum);
 
 		if (err < 0)
 			return err;
@@ -1010,12 +1109,27 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 		return -EINVAL;
 	}
 
-	vol_id = be32_to_cpu(vidh->vol_id);
+	vol_id = be32_to_cpu(slot->vidh->vol_id);
+	if (vol_id == UBI_CP_VOLUME_ID) {
+		struct ubi_scan_leb *seb;
+
+		/*
+		 * Checkpoints are not attached as a volume. They are either
+		 * used for attaching or erased before anything is written.
+		 */
+		err = add_to_list(si, pnum, ec, 0, &si->cp_pebs);
+		if (err)
+			return err;
+		seb = list_entry(si->cp_pebs.prev, struct ubi_scan_leb, u.list);
+		seb->sqnum = be64_to_cpu(slot->vidh->sqnum);
+		goto adjust_mean_ec;
+	}
+
 	if (vol_id > UBI_MAX_VOLUMES && vol_id != UBI_LAYOUT_VOLUME_ID) {
-		int lnum = be32_to_cpu(vidh->lnum);
+		int lnum = be32_to_cpu(slot->vidh->lnum);
 
 		/* Unsupported internal volume */
-		switch (vidh->compat) {
+		switch (slot->vidh->compat) {
 		case UBI_COMPAT_DELETE:
 			ubi_msg("\"delete\" compatible internal volume %d:%d"
 				" found, will remove it", vol_id, lnum);
@@ -1049,7 +1163,8 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 	if (ec_err)
 		ubi_warn("valid VID header but corrupted EC header at PEB %d",
 			 pnum);
-	err = ubi_scan_add_used(ubi, si, pnum, ec, vidh, bitflips);
+	err = ubi_scan_add_used(ubi, si, pnum, ec, slot->vidh,
+				bitflips);
 	if (err)
 		return err;
 
@@ -1141,55 +1256,415 @@ static int check_what_we_have(struct ubi_device *ubi, struct ubi_scan_info *si)
 }
 
 /**
- * ubi_scan - scan an MTD device.
+ * scan_serial - read and process all physical eraseblocks one by one.
  * @ubi: UBI device description object
+ * @si: scanning information
  *
- * This function does full scanning of an MTD device and returns complete
- * information about it. In case of failure, an error code is returned.
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
  */
-struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
+static int scan_serial(struct ubi_device *ubi, struct ubi_scan_info *si)
 {
 	int err, pnum;
-	struct rb_node *rb1, *rb2;
-	struct ubi_scan_volume *sv;
-	struct ubi_scan_leb *seb;
+	struct scan_slot slot = { .ech = ech, .vidh = vidh };
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		cond_resched();
+
+		dbg_gen("process PEB %d", pnum);
+		slot.pnum = pnum;
+		read_headers(ubi, &slot);
+		err = process_eb(ubi, si, &slot);
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+/**
+ * scan_parallel - read physical eraseblocks concurrently and process them.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ * @threads: how many physical eraseblocks may be read at a time
+ *
+ * The headers are read by up to @threads workers into a ring of slots, which
+ * stays @SCAN_READAHEAD eraseblocks per worker ahead of the caller. The caller
+ * processes the slots strictly in @pnum order, so the scanning information is
+ * built exactly as by 'scan_serial()'. Returns zero in case of success and a
+ * negative error code in case of failure.
+ */
+static int scan_parallel(struct ubi_device *ubi, struct ubi_scan_info *si,
+			 int threads)
+{
+	int i, err, pnum, nr_slots;
+	struct scan_slot *slots;
+	struct workqueue_struct *wq;
+
+	nr_slots = min(threads * SCAN_READAHEAD, ubi->peb_count);
+	slots = kcalloc(nr_slots, sizeof(struct scan_slot), GFP_KERNEL);
+	if (!slots)
+		return -ENOMEM;
+
+	err = -ENOMEM;
+	for (i = 0; i < nr_slots; i++) {
+		slots[i].ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+		if (!slots[i].ech)
+			goto out_free;
+		slots[i].vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+		if (!slots[i].vidh)
+			goto out_free;
+		slots[i].ubi = ubi;
+		INIT_WORK(&slots[i].work, scan_worker);
+		init_completion(&slots[i].done);
+	}
+
+	wq = alloc_workqueue("ubi_scan", WQ_UNBOUND, threads);
+	if (!wq)
+		goto out_free;
+
+	for (i = 0; i < nr_slots; i++) {
+		slots[i].pnum = i;
+		queue_work(wq, &slots[i].work);
+	}
+
+	err = 0;
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		struct scan_slot *slot = &slots[pnum % nr_slots];
+
+		wait_for_completion(&slot->done);
+
+		dbg_gen("process PEB %d", pnum);
+		err = process_eb(ubi, si, slot);
+		if (err < 0)
+			break;
+
+		if (pnum + nr_slots < ubi->peb_count) {
+			slot->pnum = pnum + nr_slots;
+			INIT_COMPLETION(slot->done);
+			queue_work(wq, &slot->work);
+		}
+	}
+
+	/* Waits for the works which are still in flight after an error */
+	destroy_workqueue(wq);
+
+out_free:
+	for (i = 0; i < nr_slots; i++) {
+		if (slots[i].vidh)
+			ubi_free_vid_hdr(ubi, slots[i].vidh);
+		kfree(slots[i].ech);
+	}
+	kfree(slots);
+	return err;
+}
+
+/**
+ * scan_all - scan all physical eraseblocks.
+ * @ubi: UBI device description object
+ * @si: scanning information to fill
+ *
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+static int scan_all(struct ubi_device *ubi, struct ubi_scan_info *si)
+{
+	int err, threads;
+	unsigned long start = jiffies;
+
+	threads = scan_threads;
+	if (threads > 1)
+		err = scan_parallel(ubi, si, threads);
+	else {
+		threads = 1;
+		err = scan_serial(ubi, si);
+	}
+	if (err < 0)
+		return err;
+
+	ubi_msg("scanned %d PEBs in %u ms using %d thread(s)", ubi->peb_count,
+		jiffies_to_msecs(jiffies - start), threads);
+	return 0;
+}
+
+/**
+ * alloc_si - allocate scanning information.
+ * @slab_name: name of the slab cache for &struct ubi_scan_leb objects
+ *
+ * Returns the new scanning information or %NULL if there is no memory.
+ */
+static struct ubi_scan_info *alloc_si(const char *slab_name)
+{
 	struct ubi_scan_info *si;
 
 	si = kzalloc(sizeof(struct ubi_scan_info), GFP_KERNEL);
 	if (!si)
-		return ERR_PTR(-ENOMEM);
+		return NULL;
 
 	INIT_LIST_HEAD(&si->corr);
 	INIT_LIST_HEAD(&si->free);
 	INIT_LIST_HEAD(&si->erase);
 	INIT_LIST_HEAD(&si->alien);
+	INIT_LIST_HEAD(&si->cp_pebs);
 	si->volumes = RB_ROOT;
+	si->cp_pnum = -1;
 
-	err = -ENOMEM;
-	si->scan_leb_slab = kmem_cache_create("ubi_scan_leb_slab",
+	si->scan_leb_slab = kmem_cache_create(slab_name,
 					      sizeof(struct ubi_scan_leb),
 					      0, 0, NULL);
-	if (!si->scan_leb_slab)
-		goto out_si;
+	if (!si->scan_leb_slab) {
+		kfree(si);
+		return NULL;
+	}
 
-	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
-	if (!ech)
-		goto out_slab;
+	return si;
+}
 
-	vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
-	if (!vidh)
-		goto out_ech;
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
 
-	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
-		cond_resched();
+/* Marks PEBs claimed by an EBA table of the checkpoint */
+#define CP_PEB_CLAIMED 0xFF
 
-		dbg_gen("process PEB %d", pnum);
-		err = process_eb(ubi, si, pnum);
+#ifdef CONFIG_MTD_UBI_DEBUG
+static int paranoid_check_cp(struct ubi_device *ubi, struct ubi_scan_info *si);
+#else
+#define paranoid_check_cp(ubi, si) 0
+#endif
+
+/**
+ * add_cp_ec - account an erase counter taken from the checkpoint.
+ * @si: scanning information
+ * @ec: the erase counter
+ */
+static void add_cp_ec(struct ubi_scan_info *si, int ec)
+{
+	si->ec_sum += ec;
+	si->ec_count += 1;
+	if (ec > si->max_ec)
+		si->max_ec = ec;
+	if (ec < si->min_ec)
+		si->min_ec = ec;
+}
+
+/**
+ * add_cp_volumes - add logical eraseblocks listed in the checkpoint.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ * @start: physical eraseblocks below this were scanned and are skipped
+ *
+ * Logical eraseblocks are added with sequence number zero, so that any copy
+ * found by scanning is newer. Every physical eraseblock has to be in the
+ * "used" state and may be claimed only once, otherwise the checkpoint is
+ * inconsistent. Returns zero in case of success and a negative error code in
+ * case of failure.
+ */
+static int add_cp_volumes(struct ubi_device *ubi, struct ubi_scan_info *si,
+			  int start)
+{
+	int i, err, lnum, pnum, ec;
+	const struct ubi_cp_hdr *hdr = ubi->cp_buf;
+	int peb_count = be32_to_cpu(hdr->peb_count);
+	int vol_count = be32_to_cpu(hdr->vol_count);
+	const __be32 *ecs = (const void *)(hdr + 1);
+	u8 *state = (void *)(ecs + peb_count);
+	const void *p = state + ALIGN(peb_count, 4);
+
+	memset(vidh, 0, sizeof(struct ubi_vid_hdr));
+	for (i = 0; i < vol_count; i++) {
+		const struct ubi_cp_vol *cv = p;
+		const __be32 *tbl = (const void *)(cv + 1);
+		int leb_count = be32_to_cpu(cv->leb_count);
+		int used_ebs = be32_to_cpu(cv->used_ebs);
+		int data_size = 0;
+
+		vidh->vol_type = cv->vol_type;
+		vidh->compat = cv->compat;
+		vidh->vol_id = cv->vol_id;
+		vidh->used_ebs = cv->used_ebs;
+		vidh->data_pad = cv->data_pad;
+		if (cv->vol_type == UBI_VID_STATIC)
+			data_size = ubi->leb_size - be32_to_cpu(cv->data_pad);
+
+		for (lnum = 0; lnum < leb_count; lnum++) {
+			if (be32_to_cpu(tbl[lnum]) == UBI_CP_UNMAPPED)
+				continue;
+			pnum = be32_to_cpu(tbl[lnum]);
+			if (pnum < 0 || pnum >= peb_count) {
+				ubi_err("LEB %d:%d is mapped to bad PEB %d",
+					be32_to_cpu(cv->vol_id), lnum, pnum);
+				return -EINVAL;
+			}
+			if (pnum < start)
+				continue;
+
+			if (state[pnum] != UBI_CP_PEB_USED) {
+				ubi_err("LEB %d:%d is mapped to bad PEB %d",
+					be32_to_cpu(cv->vol_id), lnum, pnum);
+				return -EINVAL;
+			}
+			state[pnum] = CP_PEB_CLAIMED;
+
+			vidh->lnum = cpu_to_be32(lnum);
+			if (cv->vol_type == UBI_VID_STATIC &&
+			    lnum == used_ebs - 1)
+				vidh->data_size = cv->last_data_size;
+			else
+				vidh->data_size = cpu_to_be32(data_size);
+
+			ec = be32_to_cpu(ecs[pnum]);
+			err = ubi_scan_add_used(ubi, si, pnum, ec, vidh, 0);
+			if (err)
+				return err;
+			add_cp_ec(si, ec);
+		}
+
+		p = tbl + leb_count;
+	}
+
+	return 0;
+}
+
+/**
+ * scan_checkpoint - build scanning information using a checkpoint.
+ * @ubi: UBI device description object
+ * @si: scanning information to fill
+ *
+ * This function scans the first %UBI_CP_MAX_START physical eraseblocks, picks
+ * the newest valid checkpoint among them, and takes the state of the other
+ * physical eraseblocks from it. Only the physical eraseblocks which may have
+ * been written to after the checkpoint was written, and those the checkpoint
+ * does not describe, e.g. bad ones, are scanned. Returns zero in case of
+ * success, %1 if there is no usable checkpoint, and a negative error code if
+ * the checkpoint is inconsistent or an error occurred.
+ */
+static int scan_checkpoint(struct ubi_device *ubi, struct ubi_scan_info *si)
+{
+	int err, pnum, ec, start, scanned, peb_count;
+	unsigned long begin = jiffies;
+	unsigned long long limit = ULLONG_MAX;
+	struct scan_slot slot = { .ech = ech, .vidh = vidh };
+	struct ubi_scan_leb *seb, *cp_seb;
+	const struct ubi_cp_hdr *hdr = ubi->cp_buf;
+	const __be32 *ecs = (const void *)(hdr + 1);
+	u8 *state;
+
+	start = scanned = min(ubi->peb_count, UBI_CP_MAX_START);
+	for (pnum = 0; pnum < start; pnum++) {
+		slot.pnum = pnum;
+		read_headers(ubi, &slot);
+		err = process_eb(ubi, si, &slot);
 		if (err < 0)
-			goto out_vidh;
+			return err;
+	}
+
+	/* Try the checkpoints found starting from the newest one */
+	for (;;) {
+		cp_seb = NULL;
+		list_for_each_entry(seb, &si->cp_pebs, u.list)
+			if (seb->sqnum < limit &&
+			    (!cp_seb || seb->sqnum > cp_seb->sqnum))
+				cp_seb = seb;
+		if (!cp_seb) {
+			dbg_bld("no checkpoint found");
+			return 1;
+		}
+
+		err = ubi_cp_read(ubi, cp_seb->pnum);
+		if (err <= 0)
+			break;
+		ubi_warn("bad checkpoint in PEB %d", cp_seb->pnum);
+		limit = cp_seb->sqnum;
+	}
+	if (err)
+		return err;
+
+	if (ubi->image_seq && be32_to_cpu(hdr->image_seq) != ubi->image_seq) {
+		ubi_err("bad image sequence number %d in the checkpoint",
+			be32_to_cpu(hdr->image_seq));
+		return -EINVAL;
 	}
 
-	dbg_msg("scanning is finished");
+	peb_count = be32_to_cpu(hdr->peb_count);
+	state = (void *)(ecs + peb_count);
+
+	list_del(&cp_seb->u.list);
+	si->cp_pnum = cp_seb->pnum;
+	si->cp_ec = cp_seb->ec;
+	if (si->cp_ec == UBI_SCAN_UNKNOWN_EC)
+		si->cp_ec = be32_to_cpu(ecs[cp_seb->pnum]);
+	kmem_cache_free(si->scan_leb_slab, cp_seb);
+
+	err = add_cp_volumes(ubi, si, start);
+	if (err)
+		return err;
+
+	for (pnum = start; pnum < peb_count; pnum++) {
+		ec = be32_to_cpu(ecs[pnum]);
+		switch (state[pnum]) {
+		case UBI_CP_PEB_FREE:
+			err = add_to_list(si, pnum, ec, 0, &si->free);
+			break;
+		case UBI_CP_PEB_ERASE:
+			err = add_to_list(si, pnum, ec, 0, &si->erase);
+			break;
+		case CP_PEB_CLAIMED:
+			continue;
+		case UBI_CP_PEB_SCAN:
+			cond_resched();
+			scanned += 1;
+			slot.pnum = pnum;
+			read_headers(ubi, &slot);
+			err = process_eb(ubi, si, &slot);
+			if (err < 0)
+				return err;
+			continue;
+		default:
+			ubi_err("bad state %d of PEB %d in the checkpoint",
+				state[pnum], pnum);
+			return -EINVAL;
+		}
+		if (err)
+			return err;
+		add_cp_ec(si, ec);
+	}
+
+	if (si->max_sqnum < be64_to_cpu(hdr->sqnum))
+		si->max_sqnum = be64_to_cpu(hdr->sqnum);
+	si->checkpoint = 1;
+
+	ubi_msg("attached using checkpoint in PEB %d, scanned %d PEBs in %u ms",
+		si->cp_pnum, scanned, jiffies_to_msecs(jiffies - begin));
+	return 0;
+}
+
+#else
+
+static inline int scan_checkpoint(struct ubi_device *ubi,
+				  struct ubi_scan_info *si)
+{
+	return 1;
+}
+
+#define paranoid_check_cp(ubi, si) 0
+
+#endif /* CONFIG_MTD_UBI_CHECKPOINT */
+
+/**
+ * late_analysis - analyze the overall situation with PEB.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ *
+ * This function calculates the mean erase counter, checks what was found and
+ * assigns the mean erase counter to physical eraseblocks with unknown erase
+ * counter. Returns zero if we should proceed with attaching the MTD device,
+ * and a negative error code if we should not.
+ */
+static int late_analysis(struct ubi_device *ubi, struct ubi_scan_info *si)
+{
+	int err;
+	struct rb_node *rb1, *rb2;
+	struct ubi_scan_volume *sv;
+	struct ubi_scan_leb *seb;
 
 	/* Calculate mean erase counter */
 	if (si->ec_count)
@@ -1197,7 +1672,7 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 
 	err = check_what_we_have(ubi, si);
 	if (err)
-		goto out_vidh;
+		return err;
 
 	/*
 	 * In case of unknown erase counter we use the mean erase counter
@@ -1222,23 +1697,119 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 		if (seb->ec == UBI_SCAN_UNKNOWN_EC)
 			seb->ec = si->mean_ec;
 
-	err = paranoid_check_si(ubi, si);
-	if (err)
-		goto out_vidh;
+	list_for_each_entry(seb, &si->cp_pebs, u.list)
+		if (seb->ec == UBI_SCAN_UNKNOWN_EC)
+			seb->ec = si->mean_ec;
+
+	return 0;
+}
+
+/**
+ * erase_stale_cps - erase checkpoints which were not used for attaching.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ *
+ * A stale checkpoint must not survive until the next attach, where it could be
+ * taken for the current one, so checkpoints are erased synchronously before
+ * anything is written to the flash, and are added to the free list. If this is
+ * impossible, e.g. in read-only mode, they are left for the erase worker.
+ */
+static void erase_stale_cps(struct ubi_device *ubi, struct ubi_scan_info *si)
+{
+	int err;
+	struct ubi_scan_leb *seb, *tmp;
+
+	list_for_each_entry_safe(seb, tmp, &si->cp_pebs, u.list) {
+		dbg_bld("erase stale checkpoint in PEB %d", seb->pnum);
+		list_del(&seb->u.list);
+		err = ubi_scan_erase_peb(ubi, si, seb->pnum, seb->ec + 1);
+		if (err) {
+			list_add(&seb->u.list, &si->erase);
+			continue;
+		}
+		seb->ec += 1;
+		list_add_tail(&seb->u.list, &si->free);
+	}
+}
+
+/**
+ * ubi_scan - scan an MTD device.
+ * @ubi: UBI device description object
+ * @use_cp: whether a checkpoint may be used instead of scanning the whole
+ *          flash
+ *
+ * This function scans an MTD device, or uses a checkpoint to avoid scanning
+ * most of it, and returns complete information about it. If the checkpoint
+ * cannot be used, the whole flash is scanned. In case of failure, an error
+ * code is returned.
+ */
+struct ubi_scan_info *ubi_scan(struct ubi_device *ubi, int use_cp)
+{
+	int err;
+	struct ubi_scan_info *si = NULL;
+
+	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+	if (!ech)
+		return ERR_PTR(-ENOMEM);
+
+	err = -ENOMEM;
+	vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vidh)
+		goto out_ech;
+
+	if (use_cp && ubi->cp_buf) {
+		si = alloc_si("ubi_scan_leb_slab");
+		if (!si)
+			goto out_vidh;
+
+		err = scan_checkpoint(ubi, si);
+		if (!err)
+			err = late_analysis(ubi, si);
+		if (!err)
+			err = paranoid_check_cp(ubi, si);
+		if (err) {
+			if (err < 0)
+				ubi_warn("cannot use the checkpoint, error %d, "
+					 "scan the whole flash", err);
+			ubi_scan_destroy_si(si);
+			ubi->image_seq = 0;
+			si = NULL;
+		}
+	}
+
+	if (!si) {
+		err = -ENOMEM;
+		si = alloc_si("ubi_scan_leb_slab");
+		if (!si)
+			goto out_vidh;
+
+		err = scan_all(ubi, si);
+		if (err)
+			goto out_si;
+
+		err = late_analysis(ubi, si);
+		if (err)
+			goto out_si;
+
+		/* Stale mappings of a checkpoint would not pass this check */
+		err = paranoid_check_si(ubi, si);
+		if (err)
+			goto out_si;
+	}
+
+	erase_stale_cps(ubi, si);
 
 	ubi_free_vid_hdr(ubi, vidh);
 	kfree(ech);
 
 	return si;
 
+out_si:
+	ubi_scan_destroy_si(si);
 out_vidh:
 	ubi_free_vid_hdr(ubi, vidh);
 out_ech:
 	kfree(ech);
-out_slab:
-	kmem_cache_destroy(si->scan_leb_slab);
-out_si:
-	ubi_scan_destroy_si(si);
 	return ERR_PTR(err);
 }
 
@@ -1302,6 +1873,10 @@ void ubi_scan_destroy_si(struct ubi_scan_info *si)
 		list_del(&seb->u.list);
 		kmem_cache_free(si->scan_leb_slab, seb);
 	}
+	list_for_each_entry_safe(seb, seb_tmp, &si->cp_pebs, u.list) {
+		list_del(&seb->u.list);
+		kmem_cache_free(si->scan_leb_slab, seb);
+	}
 
 	/* Destroy the volume RB-tree */
 	rb = si->volumes.rb_node;
@@ -1569,6 +2144,9 @@ static int paranoid_check_si(struct ubi_device *ubi, struct ubi_scan_info *si)
 	list_for_each_entry(seb, &si->alien, u.list)
 		buf[seb->pnum] = 1;
 
+	list_for_each_entry(seb, &si->cp_pebs, u.list)
+		buf[seb->pnum] = 1;
+
 	err = 0;
 	for (pnum = 0; pnum < ubi->peb_count; pnum++)
 		if (!buf[pnum]) {
@@ -1602,4 +2180,58 @@ out:
 	return -EINVAL;
 }
 
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+
+/**
+ * paranoid_check_cp - check scanning information built using a checkpoint.
+ * @ubi: UBI device description object
+ * @si: scanning information built using the checkpoint
+ *
+ * This function scans the whole flash and makes sure that every logical
+ * eraseblock found is mapped to the same physical eraseblock in @si. Logical
+ * eraseblocks only present in @si are stale mappings which are verified when
+ * accessed. Returns zero if @si is all right, and a negative error code if not
+ * or if an error occurred.
+ */
+static int paranoid_check_cp(struct ubi_device *ubi, struct ubi_scan_info *si)
+{
+	int err;
+	struct ubi_scan_info *fsi;
+	struct rb_node *rb1, *rb2;
+	struct ubi_scan_volume *sv, *fsv;
+	struct ubi_scan_leb *seb, *fseb;
+
+	if (!(ubi_chk_flags & UBI_CHK_GEN))
+		return 0;
+
+	fsi = alloc_si("ubi_scan_leb_slab_chk");
+	if (!fsi)
+		return -ENOMEM;
+
+	err = scan_all(ubi, fsi);
+	if (err)
+		goto out;
+
+	ubi_rb_for_each_entry(rb1, fsv, &fsi->volumes, rb) {
+		sv = ubi_scan_find_sv(si, fsv->vol_id);
+		ubi_rb_for_each_entry(rb2, fseb, &fsv->root, u.rb) {
+			seb = sv ? ubi_scan_find_seb(sv, fseb->lnum) : NULL;
+			if (seb && seb->pnum == fseb->pnum)
+				continue;
+			ubi_err("LEB %d:%d is in PEB %d, but the checkpoint "
+				"says PEB %d", fsv->vol_id, fseb->lnum,
+				fseb->pnum, seb ? seb->pnum : -1);
+			err = -EINVAL;
+		}
+	}
+
+	if (err)
+		ubi_dbg_dump_stack();
+out:
+	ubi_scan_destroy_si(fsi);
+	return err;
+}
+
+#endif /* CONFIG_MTD_UBI_CHECKPOINT */
+
 #endif /* CONFIG_MTD_UBI_DEBUG */
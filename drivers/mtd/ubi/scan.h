@@ -93,6 +93,8 @@ struct ubi_scan_volume {
  * @erase: list of physical eraseblocks which have to be erased
  * @alien: list of physical eraseblocks which should not be used by UBI (e.g.,
  *         those belonging to "preserve"-compatible internal volumes)
+ * @cp_pebs: list of stale checkpoint physical eraseblocks which have to be
+ *           erased before anything is written to the flash
  * @corr_peb_count: count of PEBs in the @corr list
  * @empty_peb_count: count of PEBs which are presumably empty (contain only
  *                   0xFF bytes)
@@ -110,6 +112,10 @@ struct ubi_scan_volume {
  * @ec_sum: a temporary variable used when calculating @mean_ec
  * @ec_count: a temporary variable used when calculating @mean_ec
  * @scan_leb_slab: slab cache for &struct ubi_scan_leb objects
+ * @checkpoint: non-zero if the information was taken from a checkpoint
+ *              rather than from scanning the whole flash
+ * @cp_pnum: physical eraseblock of the checkpoint used for attaching, or %-1
+ * @cp_ec: erase counter of @cp_pnum
  *
  * This data structure contains the result of scanning and may be used by other
  * UBI sub-systems to build final UBI data structures, further error-recovery
@@ -121,6 +127,7 @@ struct ubi_scan_info {
 	struct list_head free;
 	struct list_head erase;
 	struct list_head alien;
+	struct list_head cp_pebs;
 	int corr_peb_count;
 	int empty_peb_count;
 	int alien_peb_count;
@@ -136,6 +143,9 @@ struct ubi_scan_info {
 	uint64_t ec_sum;
 	int ec_count;
 	struct kmem_cache *scan_leb_slab;
+	int checkpoint;
+	int cp_pnum;
+	int cp_ec;
 };
 
 struct ubi_device;
@@ -168,7 +178,7 @@ struct ubi_scan_leb *ubi_scan_get_free_peb(struct ubi_device *ubi,
 					   struct ubi_scan_info *si);
 int ubi_scan_erase_peb(struct ubi_device *ubi, const struct ubi_scan_info *si,
 		       int pnum, int ec);
-struct ubi_scan_info *ubi_scan(struct ubi_device *ubi);
+struct ubi_scan_info *ubi_scan(struct ubi_device *ubi, int use_cp);
 void ubi_scan_destroy_si(struct ubi_scan_info *si);
 
 #endif /* !__UBI_SCAN_H__ */
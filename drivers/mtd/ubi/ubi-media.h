@@ -312,6 +312,19 @@ struct ubi_vid_hdr {
 #define UBI_LAYOUT_VOLUME_NAME   "layout volume"
 #define UBI_LAYOUT_VOLUME_COMPAT UBI_COMPAT_REJECT
 
+/*
+ * The checkpoint volume contains a snapshot of the erase counters and of the
+ * EBA tables which allows to attach without scanning the whole flash. It is
+ * "delete" compatible, so UBI implementations which do not support
+ * checkpoints just erase it.
+ */
+#define UBI_CP_VOLUME_ID     (UBI_INTERNAL_VOL_START + 1)
+#define UBI_CP_VOLUME_TYPE   UBI_VID_STATIC
+#define UBI_CP_VOLUME_COMPAT UBI_COMPAT_DELETE
+
+/* The checkpoint is always stored in one of this many first PEBs */
+#define UBI_CP_MAX_START 64
+
 /* The maximum number of volumes per one UBI device */
 #define UBI_MAX_VOLUMES 128
 
@@ -375,4 +388,92 @@ struct ubi_vtbl_record {
 	__be32  crc;
 } __packed;
 
+/* Checkpoint header magic number ("UBIC") */
+#define UBI_CP_HDR_MAGIC 0x55424943
+
+/* The checkpoint format version */
+#define UBI_CP_FORMAT_VERSION 1
+
+/*
+ * Physical eraseblock states recorded in the checkpoint.
+ *
+ * UBI_CP_PEB_FREE: the PEB is erased and contains only the EC header
+ * UBI_CP_PEB_USED: the PEB belongs to a LEB listed in one of the EBA tables
+ * UBI_CP_PEB_ERASE: the PEB has to be erased
+ * UBI_CP_PEB_SCAN: the PEB may have been written to after the checkpoint was
+ *                  written and has to be scanned when attaching
+ */
+enum {
+	UBI_CP_PEB_FREE  = 0,
+	UBI_CP_PEB_USED  = 1,
+	UBI_CP_PEB_ERASE = 2,
+	UBI_CP_PEB_SCAN  = 3,
+};
+
+/* Marks unmapped LEBs in the EBA tables of the checkpoint */
+#define UBI_CP_UNMAPPED 0xFFFFFFFFU
+
+/**
+ * struct ubi_cp_hdr - checkpoint header.
+ * @magic: checkpoint header magic number (%UBI_CP_HDR_MAGIC)
+ * @version: checkpoint format version (%UBI_CP_FORMAT_VERSION)
+ * @padding1: reserved for future, zeroes
+ * @peb_count: count of physical eraseblocks the checkpoint describes
+ * @vol_count: count of volume records in the checkpoint
+ * @image_seq: image sequence number
+ * @padding2: reserved for future, zeroes
+ * @sqnum: highest sequence number used by the time the checkpoint was written
+ *
+ * The checkpoint is stored as the only logical eraseblock of the checkpoint
+ * volume, in one of the first %UBI_CP_MAX_START physical eraseblocks. The
+ * data CRC of its VID header protects the whole checkpoint, which consists
+ * of:
+ *   o this header;
+ *   o @peb_count big-endian 32-bit erase counters;
+ *   o @peb_count one-byte physical eraseblock states (%UBI_CP_PEB_FREE,
+ *     etc), padded with zeroes to a multiple of 4 bytes;
+ *   o @vol_count &struct ubi_cp_vol volume records, each followed by the EBA
+ *     table of the volume.
+ *
+ * Erase counters of physical eraseblocks in state %UBI_CP_PEB_SCAN are zero,
+ * they are read from the EC headers.
+ */
+struct ubi_cp_hdr {
+	__be32  magic;
+	__u8    version;
+	__u8    padding1[3];
+	__be32  peb_count;
+	__be32  vol_count;
+	__be32  image_seq;
+	__u8    padding2[4];
+	__be64  sqnum;
+} __packed;
+
+/**
+ * struct ubi_cp_vol - checkpoint volume record.
+ * @vol_id: volume ID
+ * @leb_count: count of entries in the EBA table following the record
+ * @used_ebs: total number of used logical eraseblocks in this volume
+ * @data_pad: how many bytes at the end of this physical eraseblock are not
+ *            used
+ * @last_data_size: how many bytes the last logical eraseblock of a static
+ *                  volume contains
+ * @vol_type: volume type (%UBI_VID_DYNAMIC or %UBI_VID_STATIC)
+ * @compat: compatibility of this volume (%0, %UBI_COMPAT_DELETE, etc)
+ * @padding: reserved for future, zeroes
+ *
+ * The record is followed by @leb_count big-endian 32-bit physical eraseblock
+ * numbers, %UBI_CP_UNMAPPED for unmapped logical eraseblocks.
+ */
+struct ubi_cp_vol {
+	__be32  vol_id;
+	__be32  leb_count;
+	__be32  used_ebs;
+	__be32  data_pad;
+	__be32  last_data_size;
+	__u8    vol_type;
+	__u8    compat;
+	__u8    padding[2];
+} __packed;
+
 #endif /* !__UBI_MEDIA_H__ */
@@ -38,6 +38,7 @@
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 #include <linux/notifier.h>
+#include <linux/workqueue.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/ubi.h>
 #include <asm/pgtable.h>
@@ -231,6 +232,9 @@ struct ubi_volume_desc;
  *           atomic LEB change
  *
  * @eba_tbl: EBA table of this volume (LEB->PEB mapping)
+ * @checkmap: bitmap of LEBs which were mapped according to the checkpoint and
+ *            have not been verified yet
+ * @checkmap_lebs: how many LEBs @checkmap covers
  * @checked: %1 if this static volume was checked
  * @corrupted: %1 if the volume is corrupted (static volumes only)
  * @upd_marker: %1 if the update marker is set for this volume
@@ -275,6 +279,8 @@ struct ubi_volume {
 	void *upd_buf;
 
 	int *eba_tbl;
+	unsigned long *checkmap;
+	int checkmap_lebs;
 	unsigned int checked:1;
 	unsigned int corrupted:1;
 	unsigned int upd_marker:1;
@@ -357,6 +363,24 @@ struct ubi_wl_entry;
  * @thread_enabled: if the background thread is enabled
  * @bgt_name: background thread name
  *
+ * @cp_enabled: non-zero if new PEBs are taken from the checkpoint pool
+ * @cp_pool: RB-tree of free physical eraseblocks new PEBs are taken from when
+ *           checkpoints are enabled (protected by @wl_lock)
+ * @cp_pool_max: how many physical eraseblocks the checkpoint pool is filled
+ *               with
+ * @cp_e: physical eraseblock containing the current checkpoint
+ * @cp_anchor: erased physical eraseblock reserved for the next checkpoint
+ * @cp_buf: buffer of LEB size to build and read checkpoints in
+ * @cp_mutex: serializes checkpoint writing and protects @cp_buf
+ * @cp_sem: held in read mode while a PEB taken from the checkpoint pool is not
+ *          yet mapped, and in write mode while writing a checkpoint
+ * @cp_check_mutex: serializes verification of LEB mappings which were taken
+ *                  from the checkpoint
+ * @cp_work: re-fills the checkpoint pool for the WL worker, or disables
+ *           checkpoints if @cp_invalid is set
+ * @cp_invalid: a mapping taken from the checkpoint turned out to be wrong, so
+ *              the checkpoint has to be dropped
+ *
  * @flash_size: underlying MTD device size (in bytes)
  * @peb_count: count of physical eraseblocks on the MTD device
  * @peb_size: physical eraseblock size
@@ -444,6 +468,19 @@ struct ubi_device {
 	int thread_enabled;
 	char bgt_name[sizeof(UBI_BGT_NAME_PATTERN)+2];
 
+	/* Checkpoint stuff */
+	int cp_enabled;
+	struct rb_root cp_pool;
+	int cp_pool_max;
+	struct ubi_wl_entry *cp_e;
+	struct ubi_wl_entry *cp_anchor;
+	void *cp_buf;
+	struct mutex cp_mutex;
+	struct rw_semaphore cp_sem;
+	struct mutex cp_check_mutex;
+	struct work_struct cp_work;
+	int cp_invalid;
+
 	/* I/O sub-system's stuff */
 	long long flash_size;
 	int peb_count;
@@ -515,6 +552,9 @@ void ubi_calculate_reserved(struct ubi_device *ubi);
 int ubi_check_pattern(const void *buf, uint8_t patt, int size);
 
 /* eba.c */
+unsigned long long ubi_next_sqnum(struct ubi_device *ubi);
+int ubi_eba_is_mapped(struct ubi_device *ubi, struct ubi_volume *vol,
+		      int lnum);
 int ubi_eba_unmap_leb(struct ubi_device *ubi, struct ubi_volume *vol,
 		      int lnum);
 int ubi_eba_read_leb(struct ubi_device *ubi, struct ubi_volume *vol, int lnum,
@@ -538,6 +578,25 @@ int ubi_wl_scrub_peb(struct ubi_device *ubi, int pnum);
 int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si);
 void ubi_wl_close(struct ubi_device *ubi);
 int ubi_thread(void *u);
+struct ubi_wl_entry *ubi_wl_cp_prepare(struct ubi_device *ubi, int refill);
+void ubi_wl_cp_commit(struct ubi_device *ubi, struct ubi_wl_entry *e);
+void ubi_wl_cp_disable(struct ubi_device *ubi, struct ubi_wl_entry *e);
+
+/* checkpoint.c */
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+int ubi_cp_init(struct ubi_device *ubi);
+void ubi_cp_close(struct ubi_device *ubi);
+int ubi_update_checkpoint(struct ubi_device *ubi, int refill);
+int ubi_cp_read(struct ubi_device *ubi, int pnum);
+void ubi_cp_invalidate(struct ubi_device *ubi);
+#else
+static inline int ubi_cp_init(struct ubi_device *ubi) { return 0; }
+static inline void ubi_cp_close(struct ubi_device *ubi) {}
+static inline int ubi_update_checkpoint(struct ubi_device *ubi, int refill)
+{
+	return 0;
+}
+#endif
 
 /* io.c */
 int ubi_io_read(const struct ubi_device *ubi, void *buf, int pnum, int offset,
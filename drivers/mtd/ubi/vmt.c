@@ -129,6 +129,7 @@ static void vol_release(struct device *dev)
 	struct ubi_volume *vol = container_of(dev, struct ubi_volume, dev);
 
 	kfree(vol->eba_tbl);
+	kfree(vol->checkmap);
 	kfree(vol);
 }
 
@@ -574,11 +575,17 @@ int ubi_resize_volume(struct ubi_volume_desc *desc, int reserved_pebs)
 		for (i = 0; i < reserved_pebs; i++)
 			new_mapping[i] = vol->eba_tbl[i];
 		kfree(vol->eba_tbl);
+		/* The checkpoint walks the EBA table under @volumes_lock */
 		vol->eba_tbl = new_mapping;
+		vol->reserved_pebs = reserved_pebs;
+		spin_unlock(&ubi->volumes_lock);
+	} else {
+		/* The new EBA table is longer, it was safe to install first */
+		spin_lock(&ubi->volumes_lock);
+		vol->reserved_pebs = reserved_pebs;
 		spin_unlock(&ubi->volumes_lock);
 	}
 
-	vol->reserved_pebs = reserved_pebs;
 	if (vol->vol_type == UBI_DYNAMIC_VOLUME) {
 		vol->used_ebs = reserved_pebs;
 		vol->last_eb_bytes = vol->usable_leb_size;
@@ -103,6 +103,17 @@
  * target PEB, we pick a PEB with the highest EC if our PEB is "old" and we
  * pick target PEB with an average EC if our PEB is not very "old". This is a
  * room for future re-works of the WL sub-system.
+ *
+ * When checkpoints are enabled (@ubi->cp_enabled), physical eraseblocks are
+ * not taken directly from the @wl->free tree. Instead, a limited number of
+ * free physical eraseblocks are moved to the checkpoint pool (@wl->cp_pool)
+ * when a checkpoint is written, and new eraseblocks are only taken from the
+ * pool, both by 'ubi_wl_get_peb()' and by the WL worker. This way all
+ * physical eraseblocks which may have been written to since the last
+ * checkpoint are known, and only they have to be scanned when attaching. When
+ * the pool is exhausted, a new checkpoint is written and the pool is
+ * re-filled. The checkpoint itself is kept in @wl->cp_e, which is never in
+ * any of the trees.
  */
 
 #include <linux/slab.h>
@@ -114,6 +125,12 @@
 /* Number of physical eraseblocks reserved for wear-leveling purposes */
 #define WL_RESERVED_PEBS 1
 
+/*
+ * Number of physical eraseblocks reserved for checkpoints: the current one and
+ * the one the next checkpoint is written to.
+ */
+#define CP_RESERVED_PEBS 2
+
 /*
  * Maximum difference between two erase counters. If this threshold is
  * exceeded, the WL sub-system starts moving data from used physical
@@ -141,6 +158,13 @@
  */
 #define WL_MAX_FAILURES 32
 
+/*
+ * Maximum number of pending erasures the background thread does in one go.
+ * Erasures are picked ahead of other pending works, and wear-leveling is
+ * checked once per batch instead of after every erasure.
+ */
+#define WL_ERASE_BATCH 16
+
 /**
  * struct ubi_work - UBI work description data structure.
  * @list: a link in the list of pending works
@@ -376,6 +400,18 @@ static struct ubi_wl_entry *find_wl_entry(struct rb_root *root, int max)
 	return e;
 }
 
+/**
+ * alloc_tree - get the tree new physical eraseblocks are taken from.
+ * @ubi: UBI device description object
+ *
+ * This is the checkpoint pool if checkpoints are enabled and the @ubi->free
+ * tree otherwise. Note, @ubi->wl_lock has to be locked.
+ */
+static struct rb_root *alloc_tree(struct ubi_device *ubi)
+{
+	return ubi->cp_enabled ? &ubi->cp_pool : &ubi->free;
+}
+
 /**
  * ubi_wl_get_peb - get a physical eraseblock.
  * @ubi: UBI device description object
@@ -383,29 +419,45 @@ static struct ubi_wl_entry *find_wl_entry(struct rb_root *root, int max)
  *
  * This function returns a physical eraseblock in case of success and a
  * negative error code in case of failure. Might sleep.
+ *
+ * In case of success @ubi->cp_sem is held in read mode, and the caller has to
+ * release it once the physical eraseblock is either mapped in the EBA table or
+ * returned back. This makes sure that a checkpoint is never written while a
+ * PEB taken from the checkpoint pool is not yet mapped.
  */
 int ubi_wl_get_peb(struct ubi_device *ubi, int dtype)
 {
 	int err, medium_ec;
 	struct ubi_wl_entry *e, *first, *last;
+	struct rb_root *root;
 
 	ubi_assert(dtype == UBI_LONGTERM || dtype == UBI_SHORTTERM ||
 		   dtype == UBI_UNKNOWN);
 
 retry:
+	down_read(&ubi->cp_sem);
 	spin_lock(&ubi->wl_lock);
-	if (!ubi->free.rb_node) {
-		if (ubi->works_count == 0) {
+	root = alloc_tree(ubi);
+	if (!root->rb_node) {
+		if (!ubi->free.rb_node && ubi->works_count == 0) {
 			ubi_assert(list_empty(&ubi->works));
 			ubi_err("no free eraseblocks");
 			spin_unlock(&ubi->wl_lock);
+			up_read(&ubi->cp_sem);
 			return -ENOSPC;
 		}
 		spin_unlock(&ubi->wl_lock);
+		up_read(&ubi->cp_sem);
 
 		err = produce_free_peb(ubi);
 		if (err < 0)
 			return err;
+		if (root == &ubi->cp_pool) {
+			/* The pool is exhausted, write a new checkpoint */
+			err = ubi_update_checkpoint(ubi, 1);
+			if (err < 0)
+				return err;
+		}
 		goto retry;
 	}
 
@@ -417,7 +469,7 @@ retry:
 		 * bounded by the the lowest erase counter plus
 		 * %WL_FREE_MAX_DIFF.
 		 */
-		e = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+		e = find_wl_entry(root, WL_FREE_MAX_DIFF);
 		break;
 	case UBI_UNKNOWN:
 		/*
@@ -426,16 +478,14 @@ retry:
 		 * eraseblock with erase counter greater or equivalent than the
 		 * lowest erase counter plus %WL_FREE_MAX_DIFF.
 		 */
-		first = rb_entry(rb_first(&ubi->free), struct ubi_wl_entry,
-					u.rb);
-		last = rb_entry(rb_last(&ubi->free), struct ubi_wl_entry, u.rb);
+		first = rb_entry(rb_first(root), struct ubi_wl_entry, u.rb);
+		last = rb_entry(rb_last(root), struct ubi_wl_entry, u.rb);
 
 		if (last->ec - first->ec < WL_FREE_MAX_DIFF)
-			e = rb_entry(ubi->free.rb_node,
-					struct ubi_wl_entry, u.rb);
+			e = rb_entry(root->rb_node, struct ubi_wl_entry, u.rb);
 		else {
 			medium_ec = (first->ec + WL_FREE_MAX_DIFF)/2;
-			e = find_wl_entry(&ubi->free, medium_ec);
+			e = find_wl_entry(root, medium_ec);
 		}
 		break;
 	case UBI_SHORTTERM:
@@ -443,19 +493,19 @@ retry:
 		 * For short term data we pick a physical eraseblock with the
 		 * lowest erase counter as we expect it will be erased soon.
 		 */
-		e = rb_entry(rb_first(&ubi->free), struct ubi_wl_entry, u.rb);
+		e = rb_entry(rb_first(root), struct ubi_wl_entry, u.rb);
 		break;
 	default:
 		BUG();
 	}
 
-	paranoid_check_in_wl_tree(e, &ubi->free);
+	paranoid_check_in_wl_tree(e, root);
 
 	/*
 	 * Move the physical eraseblock to the protection queue where it will
 	 * be protected from being moved for some time.
 	 */
-	rb_erase(&e->u.rb, &ubi->free);
+	rb_erase(&e->u.rb, root);
 	dbg_wl("PEB %d EC %d", e->pnum, e->ec);
 	prot_queue_add(ubi, e);
 	spin_unlock(&ubi->wl_lock);
@@ -464,6 +514,7 @@ retry:
 				   ubi->peb_size - ubi->vid_hdr_aloffset);
 	if (err) {
 		ubi_err("new PEB %d does not contain all 0xFF bytes", e->pnum);
+		up_read(&ubi->cp_sem);
 		return err;
 	}
 
@@ -667,6 +718,7 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 	int vol_id = -1, uninitialized_var(lnum);
 	struct ubi_wl_entry *e1, *e2;
 	struct ubi_vid_hdr *vid_hdr;
+	struct rb_root *root;
 
 	kfree(wrk);
 	if (cancel)
@@ -681,12 +733,15 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 	ubi_assert(!ubi->move_from && !ubi->move_to);
 	ubi_assert(!ubi->move_to_put);
 
-	if (!ubi->free.rb_node ||
+	root = alloc_tree(ubi);
+	if (!root->rb_node ||
 	    (!ubi->used.rb_node && !ubi->scrub.rb_node)) {
 		/*
 		 * No free physical eraseblocks? Well, they must be waiting in
 		 * the queue to be erased. Cancel movement - it will be
 		 * triggered again when a free physical eraseblock appears.
+		 * If it is the checkpoint pool which is empty, it is re-filled
+		 * in process context, which triggers wear-leveling again.
 		 *
 		 * No used physical eraseblocks? They must be temporarily
 		 * protected from being moved. They will be moved to the
@@ -694,7 +749,9 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		 * triggered again.
 		 */
 		dbg_wl("cancel WL, a list is empty: free %d, used %d",
-		       !ubi->free.rb_node, !ubi->used.rb_node);
+		       !root->rb_node, !ubi->used.rb_node);
+		if (!root->rb_node && root == &ubi->cp_pool)
+			schedule_work(&ubi->cp_work);
 		goto out_cancel;
 	}
 
@@ -705,7 +762,7 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		 * counters differ much enough, start wear-leveling.
 		 */
 		e1 = rb_entry(rb_first(&ubi->used), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+		e2 = find_wl_entry(root, WL_FREE_MAX_DIFF);
 
 		if (!(e2->ec - e1->ec >= UBI_WL_THRESHOLD)) {
 			dbg_wl("no WL needed: min used EC %d, max free EC %d",
@@ -720,14 +777,14 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		/* Perform scrubbing */
 		scrubbing = 1;
 		e1 = rb_entry(rb_first(&ubi->scrub), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+		e2 = find_wl_entry(root, WL_FREE_MAX_DIFF);
 		paranoid_check_in_wl_tree(e1, &ubi->scrub);
 		rb_erase(&e1->u.rb, &ubi->scrub);
 		dbg_wl("scrub PEB %d to PEB %d", e1->pnum, e2->pnum);
 	}
 
-	paranoid_check_in_wl_tree(e2, &ubi->free);
-	rb_erase(&e2->u.rb, &ubi->free);
+	paranoid_check_in_wl_tree(e2, root);
+	rb_erase(&e2->u.rb, root);
 	ubi->move_from = e1;
 	ubi->move_to = e2;
 	spin_unlock(&ubi->wl_lock);
@@ -947,6 +1004,7 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 	struct ubi_wl_entry *e1;
 	struct ubi_wl_entry *e2;
 	struct ubi_work *wrk;
+	struct rb_root *root;
 
 	spin_lock(&ubi->wl_lock);
 	if (ubi->wl_scheduled)
@@ -958,7 +1016,8 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 	 * the WL worker has to be scheduled anyway.
 	 */
 	if (!ubi->scrub.rb_node) {
-		if (!ubi->used.rb_node || !ubi->free.rb_node)
+		root = alloc_tree(ubi);
+		if (!ubi->used.rb_node || !root->rb_node)
 			/* No physical eraseblocks - no deal */
 			goto out_unlock;
 
@@ -969,7 +1028,7 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 		 * %UBI_WL_THRESHOLD.
 		 */
 		e1 = rb_entry(rb_first(&ubi->used), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+		e2 = find_wl_entry(root, WL_FREE_MAX_DIFF);
 
 		if (!(e2->ec - e1->ec >= UBI_WL_THRESHOLD))
 			goto out_unlock;
@@ -999,29 +1058,22 @@ out_unlock:
 }
 
 /**
- * erase_worker - physical eraseblock erase worker function.
+ * erase_one - erase the physical eraseblock of an erase work.
  * @ubi: UBI device description object
  * @wl_wrk: the work object
- * @cancel: non-zero if the worker has to free memory and exit
  *
  * This function erases a physical eraseblock and perform torture testing if
  * needed. It also takes care about marking the physical eraseblock bad if
- * needed. Returns zero in case of success and a negative error code in case of
+ * needed. Unlike 'erase_worker()', it does not check whether wear-leveling is
+ * needed afterwards, which is left to the caller. The work object is freed.
+ * Returns zero in case of success and a negative error code in case of
  * failure.
  */
-static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
-			int cancel)
+static int erase_one(struct ubi_device *ubi, struct ubi_work *wl_wrk)
 {
 	struct ubi_wl_entry *e = wl_wrk->e;
 	int pnum = e->pnum, err, need;
 
-	if (cancel) {
-		dbg_wl("cancel erasure of PEB %d EC %d", pnum, e->ec);
-		kfree(wl_wrk);
-		kmem_cache_free(ubi_wl_entry_slab, e);
-		return 0;
-	}
-
 	dbg_wl("erase PEB %d EC %d", pnum, e->ec);
 
 	err = sync_erase(ubi, e, wl_wrk->torture);
@@ -1038,15 +1090,11 @@ static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
 		 * protected physical eraseblocks.
 		 */
 		serve_prot_queue(ubi);
-
-		/* And take care about wear-leveling */
-		err = ensure_wear_leveling(ubi);
-		return err;
+		return 0;
 	}
 
 	ubi_err("failed to erase PEB %d, error %d", pnum, err);
 	kfree(wl_wrk);
-	kmem_cache_free(ubi_wl_entry_slab, e);
 
 	if (err == -EINTR || err == -ENOMEM || err == -EAGAIN ||
 	    err == -EBUSY) {
@@ -1059,7 +1107,15 @@ static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
 			goto out_ro;
 		}
 		return err;
-	} else if (err != -EIO) {
+	}
+
+	/* Do not leave a dangling pointer in the lookup table */
+	spin_lock(&ubi->wl_lock);
+	ubi->lookuptbl[pnum] = NULL;
+	spin_unlock(&ubi->wl_lock);
+	kmem_cache_free(ubi_wl_entry_slab, e);
+
+	if (err != -EIO) {
 		/*
 		 * If this is not %-EIO, we have no idea what to do. Scheduling
 		 * this physical eraseblock for erasure again would cause
@@ -1116,6 +1172,38 @@ out_ro:
 	return err;
 }
 
+/**
+ * erase_worker - physical eraseblock erase worker function.
+ * @ubi: UBI device description object
+ * @wl_wrk: the work object
+ * @cancel: non-zero if the worker has to free memory and exit
+ *
+ * This function erases a physical eraseblock by means of 'erase_one()' and
+ * then takes care about wear-leveling. Returns zero in case of success and a
+ * negative error code in case of failure.
+ */
+static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
+			int cancel)
+{
+	int err;
+
+	if (cancel) {
+		struct ubi_wl_entry *e = wl_wrk->e;
+
+		dbg_wl("cancel erasure of PEB %d EC %d", e->pnum, e->ec);
+		kfree(wl_wrk);
+		kmem_cache_free(ubi_wl_entry_slab, e);
+		return 0;
+	}
+
+	err = erase_one(ubi, wl_wrk);
+	if (err)
+		return err;
+
+	/* And take care about wear-leveling */
+	return ensure_wear_leveling(ubi);
+}
+
 /**
  * ubi_wl_put_peb - return a PEB to the wear-leveling sub-system.
  * @ubi: UBI device description object
@@ -1309,6 +1397,160 @@ int ubi_wl_flush(struct ubi_device *ubi)
 	return 0;
 }
 
+#ifdef CONFIG_MTD_UBI_CHECKPOINT
+
+/**
+ * ubi_wl_cp_prepare - prepare the WL sub-system for writing a checkpoint.
+ * @ubi: UBI device description object
+ * @refill: whether the checkpoint pool has to be re-filled
+ *
+ * This function returns the physical eraseblocks left in the checkpoint pool
+ * to the @ubi->free tree, picks the physical eraseblock to write the new
+ * checkpoint to and, if @refill is not zero, fills the pool again. Returns the
+ * picked physical eraseblock, which is not in any tree, or %NULL if there is
+ * no suitable one. Note, @ubi->cp_sem has to be locked in write mode, so that
+ * nobody uses the pool until the checkpoint is written.
+ */
+struct ubi_wl_entry *ubi_wl_cp_prepare(struct ubi_device *ubi, int refill)
+{
+	int i;
+	struct rb_node *rb;
+	struct ubi_wl_entry *e, *anchor = NULL;
+
+	spin_lock(&ubi->wl_lock);
+	while ((rb = rb_first(&ubi->cp_pool))) {
+		e = rb_entry(rb, struct ubi_wl_entry, u.rb);
+		rb_erase(rb, &ubi->cp_pool);
+		wl_tree_add(e, &ubi->free);
+	}
+
+	/*
+	 * The checkpoint has to be in one of the first %UBI_CP_MAX_START PEBs.
+	 * To spread the wear, use the least worn out free one of them, unless
+	 * the reserved @ubi->cp_anchor is not more worn out, or unless there
+	 * would be nothing left for the pool then.
+	 */
+	ubi_rb_for_each_entry(rb, e, &ubi->free, u.rb)
+		if (e->pnum < UBI_CP_MAX_START) {
+			anchor = e;
+			break;
+		}
+
+	if (anchor && ubi->cp_anchor &&
+	    (ubi->cp_anchor->ec <= anchor->ec ||
+	     (!ubi->free.rb_node->rb_left && !ubi->free.rb_node->rb_right)))
+		anchor = NULL;
+
+	if (anchor)
+		rb_erase(&anchor->u.rb, &ubi->free);
+	else {
+		anchor = ubi->cp_anchor;
+		ubi->cp_anchor = NULL;
+	}
+
+	/*
+	 * Take PEBs with low and high erase counters by turn, so that
+	 * 'ubi_wl_get_peb()' still has a choice for different data types.
+	 */
+	for (i = 0; refill && i < ubi->cp_pool_max && ubi->free.rb_node; i++) {
+		if (i & 1)
+			e = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+		else
+			e = rb_entry(rb_first(&ubi->free), struct ubi_wl_entry,
+				     u.rb);
+		rb_erase(&e->u.rb, &ubi->free);
+		wl_tree_add(e, &ubi->cp_pool);
+	}
+	spin_unlock(&ubi->wl_lock);
+
+	if (anchor)
+		dbg_wl("checkpoint PEB %d EC %d, %d PEBs in the pool",
+		       anchor->pnum, anchor->ec, i);
+	return anchor;
+}
+
+/**
+ * ubi_wl_cp_commit - switch to a newly written checkpoint.
+ * @ubi: UBI device description object
+ * @e: the physical eraseblock the checkpoint was written to
+ *
+ * This function makes @e the current checkpoint and erases the previous one
+ * synchronously, so that a stale checkpoint is never left on the flash. Then
+ * the checkpoint pool may be used. Note, @ubi->cp_sem has to be locked in
+ * write mode.
+ */
+void ubi_wl_cp_commit(struct ubi_device *ubi, struct ubi_wl_entry *e)
+{
+	struct ubi_wl_entry *old;
+
+	spin_lock(&ubi->wl_lock);
+	old = ubi->cp_e;
+	ubi->cp_e = e;
+	ubi->cp_enabled = 1;
+	spin_unlock(&ubi->wl_lock);
+
+	if (old) {
+		if (sync_erase(ubi, old, 0)) {
+			/* Let the WL worker torture it and mark it bad */
+			ubi_err("cannot erase old checkpoint PEB %d",
+				old->pnum);
+			if (schedule_erase(ubi, old, 1))
+				ubi_ro_mode(ubi);
+		} else {
+			spin_lock(&ubi->wl_lock);
+			if (!ubi->cp_anchor)
+				ubi->cp_anchor = old;
+			else
+				wl_tree_add(old, &ubi->free);
+			spin_unlock(&ubi->wl_lock);
+		}
+	}
+
+	ensure_wear_leveling(ubi);
+}
+
+#endif /* CONFIG_MTD_UBI_CHECKPOINT */
+
+/**
+ * ubi_wl_cp_disable - stop using checkpoints.
+ * @ubi: UBI device description object
+ * @e: physical eraseblock a checkpoint failed to be written to, or %NULL
+ *
+ * This function is called when a checkpoint cannot be written. The current
+ * checkpoint does not describe the physical eraseblocks which are going to be
+ * used from now on, so it is erased synchronously, and new physical
+ * eraseblocks are taken from the @ubi->free tree again. Note, @ubi->cp_sem
+ * has to be locked in write mode.
+ */
+void ubi_wl_cp_disable(struct ubi_device *ubi, struct ubi_wl_entry *e)
+{
+	struct rb_node *rb;
+	struct ubi_wl_entry *e1;
+
+	if (ubi->cp_e && sync_erase(ubi, ubi->cp_e, 0)) {
+		ubi_err("cannot erase checkpoint PEB %d", ubi->cp_e->pnum);
+		ubi_ro_mode(ubi);
+		return;
+	}
+
+	spin_lock(&ubi->wl_lock);
+	ubi->cp_enabled = 0;
+	while ((rb = rb_first(&ubi->cp_pool))) {
+		e1 = rb_entry(rb, struct ubi_wl_entry, u.rb);
+		rb_erase(rb, &ubi->cp_pool);
+		wl_tree_add(e1, &ubi->free);
+	}
+	if (ubi->cp_e)
+		wl_tree_add(ubi->cp_e, &ubi->free);
+	if (ubi->cp_anchor)
+		wl_tree_add(ubi->cp_anchor, &ubi->free);
+	ubi->cp_e = ubi->cp_anchor = NULL;
+	spin_unlock(&ubi->wl_lock);
+
+	if (e && schedule_erase(ubi, e, 1))
+		ubi_ro_mode(ubi);
+}
+
 /**
  * tree_destroy - destroy an RB-tree.
  * @root: the root of the tree to destroy
@@ -1340,6 +1582,71 @@ static void tree_destroy(struct rb_root *root)
 	}
 }
 
+/**
+ * do_works - do pending works, batching erasures.
+ * @ubi: UBI device description object
+ *
+ * If the first pending work is an erasure, this function takes up to
+ * %WL_ERASE_BATCH pending erasures off the queue and does them one after
+ * the other, then checks whether wear-leveling is needed. Otherwise it does
+ * one work like 'do_work()'. If an erasure fails, the rest of the batch is put
+ * back to the head of the queue. Returns zero in case of success and a
+ * negative error code in case of failure, which the caller reports.
+ */
+static int do_works(struct ubi_device *ubi)
+{
+	int err = 0, count = 0, done = 0;
+	struct ubi_work *wrk, *tmp;
+	LIST_HEAD(batch);
+
+	cond_resched();
+
+	down_read(&ubi->work_sem);
+	spin_lock(&ubi->wl_lock);
+	if (list_empty(&ubi->works) ||
+	    list_entry(ubi->works.next, struct ubi_work, list)->func !=
+							erase_worker) {
+		spin_unlock(&ubi->wl_lock);
+		up_read(&ubi->work_sem);
+		return do_work(ubi);
+	}
+
+	list_for_each_entry_safe(wrk, tmp, &ubi->works, list) {
+		if (wrk->func != erase_worker)
+			continue;
+		list_move_tail(&wrk->list, &batch);
+		ubi->works_count -= 1;
+		if (++count == WL_ERASE_BATCH)
+			break;
+	}
+	ubi_assert(ubi->works_count >= 0);
+	spin_unlock(&ubi->wl_lock);
+
+	list_for_each_entry_safe(wrk, tmp, &batch, list) {
+		list_del(&wrk->list);
+		err = erase_one(ubi, wrk);
+		if (err)
+			break;
+		done += 1;
+		cond_resched();
+	}
+
+	if (!list_empty(&batch)) {
+		spin_lock(&ubi->wl_lock);
+		list_for_each_entry(wrk, &batch, list)
+			ubi->works_count += 1;
+		list_splice(&batch, &ubi->works);
+		spin_unlock(&ubi->wl_lock);
+	}
+
+	dbg_wl("erased %d of %d PEBs in one batch", done, count);
+	if (!err)
+		err = ensure_wear_leveling(ubi);
+	up_read(&ubi->work_sem);
+
+	return err;
+}
+
 /**
  * ubi_thread - UBI background thread.
  * @u: the UBI device description object pointer
@@ -1372,7 +1679,7 @@ int ubi_thread(void *u)
 		}
 		spin_unlock(&ubi->wl_lock);
 
-		err = do_work(ubi);
+		err = do_works(ubi);
 		if (err) {
 			ubi_err("%s: work failed with error code %d",
 				ubi->bgt_name, err);
@@ -1431,9 +1738,11 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 	struct ubi_wl_entry *e;
 
 	ubi->used = ubi->erroneous = ubi->free = ubi->scrub = RB_ROOT;
+	ubi->cp_pool = RB_ROOT;
 	spin_lock_init(&ubi->wl_lock);
 	mutex_init(&ubi->move_mutex);
 	init_rwsem(&ubi->work_sem);
+	init_rwsem(&ubi->cp_sem);
 	ubi->max_ec = si->max_ec;
 	INIT_LIST_HEAD(&ubi->works);
 
@@ -1512,6 +1821,34 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 	ubi->avail_pebs -= WL_RESERVED_PEBS;
 	ubi->rsvd_pebs += WL_RESERVED_PEBS;
 
+	if (si->cp_pnum >= 0) {
+		/* The checkpoint we attached from stays until the next one */
+		e = kmem_cache_alloc(ubi_wl_entry_slab, GFP_KERNEL);
+		if (!e)
+			goto out_free;
+
+		e->pnum = si->cp_pnum;
+		e->ec = si->cp_ec;
+		ubi->lookuptbl[e->pnum] = e;
+		ubi->cp_e = e;
+	}
+
+	if (ubi->cp_buf) {
+		if (ubi->avail_pebs < CP_RESERVED_PEBS) {
+			ubi_warn("no enough physical eraseblocks for "
+				 "checkpoints, disable them");
+			ubi_wl_cp_disable(ubi, NULL);
+		} else {
+			ubi->avail_pebs -= CP_RESERVED_PEBS;
+			ubi->rsvd_pebs += CP_RESERVED_PEBS;
+			/*
+			 * The pool is empty, so the first write triggers a
+			 * new checkpoint before anything is written.
+			 */
+			ubi->cp_enabled = 1;
+		}
+	}
+
 	/* Schedule wear-leveling if needed */
 	err = ensure_wear_leveling(ubi);
 	if (err)
@@ -1524,6 +1861,11 @@ out_free:
 	tree_destroy(&ubi->used);
 	tree_destroy(&ubi->free);
 	tree_destroy(&ubi->scrub);
+	tree_destroy(&ubi->cp_pool);
+	if (ubi->cp_e)
+		kmem_cache_free(ubi_wl_entry_slab, ubi->cp_e);
+	ubi->cp_e = NULL;
+	ubi->cp_enabled = 0;
 	kfree(ubi->lookuptbl);
 	return err;
 }
@@ -1558,6 +1900,13 @@ void ubi_wl_close(struct ubi_device *ubi)
 	tree_destroy(&ubi->erroneous);
 	tree_destroy(&ubi->free);
 	tree_destroy(&ubi->scrub);
+	tree_destroy(&ubi->cp_pool);
+	if (ubi->cp_e)
+		kmem_cache_free(ubi_wl_entry_slab, ubi->cp_e);
+	if (ubi->cp_anchor)
+		kmem_cache_free(ubi_wl_entry_slab, ubi->cp_anchor);
+	ubi->cp_e = ubi->cp_anchor = NULL;
+	ubi->cp_enabled = 0;
 	kfree(ubi->lookuptbl);
 }
 
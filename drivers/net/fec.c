@@ -36,6 +36,7 @@
 #include <linux/netdevice.h>
 #include <linux/etherdevice.h>
 #include <linux/skbuff.h>
+#include <linux/ip.h>
 #include <linux/spinlock.h>
 #include <linux/workqueue.h>
 #include <linux/bitops.h>
@@ -46,6 +47,7 @@
 #include <linux/platform_device.h>
 #include <linux/phy.h>
 #include <linux/fec.h>
+#include <linux/hrtimer.h>
 
 #include <asm/cacheflush.h>
 
@@ -93,6 +95,17 @@ static unsigned char macaddr[ETH_ALEN];
 module_param_array(macaddr, byte, NULL, 0);
 MODULE_PARM_DESC(macaddr, "FEC Ethernet MAC address");
 
+/* Budget handed to the NAPI poll routine on every invocation */
+#define FEC_NAPI_WEIGHT		64
+static int napi_weight = FEC_NAPI_WEIGHT;
+module_param(napi_weight, int, 0444);
+MODULE_PARM_DESC(napi_weight, "FEC NAPI poll budget (packets per poll)");
+
+static int rx_page_recycle;
+module_param(rx_page_recycle, bool, 0644);
+MODULE_PARM_DESC(rx_page_recycle,
+	"Receive into recycled pages and pass frames up as page fragments");
+
 #if defined(CONFIG_M5272)
 /*
  * Some hardware gets it MAC address out of local flash memory.
@@ -125,12 +138,30 @@ MODULE_PARM_DESC(macaddr, "FEC Ethernet MAC address");
 #define RX_RING_SIZE		(FEC_ENET_RX_FRPPG * FEC_ENET_RX_PAGES)
 #define FEC_ENET_TX_FRSIZE	2048
 #define FEC_ENET_TX_FRPPG	(PAGE_SIZE / FEC_ENET_TX_FRSIZE)
-#define TX_RING_SIZE		16	/* Must be power of two */
-#define TX_RING_MOD_MASK	15	/*   for this to work */
+#define TX_RING_SIZE		16	/* Default, ethtool -G changes it */
 
-#if (((RX_RING_SIZE + TX_RING_SIZE) * 8) > PAGE_SIZE)
-#error "FEC: descriptor ring size constants too large"
-#endif
+/*
+ * The TX ring is sized at open time.  Descriptor memory is reserved for
+ * the largest ring up front.  Scatter-gather capable controllers need
+ * room for a maximally fragmented skb twice over, so they get a bigger
+ * default and minimum ring.
+ */
+#define FEC_TX_RING_MIN		8
+#define FEC_TX_RING_MAX		256
+#define FEC_TX_RING_SG		64
+#define FEC_TX_RING_MIN_SG	(2 * (MAX_SKB_FRAGS + 1))
+#define FEC_BD_AREA_SIZE	\
+	PAGE_ALIGN((RX_RING_SIZE + FEC_TX_RING_MAX) * sizeof(struct bufdesc))
+
+/*
+ * In page recycling mode only the first FEC_RX_HDR_LEN bytes of a frame
+ * are copied into the skb, the rest is attached as a page fragment.
+ * Frames up to that size are copied whole and the buffer stays on the
+ * ring.  FEC_RX_POOL_SIZE pages that are still held by the stack are
+ * remembered so they can be reused once the stack lets go of them.
+ */
+#define FEC_RX_HDR_LEN		128
+#define FEC_RX_POOL_SIZE	RX_RING_SIZE
 
 /* Interrupt events/masks. */
 #define FEC_ENET_HBERR	((uint)0x80000000)	/* Heartbeat error */
@@ -156,6 +187,15 @@ MODULE_PARM_DESC(macaddr, "FEC Ethernet MAC address");
 #define FEC_DEFAULT_IMASK (FEC_ENET_TXF | FEC_ENET_RXF | FEC_ENET_MII)
 #endif
 
+/* Events handled from the NAPI poll routine rather than the irq handler */
+#define FEC_NAPI_IMASK	(FEC_ENET_TXF | FEC_ENET_RXF)
+
+/*
+ * Upper bound for the software interrupt holdoff set through
+ * ethtool -C rx-usecs/tx-usecs.
+ */
+#define FEC_MAX_COALESCE_USECS	1000
+
 /* The FEC stores dest/src/type, data, and checksum for receive packets.
  */
 #define PKT_MAXBUF_SIZE		1518
@@ -177,13 +217,24 @@ MODULE_PARM_DESC(macaddr, "FEC Ethernet MAC address");
 #define	OPT_FRAME_SIZE	0
 #endif
 
+/* A receive buffer in page recycling mode: one FEC_ENET_RX_FRSIZE slot
+ * of a page that stays DMA mapped for as long as the driver owns it.
+ */
+struct fec_rx_page {
+	struct page	*page;
+	dma_addr_t	dma;
+	unsigned int	offset;
+};
+
 /* The FEC buffer descriptors track the ring buffers.  The rx_bd_base and
  * tx_bd_base always point to the base of the buffer descriptors.  The
  * cur_rx and cur_tx point to the currently available buffer.
  * The dirty_tx tracks the current buffer that is being sent by the
  * controller.  The cur_tx and dirty_tx are equal under both completely
- * empty and completely full conditions.  The empty/ready indicator in
- * the buffer descriptor determines the actual condition.
+ * empty and completely full conditions; tx_used counts the descriptors
+ * handed to the controller and tells them apart.  A scatter-gather
+ * frame takes one descriptor per fragment, its skb is stored with the
+ * last one.
  */
 struct fec_enet_private {
 	/* Hardware registers of the FEC device */
@@ -194,11 +245,9 @@ struct fec_enet_private {
 	struct clk *clk;
 
 	/* The saved address of a sent-in-place packet/buffer, for skfree(). */
-	unsigned char *tx_bounce[TX_RING_SIZE];
-	struct	sk_buff* tx_skbuff[TX_RING_SIZE];
+	unsigned char *tx_bounce[FEC_TX_RING_MAX];
+	struct	sk_buff* tx_skbuff[FEC_TX_RING_MAX];
 	struct	sk_buff* rx_skbuff[RX_RING_SIZE];
-	ushort	skb_cur;
-	ushort	skb_dirty;
 
 	/* CPM dual port RAM relative addresses */
 	dma_addr_t	bd_dma;
@@ -210,7 +259,8 @@ struct fec_enet_private {
 	/* The ring entries to be free()ed */
 	struct bufdesc	*dirty_tx;
 
-	uint	tx_full;
+	uint	tx_used;
+	uint	tx_ring_size;
 	/* hold while accessing the HW like ringbuffer for tx/rx but not MAC */
 	spinlock_t hw_lock;
 
@@ -231,11 +281,27 @@ struct fec_enet_private {
 
 	struct  fec_ptp_private *ptp_priv;
 	uint    ptimer_present;
+
+	struct	napi_struct napi;
+	/*
+	 * Interrupt coalescing: after a poll that did some work, the rx/tx
+	 * interrupts stay masked for this many microseconds and the ring is
+	 * polled again from coalesce_timer instead.
+	 */
+	uint	rx_coalesce_usecs;
+	uint	tx_coalesce_usecs;
+	struct	hrtimer coalesce_timer;
+
+	/* Page recycling receive mode, latched from rx_page_recycle */
+	int	rx_page_mode;
+	struct	fec_rx_page rx_page[RX_RING_SIZE];
+	struct	fec_rx_page rx_pool[FEC_RX_POOL_SIZE];
+	int	rx_pool_count;
 };
 
 static irqreturn_t fec_enet_interrupt(int irq, void * dev_id);
-static void fec_enet_tx(struct net_device *dev);
-static void fec_enet_rx(struct net_device *dev);
+static int fec_enet_tx(struct net_device *dev);
+static int fec_enet_rx(struct net_device *dev, int budget);
 static int fec_enet_close(struct net_device *dev);
 static void fec_restart(struct net_device *dev, int duplex);
 static void fec_stop(struct net_device *dev);
@@ -265,108 +331,170 @@ static void *swap_buffer(void *bufaddr, int len)
 	return bufaddr;
 }
 
+/*
+ * The controller inserts the IP header and protocol checksums itself,
+ * but only into checksum fields that have been cleared.
+ */
+static int
+fec_enet_clear_csum(struct sk_buff *skb, struct net_device *ndev)
+{
+	if (skb->ip_summed != CHECKSUM_PARTIAL)
+		return 0;
+
+	if (unlikely(skb_cow_head(skb, 0)))
+		return -1;
+
+	if (skb->protocol == htons(ETH_P_IP))
+		ip_hdr(skb)->check = 0;
+	*(__sum16 *)(skb->head + skb->csum_start + skb->csum_offset) = 0;
+
+	return 0;
+}
+
+/* Descriptors a frame must find free before the queue is restarted */
+static inline unsigned int fec_enet_tx_stop_thresh(struct net_device *ndev)
+{
+	return (ndev->features & NETIF_F_SG) ? MAX_SKB_FRAGS + 1 : 1;
+}
+
 static netdev_tx_t
 fec_enet_start_xmit(struct sk_buff *skb, struct net_device *ndev)
 {
 	struct fec_enet_private *fep = netdev_priv(ndev);
 	const struct platform_device_id *id_entry =
 				platform_get_device_id(fep->pdev);
-	struct bufdesc *bdp;
+	struct bufdesc *bdp, *bdp_first;
 	void *bufaddr;
-	unsigned short	status;
-	unsigned long   estatus;
+	unsigned short	status, status_first = 0, status_ptp = 0;
+	unsigned long   estatus = 0;
 	unsigned long flags;
+	unsigned int nr_frags = skb_shinfo(skb)->nr_frags;
+	unsigned int index, len, i;
+	skb_frag_t *frag;
 
 	if (!fep->link) {
 		/* Link is down or autonegotiation is in progress. */
 		return NETDEV_TX_BUSY;
 	}
 
+	if (fec_enet_clear_csum(skb, ndev)) {
+		ndev->stats.tx_dropped++;
+		dev_kfree_skb_any(skb);
+		return NETDEV_TX_OK;
+	}
+
 	spin_lock_irqsave(&fep->hw_lock, flags);
 	/* Fill in a Tx ring entry */
-	bdp = fep->cur_tx;
-
-	status = bdp->cbd_sc;
+	bdp_first = bdp = fep->cur_tx;
 
-	if (status & BD_ENET_TX_READY) {
+	if (fep->tx_ring_size - fep->tx_used < nr_frags + 1) {
 		/* Ooops.  All transmit buffers are full.  Bail out.
 		 * This should not happen, since ndev->tbusy should be set.
 		 */
 		printk("%s: tx queue full!.\n", ndev->name);
+		netif_stop_queue(ndev);
 		spin_unlock_irqrestore(&fep->hw_lock, flags);
 		return NETDEV_TX_BUSY;
 	}
 
-	/* Clear all of the status flags */
-	status &= ~BD_ENET_TX_STATS;
-
-	/* Set buffer length and buffer pointer */
-	bufaddr = skb->data;
-	bdp->cbd_datlen = skb->len;
+	if (fep->ptimer_present && fec_ptp_do_txstamp(skb)) {
+		estatus = BD_ENET_TX_TS;
+		status_ptp = BD_ENET_TX_PTP;
+	}
+#ifdef CONFIG_ENHANCED_BD
+	if (skb->ip_summed == CHECKSUM_PARTIAL)
+		estatus |= BD_ENET_TX_PINS | BD_ENET_TX_IINS;
+#endif
 
-	/*
-	 * On some FEC implementations data must be aligned on
-	 * 4-byte boundaries. Use bounce buffers to copy data
-	 * and get it aligned. Ugh.
-	 */
-	if (((unsigned long) bufaddr) & FEC_ALIGNMENT) {
-		unsigned int index;
+	for (i = 0; i <= nr_frags; i++) {
 		index = bdp - fep->tx_bd_base;
-		memcpy(fep->tx_bounce[index], (void *)skb->data, skb->len);
-		bufaddr = fep->tx_bounce[index];
-	}
 
-	if (fep->ptimer_present) {
-		if (fec_ptp_do_txstamp(skb)) {
-			estatus = BD_ENET_TX_TS;
-			status |= BD_ENET_TX_PTP;
-		} else
-			estatus = 0;
+		if (i == 0) {
+			bufaddr = skb->data;
+			len = skb_headlen(skb);
+		} else {
+			frag = &skb_shinfo(skb)->frags[i - 1];
+			bufaddr = page_address(frag->page) + frag->page_offset;
+			len = frag->size;
+		}
+
+		/*
+		 * On some FEC implementations data must be aligned on
+		 * 4-byte boundaries. Use bounce buffers to copy data
+		 * and get it aligned. Ugh.  Fragments are not ours to
+		 * byte-swap either, so they always bounce on those parts.
+		 */
+		if ((((unsigned long) bufaddr) & FEC_ALIGNMENT) ||
+		    (i && (id_entry->driver_data & FEC_QUIRK_SWAP_FRAME))) {
+			memcpy(fep->tx_bounce[index], bufaddr, len);
+			bufaddr = fep->tx_bounce[index];
+		}
+
+		/*
+		 * Some design made an incorrect assumption on endian mode of
+		 * the system that it's running on. As the result, driver has
+		 * to swap every frame going to and coming from the controller.
+		 */
+		if (id_entry->driver_data & FEC_QUIRK_SWAP_FRAME)
+			swap_buffer(bufaddr, len);
+
+		/* Clear all of the status flags */
+		status = (bdp->cbd_sc & ~BD_ENET_TX_STATS) | status_ptp;
+
+		/* Set buffer length and buffer pointer */
+		bdp->cbd_datlen = len;
+
+		/* Push the data cache so the CPM does not get stale memory
+		 * data.
+		 */
+		bdp->cbd_bufaddr = dma_map_single(&fep->pdev->dev, bufaddr,
+				len, DMA_TO_DEVICE);
+
 #ifdef CONFIG_ENHANCED_BD
-		bdp->cbd_esc = (estatus | BD_ENET_TX_INT);
+		bdp->cbd_esc = estatus | BD_ENET_TX_INT;
 		bdp->cbd_bdu = 0;
 #endif
-	}
-	/*
-	 * Some design made an incorrect assumption on endian mode of
-	 * the system that it's running on. As the result, driver has to
-	 * swap every frame going to and coming from the controller.
-	 */
-	if (id_entry->driver_data & FEC_QUIRK_SWAP_FRAME)
-		swap_buffer(bufaddr, skb->len);
 
-	/* Save skb pointer */
-	fep->tx_skbuff[fep->skb_cur] = skb;
+		/* Every descriptor carries the CRC flag, the last one also
+		 * asks for an interrupt and closes the frame.
+		 */
+		status |= BD_ENET_TX_TC;
+		if (i == nr_frags) {
+			status |= BD_ENET_TX_INTR | BD_ENET_TX_LAST;
+			fep->tx_skbuff[index] = skb;
+		} else {
+			fep->tx_skbuff[index] = NULL;
+		}
 
-	ndev->stats.tx_bytes += skb->len;
-	fep->skb_cur = (fep->skb_cur+1) & TX_RING_MOD_MASK;
+		/* The first descriptor is handed over once the rest of the
+		 * frame is in place.
+		 */
+		if (i == 0)
+			status_first = status;
+		else
+			bdp->cbd_sc = status | BD_ENET_TX_READY;
 
-	/* Push the data cache so the CPM does not get stale memory
-	 * data.
-	 */
-	bdp->cbd_bufaddr = dma_map_single(&fep->pdev->dev, bufaddr,
-			FEC_ENET_TX_FRSIZE, DMA_TO_DEVICE);
+		/* If this was the last BD in the ring, start at the beginning
+		 * again.
+		 */
+		if (status & BD_ENET_TX_WRAP)
+			bdp = fep->tx_bd_base;
+		else
+			bdp++;
+	}
 
-	/* Send it on its way.  Tell FEC it's ready, interrupt when done,
-	 * it's the last BD of the frame, and to put the CRC on the end.
-	 */
-	status |= (BD_ENET_TX_READY | BD_ENET_TX_INTR
-			| BD_ENET_TX_LAST | BD_ENET_TX_TC);
-	bdp->cbd_sc = status;
+	ndev->stats.tx_bytes += skb->len;
+	fep->tx_used += nr_frags + 1;
+
+	/* Send it on its way.  Tell FEC it's ready. */
+	wmb();
+	bdp_first->cbd_sc = status_first | BD_ENET_TX_READY;
 
 	/* Trigger transmission start */
 	writel(0, fep->hwp + FEC_X_DES_ACTIVE);
 
-	/* If this was the last BD in the ring, start at the beginning again. */
-	if (status & BD_ENET_TX_WRAP)
-		bdp = fep->tx_bd_base;
-	else
-		bdp++;
-
-	if (bdp == fep->dirty_tx) {
-		fep->tx_full = 1;
+	if (fep->tx_ring_size - fep->tx_used < fec_enet_tx_stop_thresh(ndev))
 		netif_stop_queue(ndev);
-	}
 
 	fep->cur_tx = bdp;
 
@@ -386,7 +514,7 @@ fec_timeout(struct net_device *ndev)
 	netif_wake_queue(ndev);
 }
 
-static void
+static int
 fec_enet_tx(struct net_device *ndev)
 {
 	struct	fec_enet_private *fep;
@@ -394,22 +522,29 @@ fec_enet_tx(struct net_device *ndev)
 	struct bufdesc *bdp;
 	unsigned short status;
 	struct	sk_buff	*skb;
+	int	reclaimed = 0;
+	unsigned int index;
 
 	fep = netdev_priv(ndev);
 	fpp = fep->ptp_priv;
 	spin_lock(&fep->hw_lock);
 	bdp = fep->dirty_tx;
 
-	while (((status = bdp->cbd_sc) & BD_ENET_TX_READY) == 0) {
-		if (bdp == fep->cur_tx && fep->tx_full == 0)
-			break;
+	while (fep->tx_used &&
+	       ((status = bdp->cbd_sc) & BD_ENET_TX_READY) == 0) {
+		index = bdp - fep->tx_bd_base;
 
 		if (bdp->cbd_bufaddr)
 			dma_unmap_single(&fep->pdev->dev, bdp->cbd_bufaddr,
-				FEC_ENET_TX_FRSIZE, DMA_TO_DEVICE);
+				bdp->cbd_datlen, DMA_TO_DEVICE);
 		bdp->cbd_bufaddr = 0;
+		fep->tx_used--;
+
+		/* Only the last descriptor of a frame carries the skb */
+		skb = fep->tx_skbuff[index];
+		if (!skb)
+			goto tx_next;
 
-		skb = fep->tx_skbuff[fep->skb_dirty];
 		/* Check for errors. */
 		if (status & (BD_ENET_TX_HB | BD_ENET_TX_LC |
 				   BD_ENET_TX_RL | BD_ENET_TX_UN |
@@ -452,35 +587,139 @@ fec_enet_tx(struct net_device *ndev)
 
 		/* Free the sk buffer associated with this last transmit */
 		dev_kfree_skb_any(skb);
-		fep->tx_skbuff[fep->skb_dirty] = NULL;
-		fep->skb_dirty = (fep->skb_dirty + 1) & TX_RING_MOD_MASK;
+		fep->tx_skbuff[index] = NULL;
+		reclaimed++;
 
+tx_next:
 		/* Update pointer to next buffer descriptor to be transmitted */
 		if (status & BD_ENET_TX_WRAP)
 			bdp = fep->tx_bd_base;
 		else
 			bdp++;
-
-		/* Since we have freed up a buffer, the ring is no longer full
-		 */
-		if (fep->tx_full) {
-			fep->tx_full = 0;
-			if (netif_queue_stopped(ndev))
-				netif_wake_queue(ndev);
-		}
 	}
 	fep->dirty_tx = bdp;
+
+	/* Since we have freed up buffers, the ring may no longer be full */
+	if (netif_queue_stopped(ndev) &&
+	    fep->tx_ring_size - fep->tx_used >= fec_enet_tx_stop_thresh(ndev))
+		netif_wake_queue(ndev);
+
 	spin_unlock(&fep->hw_lock);
+
+	return reclaimed;
+}
+
+
+/*
+ * Get a receive page, preferably one from the recycle pool that the
+ * stack has finished with (only the pool's reference is left).
+ */
+static int
+fec_enet_rx_page_get(struct fec_enet_private *fep, struct fec_rx_page *rxp,
+		     gfp_t gfp)
+{
+	struct page *page;
+	int i;
+
+	for (i = 0; i < fep->rx_pool_count; i++) {
+		if (page_count(fep->rx_pool[i].page) != 1)
+			continue;
+		*rxp = fep->rx_pool[i];
+		rxp->offset = 0;
+		fep->rx_pool[i] = fep->rx_pool[--fep->rx_pool_count];
+		return 0;
+	}
+
+	page = alloc_page(gfp | __GFP_COLD);
+	if (!page)
+		return -ENOMEM;
+
+	rxp->dma = dma_map_page(&fep->pdev->dev, page, 0, PAGE_SIZE,
+				DMA_FROM_DEVICE);
+	if (dma_mapping_error(&fep->pdev->dev, rxp->dma)) {
+		__free_page(page);
+		return -ENOMEM;
+	}
+	rxp->page = page;
+	rxp->offset = 0;
+
+	return 0;
 }
 
+/*
+ * The ring gives up a page whose reference now belongs to the stack.
+ * Keep a reference in the recycle pool if there is room for it.
+ */
+static void
+fec_enet_rx_page_retire(struct fec_enet_private *fep, struct fec_rx_page *rxp)
+{
+	if (fep->rx_pool_count < FEC_RX_POOL_SIZE) {
+		get_page(rxp->page);
+		fep->rx_pool[fep->rx_pool_count++] = *rxp;
+	} else {
+		dma_unmap_page(&fep->pdev->dev, rxp->dma, PAGE_SIZE,
+				DMA_FROM_DEVICE);
+	}
+}
+
+/*
+ * Build an skb around a frame received in page recycling mode.  The
+ * ring entry is switched to a fresh buffer when the frame is passed on
+ * as a fragment.  Returns NULL, leaving the ring entry untouched, if
+ * no skb or replacement buffer could be had.
+ */
+static struct sk_buff *
+fec_enet_rx_page_skb(struct net_device *ndev, struct fec_rx_page *rxp,
+		     ushort len)
+{
+	struct fec_enet_private *fep = netdev_priv(ndev);
+	struct page *page = rxp->page;
+	unsigned int offset = rxp->offset;
+	void *data = page_address(page) + offset;
+	struct fec_rx_page new;
+	struct sk_buff *skb;
+
+	skb = netdev_alloc_skb_ip_align(ndev, FEC_RX_HDR_LEN);
+	if (unlikely(!skb))
+		return NULL;
+
+	if (len <= FEC_RX_HDR_LEN) {
+		memcpy(skb_put(skb, len), data, len);
+		return skb;
+	}
+
+	if (page_count(page) == 1) {
+		/* Nobody else uses the page, move on to its next slot */
+		get_page(page);
+		rxp->offset = (offset + FEC_ENET_RX_FRSIZE) & ~PAGE_MASK;
+	} else {
+		if (fec_enet_rx_page_get(fep, &new, GFP_ATOMIC)) {
+			dev_kfree_skb_any(skb);
+			return NULL;
+		}
+		fec_enet_rx_page_retire(fep, rxp);
+		*rxp = new;
+	}
+
+	memcpy(skb_put(skb, FEC_RX_HDR_LEN), data, FEC_RX_HDR_LEN);
+	skb_add_rx_frag(skb, 0, page, offset + FEC_RX_HDR_LEN,
+			len - FEC_RX_HDR_LEN);
+
+	return skb;
+}
 
 /* During a receive, the cur_rx points to the current incoming buffer.
  * When we update through the ring, if the next incoming buffer has
  * not been given to the system, we just set the empty indicator,
  * effectively tossing the packet.
+ *
+ * Called from the NAPI poll routine; at most budget frames are taken
+ * off the ring.  The frames are collected while hw_lock is held and
+ * only handed to the stack once it has been dropped, as the stack may
+ * loop straight back into fec_enet_start_xmit().
  */
-static void
-fec_enet_rx(struct net_device *ndev)
+static int
+fec_enet_rx(struct net_device *ndev, int budget)
 {
 	struct fec_enet_private *fep = netdev_priv(ndev);
 	struct  fec_ptp_private *fpp = fep->ptp_priv;
@@ -489,13 +728,18 @@ fec_enet_rx(struct net_device *ndev)
 	struct bufdesc *bdp;
 	unsigned short status;
 	struct	sk_buff	*skb;
+	struct	sk_buff_head rxq;
+	struct	fec_rx_page *rxp;
 	ushort	pkt_len;
 	__u8 *data;
+	int	pkt_received = 0;
 
 #ifdef CONFIG_M532x
 	flush_cache_all();
 #endif
 
+	__skb_queue_head_init(&rxq);
+
 	spin_lock(&fep->hw_lock);
 
 	/* First, grab all of the stats for the incoming packet.
@@ -505,6 +749,10 @@ fec_enet_rx(struct net_device *ndev)
 
 	while (!((status = bdp->cbd_sc) & BD_ENET_RX_EMPTY)) {
 
+		if (pkt_received >= budget)
+			break;
+		pkt_received++;
+
 		/* Since we have allocated space to hold a complete frame,
 		 * the last indicator should be set.
 		 */
@@ -544,6 +792,35 @@ fec_enet_rx(struct net_device *ndev)
 		ndev->stats.rx_packets++;
 		pkt_len = bdp->cbd_datlen;
 		ndev->stats.rx_bytes += pkt_len;
+
+		if (fep->rx_page_mode) {
+			rxp = &fep->rx_page[bdp - fep->rx_bd_base];
+			dma_sync_single_range_for_cpu(&fep->pdev->dev,
+				rxp->dma, rxp->offset, FEC_ENET_RX_FRSIZE,
+				DMA_FROM_DEVICE);
+			data = page_address(rxp->page) + rxp->offset;
+
+			if (id_entry->driver_data & FEC_QUIRK_SWAP_FRAME)
+				swap_buffer(data, pkt_len);
+
+			/* Strip the FCS as the copying path below does */
+			skb = fec_enet_rx_page_skb(ndev, rxp, pkt_len - 4);
+			if (unlikely(!skb)) {
+				ndev->stats.rx_dropped++;
+			} else {
+				if (fep->ptimer_present)
+					fec_ptp_store_rxstamp(fpp, skb, bdp);
+				skb->protocol = eth_type_trans(skb, ndev);
+				__skb_queue_tail(&rxq, skb);
+			}
+
+			bdp->cbd_bufaddr = rxp->dma + rxp->offset;
+			dma_sync_single_range_for_device(&fep->pdev->dev,
+				rxp->dma, rxp->offset, FEC_ENET_RX_FRSIZE,
+				DMA_FROM_DEVICE);
+			goto rx_processing_done;
+		}
+
 		data = (__u8*)__va(bdp->cbd_bufaddr);
 
 		if (bdp->cbd_bufaddr)
@@ -572,7 +849,7 @@ fec_enet_rx(struct net_device *ndev)
 			if (fep->ptimer_present)
 				fec_ptp_store_rxstamp(fpp, skb, bdp);
 			skb->protocol = eth_type_trans(skb, ndev);
-			netif_rx(skb);
+			__skb_queue_tail(&rxq, skb);
 		}
 
 		bdp->cbd_bufaddr = dma_map_single(&fep->pdev->dev, data,
@@ -604,6 +881,64 @@ rx_processing_done:
 	fep->cur_rx = bdp;
 
 	spin_unlock(&fep->hw_lock);
+
+	while ((skb = __skb_dequeue(&rxq)) != NULL)
+		netif_receive_skb(skb);
+
+	return pkt_received;
+}
+
+/*
+ * NAPI poll routine.  TX reclaim is cheap and not counted against the
+ * budget; RX is limited to budget frames.  Once the rings are drained
+ * the rx/tx interrupts are either unmasked again, or, when interrupt
+ * coalescing is configured, kept masked for another holdoff period.
+ */
+static int
+fec_enet_rx_napi(struct napi_struct *napi, int budget)
+{
+	struct fec_enet_private *fep =
+			container_of(napi, struct fec_enet_private, napi);
+	struct net_device *ndev = fep->netdev;
+	int tx_done, pkts;
+	uint usecs;
+
+	/* Drop the events we are about to service */
+	writel(FEC_NAPI_IMASK, fep->hwp + FEC_IEVENT);
+
+	tx_done = fec_enet_tx(ndev);
+	pkts = fec_enet_rx(ndev, budget);
+
+	if (pkts < budget) {
+		napi_complete(napi);
+
+		if (pkts)
+			usecs = fep->rx_coalesce_usecs;
+		else if (tx_done)
+			usecs = fep->tx_coalesce_usecs;
+		else
+			usecs = 0;
+
+		if (usecs)
+			hrtimer_start(&fep->coalesce_timer,
+				ns_to_ktime((u64)usecs * NSEC_PER_USEC),
+				HRTIMER_MODE_REL);
+		else
+			writel(FEC_DEFAULT_IMASK, fep->hwp + FEC_IMASK);
+	}
+
+	return pkts;
+}
+
+static enum hrtimer_restart
+fec_enet_coalesce_timer(struct hrtimer *timer)
+{
+	struct fec_enet_private *fep =
+		container_of(timer, struct fec_enet_private, coalesce_timer);
+
+	napi_schedule(&fep->napi);
+
+	return HRTIMER_NORESTART;
 }
 
 static irqreturn_t
@@ -616,21 +951,24 @@ fec_enet_interrupt(int irq, void *dev_id)
 	irqreturn_t ret = IRQ_NONE;
 
 	do {
-		int_events = readl(fep->hwp + FEC_IEVENT);
+		/*
+		 * Events masked off while NAPI is running stay latched in
+		 * IEVENT; leave them for the poll routine.
+		 */
+		int_events = readl(fep->hwp + FEC_IEVENT) &
+			(readl(fep->hwp + FEC_IMASK) | ~FEC_NAPI_IMASK);
 		writel(int_events, fep->hwp + FEC_IEVENT);
 
-		if (int_events & FEC_ENET_RXF) {
-			ret = IRQ_HANDLED;
-			fec_enet_rx(ndev);
-		}
-
-		/* Transmit OK, or non-fatal error. Update the buffer
-		 * descriptors. FEC handles all errors, we just discover
-		 * them as part of the transmit process.
+		/* Frame received, or transmit OK / non-fatal error.  Mask
+		 * both and let the NAPI poll routine walk the rings.  FEC
+		 * handles all errors, we just discover them as part of the
+		 * transmit process.
 		 */
-		if (int_events & FEC_ENET_TXF) {
+		if (int_events & FEC_NAPI_IMASK) {
 			ret = IRQ_HANDLED;
-			fec_enet_tx(ndev);
+			writel(FEC_DEFAULT_IMASK & ~FEC_NAPI_IMASK,
+					fep->hwp + FEC_IMASK);
+			napi_schedule(&fep->napi);
 		}
 
 		if (int_events & FEC_ENET_TS_TIMER) {
@@ -1007,11 +1345,75 @@ static void fec_enet_get_drvinfo(struct net_device *ndev,
 	strcpy(info->bus_info, dev_name(&ndev->dev));
 }
 
+static int fec_enet_get_coalesce(struct net_device *ndev,
+				 struct ethtool_coalesce *ec)
+{
+	struct fec_enet_private *fep = netdev_priv(ndev);
+
+	ec->rx_coalesce_usecs = fep->rx_coalesce_usecs;
+	ec->tx_coalesce_usecs = fep->tx_coalesce_usecs;
+
+	return 0;
+}
+
+static int fec_enet_set_coalesce(struct net_device *ndev,
+				 struct ethtool_coalesce *ec)
+{
+	struct fec_enet_private *fep = netdev_priv(ndev);
+
+	if (ec->rx_coalesce_usecs > FEC_MAX_COALESCE_USECS ||
+	    ec->tx_coalesce_usecs > FEC_MAX_COALESCE_USECS)
+		return -EINVAL;
+
+	fep->rx_coalesce_usecs = ec->rx_coalesce_usecs;
+	fep->tx_coalesce_usecs = ec->tx_coalesce_usecs;
+
+	return 0;
+}
+
+static void fec_enet_get_ringparam(struct net_device *ndev,
+				   struct ethtool_ringparam *ring)
+{
+	struct fec_enet_private *fep = netdev_priv(ndev);
+
+	ring->rx_max_pending = RX_RING_SIZE;
+	ring->rx_pending = RX_RING_SIZE;
+	ring->tx_max_pending = FEC_TX_RING_MAX;
+	ring->tx_pending = fep->tx_ring_size;
+}
+
+static int fec_enet_set_ringparam(struct net_device *ndev,
+				  struct ethtool_ringparam *ring)
+{
+	struct fec_enet_private *fep = netdev_priv(ndev);
+	unsigned int min = (ndev->hw_features & NETIF_F_SG) ?
+				FEC_TX_RING_MIN_SG : FEC_TX_RING_MIN;
+
+	if (ring->rx_pending != RX_RING_SIZE ||
+	    ring->rx_mini_pending || ring->rx_jumbo_pending)
+		return -EINVAL;
+
+	if (ring->tx_pending < min || ring->tx_pending > FEC_TX_RING_MAX)
+		return -EINVAL;
+
+	/* The descriptor rings are only laid out when the device opens */
+	if (netif_running(ndev))
+		return -EBUSY;
+
+	fep->tx_ring_size = ring->tx_pending;
+
+	return 0;
+}
+
 static struct ethtool_ops fec_enet_ethtool_ops = {
 	.get_settings		= fec_enet_get_settings,
 	.set_settings		= fec_enet_set_settings,
 	.get_drvinfo		= fec_enet_get_drvinfo,
 	.get_link		= ethtool_op_get_link,
+	.get_coalesce		= fec_enet_get_coalesce,
+	.set_coalesce		= fec_enet_set_coalesce,
+	.get_ringparam		= fec_enet_get_ringparam,
+	.set_ringparam		= fec_enet_set_ringparam,
 };
 
 static int fec_enet_ioctl(struct net_device *ndev, struct ifreq *rq, int cmd)
@@ -1034,9 +1436,19 @@ static void fec_enet_free_buffers(struct net_device *ndev)
 	int i;
 	struct sk_buff *skb;
 	struct bufdesc	*bdp;
+	struct fec_rx_page *rxp;
 
 	bdp = fep->rx_bd_base;
 	for (i = 0; i < RX_RING_SIZE; i++) {
+		rxp = &fep->rx_page[i];
+		if (rxp->page) {
+			dma_unmap_page(&fep->pdev->dev, rxp->dma, PAGE_SIZE,
+					DMA_FROM_DEVICE);
+			put_page(rxp->page);
+			rxp->page = NULL;
+			bdp->cbd_bufaddr = 0;
+		}
+
 		skb = fep->rx_skbuff[i];
 
 		if (bdp->cbd_bufaddr)
@@ -1044,12 +1456,22 @@ static void fec_enet_free_buffers(struct net_device *ndev)
 					FEC_ENET_RX_FRSIZE, DMA_FROM_DEVICE);
 		if (skb)
 			dev_kfree_skb(skb);
+		fep->rx_skbuff[i] = NULL;
+		bdp->cbd_bufaddr = 0;
 		bdp++;
 	}
 
-	bdp = fep->tx_bd_base;
-	for (i = 0; i < TX_RING_SIZE; i++)
+	while (fep->rx_pool_count) {
+		rxp = &fep->rx_pool[--fep->rx_pool_count];
+		dma_unmap_page(&fep->pdev->dev, rxp->dma, PAGE_SIZE,
+				DMA_FROM_DEVICE);
+		put_page(rxp->page);
+	}
+
+	for (i = 0; i < fep->tx_ring_size; i++) {
 		kfree(fep->tx_bounce[i]);
+		fep->tx_bounce[i] = NULL;
+	}
 }
 
 static int fec_enet_alloc_buffers(struct net_device *ndev)
@@ -1059,17 +1481,29 @@ static int fec_enet_alloc_buffers(struct net_device *ndev)
 	struct sk_buff *skb;
 	struct bufdesc	*bdp;
 
+	fep->rx_page_mode = rx_page_recycle;
+
 	bdp = fep->rx_bd_base;
 	for (i = 0; i < RX_RING_SIZE; i++) {
-		skb = dev_alloc_skb(FEC_ENET_RX_FRSIZE);
-		if (!skb) {
-			fec_enet_free_buffers(ndev);
-			return -ENOMEM;
-		}
-		fep->rx_skbuff[i] = skb;
+		if (fep->rx_page_mode) {
+			if (fec_enet_rx_page_get(fep, &fep->rx_page[i],
+						 GFP_KERNEL)) {
+				fec_enet_free_buffers(ndev);
+				return -ENOMEM;
+			}
+			bdp->cbd_bufaddr = fep->rx_page[i].dma;
+		} else {
+			skb = dev_alloc_skb(FEC_ENET_RX_FRSIZE);
+			if (!skb) {
+				fec_enet_free_buffers(ndev);
+				return -ENOMEM;
+			}
+			fep->rx_skbuff[i] = skb;
 
-		bdp->cbd_bufaddr = dma_map_single(&fep->pdev->dev, skb->data,
-				FEC_ENET_RX_FRSIZE, DMA_FROM_DEVICE);
+			bdp->cbd_bufaddr = dma_map_single(&fep->pdev->dev,
+					skb->data, FEC_ENET_RX_FRSIZE,
+					DMA_FROM_DEVICE);
+		}
 		bdp->cbd_sc = BD_ENET_RX_EMPTY;
 #ifdef CONFIG_ENHANCED_BD
 		bdp->cbd_esc = BD_ENET_RX_INT;
@@ -1082,8 +1516,12 @@ static int fec_enet_alloc_buffers(struct net_device *ndev)
 	bdp->cbd_sc |= BD_SC_WRAP;
 
 	bdp = fep->tx_bd_base;
-	for (i = 0; i < TX_RING_SIZE; i++) {
+	for (i = 0; i < fep->tx_ring_size; i++) {
 		fep->tx_bounce[i] = kmalloc(FEC_ENET_TX_FRSIZE, GFP_KERNEL);
+		if (!fep->tx_bounce[i]) {
+			fec_enet_free_buffers(ndev);
+			return -ENOMEM;
+		}
 
 		bdp->cbd_sc = 0;
 		bdp->cbd_bufaddr = 0;
@@ -1123,6 +1561,7 @@ fec_enet_open(struct net_device *ndev)
 		return ret;
 	}
 
+	napi_enable(&fep->napi);
 	phy_start(fep->phy_dev);
 	netif_start_queue(ndev);
 	fep->opened = 1;
@@ -1142,6 +1581,9 @@ fec_enet_close(struct net_device *ndev)
 	/* Don't know what to do yet. */
 	fep->opened = 0;
 	netif_stop_queue(ndev);
+	/* A poll still running may re-arm the timer, so stop NAPI first */
+	napi_disable(&fep->napi);
+	hrtimer_cancel(&fep->coalesce_timer);
 	fec_stop(ndev);
 
 	if (fep->phy_dev) {
@@ -1276,12 +1718,16 @@ static const struct net_device_ops fec_netdev_ops = {
 static int fec_enet_init(struct net_device *ndev)
 {
 	struct fec_enet_private *fep = netdev_priv(ndev);
+#ifdef CONFIG_ENHANCED_BD
+	const struct platform_device_id *id_entry =
+				platform_get_device_id(fep->pdev);
+#endif
 	struct bufdesc *cbd_base;
 	struct bufdesc *bdp;
 	int i;
 
 	/* Allocate memory for buffer descriptors. */
-	cbd_base = dma_alloc_coherent(NULL, PAGE_SIZE, &fep->bd_dma,
+	cbd_base = dma_alloc_coherent(NULL, FEC_BD_AREA_SIZE, &fep->bd_dma,
 			GFP_KERNEL);
 	if (!cbd_base) {
 		printk("FEC: allocate descriptor memory failed?\n");
@@ -1304,6 +1750,30 @@ static int fec_enet_init(struct net_device *ndev)
 	ndev->netdev_ops = &fec_netdev_ops;
 	ndev->ethtool_ops = &fec_enet_ethtool_ops;
 
+#ifdef CONFIG_ENHANCED_BD
+	/*
+	 * The enhanced descriptors can have the IP and TCP/UDP checksums
+	 * inserted by the controller, which also makes scatter-gather
+	 * worthwhile.  Not on controllers that need every frame swapped.
+	 */
+	if ((id_entry->driver_data & FEC_QUIRK_ENET_MAC) &&
+	    !(id_entry->driver_data & FEC_QUIRK_SWAP_FRAME)) {
+		ndev->hw_features |= NETIF_F_SG | NETIF_F_IP_CSUM;
+		ndev->features |= ndev->hw_features;
+	}
+#endif
+	if (ndev->hw_features & NETIF_F_SG)
+		fep->tx_ring_size = FEC_TX_RING_SG;
+	else
+		fep->tx_ring_size = TX_RING_SIZE;
+
+	if (napi_weight <= 0)
+		napi_weight = FEC_NAPI_WEIGHT;
+	netif_napi_add(ndev, &fep->napi, fec_enet_rx_napi, napi_weight);
+
+	hrtimer_init(&fep->coalesce_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	fep->coalesce_timer.function = fec_enet_coalesce_timer;
+
 	/* Initialize the receive buffer descriptors. */
 	bdp = fep->rx_bd_base;
 	for (i = 0; i < RX_RING_SIZE; i++) {
@@ -1320,7 +1790,7 @@ static int fec_enet_init(struct net_device *ndev)
 
 	/* ...and the same for transmit */
 	bdp = fep->tx_bd_base;
-	for (i = 0; i < TX_RING_SIZE; i++) {
+	for (i = 0; i < fep->tx_ring_size; i++) {
 
 		/* Initialize the BD for every fragment in the page. */
 		bdp->cbd_sc = 0;
@@ -1347,6 +1817,7 @@ fec_restart(struct net_device *dev, int duplex)
 	struct fec_enet_private *fep = netdev_priv(dev);
 	const struct platform_device_id *id_entry =
 				platform_get_device_id(fep->pdev);
+	struct bufdesc *bdp;
 	int i, ret;
 	u32 val, temp_mac[2], reg = 0;
 
@@ -1386,9 +1857,16 @@ fec_restart(struct net_device *dev, int duplex)
 	fep->dirty_tx = fep->cur_tx = fep->tx_bd_base;
 	fep->cur_rx = fep->rx_bd_base;
 
-	/* Reset SKB transmit buffers. */
-	fep->skb_cur = fep->skb_dirty = 0;
-	for (i = 0; i <= TX_RING_MOD_MASK; i++) {
+	/* Reset SKB transmit buffers and give the descriptors back. */
+	fep->tx_used = 0;
+	bdp = fep->tx_bd_base;
+	for (i = 0; i < fep->tx_ring_size; i++, bdp++) {
+		if (bdp->cbd_bufaddr)
+			dma_unmap_single(&fep->pdev->dev, bdp->cbd_bufaddr,
+					bdp->cbd_datlen, DMA_TO_DEVICE);
+		bdp->cbd_bufaddr = 0;
+		bdp->cbd_sc = (i == fep->tx_ring_size - 1) ? BD_SC_WRAP : 0;
+
 		if (fep->tx_skbuff[i]) {
 			dev_kfree_skb_any(fep->tx_skbuff[i]);
 			fep->tx_skbuff[i] = NULL;
@@ -171,6 +171,8 @@ struct bufdesc {
 #define BD_ENET_TX_STATS        ((ushort)0x03ff)        /* All status bits */
 
 #define BD_ENET_TX_INT          0x40000000
+#define BD_ENET_TX_PINS         0x10000000	/* Insert protocol checksum */
+#define BD_ENET_TX_IINS         0x08000000	/* Insert IP header checksum */
 #define BD_ENET_TX_PTP          ((ushort)0x0100)
 
 /****************************************************************************/
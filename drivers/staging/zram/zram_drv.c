@@ -23,6 +23,7 @@
 #include <linux/kernel.h>
 #include <linux/bio.h>
 #include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
 #include <linux/device.h>
@@ -42,14 +43,14 @@ struct zram *devices;
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
-static void zram_stat_inc(u32 *v)
+static void zram_stat_inc(atomic_t *v)
 {
-	*v = *v + 1;
+	atomic_inc(v);
 }
 
-static void zram_stat_dec(u32 *v)
+static void zram_stat_dec(atomic_t *v)
 {
-	*v = *v - 1;
+	atomic_dec(v);
 }
 
 static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
@@ -71,22 +72,157 @@ static void zram_stat64_inc(struct zram *zram, u64 *v)
 	zram_stat64_add(zram, v, 1);
 }
 
+static void zram_cpu_stat_inc(struct zram *zram, enum zram_cpu_stat_item item)
+{
+	struct zram_cpu_stats *stats = get_cpu_ptr(zram->cpu_stats);
+
+	u64_stats_update_begin(&stats->syncp);
+	stats->count[item]++;
+	u64_stats_update_end(&stats->syncp);
+	put_cpu_ptr(zram->cpu_stats);
+}
+
 static int zram_test_flag(struct zram *zram, u32 index,
 			enum zram_pageflags flag)
 {
-	return zram->table[index].flags & BIT(flag);
+	return zram->table[index].value & BIT(flag + ZRAM_FLAG_SHIFT);
 }
 
 static void zram_set_flag(struct zram *zram, u32 index,
 			enum zram_pageflags flag)
 {
-	zram->table[index].flags |= BIT(flag);
+	zram->table[index].value |= BIT(flag + ZRAM_FLAG_SHIFT);
 }
 
 static void zram_clear_flag(struct zram *zram, u32 index,
 			enum zram_pageflags flag)
 {
-	zram->table[index].flags &= ~BIT(flag);
+	zram->table[index].value &= ~BIT(flag + ZRAM_FLAG_SHIFT);
+}
+
+static u32 zram_get_offset(struct zram *zram, u32 index)
+{
+	return zram->table[index].value & (BIT(ZRAM_FLAG_SHIFT) - 1);
+}
+
+static void zram_set_offset(struct zram *zram, u32 index, u32 offset)
+{
+	unsigned long flags = zram->table[index].value >> ZRAM_FLAG_SHIFT;
+
+	zram->table[index].value = (flags << ZRAM_FLAG_SHIFT) | offset;
+}
+
+/*
+ * Compressed objects live in the allocator selected for the device.
+ * obj is either a table entry or a new entry not yet in the table.
+ */
+static int zram_obj_alloc(struct zram *zram, size_t clen, struct table *obj)
+{
+	u32 offset;
+
+	if (zram->allocator == ZRAM_ZSMALLOC) {
+		obj->handle = zs_malloc(zram->zs_pool, clen,
+					GFP_NOIO | __GFP_HIGHMEM);
+		obj->value = clen;
+		return obj->handle ? 0 : -ENOMEM;
+	}
+
+	if (xv_malloc(zram->mem_pool, clen + sizeof(struct zobj_header),
+			&obj->page, &offset, GFP_NOIO | __GFP_HIGHMEM))
+		return -ENOMEM;
+
+	obj->value = offset;
+	return 0;
+}
+
+static void zram_obj_free(struct zram *zram, struct table *obj)
+{
+	if (zram->allocator == ZRAM_ZSMALLOC)
+		zs_free(zram->zs_pool, obj->handle);
+	else
+		xv_free(zram->mem_pool, obj->page,
+			obj->value & (BIT(ZRAM_FLAG_SHIFT) - 1));
+}
+
+static void *zram_obj_map(struct zram *zram, struct table *obj,
+			enum zs_mapmode mm)
+{
+	if (zram->allocator == ZRAM_ZSMALLOC)
+		return zs_map_object(zram->zs_pool, obj->handle, mm);
+
+	return kmap_atomic(obj->page, KM_USER1) +
+		(obj->value & (BIT(ZRAM_FLAG_SHIFT) - 1));
+}
+
+static void zram_obj_unmap(struct zram *zram, struct table *obj, void *cmem)
+{
+	if (zram->allocator == ZRAM_ZSMALLOC)
+		zs_unmap_object(zram->zs_pool, obj->handle);
+	else
+		kunmap_atomic(cmem, KM_USER1);
+}
+
+/* Compressed size, without the object header */
+static u32 zram_obj_size(struct zram *zram, struct table *obj)
+{
+	u32 size;
+	void *cmem;
+
+	if (zram->allocator == ZRAM_ZSMALLOC)
+		return obj->value & (BIT(ZRAM_FLAG_SHIFT) - 1);
+
+	cmem = zram_obj_map(zram, obj, ZS_MM_RO);
+	size = xv_get_object_size(cmem) - sizeof(struct zobj_header);
+	zram_obj_unmap(zram, obj, cmem);
+
+	return size;
+}
+
+u64 zram_get_pool_size(struct zram *zram)
+{
+	if (zram->allocator == ZRAM_ZSMALLOC)
+		return zs_get_total_size_bytes(zram->zs_pool);
+
+	return xv_get_total_size_bytes(zram->mem_pool);
+}
+
+/*
+ * Table entries are protected by a bit spinlock in their own flags, so
+ * I/O to different pages never contends.  Nothing that sleeps may be
+ * done with an entry locked.
+ */
+static void zram_lock_slot(struct zram *zram, u32 index)
+{
+	int bit = ZRAM_ACCESS + ZRAM_FLAG_SHIFT;
+
+	if (!bit_spin_trylock(bit, &zram->table[index].value)) {
+		zram_cpu_stat_inc(zram, ZRAM_CPU_SLOT_WAIT);
+		bit_spin_lock(bit, &zram->table[index].value);
+	}
+}
+
+static void zram_unlock_slot(struct zram *zram, u32 index)
+{
+	bit_spin_unlock(ZRAM_ACCESS + ZRAM_FLAG_SHIFT,
+			&zram->table[index].value);
+}
+
+static struct zram_stream *zram_stream_get(struct zram *zram)
+{
+	struct zram_stream *zstrm;
+
+	zstrm = per_cpu_ptr(zram->streams, raw_smp_processor_id());
+	if (!mutex_trylock(&zstrm->lock)) {
+		zram_cpu_stat_inc(zram, ZRAM_CPU_STREAM_WAIT);
+		mutex_lock(&zstrm->lock);
+	}
+
+	return zstrm;
+}
+
+static void zram_stream_put(struct zram_stream *zstrm)
+{
+	mutex_unlock(&zstrm->lock);
 }
 
 static int page_zero_filled(void *ptr)
@@ -133,15 +269,13 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+/* Called with the table entry locked */
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	u32 clen;
-	void *obj;
+	struct table *obj = &zram->table[index];
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
-
-	if (unlikely(!page)) {
+	if (unlikely(!obj->page)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
@@ -155,17 +289,14 @@ static void zram_free_page(struct zram *zram, size_t index)
 
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		clen = PAGE_SIZE;
-		__free_page(page);
+		__free_page(obj->page);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
 		zram_stat_dec(&zram->stats.pages_expand);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
-
-	xv_free(zram->mem_pool, page, offset);
+	clen = zram_obj_size(zram, obj);
+	zram_obj_free(zram, obj);
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
 
@@ -173,8 +304,8 @@ out:
 	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
 	zram_stat_dec(&zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+	obj->page = NULL;
+	zram_set_offset(zram, index, 0);
 }
 
 static void handle_zero_page(struct page *page)
@@ -195,7 +326,7 @@ static void handle_uncompressed_page(struct zram *zram,
 
 	user_mem = kmap_atomic(page, KM_USER0);
 	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+			zram_get_offset(zram, index);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
 	kunmap_atomic(user_mem, KM_USER0);
@@ -204,70 +335,78 @@ static void handle_uncompressed_page(struct zram *zram,
 	flush_dcache_page(page);
 }
 
-static void zram_read(struct zram *zram, struct bio *bio)
+static int zram_read_page(struct zram *zram, struct page *page, u32 index)
 {
+	int ret;
+	size_t clen;
+	struct zobj_header *zheader;
+	unsigned char *user_mem, *cmem;
+	struct table *obj = &zram->table[index];
 
-	int i;
-	u32 index;
-	struct bio_vec *bvec;
+	zram_lock_slot(zram, index);
 
-	zram_stat64_inc(zram, &zram->stats.num_reads);
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+		zram_unlock_slot(zram, index);
+		handle_zero_page(page);
+		return 0;
+	}
 
-	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		size_t clen;
-		struct page *page;
-		struct zobj_header *zheader;
-		unsigned char *user_mem, *cmem;
+	/* Requested page is not present in compressed area */
+	if (unlikely(!zram->table[index].page)) {
+		zram_unlock_slot(zram, index);
+		pr_debug("Read before write: index=%u", index);
+		handle_zero_page(page);
+		return 0;
+	}
 
-		page = bvec->bv_page;
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		handle_uncompressed_page(zram, page, index);
+		zram_unlock_slot(zram, index);
+		return 0;
+	}
 
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
+	user_mem = kmap_atomic(page, KM_USER0);
+	clen = PAGE_SIZE;
 
-		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
-			pr_debug("Read before write: sector=%lu, size=%u",
-				(ulong)(bio->bi_sector), bio->bi_size);
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
+	cmem = zram_obj_map(zram, obj, ZS_MM_RO);
 
-		/* Page is stored uncompressed since it's incompressible */
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-			handle_uncompressed_page(zram, page, index);
-			index++;
-			continue;
-		}
+	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
+		zram_obj_size(zram, obj), user_mem, &clen);
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		clen = PAGE_SIZE;
+	zram_obj_unmap(zram, obj, cmem);
+	kunmap_atomic(user_mem, KM_USER0);
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	zram_unlock_slot(zram, index);
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret != LZO_E_OK)) {
+		pr_err("Decompression failed! err=%d, page=%u\n",
+			ret, index);
+		return -EIO;
+	}
 
-		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+	flush_dcache_page(page);
+	return 0;
+}
 
-		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
-			pr_err("Decompression failed! err=%d, page=%u\n",
-				ret, index);
+static void zram_read(struct zram *zram, struct bio *bio)
+{
+
+	int i;
+	u32 index;
+	struct bio_vec *bvec;
+
+	zram_stat64_inc(zram, &zram->stats.num_reads);
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+
+	bio_for_each_segment(bvec, bio, i) {
+		if (zram_read_page(zram, bvec->bv_page, index)) {
 			zram_stat64_inc(zram, &zram->stats.failed_reads);
 			goto out;
 		}
 
-		flush_dcache_page(page);
+		zram_cpu_stat_inc(zram, ZRAM_CPU_READS);
 		index++;
 	}
 
@@ -279,121 +418,126 @@ out:
 	bio_io_error(bio);
 }
 
-static void zram_write(struct zram *zram, struct bio *bio)
+/*
+ * Compress and allocate without holding the table entry, which is only
+ * locked to swap the new object in.
+ */
+static int zram_write_page(struct zram *zram, struct page *page, u32 index)
 {
-	int i;
-	u32 index;
-	struct bio_vec *bvec;
+	int ret;
+	size_t clen;
+	struct table obj;
+	struct zobj_header *zheader;
+	struct zram_stream *zstrm;
+	unsigned char *user_mem, *cmem, *src;
 
-	zram_stat64_inc(zram, &zram->stats.num_writes);
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	user_mem = kmap_atomic(page, KM_USER0);
+	if (page_zero_filled(user_mem)) {
+		kunmap_atomic(user_mem, KM_USER0);
+		zram_lock_slot(zram, index);
+		zram_free_page(zram, index);
+		zram_set_flag(zram, index, ZRAM_ZERO);
+		zram_unlock_slot(zram, index);
+		zram_stat_inc(&zram->stats.pages_zero);
+		return 0;
+	}
+	kunmap_atomic(user_mem, KM_USER0);
 
-	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
+	zstrm = zram_stream_get(zram);
+	src = zstrm->buffer;
 
-		page = bvec->bv_page;
-		src = zram->compress_buffer;
+	user_mem = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
+				zstrm->workmem);
+	kunmap_atomic(user_mem, KM_USER0);
 
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
-
-		mutex_lock(&zram->lock);
-
-		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
-			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
-			index++;
-			continue;
+	if (unlikely(ret != LZO_E_OK)) {
+		zram_stream_put(zstrm);
+		pr_err("Compression failed! err=%d\n", ret);
+		return -EIO;
+	}
+
+	/*
+	 * Page is incompressible. Store it as-is (uncompressed)
+	 * since we do not want to return too many disk write
+	 * errors which has side effect of hanging the system.
+	 */
+	if (unlikely(clen > max_zpage_size)) {
+		zram_stream_put(zstrm);
+
+		clen = PAGE_SIZE;
+		obj.page = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
+		if (unlikely(!obj.page)) {
+			pr_info("Error allocating memory for "
+				"incompressible page: %u\n", index);
+			return -ENOMEM;
 		}
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+		obj.value = 0;
+		src = kmap_atomic(page, KM_USER0);
+		cmem = kmap_atomic(obj.page, KM_USER1);
+		memcpy(cmem, src, clen);
+		kunmap_atomic(cmem, KM_USER1);
+		kunmap_atomic(src, KM_USER0);
+		goto store;
+	}
 
-		kunmap_atomic(user_mem, KM_USER0);
+	if (zram_obj_alloc(zram, clen, &obj)) {
+		zram_stream_put(zstrm);
+		pr_info("Error allocating memory for compressed "
+			"page: %u, size=%zu\n", index, clen);
+		return -ENOMEM;
+	}
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
-			pr_err("Compression failed! err=%d\n", ret);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
-		}
+	cmem = zram_obj_map(zram, &obj, ZS_MM_WO);
+	memcpy(cmem + sizeof(*zheader), src, clen);
+	zram_obj_unmap(zram, &obj, cmem);
+	zram_stream_put(zstrm);
 
-		/*
-		 * Page is incompressible. Store it as-is (uncompressed)
-		 * since we do not want to return too many disk write
-		 * errors which has side effect of hanging the system.
-		 */
-		if (unlikely(clen > max_zpage_size)) {
-			clen = PAGE_SIZE;
-			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
-				pr_info("Error allocating memory for "
-					"incompressible page: %u\n", index);
-				zram_stat64_inc(zram,
-					&zram->stats.failed_writes);
-				goto out;
-			}
-
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
-		}
+store:
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
-			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
-		}
+	zram_lock_slot(zram, index);
 
-memstore:
-		zram->table[index].offset = offset;
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now.
+	 */
+	zram_free_page(zram, index);
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	zram->table[index].page = obj.page;
+	zram_set_offset(zram, index, obj.value);
+	if (unlikely(clen == PAGE_SIZE))
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
 
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
-		}
-#endif
+	zram_unlock_slot(zram, index);
 
-		memcpy(cmem, src, clen);
+	/* Update stats */
+	zram_stat64_add(zram, &zram->stats.compr_size, clen);
+	zram_stat_inc(&zram->stats.pages_stored);
+	if (clen == PAGE_SIZE)
+		zram_stat_inc(&zram->stats.pages_expand);
+	else if (clen <= PAGE_SIZE / 2)
+		zram_stat_inc(&zram->stats.good_compress);
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+	return 0;
+}
 
-		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
-		zram_stat_inc(&zram->stats.pages_stored);
-		if (clen <= PAGE_SIZE / 2)
-			zram_stat_inc(&zram->stats.good_compress);
+static void zram_write(struct zram *zram, struct bio *bio)
+{
+	int i;
+	u32 index;
+	struct bio_vec *bvec;
+
+	zram_stat64_inc(zram, &zram->stats.num_writes);
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
-		mutex_unlock(&zram->lock);
+	bio_for_each_segment(bvec, bio, i) {
+		if (zram_write_page(zram, bvec->bv_page, index)) {
+			zram_stat64_inc(zram, &zram->stats.failed_writes);
+			goto out;
+		}
+
+		zram_cpu_stat_inc(zram, ZRAM_CPU_WRITES);
 		index++;
 	}
 
@@ -453,45 +597,88 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 	return 0;
 }
 
+static void zram_free_streams(struct zram *zram)
+{
+	int cpu;
+	struct zram_stream *zstrm;
+
+	if (!zram->streams)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		zstrm = per_cpu_ptr(zram->streams, cpu);
+		kfree(zstrm->workmem);
+		free_pages((unsigned long)zstrm->buffer, 1);
+	}
+
+	free_percpu(zram->streams);
+	zram->streams = NULL;
+}
+
+static int zram_alloc_streams(struct zram *zram)
+{
+	int cpu;
+	struct zram_stream *zstrm;
+
+	zram->streams = alloc_percpu(struct zram_stream);
+	if (!zram->streams)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		zstrm = per_cpu_ptr(zram->streams, cpu);
+		mutex_init(&zstrm->lock);
+
+		zstrm->workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+		zstrm->buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
+		if (!zstrm->workmem || !zstrm->buffer) {
+			zram_free_streams(zram);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
 void zram_reset_device(struct zram *zram)
 {
+	int cpu;
 	size_t index;
 
 	mutex_lock(&zram->init_lock);
 	zram->init_done = 0;
 
 	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	zram_free_streams(zram);
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
+		struct table *obj = &zram->table[index];
 
-		if (!page)
+		if (!obj->page)
 			continue;
 
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
+			__free_page(obj->page);
 		else
-			xv_free(zram->mem_pool, page, offset);
+			zram_obj_free(zram, obj);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	if (zram->mem_pool)
+		xv_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
+	if (zram->zs_pool)
+		zs_destroy_pool(zram->zs_pool);
+	zram->zs_pool = NULL;
+
 	/* Reset stats */
 	memset(&zram->stats, 0, sizeof(zram->stats));
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(zram->cpu_stats, cpu)->count, 0,
+			sizeof(zram->cpu_stats->count));
 
 	zram->disksize = 0;
 	mutex_unlock(&zram->init_lock);
@@ -511,17 +698,9 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = zram_alloc_streams(zram);
+	if (ret) {
+		pr_err("Error allocating compression streams\n");
 		goto fail;
 	}
 
@@ -540,8 +719,11 @@ int zram_init_device(struct zram *zram)
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
-	if (!zram->mem_pool) {
+	if (zram->allocator == ZRAM_ZSMALLOC)
+		zram->zs_pool = zs_create_pool();
+	else
+		zram->mem_pool = xv_create_pool();
+	if (!zram->mem_pool && !zram->zs_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
 		goto fail;
@@ -566,7 +748,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	zram_lock_slot(zram, index);
 	zram_free_page(zram, index);
+	zram_unlock_slot(zram, index);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -579,16 +763,23 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
 
+	zram->cpu_stats = alloc_percpu(struct zram_cpu_stats);
+	if (!zram->cpu_stats) {
+		pr_err("Error allocating cpu stats for device %d\n",
+			device_id);
+		ret = -ENOMEM;
+		goto out;
+	}
+
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
 		pr_err("Error allocating disk queue for device %d\n",
 			device_id);
 		ret = -ENOMEM;
-		goto out;
+		goto out_free_stats;
 	}
 
 	blk_queue_make_request(zram->queue, zram_make_request);
@@ -601,7 +792,7 @@ static int create_device(struct zram *zram, int device_id)
 		pr_warning("Error allocating disk structure for device %d\n",
 			device_id);
 		ret = -ENOMEM;
-		goto out;
+		goto out_free_stats;
 	}
 
 	zram->disk->major = zram_major;
@@ -634,7 +825,11 @@ static int create_device(struct zram *zram, int device_id)
 	}
 
 	zram->init_done = 0;
+	return 0;
 
+out_free_stats:
+	free_percpu(zram->cpu_stats);
+	zram->cpu_stats = NULL;
 out:
 	return ret;
 }
@@ -693,8 +888,10 @@ static int __init zram_init(void)
 	return 0;
 
 free_devices:
-	while (dev_id)
+	while (dev_id) {
 		destroy_device(&devices[--dev_id]);
+		free_percpu(devices[dev_id].cpu_stats);
+	}
 	kfree(devices);
 unregister:
 	unregister_blkdev(zram_major, "zram");
@@ -713,6 +910,7 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+		free_percpu(zram->cpu_stats);
 	}
 
 	unregister_blkdev(zram_major, "zram");
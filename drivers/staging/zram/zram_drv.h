@@ -17,8 +17,11 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
 
 #include "xvmalloc.h"
+#include "zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -71,18 +74,36 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Table entry is locked (bit spinlock) */
+	ZRAM_ACCESS,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
+/*
+ * table[page_no].value holds the object offset within its page
+ * (xvmalloc) or the object size (zsmalloc) in its lower
+ * ZRAM_FLAG_SHIFT bits and the zram_pageflags above that.
+ */
+#define ZRAM_FLAG_SHIFT		16
+
+/* Backing allocator for compressed pages, selected per device */
+enum zram_allocator {
+	ZRAM_XVMALLOC,
+	ZRAM_ZSMALLOC,
+	__NR_ZRAM_ALLOCATORS,
+};
+
 /*-- Data structures */
 
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
-	u8 count;	/* object ref count (not yet used) */
-	u8 flags;
-} __attribute__((aligned(4)));
+	union {
+		struct page *page;	/* xvmalloc or uncompressed page */
+		unsigned long handle;	/* zsmalloc */
+	};
+	unsigned long value;
+};
 
 struct zram_stats {
 	u64 compr_size;		/* compressed size of pages stored */
@@ -92,20 +113,45 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
-	u32 pages_stored;	/* no. of pages currently stored */
-	u32 good_compress;	/* % of pages with compression ratio<=50% */
-	u32 pages_expand;	/* % of incompressible pages */
+	atomic_t pages_zero;	/* no. of zero filled pages */
+	atomic_t pages_stored;	/* no. of pages currently stored */
+	atomic_t good_compress;	/* % of pages with compression ratio<=50% */
+	atomic_t pages_expand;	/* % of incompressible pages */
+};
+
+/* Per-cpu counters, exported through the cpu_stat sysfs node */
+enum zram_cpu_stat_item {
+	ZRAM_CPU_READS,		/* pages read */
+	ZRAM_CPU_WRITES,	/* pages written */
+	ZRAM_CPU_STREAM_WAIT,	/* waits for a busy compression stream */
+	ZRAM_CPU_SLOT_WAIT,	/* waits for a locked table entry */
+	NR_ZRAM_CPU_STATS,
+};
+
+struct zram_cpu_stats {
+	u64 count[NR_ZRAM_CPU_STATS];
+	struct u64_stats_sync syncp;
+};
+
+/*
+ * Compression workspace.  There is one per possible cpu, a writer uses
+ * the one of the cpu it runs on; the mutex only matters when a writer
+ * is preempted or migrates while compressing.
+ */
+struct zram_stream {
+	struct mutex lock;
+	void *workmem;
+	void *buffer;
 };
 
 struct zram {
+	enum zram_allocator allocator;
 	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *zs_pool;
+	struct zram_stream __percpu *streams;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
+	struct zram_cpu_stats __percpu *cpu_stats;
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -128,5 +174,6 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern u64 zram_get_pool_size(struct zram *zram);
 
 #endif
@@ -14,10 +14,16 @@
 
 #include <linux/device.h>
 #include <linux/genhd.h>
+#include <linux/math64.h>
 #include <linux/mm.h>
 
 #include "zram_drv.h"
 
+static const char * const zram_allocator_names[__NR_ZRAM_ALLOCATORS] = {
+	[ZRAM_XVMALLOC] = "xvmalloc",
+	[ZRAM_ZSMALLOC] = "zsmalloc",
+};
+
 static u64 zram_stat64_read(struct zram *zram, u64 *v)
 {
 	u64 val;
@@ -72,6 +78,47 @@ static ssize_t disksize_store(struct device *dev,
 	return len;
 }
 
+static ssize_t allocator_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	int i;
+	ssize_t len = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	for (i = 0; i < __NR_ZRAM_ALLOCATORS; i++) {
+		if (i == zram->allocator)
+			len += sprintf(buf + len, "[%s] ",
+				zram_allocator_names[i]);
+		else
+			len += sprintf(buf + len, "%s ",
+				zram_allocator_names[i]);
+	}
+	buf[len - 1] = '\n';
+
+	return len;
+}
+
+static ssize_t allocator_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int i;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (zram->init_done) {
+		pr_info("Cannot change allocator for initialized device\n");
+		return -EBUSY;
+	}
+
+	for (i = 0; i < __NR_ZRAM_ALLOCATORS; i++) {
+		if (sysfs_streq(buf, zram_allocator_names[i])) {
+			zram->allocator = i;
+			return len;
+		}
+	}
+
+	return -EINVAL;
+}
+
 static ssize_t initstate_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
@@ -153,7 +200,7 @@ static ssize_t zero_pages_show(struct device *dev,
 {
 	struct zram *zram = dev_to_zram(dev);
 
-	return sprintf(buf, "%u\n", zram->stats.pages_zero);
+	return sprintf(buf, "%u\n", atomic_read(&zram->stats.pages_zero));
 }
 
 static ssize_t orig_data_size_show(struct device *dev,
@@ -162,7 +209,7 @@ static ssize_t orig_data_size_show(struct device *dev,
 	struct zram *zram = dev_to_zram(dev);
 
 	return sprintf(buf, "%llu\n",
-		(u64)(zram->stats.pages_stored) << PAGE_SHIFT);
+		(u64)atomic_read(&zram->stats.pages_stored) << PAGE_SHIFT);
 }
 
 static ssize_t compr_data_size_show(struct device *dev,
@@ -181,15 +228,101 @@ static ssize_t mem_used_total_show(struct device *dev,
 	struct zram *zram = dev_to_zram(dev);
 
 	if (zram->init_done) {
-		val = xv_get_total_size_bytes(zram->mem_pool) +
-			((u64)(zram->stats.pages_expand) << PAGE_SHIFT);
+		val = zram_get_pool_size(zram) +
+			((u64)atomic_read(&zram->stats.pages_expand) <<
+				PAGE_SHIFT);
+	}
+
+	return sprintf(buf, "%llu\n", val);
+}
+
+static ssize_t compact_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	if (zram->allocator != ZRAM_ZSMALLOC)
+		return -EINVAL;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done)
+		zs_compact(zram->zs_pool);
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t mem_compacted_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	u64 val = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (zram->init_done && zram->allocator == ZRAM_ZSMALLOC)
+		val = zs_get_compacted_bytes(zram->zs_pool);
+
+	return sprintf(buf, "%llu\n", val);
+}
+
+/*
+ * Percentage of the allocator's memory that does not hold compressed
+ * data.  Incompressible pages are stored outside the allocator and are
+ * not counted.
+ */
+static ssize_t frag_ratio_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	u64 pool, stored, val = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (zram->init_done) {
+		pool = zram_get_pool_size(zram);
+		stored = zram_stat64_read(zram, &zram->stats.compr_size) -
+			((u64)atomic_read(&zram->stats.pages_expand) <<
+				PAGE_SHIFT);
+		if (pool > stored)
+			val = div64_u64((pool - stored) * 100, pool);
 	}
 
 	return sprintf(buf, "%llu\n", val);
 }
 
+/*
+ * One line per online cpu:
+ *   <cpu> <pages read> <pages written> <stream waits> <table entry waits>
+ */
+static ssize_t cpu_stat_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	int cpu, i;
+	unsigned int start;
+	ssize_t len = 0;
+	u64 count[NR_ZRAM_CPU_STATS];
+	struct zram_cpu_stats *stats;
+	struct zram *zram = dev_to_zram(dev);
+
+	for_each_online_cpu(cpu) {
+		stats = per_cpu_ptr(zram->cpu_stats, cpu);
+		do {
+			start = u64_stats_fetch_begin(&stats->syncp);
+			for (i = 0; i < NR_ZRAM_CPU_STATS; i++)
+				count[i] = stats->count[i];
+		} while (u64_stats_fetch_retry(&stats->syncp, start));
+
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+			"%d %llu %llu %llu %llu\n", cpu,
+			count[ZRAM_CPU_READS], count[ZRAM_CPU_WRITES],
+			count[ZRAM_CPU_STREAM_WAIT],
+			count[ZRAM_CPU_SLOT_WAIT]);
+	}
+
+	return len;
+}
+
 static DEVICE_ATTR(disksize, S_IRUGO | S_IWUSR,
 		disksize_show, disksize_store);
+static DEVICE_ATTR(allocator, S_IRUGO | S_IWUSR,
+		allocator_show, allocator_store);
 static DEVICE_ATTR(initstate, S_IRUGO, initstate_show, NULL);
 static DEVICE_ATTR(reset, S_IWUSR, NULL, reset_store);
 static DEVICE_ATTR(num_reads, S_IRUGO, num_reads_show, NULL);
@@ -200,9 +333,14 @@ static DEVICE_ATTR(zero_pages, S_IRUGO, zero_pages_show, NULL);
 static DEVICE_ATTR(orig_data_size, S_IRUGO, orig_data_size_show, NULL);
 static DEVICE_ATTR(compr_data_size, S_IRUGO, compr_data_size_show, NULL);
 static DEVICE_ATTR(mem_used_total, S_IRUGO, mem_used_total_show, NULL);
+static DEVICE_ATTR(compact, S_IWUSR, NULL, compact_store);
+static DEVICE_ATTR(mem_compacted, S_IRUGO, mem_compacted_show, NULL);
+static DEVICE_ATTR(frag_ratio, S_IRUGO, frag_ratio_show, NULL);
+static DEVICE_ATTR(cpu_stat, S_IRUGO, cpu_stat_show, NULL);
 
 static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_disksize.attr,
+	&dev_attr_allocator.attr,
 	&dev_attr_initstate.attr,
 	&dev_attr_reset.attr,
 	&dev_attr_num_reads.attr,
@@ -213,6 +351,10 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_orig_data_size.attr,
 	&dev_attr_compr_data_size.attr,
 	&dev_attr_mem_used_total.attr,
+	&dev_attr_compact.attr,
+	&dev_attr_mem_compacted.attr,
+	&dev_attr_frag_ratio.attr,
+	&dev_attr_cpu_stat.attr,
 	NULL,
 };
 
@@ -0,0 +1,686 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Objects are allocated from size classes, each of which carves fixed
+ * size slots out of zspages of one to ZS_MAX_PAGES_PER_ZSPAGE order-0
+ * pages.  Users only ever see handles, so objects can be moved between
+ * zspages of a class to give back memory once a workload has left many
+ * of them sparsely used.
+ */
+
+#ifdef CONFIG_ZRAM_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+static DEFINE_MUTEX(zs_handle_cache_lock);
+static struct kmem_cache *zs_handle_cache;
+static int zs_handle_cache_users;
+
+static int get_size_class_index(u32 size)
+{
+	if (size <= ZS_MIN_ALLOC_SIZE)
+		return 0;
+
+	return DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE, ZS_SIZE_CLASS_DELTA);
+}
+
+/*
+ * Pick the number of pages per zspage that wastes the least space at
+ * the end of the zspage.
+ */
+static int get_pages_per_zspage(u32 size)
+{
+	int i, best = 1;
+	u32 waste, min_waste = PAGE_SIZE;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		waste = (i * PAGE_SIZE) % size;
+		if (waste * best < min_waste * i) {
+			min_waste = waste;
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+static void zs_pin_handle(struct zs_handle *handle)
+{
+	bit_spin_lock(ZS_HANDLE_PIN_BIT, &handle->idx);
+}
+
+static int zs_trypin_handle(struct zs_handle *handle)
+{
+	return bit_spin_trylock(ZS_HANDLE_PIN_BIT, &handle->idx);
+}
+
+static void zs_unpin_handle(struct zs_handle *handle)
+{
+	bit_spin_unlock(ZS_HANDLE_PIN_BIT, &handle->idx);
+}
+
+static u32 handle_idx(struct zs_handle *handle)
+{
+	return handle->idx >> ZS_HANDLE_IDX_SHIFT;
+}
+
+/*
+ * The head word of an object never straddles a page: objects start at
+ * multiples of ZS_SIZE_CLASS_DELTA.
+ */
+static unsigned long read_head(struct zspage *zspage, u32 idx)
+{
+	unsigned long off = idx * zspage->class->size;
+	unsigned long head;
+	void *vaddr;
+
+	vaddr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT], KM_USER0);
+	head = *(unsigned long *)(vaddr + (off & ~PAGE_MASK));
+	kunmap_atomic(vaddr, KM_USER0);
+
+	return head;
+}
+
+static void write_head(struct zspage *zspage, u32 idx, unsigned long head)
+{
+	unsigned long off = idx * zspage->class->size;
+	void *vaddr;
+
+	vaddr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT], KM_USER0);
+	*(unsigned long *)(vaddr + (off & ~PAGE_MASK)) = head;
+	kunmap_atomic(vaddr, KM_USER0);
+}
+
+/*
+ * Copy len bytes at offset off of a zspage to or from buf, a page at a
+ * time.
+ */
+static void zs_copy(struct zspage *zspage, unsigned long off, char *buf,
+			u32 len, int to_zspage)
+{
+	u32 chunk;
+	void *vaddr;
+
+	while (len) {
+		chunk = min_t(u32, len, PAGE_SIZE - (off & ~PAGE_MASK));
+		vaddr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT],
+					KM_USER1);
+		if (to_zspage)
+			memcpy(vaddr + (off & ~PAGE_MASK), buf, chunk);
+		else
+			memcpy(buf, vaddr + (off & ~PAGE_MASK), chunk);
+		kunmap_atomic(vaddr, KM_USER1);
+
+		off += chunk;
+		buf += chunk;
+		len -= chunk;
+	}
+}
+
+static int get_fullness_group(struct size_class *class, struct zspage *zspage)
+{
+	int max_objs = class->objs_per_zspage;
+
+	if (zspage->inuse == 0)
+		return ZS_EMPTY;
+	if (zspage->inuse == max_objs)
+		return ZS_FULL;
+	if (zspage->inuse <= max_objs * (ZS_FULLNESS_FRAC - 1) /
+					ZS_FULLNESS_FRAC)
+		return ZS_ALMOST_EMPTY;
+
+	return ZS_ALMOST_FULL;
+}
+
+/*
+ * Move zspage to the fullness list matching its use.  Empty zspages
+ * are only taken off their list; freeing them is up to the caller.
+ */
+static int fix_fullness_group(struct size_class *class, struct zspage *zspage)
+{
+	int fullness = get_fullness_group(class, zspage);
+
+	if (fullness == zspage->fullness)
+		return fullness;
+
+	list_del(&zspage->list);
+	if (fullness != ZS_EMPTY)
+		list_add(&zspage->list, &class->fullness_list[fullness]);
+	zspage->fullness = fullness;
+
+	return fullness;
+}
+
+static struct zspage *find_zspage(struct size_class *class,
+				struct zspage *exclude, int first, int last)
+{
+	int i;
+	struct zspage *zspage;
+
+	for (i = first; i <= last; i++) {
+		list_for_each_entry(zspage, &class->fullness_list[i], list) {
+			if (zspage != exclude)
+				return zspage;
+		}
+	}
+
+	return NULL;
+}
+
+static void free_zspage(struct zs_pool *pool, struct zspage *zspage)
+{
+	int i;
+
+	for (i = 0; i < zspage->class->pages_per_zspage; i++)
+		__free_page(zspage->pages[i]);
+
+	atomic_long_sub(zspage->class->pages_per_zspage, &pool->total_pages);
+	kfree(zspage);
+}
+
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+				struct size_class *class, gfp_t flags)
+{
+	int i;
+	struct zspage *zspage;
+
+	zspage = kzalloc(sizeof(*zspage), flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	zspage->class = class;
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->fullness = ZS_EMPTY;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(flags);
+		if (!zspage->pages[i])
+			goto fail;
+	}
+
+	/* Chain all objects on the free list */
+	for (i = 0; i < class->objs_per_zspage; i++) {
+		u32 next = i + 1 < class->objs_per_zspage ? i + 1 : ZS_OBJ_END;
+
+		write_head(zspage, i, (next << ZS_OBJ_IDX_SHIFT) | ZS_OBJ_FREE);
+	}
+	zspage->freeobj = 0;
+
+	atomic_long_add(class->pages_per_zspage, &pool->total_pages);
+	return zspage;
+
+fail:
+	while (i--)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+	return NULL;
+}
+
+static u32 obj_alloc(struct zspage *zspage, struct zs_handle *handle)
+{
+	u32 idx = zspage->freeobj;
+
+	zspage->freeobj = read_head(zspage, idx) >> ZS_OBJ_IDX_SHIFT;
+	write_head(zspage, idx, (unsigned long)handle);
+	zspage->inuse++;
+
+	return idx;
+}
+
+static void obj_free(struct zspage *zspage, u32 idx)
+{
+	write_head(zspage, idx,
+		((unsigned long)zspage->freeobj << ZS_OBJ_IDX_SHIFT) |
+		ZS_OBJ_FREE);
+	zspage->freeobj = idx;
+	zspage->inuse--;
+}
+
+/* Number of zspages compaction could give back */
+static unsigned long zs_can_compact(struct size_class *class)
+{
+	unsigned long obj_wasted;
+
+	obj_wasted = class->nr_zspages * class->objs_per_zspage -
+			class->nr_objs_used;
+
+	return obj_wasted / class->objs_per_zspage;
+}
+
+/**
+ * zs_malloc - Allocate object of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of object to allocate
+ * @flags: gfp flags for any pages that have to be added to the pool
+ *
+ * Returns a handle for the object, to be passed to zs_map_object and
+ * zs_free, or 0 on failure.
+ *
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE
+ * will fail.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, u32 size, gfp_t flags)
+{
+	u32 idx;
+	struct zspage *zspage;
+	struct zs_handle *handle;
+	struct size_class *class;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE))
+		return 0;
+
+	handle = kmem_cache_alloc(zs_handle_cache, flags & ~__GFP_HIGHMEM);
+	if (!handle)
+		return 0;
+
+	class = &pool->size_class[get_size_class_index(size + ZS_HANDLE_SIZE)];
+
+	spin_lock(&class->lock);
+	zspage = find_zspage(class, NULL, ZS_ALMOST_EMPTY, ZS_ALMOST_FULL);
+
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class, flags);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(zs_handle_cache, handle);
+			return 0;
+		}
+
+		spin_lock(&class->lock);
+		class->nr_zspages++;
+	}
+
+	idx = obj_alloc(zspage, handle);
+	handle->zspage = zspage;
+	handle->idx = idx << ZS_HANDLE_IDX_SHIFT;
+	class->nr_objs_used++;
+	fix_fullness_group(class, zspage);
+
+	spin_unlock(&class->lock);
+
+	return (unsigned long)handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long obj)
+{
+	int fullness, compact;
+	struct zspage *zspage;
+	struct size_class *class;
+	struct zs_handle *handle = (struct zs_handle *)obj;
+
+	if (unlikely(!handle))
+		return;
+
+	/* Keep compaction from moving the object under us */
+	zs_pin_handle(handle);
+	zspage = handle->zspage;
+	class = zspage->class;
+
+	spin_lock(&class->lock);
+	obj_free(zspage, handle_idx(handle));
+	class->nr_objs_used--;
+	fullness = fix_fullness_group(class, zspage);
+	if (fullness == ZS_EMPTY)
+		class->nr_zspages--;
+	compact = zs_can_compact(class) >= ZS_COMPACT_THRESHOLD;
+	spin_unlock(&class->lock);
+
+	zs_unpin_handle(handle);
+	kmem_cache_free(zs_handle_cache, handle);
+
+	if (fullness == ZS_EMPTY)
+		free_zspage(pool, zspage);
+
+	if (compact)
+		schedule_work(&pool->compact_work);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: whether the object is read, written or both
+ *
+ * Only one object can be mapped per cpu at a time, and the caller
+ * must not sleep until it calls zs_unmap_object.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long obj,
+			enum zs_mapmode mm)
+{
+	unsigned long off;
+	struct zspage *zspage;
+	struct zs_map_area *area;
+	struct zs_handle *handle = (struct zs_handle *)obj;
+
+	zs_pin_handle(handle);
+	zspage = handle->zspage;
+	off = handle_idx(handle) * zspage->class->size;
+
+	area = this_cpu_ptr(pool->map_area);
+	area->mm = mm;
+
+	if ((off & ~PAGE_MASK) + zspage->class->size <= PAGE_SIZE) {
+		area->vaddr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT],
+					KM_USER1);
+		return area->vaddr + (off & ~PAGE_MASK) + ZS_HANDLE_SIZE;
+	}
+
+	/* The object straddles two pages, bounce it */
+	area->vaddr = NULL;
+	if (mm != ZS_MM_WO)
+		zs_copy(zspage, off + ZS_HANDLE_SIZE, area->buf,
+			zspage->class->size - ZS_HANDLE_SIZE, 0);
+
+	return area->buf;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long obj)
+{
+	unsigned long off;
+	struct zspage *zspage;
+	struct zs_map_area *area;
+	struct zs_handle *handle = (struct zs_handle *)obj;
+
+	area = this_cpu_ptr(pool->map_area);
+
+	if (area->vaddr) {
+		kunmap_atomic(area->vaddr, KM_USER1);
+	} else if (area->mm != ZS_MM_RO) {
+		zspage = handle->zspage;
+		off = handle_idx(handle) * zspage->class->size;
+		zs_copy(zspage, off + ZS_HANDLE_SIZE, area->buf,
+			zspage->class->size - ZS_HANDLE_SIZE, 1);
+	}
+
+	zs_unpin_handle(handle);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+/*
+ * Move object idx of src to dst.  Called with the class lock and the
+ * object's handle held.
+ */
+static void migrate_object(struct size_class *class, struct zspage *src,
+			u32 idx, struct zspage *dst, struct zs_handle *handle)
+{
+	u32 len, chunk, new_idx;
+	unsigned long s_off, d_off;
+	void *s_addr, *d_addr;
+
+	new_idx = obj_alloc(dst, handle);
+
+	s_off = idx * class->size + ZS_HANDLE_SIZE;
+	d_off = new_idx * class->size + ZS_HANDLE_SIZE;
+	len = class->size - ZS_HANDLE_SIZE;
+
+	while (len) {
+		chunk = min_t(u32, len, PAGE_SIZE - (s_off & ~PAGE_MASK));
+		chunk = min_t(u32, chunk, PAGE_SIZE - (d_off & ~PAGE_MASK));
+
+		s_addr = kmap_atomic(src->pages[s_off >> PAGE_SHIFT],
+					KM_USER0);
+		d_addr = kmap_atomic(dst->pages[d_off >> PAGE_SHIFT],
+					KM_USER1);
+		memcpy(d_addr + (d_off & ~PAGE_MASK),
+			s_addr + (s_off & ~PAGE_MASK), chunk);
+		kunmap_atomic(d_addr, KM_USER1);
+		kunmap_atomic(s_addr, KM_USER0);
+
+		s_off += chunk;
+		d_off += chunk;
+		len -= chunk;
+	}
+
+	obj_free(src, idx);
+
+	/* Still pinned, the caller drops the pin */
+	handle->zspage = dst;
+	handle->idx = (new_idx << ZS_HANDLE_IDX_SHIFT) |
+			BIT(ZS_HANDLE_PIN_BIT);
+}
+
+/*
+ * Move as many objects out of src as other zspages of the class have
+ * room for.  Pinned objects are left where they are.
+ */
+static void migrate_zspage(struct size_class *class, struct zspage *src)
+{
+	u32 idx;
+	unsigned long head;
+	struct zspage *dst;
+	struct zs_handle *handle;
+
+	for (idx = 0; idx < class->objs_per_zspage && src->inuse; idx++) {
+		head = read_head(src, idx);
+		if (head & ZS_OBJ_FREE)
+			continue;
+
+		dst = find_zspage(class, src, ZS_ALMOST_FULL, ZS_ALMOST_EMPTY);
+		if (!dst)
+			break;
+
+		handle = (struct zs_handle *)head;
+		if (!zs_trypin_handle(handle))
+			continue;
+
+		migrate_object(class, src, idx, dst, handle);
+		zs_unpin_handle(handle);
+
+		fix_fullness_group(class, dst);
+	}
+}
+
+static unsigned long compact_class(struct zs_pool *pool,
+				struct size_class *class)
+{
+	unsigned long freed = 0;
+	struct zspage *src;
+
+	spin_lock(&class->lock);
+	while (zs_can_compact(class)) {
+		src = find_zspage(class, NULL, ZS_ALMOST_EMPTY, ZS_ALMOST_FULL);
+		if (!src)
+			break;
+
+		migrate_zspage(class, src);
+		if (fix_fullness_group(class, src) != ZS_EMPTY)
+			break;
+
+		class->nr_zspages--;
+		spin_unlock(&class->lock);
+
+		free_zspage(pool, src);
+		freed += class->pages_per_zspage;
+		cond_resched();
+
+		spin_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - Move objects to free sparsely used zspages.
+ * @pool: pool to compact
+ *
+ * Returns the number of pages given back.  This also runs from a
+ * work item whenever zs_free leaves a size class with enough free
+ * space to release ZS_COMPACT_THRESHOLD zspages.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long freed = 0;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--)
+		freed += compact_class(pool, &pool->size_class[i]);
+
+	atomic_long_add(freed, &pool->compacted_pages);
+	pr_debug("compaction freed %lu pages\n", freed);
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+static void zs_compact_work(struct work_struct *work)
+{
+	struct zs_pool *pool = container_of(work, struct zs_pool,
+					compact_work);
+
+	zs_compact(pool);
+}
+
+static int zs_get_handle_cache(void)
+{
+	int ret = 0;
+
+	mutex_lock(&zs_handle_cache_lock);
+	if (!zs_handle_cache_users) {
+		zs_handle_cache = kmem_cache_create("zs_handle",
+				sizeof(struct zs_handle), 0, 0, NULL);
+		if (!zs_handle_cache)
+			ret = -ENOMEM;
+	}
+	if (!ret)
+		zs_handle_cache_users++;
+	mutex_unlock(&zs_handle_cache_lock);
+
+	return ret;
+}
+
+static void zs_put_handle_cache(void)
+{
+	mutex_lock(&zs_handle_cache_lock);
+	if (!--zs_handle_cache_users) {
+		kmem_cache_destroy(zs_handle_cache);
+		zs_handle_cache = NULL;
+	}
+	mutex_unlock(&zs_handle_cache_lock);
+}
+
+static void zs_free_map_areas(struct zs_pool *pool)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu_ptr(pool->map_area, cpu)->buf);
+
+	free_percpu(pool->map_area);
+}
+
+/*
+ * Create a memory pool. Sets up the size classes and the per-cpu
+ * buffers used to map objects straddling a page boundary.
+ */
+struct zs_pool *zs_create_pool(void)
+{
+	int i, cpu;
+	u32 ovhd_size;
+	struct zs_pool *pool;
+	struct size_class *class;
+
+	ovhd_size = roundup(sizeof(*pool), PAGE_SIZE);
+	pool = kzalloc(ovhd_size, GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		int fullness;
+
+		class = &pool->size_class[i];
+		spin_lock_init(&class->lock);
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage * PAGE_SIZE /
+						class->size;
+		for (fullness = 0; fullness < __NR_FULLNESS_GROUPS; fullness++)
+			INIT_LIST_HEAD(&class->fullness_list[fullness]);
+	}
+
+	INIT_WORK(&pool->compact_work, zs_compact_work);
+
+	pool->map_area = alloc_percpu(struct zs_map_area);
+	if (!pool->map_area)
+		goto free_pool;
+
+	for_each_possible_cpu(cpu) {
+		struct zs_map_area *area = per_cpu_ptr(pool->map_area, cpu);
+
+		area->buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		if (!area->buf)
+			goto free_areas;
+	}
+
+	if (zs_get_handle_cache())
+		goto free_areas;
+
+	return pool;
+
+free_areas:
+	zs_free_map_areas(pool);
+free_pool:
+	kfree(pool);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i;
+
+	cancel_work_sync(&pool->compact_work);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		if (pool->size_class[i].nr_zspages)
+			pr_info("Freeing non-empty class with size %u\n",
+				pool->size_class[i].size);
+	}
+
+	zs_free_map_areas(pool);
+	zs_put_handle_cache();
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+/*
+ * Returns total memory used by allocator (userdata + metadata)
+ */
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->total_pages) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+/*
+ * Returns memory given back by compaction since the pool was created
+ */
+u64 zs_get_compacted_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->compacted_pages) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_compacted_bytes);
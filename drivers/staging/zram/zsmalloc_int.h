@@ -0,0 +1,120 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+/* User configurable params */
+
+/* Size classes are separated by this many bytes, must be >= 16 */
+#if PAGE_SHIFT > 12
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 8)
+#else
+#define ZS_SIZE_CLASS_DELTA	16
+#endif
+
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+#define ZS_SIZE_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) \
+					/ ZS_SIZE_CLASS_DELTA + 1)
+
+/*
+ * A zspage is a group of up to this many (not necessarily contiguous)
+ * pages that objects of one size class are carved from.  Objects may
+ * straddle the pages of a zspage.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+/* A zspage is almost empty while at most 3/4 of its objects are used */
+#define ZS_FULLNESS_FRAC	4
+
+/*
+ * Background compaction is kicked once the free objects of a size
+ * class add up to this many zspages.
+ */
+#define ZS_COMPACT_THRESHOLD	4
+
+/* End of user params */
+
+/*
+ * Every object starts with a word that holds the handle pointing to it
+ * while allocated, or ZS_OBJ_FREE and the index of the next free object
+ * while free.  Handles are aligned, so bit 0 tells the two apart.
+ */
+#define ZS_HANDLE_SIZE		sizeof(unsigned long)
+#define ZS_OBJ_FREE		1UL
+#define ZS_OBJ_IDX_SHIFT	1
+#define ZS_OBJ_END		0xffff
+
+enum fullness_group {
+	ZS_ALMOST_EMPTY,
+	ZS_ALMOST_FULL,
+	ZS_FULL,
+	__NR_FULLNESS_GROUPS,
+	ZS_EMPTY = __NR_FULLNESS_GROUPS,
+};
+
+struct size_class;
+
+struct zspage {
+	struct size_class *class;
+	struct list_head list;		/* in class->fullness_list */
+	u16 inuse;			/* allocated objects */
+	u16 freeobj;			/* first free object */
+	u8 fullness;
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+};
+
+/*
+ * A handle names an object independently of where it is stored, so
+ * compaction can move objects.  Bit 0 of idx pins the object: it is
+ * held while the object is mapped or freed and compaction skips
+ * pinned objects.
+ */
+#define ZS_HANDLE_PIN_BIT	0
+#define ZS_HANDLE_IDX_SHIFT	1
+
+struct zs_handle {
+	struct zspage *zspage;
+	unsigned long idx;
+};
+
+struct size_class {
+	spinlock_t lock;
+	u32 size;
+	u16 pages_per_zspage;
+	u16 objs_per_zspage;
+	struct list_head fullness_list[__NR_FULLNESS_GROUPS];
+	unsigned long nr_zspages;
+	unsigned long nr_objs_used;
+};
+
+/* Used to map objects that straddle a page boundary */
+struct zs_map_area {
+	char *buf;
+	char *vaddr;		/* kmap address if not straddling */
+	enum zs_mapmode mm;
+};
+
+struct zs_pool {
+	struct size_class size_class[ZS_SIZE_CLASSES];
+	struct zs_map_area __percpu *map_area;
+	struct work_struct compact_work;
+	atomic_long_t total_pages;	/* stats */
+	atomic_long_t compacted_pages;
+};
+
+#endif
@@ -372,25 +372,35 @@ mpage_readpages(struct address_space *mapping, struct list_head *pages,
 	struct buffer_head map_bh;
 	unsigned long first_logical_block = 0;
 	struct blk_plug plug;
+	struct pagevec pvec;
 
 	blk_start_plug(&plug);
 
 	map_bh.b_state = 0;
 	map_bh.b_size = 0;
+	pagevec_init(&pvec, 0);
 	for (page_idx = 0; page_idx < nr_pages; page_idx++) {
 		struct page *page = list_entry(pages->prev, struct page, lru);
+		unsigned first, i;
 
 		prefetchw(&page->flags);
 		list_del(&page->lru);
-		if (!add_to_page_cache_lru(page, mapping,
-					page->index, GFP_KERNEL)) {
+		if (pagevec_add(&pvec, page) && page_idx < nr_pages - 1)
+			continue;
+
+		/* Pages in the batch, and so left to read, from the first on */
+		first = page_idx + 1 - pagevec_count(&pvec);
+		add_to_page_cache_lru_vec(&pvec, mapping, GFP_KERNEL);
+		for (i = 0; i < pagevec_count(&pvec); i++) {
+			page = pvec.pages[i];
 			bio = do_mpage_readpage(bio, page,
-					nr_pages - page_idx,
+					nr_pages - first - i,
 					&last_block_in_bio, &map_bh,
 					&first_logical_block,
 					get_block);
+			page_cache_release(page);
 		}
-		page_cache_release(page);
+		pagevec_reinit(&pvec);
 	}
 	BUG_ON(!list_empty(pages));
 	if (bio)
@@ -25,11 +25,16 @@
 #include <linux/mutex.h>
 #include <linux/slab.h>
 #include <linux/buffer_head.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
 #include "decompressor.h"
 #include "squashfs.h"
+#include "page_actor.h"
 
 /*
  * This file (and decompressor.h) implements a decompressor framework for
@@ -77,11 +82,175 @@ const struct squashfs_decompressor *squashfs_lookup_decompressor(int id)
 }
 
 
+/*
+ * Decompressor streams are shared between readers in one of three ways,
+ * selected at mount time (see enum squashfs_decomp_mode).
+ *
+ * In single and multi mode idle streams sit on a list.  A reader takes
+ * one off the list, or, if the list is empty and fewer than max_streams
+ * exist, creates a new one; otherwise it sleeps until a stream is put
+ * back.  Single mode is simply a pool of one stream created at mount
+ * time, and behaves like the old read_data_mutex.
+ *
+ * In percpu mode every possible cpu has its own stream.  A reader uses
+ * the stream of the cpu it is running on, holding that stream's mutex
+ * as it may sleep or be migrated while decompressing.
+ */
+struct squashfs_stream_entry {
+	void			*stream;
+	struct list_head	list;
+	struct mutex		mutex;
+};
+
+struct squashfs_stream {
+	int			mode;
+	void			*comp_opts;
+	int			comp_opts_len;
+	spinlock_t		lock;
+	struct list_head	idle;
+	int			created;
+	int			max_streams;
+	wait_queue_head_t	wait;
+	struct squashfs_stream_entry __percpu *percpu;
+};
+
+
+static struct squashfs_stream_entry *stream_entry_alloc(
+	struct squashfs_sb_info *msblk, struct squashfs_stream *stream)
+{
+	struct squashfs_stream_entry *entry;
+
+	entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+	if (entry == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	entry->stream = msblk->decompressor->init(msblk, stream->comp_opts,
+		stream->comp_opts_len);
+	if (IS_ERR(entry->stream)) {
+		int err = PTR_ERR(entry->stream);
+
+		kfree(entry);
+		return ERR_PTR(err);
+	}
+
+	return entry;
+}
+
+
+static struct squashfs_stream_entry *get_stream(struct squashfs_sb_info *msblk,
+	struct squashfs_stream *stream)
+{
+	struct squashfs_stream_entry *entry;
+
+	spin_lock(&stream->lock);
+	while (1) {
+		if (!list_empty(&stream->idle)) {
+			entry = list_entry(stream->idle.next,
+				struct squashfs_stream_entry, list);
+			list_del(&entry->list);
+			break;
+		}
+
+		if (stream->created < stream->max_streams) {
+			stream->created++;
+			spin_unlock(&stream->lock);
+
+			entry = stream_entry_alloc(msblk, stream);
+
+			spin_lock(&stream->lock);
+			if (!IS_ERR(entry))
+				break;
+
+			/*
+			 * Out of memory, make do with the streams we have
+			 * (there is always at least one).
+			 */
+			stream->created--;
+		}
+
+		spin_unlock(&stream->lock);
+		wait_event(stream->wait, !list_empty(&stream->idle));
+		spin_lock(&stream->lock);
+	}
+	spin_unlock(&stream->lock);
+
+	return entry;
+}
+
+
+static void put_stream(struct squashfs_stream *stream,
+	struct squashfs_stream_entry *entry)
+{
+	spin_lock(&stream->lock);
+	list_add(&entry->list, &stream->idle);
+	spin_unlock(&stream->lock);
+
+	wake_up(&stream->wait);
+}
+
+
+static int stream_percpu_init(struct squashfs_sb_info *msblk,
+	struct squashfs_stream *stream)
+{
+	struct squashfs_stream_entry *entry;
+	int cpu, err;
+
+	stream->percpu = alloc_percpu(struct squashfs_stream_entry);
+	if (stream->percpu == NULL)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		entry = per_cpu_ptr(stream->percpu, cpu);
+		mutex_init(&entry->mutex);
+		entry->stream = msblk->decompressor->init(msblk,
+			stream->comp_opts, stream->comp_opts_len);
+		if (IS_ERR(entry->stream)) {
+			err = PTR_ERR(entry->stream);
+			entry->stream = NULL;
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+
+static void stream_free(struct squashfs_sb_info *msblk,
+	struct squashfs_stream *stream)
+{
+	struct squashfs_stream_entry *entry;
+	int cpu;
+
+	if (stream->percpu) {
+		for_each_possible_cpu(cpu) {
+			entry = per_cpu_ptr(stream->percpu, cpu);
+			if (entry->stream)
+				msblk->decompressor->free(entry->stream);
+		}
+		free_percpu(stream->percpu);
+	}
+
+	while (!list_empty(&stream->idle)) {
+		entry = list_entry(stream->idle.next,
+			struct squashfs_stream_entry, list);
+		list_del(&entry->list);
+		msblk->decompressor->free(entry->stream);
+		kfree(entry);
+	}
+
+	kfree(stream->comp_opts);
+	kfree(stream);
+}
+
+
 void *squashfs_decompressor_init(struct super_block *sb, unsigned short flags)
 {
 	struct squashfs_sb_info *msblk = sb->s_fs_info;
-	void *strm, *buffer = NULL;
-	int length = 0;
+	struct squashfs_stream *stream;
+	struct squashfs_stream_entry *entry;
+	struct squashfs_page_actor actor;
+	void *buffer = NULL;
+	int length = 0, err;
 
 	/*
 	 * Read decompressor specific options from file system if present
@@ -91,20 +260,101 @@ void *squashfs_decompressor_init(struct super_block *sb, unsigned short flags)
 		if (buffer == NULL)
 			return ERR_PTR(-ENOMEM);
 
-		length = squashfs_read_data(sb, &buffer,
+		squashfs_actor_init(&actor, &buffer, 1);
+		length = squashfs_read_data(sb, &actor,
 			sizeof(struct squashfs_super_block), 0, NULL,
-			PAGE_CACHE_SIZE, 1);
+			PAGE_CACHE_SIZE);
 
 		if (length < 0) {
-			strm = ERR_PTR(length);
-			goto finished;
+			kfree(buffer);
+			return ERR_PTR(length);
 		}
 	}
 
-	strm = msblk->decompressor->init(msblk, buffer, length);
+	stream = kzalloc(sizeof(*stream), GFP_KERNEL);
+	if (stream == NULL) {
+		kfree(buffer);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	/* Kept for streams created after mount */
+	stream->comp_opts = buffer;
+	stream->comp_opts_len = length;
+	stream->mode = msblk->decomp_mode;
+	spin_lock_init(&stream->lock);
+	INIT_LIST_HEAD(&stream->idle);
+	init_waitqueue_head(&stream->wait);
+
+	switch (stream->mode) {
+	case SQUASHFS_DECOMP_PERCPU:
+		err = stream_percpu_init(msblk, stream);
+		if (err)
+			goto failed;
+		return stream;
+	case SQUASHFS_DECOMP_MULTI:
+		/*
+		 * A reader only holds a stream while it decompresses, not
+		 * while it waits for the block to be read, so there is no
+		 * use for more streams than cpus.
+		 */
+		stream->max_streams = num_online_cpus();
+		break;
+	default:
+		stream->max_streams = 1;
+		break;
+	}
+
+	/*
+	 * Create the first stream now, this also validates the compressor
+	 * options.
+	 */
+	entry = stream_entry_alloc(msblk, stream);
+	if (IS_ERR(entry)) {
+		err = PTR_ERR(entry);
+		goto failed;
+	}
+	list_add(&entry->list, &stream->idle);
+	stream->created = 1;
+
+	return stream;
+
+failed:
+	stream_free(msblk, stream);
+	return ERR_PTR(err);
+}
 
-finished:
-	kfree(buffer);
 
-	return strm;
+void squashfs_decompressor_free(struct squashfs_sb_info *msblk, void *s)
+{
+	if (msblk->decompressor && s)
+		stream_free(msblk, s);
+}
+
+
+int squashfs_decompress(struct squashfs_sb_info *msblk,
+	struct squashfs_page_actor *output, struct buffer_head **bh, int b,
+	int offset, int length, int srclength)
+{
+	struct squashfs_stream *stream = msblk->stream;
+	struct squashfs_stream_entry *entry;
+	int res;
+
+	if (stream->mode == SQUASHFS_DECOMP_PERCPU) {
+		entry = per_cpu_ptr(stream->percpu, get_cpu());
+		put_cpu();
+
+		mutex_lock(&entry->mutex);
+		res = msblk->decompressor->decompress(msblk, entry->stream,
+			output, bh, b, offset, length, srclength);
+		squashfs_finish_page(output);
+		mutex_unlock(&entry->mutex);
+	} else {
+		entry = get_stream(msblk, stream);
+		res = msblk->decompressor->decompress(msblk, entry->stream,
+			output, bh, b, offset, length, srclength);
+		squashfs_finish_page(output);
+		put_stream(stream, entry);
+	}
+
+	return res;
 }
@@ -52,6 +52,7 @@
 #include "squashfs_fs_sb.h"
 #include "squashfs_fs_i.h"
 #include "squashfs.h"
+#include "page_actor.h"
 
 /*
  * Locate cache slot in range [offset, index] for specified inode.  If
@@ -371,6 +372,95 @@ static int read_blocklist(struct inode *inode, int index, u64 *block)
 }
 
 
+/*
+ * Decompress a datablock straight into the page cache.  page[] has one
+ * slot per page in the block; filled slots are locked, not uptodate
+ * page cache pages, empty slots (pages that could not be grabbed, are
+ * already uptodate or lie beyond the end of file) decompress into a
+ * scratch buffer that is thrown away.  The decompressor maps the pages
+ * one at a time, with kmap_atomic, as it fills them.
+ *
+ * All pages other than target are unlocked and released.  On success
+ * the target page is made uptodate and unlocked as well, on failure it
+ * is left locked for the caller to deal with.
+ */
+static int squashfs_read_block_direct(struct inode *inode, struct page **page,
+	struct page *target, u64 block, int bsize)
+{
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int pages = msblk->block_size >> PAGE_CACHE_SHIFT;
+	struct squashfs_page_actor actor;
+	void *scratch = NULL;
+	int i, avail, length = -ENOMEM;
+
+	for (i = 0; i < pages; i++) {
+		if (page[i] == NULL) {
+			scratch = kmalloc(PAGE_CACHE_SIZE, GFP_KERNEL);
+			if (scratch == NULL)
+				goto release;
+			break;
+		}
+	}
+
+	squashfs_page_actor_init(&actor, page, scratch, pages);
+	length = squashfs_read_data(inode->i_sb, &actor, block, bsize, NULL,
+		msblk->block_size);
+	if (length < 0)
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
+
+	kfree(scratch);
+
+release:
+	for (i = 0; i < pages; i++) {
+		if (page[i] == NULL)
+			continue;
+
+		if (length >= 0) {
+			avail = min_t(int, max(length - i * (int)PAGE_CACHE_SIZE,
+				0), PAGE_CACHE_SIZE);
+			zero_user_segment(page[i], avail, PAGE_CACHE_SIZE);
+			SetPageUptodate(page[i]);
+		} else if (page[i] == target)
+			continue;
+
+		unlock_page(page[i]);
+		if (page[i] != target)
+			page_cache_release(page[i]);
+	}
+
+	return length < 0 ? length : 0;
+}
+
+
+/*
+ * Grab the pages of the datablock starting at start_index which are not
+ * already in page[] and still need reading.
+ */
+static void squashfs_grab_block_pages(struct inode *inode, struct page **page,
+	int start_index)
+{
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int pages = msblk->block_size >> PAGE_CACHE_SHIFT;
+	int file_pages = (i_size_read(inode) + PAGE_CACHE_SIZE - 1) >>
+		PAGE_CACHE_SHIFT;
+	int i;
+
+	for (i = 0; i < pages && start_index + i < file_pages; i++) {
+		if (page[i])
+			continue;
+
+		page[i] = grab_cache_page_nowait(inode->i_mapping,
+			start_index + i);
+		if (page[i] && PageUptodate(page[i])) {
+			unlock_page(page[i]);
+			page_cache_release(page[i]);
+			page[i] = NULL;
+		}
+	}
+}
+
+
 static int squashfs_readpage(struct file *file, struct page *page)
 {
 	struct inode *inode = page->mapping->host;
@@ -410,17 +500,26 @@ static int squashfs_readpage(struct file *file, struct page *page)
 			sparse = 1;
 		} else {
 			/*
-			 * Read and decompress datablock.
+			 * Read and decompress datablock directly into the
+			 * page cache.
 			 */
-			buffer = squashfs_get_datablock(inode->i_sb,
-								block, bsize);
-			if (buffer->error) {
-				ERROR("Unable to read page, block %llx, size %x"
-					"\n", block, bsize);
-				squashfs_cache_put(buffer);
+			struct page **block_page;
+
+			block_page = kcalloc(mask + 1, sizeof(*block_page),
+				GFP_KERNEL);
+			if (block_page == NULL)
 				goto error_out;
-			}
-			bytes = buffer->length;
+
+			block_page[page->index - start_index] = page;
+			squashfs_grab_block_pages(inode, block_page,
+				start_index);
+
+			i = squashfs_read_block_direct(inode, block_page, page,
+				block, bsize);
+			kfree(block_page);
+			if (i)
+				goto error_out;
+			return 0;
 		}
 	} else {
 		/*
@@ -496,6 +595,75 @@ out:
 }
 
 
+#define list_to_page(head) (list_entry((head)->prev, struct page, lru))
+
+/*
+ * Readahead.  The pages handed to us are grouped by datablock, so each
+ * datablock is read and decompressed once, straight into all of its
+ * pages.  Fragments, holes and read errors are left to readpage.
+ */
+static int squashfs_readpages(struct file *file, struct address_space *mapping,
+	struct list_head *pages, unsigned nr_pages)
+{
+	struct inode *inode = mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int shift = msblk->block_log - PAGE_CACHE_SHIFT;
+	int file_end = i_size_read(inode) >> msblk->block_log;
+	struct page **block_page, *page;
+	int i, index, start_index, bsize;
+	u64 block;
+
+	block_page = kcalloc(1 << shift, sizeof(*block_page), GFP_KERNEL);
+	if (block_page == NULL)
+		return -ENOMEM;
+
+	while (!list_empty(pages)) {
+		index = list_to_page(pages)->index >> shift;
+		start_index = index << shift;
+		memset(block_page, 0, sizeof(*block_page) << shift);
+
+		/* Move this datablock's pages into the page cache */
+		while (!list_empty(pages)) {
+			page = list_to_page(pages);
+			if (page->index >> shift != index)
+				break;
+
+			list_del(&page->lru);
+			if (add_to_page_cache_lru(page, mapping, page->index,
+					GFP_KERNEL)) {
+				page_cache_release(page);
+				continue;
+			}
+			block_page[page->index - start_index] = page;
+		}
+
+		bsize = 0;
+		if (index < file_end || squashfs_i(inode)->fragment_block ==
+						SQUASHFS_INVALID_BLK)
+			bsize = read_blocklist(inode, index, &block);
+
+		if (bsize > 0) {
+			squashfs_grab_block_pages(inode, block_page,
+				start_index);
+			squashfs_read_block_direct(inode, block_page, NULL,
+				block, bsize);
+			continue;
+		}
+
+		for (i = 0; i < 1 << shift; i++) {
+			if (block_page[i] == NULL)
+				continue;
+			squashfs_readpage(file, block_page[i]);
+			page_cache_release(block_page[i]);
+		}
+	}
+
+	kfree(block_page);
+	return 0;
+}
+
+
 const struct address_space_operations squashfs_aops = {
-	.readpage = squashfs_readpage
+	.readpage = squashfs_readpage,
+	.readpages = squashfs_readpages
 };
@@ -0,0 +1,92 @@
+#ifndef PAGE_ACTOR_H
+#define PAGE_ACTOR_H
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * Copyright (c) 2002, 2003, 2004, 2005, 2006, 2007, 2008, 2009
+ * Phillip Lougher <phillip@squashfs.org.uk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * page_actor.h
+ */
+
+#include <linux/highmem.h>
+
+/*
+ * Where squashfs_read_data() puts a block, one PAGE_CACHE_SIZE piece at a
+ * time: either an array of kernel buffers, or an array of page cache pages
+ * which are mapped one at a time with kmap_atomic while they are filled.
+ * Empty slots in the page array go to a scratch buffer.
+ */
+struct squashfs_page_actor {
+	void	**buffer;
+	struct page **page;
+	void	*scratch;
+	void	*pageaddr;
+	int	pages;
+	int	next_page;
+};
+
+static inline void squashfs_actor_init(struct squashfs_page_actor *actor,
+	void **buffer, int pages)
+{
+	actor->buffer = buffer;
+	actor->page = NULL;
+	actor->scratch = NULL;
+	actor->pageaddr = NULL;
+	actor->pages = pages;
+	actor->next_page = 0;
+}
+
+static inline void squashfs_page_actor_init(struct squashfs_page_actor *actor,
+	struct page **page, void *scratch, int pages)
+{
+	squashfs_actor_init(actor, NULL, pages);
+	actor->page = page;
+	actor->scratch = scratch;
+}
+
+/*
+ * Done writing to the current page.  Must be called before anything that
+ * can sleep, and once all the output has been written.
+ */
+static inline void squashfs_finish_page(struct squashfs_page_actor *actor)
+{
+	if (actor->pageaddr) {
+		kunmap_atomic(actor->pageaddr, KM_USER0);
+		actor->pageaddr = NULL;
+	}
+}
+
+/* Return the next page to write to, or NULL once they are all used up */
+static inline void *squashfs_next_page(struct squashfs_page_actor *actor)
+{
+	struct page *page;
+
+	squashfs_finish_page(actor);
+	if (actor->next_page == actor->pages)
+		return NULL;
+
+	if (actor->buffer)
+		return actor->buffer[actor->next_page++];
+
+	page = actor->page[actor->next_page++];
+	if (page == NULL)
+		return actor->scratch;
+	actor->pageaddr = kmap_atomic(page, KM_USER0);
+	return actor->pageaddr;
+}
+#endif
@@ -57,14 +57,13 @@ struct squashfs_sb_info {
 	int					devblksize_log2;
 	struct squashfs_cache			*block_cache;
 	struct squashfs_cache			*fragment_cache;
-	struct squashfs_cache			*read_page;
 	int					next_meta_index;
 	__le64					*id_table;
 	__le64					*fragment_index;
 	__le64					*xattr_id_table;
-	struct mutex				read_data_mutex;
 	struct mutex				meta_index_mutex;
 	struct meta_index			*meta_index;
+	int					decomp_mode;
 	void					*stream;
 	__le64					*inode_lookup_table;
 	u64					inode_table;
@@ -36,6 +36,7 @@
 #include <linux/module.h>
 #include <linux/magic.h>
 #include <linux/xattr.h>
+#include <linux/parser.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -47,6 +48,54 @@
 static struct file_system_type squashfs_fs_type;
 static const struct super_operations squashfs_super_ops;
 
+enum {
+	Opt_threads, Opt_err
+};
+
+static const match_table_t tokens = {
+	{Opt_threads, "threads=%s"},
+	{Opt_err, NULL}
+};
+
+/*
+ * Parse the mount options into *decomp_mode, which is left alone if no
+ * threads= option is given.
+ */
+static int squashfs_parse_options(char *options, int *decomp_mode)
+{
+	substring_t args[MAX_OPT_ARGS];
+	char *p;
+
+	if (!options)
+		return 0;
+
+	while ((p = strsep(&options, ",")) != NULL) {
+		if (!*p)
+			continue;
+
+		switch (match_token(p, tokens, args)) {
+		case Opt_threads:
+			if (!strcmp(args[0].from, "single"))
+				*decomp_mode = SQUASHFS_DECOMP_SINGLE;
+			else if (!strcmp(args[0].from, "multi"))
+				*decomp_mode = SQUASHFS_DECOMP_MULTI;
+			else if (!strcmp(args[0].from, "percpu"))
+				*decomp_mode = SQUASHFS_DECOMP_PERCPU;
+			else {
+				ERROR("Invalid threads option \"%s\"\n",
+					args[0].from);
+				return -EINVAL;
+			}
+			break;
+		default:
+			ERROR("Unrecognized mount option \"%s\"\n", p);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
 static const struct squashfs_decompressor *supported_squashfs_filesystem(short
 	major, short minor, short id)
 {
@@ -95,10 +144,16 @@ static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 	}
 	msblk = sb->s_fs_info;
 
+	save_mount_options(sb, data);
+
+	msblk->decomp_mode = SQUASHFS_DECOMP_SINGLE;
+	err = squashfs_parse_options(data, &msblk->decomp_mode);
+	if (err)
+		goto failed_mount;
+
 	msblk->devblksize = sb_min_blocksize(sb, BLOCK_SIZE);
 	msblk->devblksize_log2 = ffz(~msblk->devblksize);
 
-	mutex_init(&msblk->read_data_mutex);
 	mutex_init(&msblk->meta_index_mutex);
 
 	/*
@@ -200,13 +255,6 @@ static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 	if (msblk->block_cache == NULL)
 		goto failed_mount;
 
-	/* Allocate read_page block */
-	msblk->read_page = squashfs_cache_init("data", 1, msblk->block_size);
-	if (msblk->read_page == NULL) {
-		ERROR("Failed to allocate read_page block\n");
-		goto failed_mount;
-	}
-
 	msblk->stream = squashfs_decompressor_init(sb, flags);
 	if (IS_ERR(msblk->stream)) {
 		err = PTR_ERR(msblk->stream);
@@ -331,7 +379,6 @@ check_directory_table:
 failed_mount:
 	squashfs_cache_delete(msblk->block_cache);
 	squashfs_cache_delete(msblk->fragment_cache);
-	squashfs_cache_delete(msblk->read_page);
 	squashfs_decompressor_free(msblk, msblk->stream);
 	kfree(msblk->inode_lookup_table);
 	kfree(msblk->fragment_index);
@@ -367,6 +414,20 @@ static int squashfs_statfs(struct dentry *dentry, struct kstatfs *buf)
 
 static int squashfs_remount(struct super_block *sb, int *flags, char *data)
 {
+	struct squashfs_sb_info *msblk = sb->s_fs_info;
+	int decomp_mode = msblk->decomp_mode;
+	int err;
+
+	err = squashfs_parse_options(data, &decomp_mode);
+	if (err)
+		return err;
+
+	/* The decompressors in use cannot be swapped under the readers */
+	if (decomp_mode != msblk->decomp_mode) {
+		ERROR("threads= cannot be changed on remount\n");
+		return -EINVAL;
+	}
+
 	*flags |= MS_RDONLY;
 	return 0;
 }
@@ -378,7 +439,6 @@ static void squashfs_put_super(struct super_block *sb)
 		struct squashfs_sb_info *sbi = sb->s_fs_info;
 		squashfs_cache_delete(sbi->block_cache);
 		squashfs_cache_delete(sbi->fragment_cache);
-		squashfs_cache_delete(sbi->read_page);
 		squashfs_decompressor_free(sbi, sbi->stream);
 		kfree(sbi->id_table);
 		kfree(sbi->fragment_index);
@@ -487,7 +547,8 @@ static const struct super_operations squashfs_super_ops = {
 	.destroy_inode = squashfs_destroy_inode,
 	.statfs = squashfs_statfs,
 	.put_super = squashfs_put_super,
-	.remount_fs = squashfs_remount
+	.remount_fs = squashfs_remount,
+	.show_options = generic_show_options
 };
 
 module_init(init_squashfs_fs);
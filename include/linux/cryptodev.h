@@ -63,6 +63,14 @@ struct crypt_op {
 	char		*iv;
 };
 
+/* ioctl parameter to request several crypt/decrypt operations at once */
+struct crypt_mop {
+	#define CRYPTODEV_MAX_BATCH	32
+	uint32_t	count;		/* number of ops, <= CRYPTODEV_MAX_BATCH */
+	struct crypt_op	*ops;
+	int		*status;	/* returns 0 or -errno for each op */
+};
+
 /* clone original filedescriptor */
 #define CRIOGET         _IOWR('c', 100, uint32_t)
 
@@ -79,4 +87,7 @@ struct crypt_op {
 #define CIOCKEY         _IOWR('c', 104, void *)
 #define CIOCASYMFEAT    _IOR('c', 105, uint32_t)
 
+/* submit a batch of crypt_ops and wait for all of them to complete */
+#define CIOCCRYPTMULTI  _IOWR('c', 106, struct crypt_mop)
+
 #endif /* _CRYPTODEV_H */
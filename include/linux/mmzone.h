@@ -334,6 +334,14 @@ struct zone {
 	 */
 	unsigned int		compact_considered;
 	unsigned int		compact_defer_shift;
+	/*
+	 * kcompactd leaves the zone alone until then after failing on it;
+	 * 0 when the zone is not deferred.
+	 */
+	unsigned long		kcompactd_defer_until;
+	/* Where kcompactd's scanners stopped, so the next slice resumes there */
+	unsigned long		kcompactd_migrate_pfn;
+	unsigned long		kcompactd_free_pfn;
 #endif
 
 	ZONE_PADDING(_pad1_)
@@ -604,6 +612,25 @@ extern struct page *mem_map;
  * per-zone basis.
  */
 struct bootmem_data;
+struct pglist_data;
+
+/*
+ * Background reclaim of a node is done by up to MAX_KSWAPD_THREADS workers
+ * (vm.kswapd_threads).  Worker 0 is the classic kswapd balancing the whole
+ * node, the others split the node's zones and LRU lists between them.
+ */
+#define MAX_KSWAPD_THREADS	16
+
+struct kswapd_worker {
+	struct task_struct *task;
+	struct pglist_data *pgdat;
+	int id;
+	/* Reclaim throughput, reported in /proc/vmstat */
+	unsigned long nr_scanned;
+	unsigned long nr_reclaimed;
+	unsigned long run_time;		/* jiffies spent reclaiming */
+};
+
 typedef struct pglist_data {
 	struct zone node_zones[MAX_NR_ZONES];
 	struct zonelist node_zonelists[MAX_ZONELISTS];
@@ -633,7 +660,7 @@ typedef struct pglist_data {
 					     range, including holes */
 	int node_id;
 	wait_queue_head_t kswapd_wait;
-	struct task_struct *kswapd;
+	struct kswapd_worker kswapd[MAX_KSWAPD_THREADS];
 	int kswapd_max_order;
 	enum zone_type classzone_idx;
 } pg_data_t;
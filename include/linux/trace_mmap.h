@@ -0,0 +1,49 @@
+#ifndef _LINUX_TRACE_MMAP_H
+#define _LINUX_TRACE_MMAP_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Layout of a memory mapped per_cpu/cpuN/trace_pipe_raw file:
+ *
+ *	page 0:			struct trace_buffer_meta
+ *	page 1 + id:		sub-buffer @id, 0 <= id < nr_subbufs
+ *
+ * Each sub-buffer is one ring buffer page as read from trace_pipe_raw:
+ * a u64 time stamp, a long holding the length of the committed data,
+ * then the events, as described in events/header_page.  Sub-buffers
+ * keep their id for the life time of the mapping, only the one given
+ * by reader.id is handed to the reader at a time.
+ *
+ * TRACE_MMAP_IOCTL_GET_READER tells the kernel that the events from
+ * reader.read to reader.commit of the previous call have been consumed
+ * and updates the meta page with the next range of events to consume,
+ * swapping a new sub-buffer in as reader if the current one is done.
+ * The range is empty when the buffer is.  The events before reader.read
+ * are left on the sub-buffer, walking them gives the time stamp at
+ * reader.read.
+ */
+struct trace_buffer_meta {
+	__u32	meta_page_size;		/* size of this page */
+	__u32	meta_struct_len;	/* sizeof(struct trace_buffer_meta) */
+
+	__u32	subbuf_size;		/* size of a sub-buffer, in bytes */
+	__u32	nr_subbufs;		/* number of sub-buffers mapped */
+
+	struct {
+		__u64	lost_events;	/* events overwritten before this range */
+		__u32	id;		/* sub-buffer holding the range */
+		__u32	read;		/* start of the range in data[] */
+		__u32	commit;		/* end of the range in data[] */
+		__u32	__reserved;
+	} reader;
+
+	__u64	entries;		/* events in the buffer */
+	__u64	overrun;		/* events lost to overwrite */
+	__u64	read;			/* events consumed */
+};
+
+#define TRACE_MMAP_IOCTL_GET_READER	_IO('R', 0x20)
+
+#endif /* _LINUX_TRACE_MMAP_H */
@@ -133,6 +133,22 @@ extern rwlock_t vmlist_lock;
 extern struct vm_struct *vmlist;
 extern __init void vm_area_register_early(struct vm_struct *vm, size_t align);
 
+#ifdef CONFIG_HAVE_ARCH_HUGE_VMAP
+/*
+ * Architecture hooks mapping a PMD_SIZE aligned chunk of kernel virtual
+ * space with a single PMD level entry.  arch_vmap_pmd() returns nonzero
+ * if it installed such a mapping, the caller falls back to ptes otherwise.
+ * arch_vunmap_pmd() and arch_vmap_pmd_page() return nonzero if @pmd is
+ * such a mapping, which they tear down or translate.
+ */
+extern int vmap_allow_huge;
+extern int arch_vmap_pmd(pmd_t *pmd, unsigned long addr, phys_addr_t phys,
+			 pgprot_t prot);
+extern int arch_vunmap_pmd(pmd_t *pmd, unsigned long addr);
+extern int arch_vmap_pmd_page(pmd_t *pmd, unsigned long addr,
+			      struct page **page);
+#endif
+
 #ifdef CONFIG_SMP
 # ifdef CONFIG_MMU
 struct vm_struct **pcpu_get_vm_areas(const unsigned long *offsets,
@@ -59,6 +59,8 @@
 #include <linux/magic.h>
 #include <linux/pid.h>
 #include <linux/nsproxy.h>
+#include <linux/bootmem.h>
+#include <linux/log2.h>
 
 #include <asm/futex.h>
 
@@ -66,8 +68,6 @@
 
 int __read_mostly futex_cmpxchg_enabled;
 
-#define FUTEX_HASHBITS (CONFIG_BASE_SMALL ? 4 : 8)
-
 /*
  * Futex flags used to encode options to functions and preserve them across
  * restarts.
@@ -145,19 +145,100 @@ static const struct futex_q futex_q_init = {
 struct futex_hash_bucket {
 	spinlock_t lock;
 	struct plist_head chain;
-};
+} ____cacheline_aligned_in_smp;
+
+/*
+ * The global table is sized at boot from the number of possible CPUs and
+ * the amount of memory, see futex_init().
+ */
+static unsigned long __read_mostly futex_hashsize;
+static struct futex_hash_bucket __read_mostly *futex_queues;
+
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+/*
+ * Multithreaded processes get a table of their own for their private
+ * futexes, so that they neither collide nor contend with other processes.
+ */
+static unsigned long __read_mostly futex_private_hashsize;
+
+static void futex_hash_init(struct futex_hash_bucket *fh, unsigned long size)
+{
+	unsigned long i;
+
+	for (i = 0; i < size; i++) {
+		plist_head_init(&fh[i].chain);
+		spin_lock_init(&fh[i].lock);
+	}
+}
+
+/**
+ * futex_private_hash_alloc() - give @mm its own private futex hash
+ * @mm:		the mm about to gain a second user
+ *
+ * Called before an mm is shared by a new thread.  The table can only be
+ * installed while @mm has a single user, which is then not waiting on any
+ * futex: private futexes hashed so far only ever had that user as waiter,
+ * so none can be left behind in the global table.  The mm keeps using the
+ * global table if the allocation fails.
+ */
+void futex_private_hash_alloc(struct mm_struct *mm)
+{
+	struct futex_hash_bucket *fh;
+
+	if (mm->futex_hash || atomic_read(&mm->mm_users) != 1)
+		return;
+
+	fh = kmalloc(futex_private_hashsize * sizeof(*fh),
+		     GFP_KERNEL | __GFP_NOWARN);
+	if (!fh)
+		return;
+	futex_hash_init(fh, futex_private_hashsize);
+
+	/* the new thread sees the initialized table */
+	smp_wmb();
+	mm->futex_hash = fh;
+}
 
-static struct futex_hash_bucket futex_queues[1<<FUTEX_HASHBITS];
+void futex_private_hash_free(struct mm_struct *mm)
+{
+	kfree(mm->futex_hash);
+}
+
+static inline struct futex_hash_bucket *
+hash_futex_private(union futex_key *key, u32 hash)
+{
+	struct futex_hash_bucket *fh;
+
+	if (key->both.offset & (FUT_OFF_INODE | FUT_OFF_MMSHARED))
+		return NULL;
+	fh = ACCESS_ONCE(key->private.mm->futex_hash);
+	if (!fh)
+		return NULL;
+	smp_read_barrier_depends();
+	return &fh[hash & (futex_private_hashsize - 1)];
+}
+#else
+static inline struct futex_hash_bucket *
+hash_futex_private(union futex_key *key, u32 hash)
+{
+	return NULL;
+}
+#endif
 
 /*
  * We hash on the keys returned from get_futex_key (see below).
  */
 static struct futex_hash_bucket *hash_futex(union futex_key *key)
 {
+	struct futex_hash_bucket *hb;
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
-	return &futex_queues[hash & ((1 << FUTEX_HASHBITS)-1)];
+
+	hb = hash_futex_private(key, hash);
+	if (hb)
+		return hb;
+	return &futex_queues[hash & (futex_hashsize - 1)];
 }
 
 /*
@@ -2722,8 +2803,9 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 
 static int __init futex_init(void)
 {
+	unsigned int futex_shift;
+	unsigned long i;
 	u32 curval;
-	int i;
 
 	/*
 	 * This will fail and we want it. Some arch implementations do
@@ -2738,11 +2820,37 @@ static int __init futex_init(void)
 	if (cmpxchg_futex_value_locked(&curval, NULL, 0, 0) == -EFAULT)
 		futex_cmpxchg_enabled = 1;
 
-	for (i = 0; i < ARRAY_SIZE(futex_queues); i++) {
+	/*
+	 * 256 buckets per possible CPU, but no more than one per 64 pages
+	 * of memory, and never fewer than the 256 of the old static table.
+	 */
+#if CONFIG_BASE_SMALL
+	futex_hashsize = 16;
+#else
+	futex_hashsize = roundup_pow_of_two(256 * num_possible_cpus());
+	if (futex_hashsize > totalram_pages / 64)
+		futex_hashsize = totalram_pages / 64 > 256 ?
+				 rounddown_pow_of_two(totalram_pages / 64) :
+				 256;
+#endif
+	futex_queues = alloc_large_system_hash("futex", sizeof(*futex_queues),
+					       futex_hashsize, 0,
+					       futex_hashsize < 256 ?
+					       HASH_SMALL : 0,
+					       &futex_shift, NULL,
+					       futex_hashsize);
+	futex_hashsize = 1UL << futex_shift;
+
+	for (i = 0; i < futex_hashsize; i++) {
 		plist_head_init(&futex_queues[i].chain);
 		spin_lock_init(&futex_queues[i].lock);
 	}
 
+#ifdef CONFIG_FUTEX_PRIVATE_HASH
+	/* 4 buckets per possible CPU, 16 at least and 1024 at most */
+	futex_private_hashsize = clamp_t(unsigned long,
+			roundup_pow_of_two(4 * num_possible_cpus()), 16, 1024);
+#endif
 	return 0;
 }
 __initcall(futex_init);
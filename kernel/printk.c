@@ -41,8 +41,11 @@
 #include <linux/cpu.h>
 #include <linux/notifier.h>
 #include <linux/rculist.h>
+#include <linux/kthread.h>
+#include <linux/slab.h>
 
 #include <asm/uaccess.h>
+#include <asm/local.h>
 
 /*
  * Architectures can override it:
@@ -142,6 +145,12 @@ EXPORT_SYMBOL(console_set_on_cmdline);
 /* Flag: console code may call schedule() */
 static int console_may_schedule;
 
+/* kprintkd, which prints the messages deferred by printk() */
+static struct task_struct *printk_flush_task;
+
+/* Deferred messages moved into log_buf per logbuf_lock hold */
+#define PRINTK_DRAIN_BATCH	16
+
 #ifdef CONFIG_PRINTK
 
 static char __log_buf[__LOG_BUF_LEN];
@@ -823,57 +832,20 @@ static inline void printk_delay(void)
 	}
 }
 
-asmlinkage int vprintk(const char *fmt, va_list args)
+/*
+ * Copy the formatted message in buf into log_buf. If the caller didn't
+ * provide the appropriate log prefix, we insert them here, along with
+ * the time stamp t if printk_time is set. Called with logbuf_lock held.
+ * Returns the number of characters added to the message.
+ */
+static int log_store(const char *buf, unsigned long long t)
 {
-	int printed_len = 0;
 	int current_log_level = default_message_loglevel;
-	unsigned long flags;
-	int this_cpu;
-	char *p;
+	const char *p = buf;
+	int added = 0;
 	size_t plen;
 	char special;
 
-	boot_delay_msec();
-	printk_delay();
-
-	preempt_disable();
-	/* This stops the holder of console_sem just where we want him */
-	raw_local_irq_save(flags);
-	this_cpu = smp_processor_id();
-
-	/*
-	 * Ouch, printk recursed into itself!
-	 */
-	if (unlikely(printk_cpu == this_cpu)) {
-		/*
-		 * If a crash is occurring during printk() on this CPU,
-		 * then try to get the crash message out but make sure
-		 * we can't deadlock. Otherwise just return to avoid the
-		 * recursion and return - but flag the recursion so that
-		 * it can be printed at the next appropriate moment:
-		 */
-		if (!oops_in_progress) {
-			recursion_bug = 1;
-			goto out_restore_irqs;
-		}
-		zap_locks();
-	}
-
-	lockdep_off();
-	spin_lock(&logbuf_lock);
-	printk_cpu = this_cpu;
-
-	if (recursion_bug) {
-		recursion_bug = 0;
-		strcpy(printk_buf, recursion_bug_msg);
-		printed_len = strlen(recursion_bug_msg);
-	}
-	/* Emit the output into the temporary buffer */
-	printed_len += vscnprintf(printk_buf + printed_len,
-				  sizeof(printk_buf) - printed_len, fmt, args);
-
-	p = printk_buf;
-
 	/* Read log level and handle special printk prefix */
 	plen = log_prefix(p, &current_log_level, &special);
 	if (plen) {
@@ -893,10 +865,6 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 		}
 	}
 
-	/*
-	 * Copy the output into log_buf. If the caller didn't provide
-	 * the appropriate log prefix, we insert them here
-	 */
 	for (; *p; p++) {
 		if (new_text_line) {
 			new_text_line = 0;
@@ -906,32 +874,31 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 				int i;
 
 				for (i = 0; i < plen; i++)
-					emit_log_char(printk_buf[i]);
-				printed_len += plen;
+					emit_log_char(buf[i]);
+				added += plen;
 			} else {
 				/* Add log prefix */
 				emit_log_char('<');
 				emit_log_char(current_log_level + '0');
 				emit_log_char('>');
-				printed_len += 3;
+				added += 3;
 			}
 
 			if (printk_time) {
-				/* Add the current time stamp */
+				/* Add the time stamp */
 				char tbuf[50], *tp;
 				unsigned tlen;
-				unsigned long long t;
+				unsigned long long ts = t;
 				unsigned long nanosec_rem;
 
-				t = cpu_clock(printk_cpu);
-				nanosec_rem = do_div(t, 1000000000);
+				nanosec_rem = do_div(ts, 1000000000);
 				tlen = sprintf(tbuf, "[%5lu.%06lu] ",
-						(unsigned long) t,
+						(unsigned long) ts,
 						nanosec_rem / 1000);
 
 				for (tp = tbuf; tp < tbuf + tlen; tp++)
 					emit_log_char(*tp);
-				printed_len += tlen;
+				added += tlen;
 			}
 
 			if (!*p)
@@ -942,6 +909,377 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 		if (*p == '\n')
 			new_text_line = 1;
 	}
+	return added;
+}
+
+#ifdef CONFIG_PRINTK_DEFERRED
+/*
+ * Deferred console output.
+ *
+ * Once the system is up, printk() only formats the message into a buffer
+ * of the local cpu and leaves log_buf and the consoles to the kprintkd
+ * thread, so that it neither spins on logbuf_lock nor waits for slow
+ * consoles with interrupts disabled. Oopses, panics, boot, shutdown and
+ * messages that don't fit still take the synchronous path, which first
+ * moves the buffered messages into log_buf to keep them in order.
+ *
+ * The writers of a buffer are serialized by disabling interrupts, except
+ * against NMIs: they reserve their room with local_cmpxchg() and the
+ * outermost one publishes everything reserved, as NMIs nest strictly and
+ * have finished by then. There is a single reader, the holder of
+ * logbuf_lock, which merges the buffers of all cpus in time stamp order.
+ */
+#define PRINTK_CPU_BUF_LEN	(1UL << CONFIG_PRINTK_CPU_BUF_SHIFT)
+#define PRINTK_CPU_BUF_MASK	(PRINTK_CPU_BUF_LEN - 1)
+/* Bytes handed to the consoles at once by kprintkd */
+#define PRINTK_FLUSH_CHUNK	32
+
+struct printk_rec {
+	unsigned long long	ts;
+	unsigned int		len;	/* of the text following the header */
+};
+
+struct printk_cpu_buf {
+	local_t		head;		/* end of the reserved room */
+	local_t		commit;		/* end of the published messages */
+	local_t		nest;		/* writers active on this cpu */
+	unsigned long	tail;		/* start of the unread messages */
+	char		*buf;
+	/* format buffers for a writer and an NMI interrupting it */
+	char		text[2][sizeof(printk_buf)];
+};
+
+static DEFINE_PER_CPU(struct printk_cpu_buf *, printk_cpu_buf);
+static char printk_drain_buf[sizeof(printk_buf)];
+
+static int printk_synchronous;
+module_param_named(synchronous, printk_synchronous, bool, S_IRUGO | S_IWUSR);
+
+static inline int printk_defer(void)
+{
+	return printk_flush_task && !printk_synchronous &&
+		!oops_in_progress && system_state == SYSTEM_RUNNING;
+}
+
+static void pcb_write(struct printk_cpu_buf *pcb, unsigned long pos,
+		      const void *src, unsigned int len)
+{
+	unsigned int off = pos & PRINTK_CPU_BUF_MASK;
+	unsigned int first = min_t(unsigned int, len, PRINTK_CPU_BUF_LEN - off);
+
+	memcpy(pcb->buf + off, src, first);
+	memcpy(pcb->buf, src + first, len - first);
+}
+
+static void pcb_read(struct printk_cpu_buf *pcb, unsigned long pos,
+		     void *dst, unsigned int len)
+{
+	unsigned int off = pos & PRINTK_CPU_BUF_MASK;
+	unsigned int first = min_t(unsigned int, len, PRINTK_CPU_BUF_LEN - off);
+
+	memcpy(dst, pcb->buf + off, first);
+	memcpy(dst + first, pcb->buf, len - first);
+}
+
+/*
+ * Publish the messages reserved on this cpu if we are the outermost
+ * writer. An NMI coming in after the update leaves its message for us,
+ * one coming in after we left publishes it itself.
+ */
+static void pcb_commit(struct printk_cpu_buf *pcb)
+{
+	for (;;) {
+		if (local_read(&pcb->nest) == 1) {
+			smp_wmb();
+			local_set(&pcb->commit, local_read(&pcb->head));
+		}
+		local_dec(&pcb->nest);
+		barrier();
+		if (local_read(&pcb->commit) == local_read(&pcb->head) ||
+		    local_read(&pcb->nest))
+			break;
+		local_inc(&pcb->nest);
+		barrier();
+	}
+}
+
+/*
+ * Store a message in the buffer of this cpu without taking any lock.
+ * Called with interrupts disabled. Returns the length of the message,
+ * or a negative error if it has to take the synchronous path.
+ */
+static int printk_cpu_buf_store(int cpu, const char *fmt, va_list args)
+{
+	struct printk_cpu_buf *pcb = __this_cpu_read(printk_cpu_buf);
+	struct printk_rec rec;
+	unsigned long head;
+	long nest;
+	int ret;
+
+	if (!pcb)
+		return -ENODEV;
+
+	nest = local_inc_return(&pcb->nest);
+	barrier();
+	if (unlikely(nest > ARRAY_SIZE(pcb->text))) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	rec.len = vscnprintf(pcb->text[nest - 1], sizeof(pcb->text[0]),
+			     fmt, args);
+	rec.ts = cpu_clock(cpu);
+
+	do {
+		head = local_read(&pcb->head);
+		if (head + sizeof(rec) + rec.len - ACCESS_ONCE(pcb->tail) >
+		    PRINTK_CPU_BUF_LEN) {
+			ret = -ENOSPC;
+			goto out;
+		}
+	} while (local_cmpxchg(&pcb->head, head,
+			       head + sizeof(rec) + rec.len) != head);
+	/* don't overwrite the room before the reader has released it */
+	smp_mb();
+
+	pcb_write(pcb, head, &rec, sizeof(rec));
+	pcb_write(pcb, head + sizeof(rec), pcb->text[nest - 1], rec.len);
+	ret = rec.len;
+out:
+	pcb_commit(pcb);
+	return ret;
+}
+
+static inline int pcb_pending(struct printk_cpu_buf *pcb)
+{
+	return pcb && local_read(&pcb->commit) != ACCESS_ONCE(pcb->tail);
+}
+
+/* Are there messages of this cpu waiting for kprintkd? */
+static int printk_cpu_buf_pending(void)
+{
+	return pcb_pending(__this_cpu_read(printk_cpu_buf));
+}
+
+/*
+ * Move up to max published messages of all cpus into log_buf, oldest
+ * first. Called with logbuf_lock held. Returns 1 if messages are left.
+ */
+static int printk_cpu_bufs_drain(unsigned int max)
+{
+	struct printk_cpu_buf *pcb, *oldest;
+	struct printk_rec rec, oldest_rec;
+	int cpu;
+
+	while (max--) {
+		oldest = NULL;
+		for_each_possible_cpu(cpu) {
+			pcb = per_cpu(printk_cpu_buf, cpu);
+			if (!pcb_pending(pcb))
+				continue;
+			smp_rmb();
+			pcb_read(pcb, pcb->tail, &rec, sizeof(rec));
+			if (!oldest || rec.ts < oldest_rec.ts) {
+				oldest = pcb;
+				oldest_rec = rec;
+			}
+		}
+		if (!oldest)
+			return 0;
+
+		pcb_read(oldest, oldest->tail + sizeof(rec), printk_drain_buf,
+			 oldest_rec.len);
+		printk_drain_buf[oldest_rec.len] = '\0';
+		/* read the message before releasing its room */
+		smp_mb();
+		ACCESS_ONCE(oldest->tail) += sizeof(rec) + oldest_rec.len;
+		log_store(printk_drain_buf, oldest_rec.ts);
+	}
+	return 1;
+}
+
+/*
+ * kprintkd hands the consoles a chunk at a time, with interrupts enabled
+ * in between, and may be preempted between chunks.  A chunk ends after the
+ * last newline it contains, so that call_console_drivers() always sees a
+ * line's <N> prefix whole; only a line longer than a chunk is split, and
+ * then its prefix is all in the first piece.
+ */
+static unsigned printk_flush_chunk(unsigned start, unsigned end)
+{
+	unsigned cut;
+
+	if (current != printk_flush_task || end - start <= PRINTK_FLUSH_CHUNK)
+		return end;
+
+	for (cut = start + PRINTK_FLUSH_CHUNK; cut != start; cut--)
+		if (LOG_BUF(cut - 1) == '\n')
+			return cut;
+	return start + PRINTK_FLUSH_CHUNK;
+}
+
+static int printk_flush_thread(void *unused)
+{
+	struct printk_cpu_buf *pcb;
+	int cpu, more;
+
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		more = 0;
+		for_each_possible_cpu(cpu) {
+			pcb = per_cpu(printk_cpu_buf, cpu);
+			if (pcb_pending(pcb))
+				more = 1;
+		}
+		if (!more)
+			schedule();
+		__set_current_state(TASK_RUNNING);
+
+		/* make the messages visible to syslog even if the
+		   consoles are suspended or busy */
+		do {
+			spin_lock_irq(&logbuf_lock);
+			more = printk_cpu_bufs_drain(PRINTK_DRAIN_BATCH);
+			spin_unlock_irq(&logbuf_lock);
+			cond_resched();
+		} while (more);
+		if (waitqueue_active(&log_wait))
+			wake_up_interruptible(&log_wait);
+
+		console_lock();
+		console_unlock();
+	}
+	return 0;
+}
+
+static void __init printk_flush_init(void)
+{
+	struct printk_cpu_buf *pcb;
+	struct task_struct *tsk;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		pcb = kzalloc_node(sizeof(*pcb), GFP_KERNEL, cpu_to_node(cpu));
+		if (!pcb)
+			goto out_free;
+		pcb->buf = kmalloc_node(PRINTK_CPU_BUF_LEN, GFP_KERNEL,
+					cpu_to_node(cpu));
+		if (!pcb->buf) {
+			kfree(pcb);
+			goto out_free;
+		}
+		per_cpu(printk_cpu_buf, cpu) = pcb;
+	}
+
+	tsk = kthread_run(printk_flush_thread, NULL, "kprintkd");
+	if (IS_ERR(tsk))
+		goto out_free;
+	printk_flush_task = tsk;
+	return;
+
+out_free:
+	for_each_possible_cpu(cpu) {
+		pcb = per_cpu(printk_cpu_buf, cpu);
+		if (pcb) {
+			kfree(pcb->buf);
+			kfree(pcb);
+		}
+		per_cpu(printk_cpu_buf, cpu) = NULL;
+	}
+	printk(KERN_WARNING "printk: deferred console output disabled\n");
+}
+#else
+static inline int printk_defer(void)
+{
+	return 0;
+}
+
+static inline int printk_cpu_buf_store(int cpu, const char *fmt,
+				       va_list args)
+{
+	return -ENODEV;
+}
+
+static inline int printk_cpu_buf_pending(void)
+{
+	return 0;
+}
+
+static inline int printk_cpu_bufs_drain(unsigned int max)
+{
+	return 0;
+}
+
+static inline unsigned printk_flush_chunk(unsigned start, unsigned end)
+{
+	return end;
+}
+
+static inline void printk_flush_init(void)
+{
+}
+#endif /* CONFIG_PRINTK_DEFERRED */
+
+asmlinkage int vprintk(const char *fmt, va_list args)
+{
+	int printed_len = 0;
+	unsigned long flags;
+	int this_cpu;
+
+	boot_delay_msec();
+	printk_delay();
+
+	preempt_disable();
+	/* This stops the holder of console_sem just where we want him */
+	raw_local_irq_save(flags);
+	this_cpu = smp_processor_id();
+
+	if (printk_defer()) {
+		va_list aq;
+
+		va_copy(aq, args);
+		printed_len = printk_cpu_buf_store(this_cpu, fmt, aq);
+		va_end(aq);
+		if (printed_len >= 0)
+			goto out_restore_irqs;
+		printed_len = 0;
+	}
+
+	/*
+	 * Ouch, printk recursed into itself!
+	 */
+	if (unlikely(printk_cpu == this_cpu)) {
+		/*
+		 * If a crash is occurring during printk() on this CPU,
+		 * then try to get the crash message out but make sure
+		 * we can't deadlock. Otherwise just return to avoid the
+		 * recursion and return - but flag the recursion so that
+		 * it can be printed at the next appropriate moment:
+		 */
+		if (!oops_in_progress) {
+			recursion_bug = 1;
+			goto out_restore_irqs;
+		}
+		zap_locks();
+	}
+
+	lockdep_off();
+	spin_lock(&logbuf_lock);
+	printk_cpu = this_cpu;
+
+	/* Messages stored for kprintkd go first */
+	printk_cpu_bufs_drain(UINT_MAX);
+
+	if (recursion_bug) {
+		recursion_bug = 0;
+		strcpy(printk_buf, recursion_bug_msg);
+		printed_len = strlen(recursion_bug_msg);
+	}
+	/* Emit the output into the temporary buffer */
+	printed_len += vscnprintf(printk_buf + printed_len,
+				  sizeof(printk_buf) - printed_len, fmt, args);
+
+	printed_len += log_store(printk_buf, cpu_clock(printk_cpu));
 
 	/*
 	 * Try to acquire and then immediately release the
@@ -972,6 +1310,25 @@ static void call_console_drivers(unsigned start, unsigned end)
 {
 }
 
+static inline int printk_cpu_buf_pending(void)
+{
+	return 0;
+}
+
+static inline int printk_cpu_bufs_drain(unsigned int max)
+{
+	return 0;
+}
+
+static inline unsigned printk_flush_chunk(unsigned start, unsigned end)
+{
+	return end;
+}
+
+static inline void printk_flush_init(void)
+{
+}
+
 #endif
 
 static int __add_preferred_console(char *name, int idx, char *options,
@@ -1209,13 +1566,15 @@ void printk_tick(void)
 		__this_cpu_write(printk_pending, 0);
 		wake_up_interruptible(&log_wait);
 	}
+	if (printk_cpu_buf_pending())
+		wake_up_process(printk_flush_task);
 }
 
 int printk_needs_cpu(int cpu)
 {
 	if (cpu_is_offline(cpu))
 		printk_tick();
-	return __this_cpu_read(printk_pending);
+	return __this_cpu_read(printk_pending) || printk_cpu_buf_pending();
 }
 
 void wake_up_klogd(void)
@@ -1253,17 +1612,20 @@ void console_unlock(void)
 
 	for ( ; ; ) {
 		spin_lock_irqsave(&logbuf_lock, flags);
+		printk_cpu_bufs_drain(PRINTK_DRAIN_BATCH);
 		wake_klogd |= log_start - log_end;
 		if (con_start == log_end)
 			break;			/* Nothing to print */
 		_con_start = con_start;
-		_log_end = log_end;
-		con_start = log_end;		/* Flush */
+		_log_end = printk_flush_chunk(con_start, log_end);
+		con_start = _log_end;		/* Flush */
 		spin_unlock(&logbuf_lock);
 		stop_critical_timings();	/* don't trace print latency */
 		call_console_drivers(_con_start, _log_end);
 		start_critical_timings();
 		local_irq_restore(flags);
+		if (current == printk_flush_task)
+			cond_resched();
 	}
 	console_locked = 0;
 
@@ -1591,6 +1953,7 @@ static int __init printk_late_init(void)
 		}
 	}
 	hotcpu_notifier(console_cpu_notify, 0);
+	printk_flush_init();
 	return 0;
 }
 late_initcall(printk_late_init);
@@ -1712,6 +2075,7 @@ void kmsg_dump(enum kmsg_dump_reason reason)
 	   there's not a lot we can do about that. The new messages
 	   will overwrite the start of what we dump. */
 	spin_lock_irqsave(&logbuf_lock, flags);
+	printk_cpu_bufs_drain(UINT_MAX);
 	end = log_end & LOG_BUF_MASK;
 	chars = logged_chars;
 	spin_unlock_irqrestore(&logbuf_lock, flags);
@@ -40,6 +40,8 @@
 #include <linux/irq_work.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 
 #include <asm/uaccess.h>
 #include <asm/unistd.h>
@@ -54,6 +56,42 @@ u64 jiffies_64 __cacheline_aligned_in_smp = INITIAL_JIFFIES;
 
 EXPORT_SYMBOL(jiffies_64);
 
+#ifdef CONFIG_TIMER_WHEEL_NOCASCADE
+/*
+ * per-CPU timer wheel definitions:
+ *
+ * The wheel has LVL_DEPTH levels of LVL_SIZE buckets. The buckets of
+ * level n are LVL_GRAN(n) = 8^n jiffies apart, and a timer goes to the
+ * level whose range covers its timeout, in the bucket of its expiry time
+ * rounded up to the level granularity. Timers are never moved to a lower
+ * level: they expire when their bucket does, up to about 1/8 of their
+ * timeout late, instead of being rehashed on the way down.
+ *
+ * A timer whose explicit slack is smaller than the granularity of its
+ * level goes to the bucket before its expiry time instead, and is requeued
+ * in a lower level when that bucket expires. So is a timer beyond the
+ * range of the wheel, which is queued in the last bucket it can reach.
+ */
+#define LVL_CLK_SHIFT	3
+#define LVL_SHIFT(n)	((n) * LVL_CLK_SHIFT)
+#define LVL_GRAN(n)	(1UL << LVL_SHIFT(n))
+#define LVL_BITS	6
+#define LVL_SIZE	(1UL << LVL_BITS)
+#define LVL_MASK	(LVL_SIZE - 1)
+#define LVL_OFFS(n)	((n) * LVL_SIZE)
+/* Level n - 1 takes the timeouts below LVL_START(n) */
+#define LVL_START(n)	((LVL_SIZE - 1) << LVL_SHIFT((n) - 1))
+
+#if HZ > 100
+# define LVL_DEPTH	9
+#else
+# define LVL_DEPTH	8
+#endif
+#define WHEEL_SIZE	(LVL_SIZE * LVL_DEPTH)
+/* Longer timeouts are queued at the capacity of the wheel, then requeued */
+#define WHEEL_TIMEOUT_CUTOFF	LVL_START(LVL_DEPTH)
+
+#else
 /*
  * per-CPU timer vector definitions:
  */
@@ -71,17 +109,40 @@ struct tvec {
 struct tvec_root {
 	struct list_head vec[TVR_SIZE];
 };
+#endif
+
+#ifdef CONFIG_TIMER_WHEEL_STATS
+#define TSTATS_HIST	16
+
+/* Histograms count values v in slot fls(v): 0, 1, 2-3, 4-7, ... */
+struct tvec_stats {
+	unsigned long expired;
+	unsigned long batches;
+	unsigned long cascades;
+	unsigned long latency[TSTATS_HIST];	/* jiffies late at expiry */
+	unsigned long batch[TSTATS_HIST];	/* timers run per softirq */
+	unsigned long cascade[TSTATS_HIST];	/* timers moved per cascade */
+};
+#endif
 
 struct tvec_base {
 	spinlock_t lock;
 	struct timer_list *running_timer;
 	unsigned long timer_jiffies;
 	unsigned long next_timer;
+#ifdef CONFIG_TIMER_WHEEL_NOCASCADE
+	DECLARE_BITMAP(pending_map, WHEEL_SIZE);
+	struct list_head vectors[WHEEL_SIZE];
+#else
 	struct tvec_root tv1;
 	struct tvec tv2;
 	struct tvec tv3;
 	struct tvec tv4;
 	struct tvec tv5;
+#endif
+#ifdef CONFIG_TIMER_WHEEL_STATS
+	struct tvec_stats stats;
+#endif
 } ____cacheline_aligned;
 
 struct tvec_base boot_tvec_bases;
@@ -330,6 +391,107 @@ void set_timer_slack(struct timer_list *timer, int slack_hz)
 }
 EXPORT_SYMBOL_GPL(set_timer_slack);
 
+#ifdef CONFIG_TIMER_WHEEL_STATS
+static int timer_wheel_stats_active;
+
+static inline unsigned int tstats_slot(unsigned long val)
+{
+	return min_t(unsigned int, fls_long(val), TSTATS_HIST - 1);
+}
+
+/* Account a timer about to run, called with base->lock held */
+static inline void tstats_expire(struct tvec_base *base,
+				 struct timer_list *timer)
+{
+	struct tvec_stats *st = &base->stats;
+	long late = jiffies - timer->expires;
+
+	if (likely(!timer_wheel_stats_active))
+		return;
+	st->expired++;
+	st->latency[tstats_slot(late > 0 ? late : 0)]++;
+}
+
+static inline void tstats_batch(struct tvec_base *base, unsigned long nr)
+{
+	struct tvec_stats *st = &base->stats;
+
+	if (likely(!timer_wheel_stats_active) || !nr)
+		return;
+	st->batches++;
+	st->batch[tstats_slot(nr)]++;
+}
+
+static inline void tstats_cascade(struct tvec_base *base, unsigned long nr)
+{
+	struct tvec_stats *st = &base->stats;
+
+	if (likely(!timer_wheel_stats_active) || !nr)
+		return;
+	st->cascades++;
+	st->cascade[tstats_slot(nr)]++;
+}
+#else
+static inline void tstats_expire(struct tvec_base *base,
+				 struct timer_list *timer) {}
+static inline void tstats_batch(struct tvec_base *base, unsigned long nr) {}
+static inline void tstats_cascade(struct tvec_base *base, unsigned long nr) {}
+#endif
+
+#ifdef CONFIG_TIMER_WHEEL_NOCASCADE
+/*
+ * The bucket of level lvl which expires at or after expires, or, if
+ * early is set, the one which expires at or before it.
+ */
+static inline unsigned int calc_index(unsigned long expires, unsigned int lvl,
+				      int early, unsigned long *bucket_expires)
+{
+	if (!early)
+		expires += LVL_GRAN(lvl) - 1;
+	expires >>= LVL_SHIFT(lvl);
+	*bucket_expires = expires << LVL_SHIFT(lvl);
+	return LVL_OFFS(lvl) + (expires & LVL_MASK);
+}
+
+static void internal_add_timer(struct tvec_base *base, struct timer_list *timer)
+{
+	unsigned long expires = timer->expires;
+	unsigned long clk = base->timer_jiffies;
+	unsigned long delta = expires - clk;
+	unsigned long bucket_expires;
+	unsigned int lvl, idx;
+
+	if ((long)delta < 0) {
+		/*
+		 * Can happen if you add a timer with expires == jiffies,
+		 * or you set a timer to go off in the past
+		 */
+		idx = clk & LVL_MASK;
+		bucket_expires = clk;
+	} else {
+		if (delta >= WHEEL_TIMEOUT_CUTOFF) {
+			delta = WHEEL_TIMEOUT_CUTOFF - 1;
+			expires = clk + delta;
+		}
+		for (lvl = 0; lvl < LVL_DEPTH - 1; lvl++)
+			if (delta < LVL_START(lvl + 1))
+				break;
+		idx = calc_index(expires, lvl,
+				 timer->slack >= 0 &&
+				 LVL_GRAN(lvl) - 1 > timer->slack,
+				 &bucket_expires);
+	}
+	/*
+	 * Timers are FIFO:
+	 */
+	list_add_tail(&timer->entry, base->vectors + idx);
+	__set_bit(idx, base->pending_map);
+
+	if (time_before(bucket_expires, base->next_timer) &&
+	    !tbase_get_deferrable(timer->base))
+		base->next_timer = bucket_expires;
+}
+#else
 static void internal_add_timer(struct tvec_base *base, struct timer_list *timer)
 {
 	unsigned long expires = timer->expires;
@@ -370,8 +532,14 @@ static void internal_add_timer(struct tvec_base *base, struct timer_list *timer)
 	 * Timers are FIFO:
 	 */
 	list_add_tail(&timer->entry, vec);
+
+	if (time_before(timer->expires, base->next_timer) &&
+	    !tbase_get_deferrable(timer->base))
+		base->next_timer = timer->expires;
 }
 
+#endif
+
 #ifdef CONFIG_TIMER_STATS
 void __timer_stats_timer_set_start_info(struct timer_list *timer, void *addr)
 {
@@ -706,9 +874,6 @@ __mod_timer(struct timer_list *timer, unsigned long expires,
 	}
 
 	timer->expires = expires;
-	if (time_before(timer->expires, base->next_timer) &&
-	    !tbase_get_deferrable(timer->base))
-		base->next_timer = timer->expires;
 	internal_add_timer(base, timer);
 
 out_unlock:
@@ -868,9 +1033,6 @@ void add_timer_on(struct timer_list *timer, int cpu)
 	spin_lock_irqsave(&base->lock, flags);
 	timer_set_base(timer, base);
 	debug_activate(timer, timer->expires);
-	if (time_before(timer->expires, base->next_timer) &&
-	    !tbase_get_deferrable(timer->base))
-		base->next_timer = timer->expires;
 	internal_add_timer(base, timer);
 	/*
 	 * Check whether the other CPU is idle and needs to be
@@ -1019,26 +1181,6 @@ int del_timer_sync(struct timer_list *timer)
 EXPORT_SYMBOL(del_timer_sync);
 #endif
 
-static int cascade(struct tvec_base *base, struct tvec *tv, int index)
-{
-	/* cascade all the timers from tv up one level */
-	struct timer_list *timer, *tmp;
-	struct list_head tv_list;
-
-	list_replace_init(tv->vec + index, &tv_list);
-
-	/*
-	 * We are removing _all_ timers from the list, so we
-	 * don't have to detach them individually.
-	 */
-	list_for_each_entry_safe(timer, tmp, &tv_list, entry) {
-		BUG_ON(tbase_get_base(timer->base) != base);
-		internal_add_timer(base, timer);
-	}
-
-	return index;
-}
-
 static void call_timer_fn(struct timer_list *timer, void (*fn)(unsigned long),
 			  unsigned long data)
 {
@@ -1080,14 +1222,95 @@ static void call_timer_fn(struct timer_list *timer, void (*fn)(unsigned long),
 	}
 }
 
+#ifdef CONFIG_TIMER_WHEEL_NOCASCADE
+/*
+ * Move the timers of the buckets expiring at base->timer_jiffies to
+ * work_list and advance base->timer_jiffies.
+ */
+static void collect_expired_timers(struct tvec_base *base,
+				   struct list_head *work_list)
+{
+	unsigned long clk = base->timer_jiffies;
+	unsigned int lvl, idx;
+
+	for (lvl = 0; lvl < LVL_DEPTH; lvl++) {
+		idx = LVL_OFFS(lvl) + ((clk >> LVL_SHIFT(lvl)) & LVL_MASK);
+		if (__test_and_clear_bit(idx, base->pending_map))
+			list_splice_tail_init(base->vectors + idx, work_list);
+		/* The next level expires a bucket every 8 of this one */
+		if (clk & (LVL_GRAN(lvl + 1) - 1))
+			break;
+	}
+	++base->timer_jiffies;
+}
+
+/*
+ * A timer placed ahead of its expiry time because of its slack is due
+ * once base->timer_jiffies has gone past it.
+ */
+static inline int timer_due(struct tvec_base *base, struct timer_list *timer)
+{
+	return time_before(timer->expires, base->timer_jiffies);
+}
+#else
+static int cascade(struct tvec_base *base, struct tvec *tv, int index)
+{
+	/* cascade all the timers from tv up one level */
+	struct timer_list *timer, *tmp;
+	struct list_head tv_list;
+	unsigned long nr = 0;
+
+	list_replace_init(tv->vec + index, &tv_list);
+
+	/*
+	 * We are removing _all_ timers from the list, so we
+	 * don't have to detach them individually.
+	 */
+	list_for_each_entry_safe(timer, tmp, &tv_list, entry) {
+		BUG_ON(tbase_get_base(timer->base) != base);
+		internal_add_timer(base, timer);
+		nr++;
+	}
+	tstats_cascade(base, nr);
+
+	return index;
+}
+
 #define INDEX(N) ((base->timer_jiffies >> (TVR_BITS + (N) * TVN_BITS)) & TVN_MASK)
 
+/*
+ * Cascade the vectors, move the timers expiring at base->timer_jiffies
+ * to work_list and advance base->timer_jiffies.
+ */
+static void collect_expired_timers(struct tvec_base *base,
+				   struct list_head *work_list)
+{
+	int index = base->timer_jiffies & TVR_MASK;
+
+	/*
+	 * Cascade timers:
+	 */
+	if (!index &&
+		(!cascade(base, &base->tv2, INDEX(0))) &&
+			(!cascade(base, &base->tv3, INDEX(1))) &&
+				!cascade(base, &base->tv4, INDEX(2)))
+		cascade(base, &base->tv5, INDEX(3));
+	++base->timer_jiffies;
+	list_splice_tail_init(base->tv1.vec + index, work_list);
+}
+
+static inline int timer_due(struct tvec_base *base, struct timer_list *timer)
+{
+	return 1;
+}
+#endif
+
 /**
  * __run_timers - run all expired timers (if any) on this CPU.
  * @base: the timer vector to be processed.
  *
- * This function cascades all vectors and executes all expired timer
- * vectors.
+ * This function collects the expired timers of all the jiffies that went
+ * by since the last run in one batch, then executes them.
  */
 static inline void __run_timers(struct tvec_base *base)
 {
@@ -1097,27 +1320,30 @@ static inline void __run_timers(struct tvec_base *base)
 	while (time_after_eq(jiffies, base->timer_jiffies)) {
 		struct list_head work_list;
 		struct list_head *head = &work_list;
-		int index = base->timer_jiffies & TVR_MASK;
+		unsigned long ran = 0, requeued = 0;
+
+		INIT_LIST_HEAD(head);
+		while (time_after_eq(jiffies, base->timer_jiffies))
+			collect_expired_timers(base, head);
 
-		/*
-		 * Cascade timers:
-		 */
-		if (!index &&
-			(!cascade(base, &base->tv2, INDEX(0))) &&
-				(!cascade(base, &base->tv3, INDEX(1))) &&
-					!cascade(base, &base->tv4, INDEX(2)))
-			cascade(base, &base->tv5, INDEX(3));
-		++base->timer_jiffies;
-		list_replace_init(base->tv1.vec + index, &work_list);
 		while (!list_empty(head)) {
 			void (*fn)(unsigned long);
 			unsigned long data;
 
 			timer = list_first_entry(head, struct timer_list,entry);
+			if (!timer_due(base, timer)) {
+				/* requeue it closer to its expiry time */
+				list_del(&timer->entry);
+				internal_add_timer(base, timer);
+				requeued++;
+				continue;
+			}
 			fn = timer->function;
 			data = timer->data;
 
 			timer_stats_account_timer(timer);
+			tstats_expire(base, timer);
+			ran++;
 
 			base->running_timer = timer;
 			detach_timer(timer, 1);
@@ -1126,6 +1352,8 @@ static inline void __run_timers(struct tvec_base *base)
 			call_timer_fn(timer, fn, data);
 			spin_lock_irq(&base->lock);
 		}
+		tstats_batch(base, ran);
+		tstats_cascade(base, requeued);
 	}
 	base->running_timer = NULL;
 	spin_unlock_irq(&base->lock);
@@ -1137,6 +1365,51 @@ static inline void __run_timers(struct tvec_base *base)
  * is used on S/390 to stop all activity when a CPU is idle.
  * This function needs to be called with interrupts disabled.
  */
+#ifdef CONFIG_TIMER_WHEEL_NOCASCADE
+/* Does the bucket hold a timer which is worth waking up for? */
+static int bucket_has_timer(struct tvec_base *base, unsigned int idx)
+{
+	struct timer_list *nte;
+
+	if (!test_bit(idx, base->pending_map))
+		return 0;
+	if (list_empty(base->vectors + idx)) {
+		__clear_bit(idx, base->pending_map);
+		return 0;
+	}
+	list_for_each_entry(nte, base->vectors + idx, entry)
+		if (!tbase_get_deferrable(nte->base))
+			return 1;
+	return 0;
+}
+
+static unsigned long __next_timer_interrupt(struct tvec_base *base)
+{
+	unsigned long clk = base->timer_jiffies;
+	unsigned long expires = clk + NEXT_TIMER_MAX_DELTA;
+	unsigned long bucket;
+	unsigned int lvl, i;
+
+	for (lvl = 0; lvl < LVL_DEPTH; lvl++) {
+		/* The first bucket of the level expiring at or after clk */
+		bucket = (clk + LVL_GRAN(lvl) - 1) >> LVL_SHIFT(lvl);
+		for (i = 0; i < LVL_SIZE; i++, bucket++) {
+			if (!time_before(bucket << LVL_SHIFT(lvl), expires)) {
+				/* The coarser levels start later still */
+				if (!i)
+					return expires;
+				break;
+			}
+			if (bucket_has_timer(base, LVL_OFFS(lvl) +
+					     (bucket & LVL_MASK))) {
+				expires = bucket << LVL_SHIFT(lvl);
+				break;
+			}
+		}
+	}
+	return expires;
+}
+#else
 static unsigned long __next_timer_interrupt(struct tvec_base *base)
 {
 	unsigned long timer_jiffies = base->timer_jiffies;
@@ -1206,6 +1479,7 @@ cascade:
 	}
 	return expires;
 }
+#endif
 
 /*
  * Check, if the next hrtimer event is before the next timer wheel
@@ -1635,6 +1909,11 @@ static int __cpuinit init_timers_cpu(int cpu)
 
 	spin_lock_init(&base->lock);
 
+#ifdef CONFIG_TIMER_WHEEL_NOCASCADE
+	for (j = 0; j < WHEEL_SIZE; j++)
+		INIT_LIST_HEAD(base->vectors + j);
+	bitmap_zero(base->pending_map, WHEEL_SIZE);
+#else
 	for (j = 0; j < TVN_SIZE; j++) {
 		INIT_LIST_HEAD(base->tv5.vec + j);
 		INIT_LIST_HEAD(base->tv4.vec + j);
@@ -1643,6 +1922,7 @@ static int __cpuinit init_timers_cpu(int cpu)
 	}
 	for (j = 0; j < TVR_SIZE; j++)
 		INIT_LIST_HEAD(base->tv1.vec + j);
+#endif
 
 	base->timer_jiffies = jiffies;
 	base->next_timer = base->timer_jiffies;
@@ -1658,9 +1938,6 @@ static void migrate_timer_list(struct tvec_base *new_base, struct list_head *hea
 		timer = list_first_entry(head, struct timer_list, entry);
 		detach_timer(timer, 0);
 		timer_set_base(timer, new_base);
-		if (time_before(timer->expires, new_base->next_timer) &&
-		    !tbase_get_deferrable(timer->base))
-			new_base->next_timer = timer->expires;
 		internal_add_timer(new_base, timer);
 	}
 }
@@ -1683,6 +1960,11 @@ static void __cpuinit migrate_timers(int cpu)
 
 	BUG_ON(old_base->running_timer);
 
+#ifdef CONFIG_TIMER_WHEEL_NOCASCADE
+	for (i = 0; i < WHEEL_SIZE; i++)
+		migrate_timer_list(new_base, old_base->vectors + i);
+	bitmap_zero(old_base->pending_map, WHEEL_SIZE);
+#else
 	for (i = 0; i < TVR_SIZE; i++)
 		migrate_timer_list(new_base, old_base->tv1.vec + i);
 	for (i = 0; i < TVN_SIZE; i++) {
@@ -1691,6 +1973,7 @@ static void __cpuinit migrate_timers(int cpu)
 		migrate_timer_list(new_base, old_base->tv4.vec + i);
 		migrate_timer_list(new_base, old_base->tv5.vec + i);
 	}
+#endif
 
 	spin_unlock(&old_base->lock);
 	spin_unlock_irq(&new_base->lock);
@@ -1740,6 +2023,139 @@ void __init init_timers(void)
 	open_softirq(TIMER_SOFTIRQ, run_timer_softirq);
 }
 
+#ifdef CONFIG_TIMER_WHEEL_STATS
+/*
+ * Start/stop data collection:
+ * # echo [1|0] >/proc/timer_wheel_stats
+ *
+ * Display the histograms collected so far, per cpu:
+ * # cat /proc/timer_wheel_stats
+ */
+static DEFINE_MUTEX(tvec_stats_mutex);
+static ktime_t tvec_stats_start, tvec_stats_stop;
+
+static int tvec_stats_show(struct seq_file *m, void *v)
+{
+	struct tvec_stats st;
+	struct timespec period;
+	unsigned long ms;
+	char range[32];
+	int cpu, i, last;
+
+	mutex_lock(&tvec_stats_mutex);
+	if (timer_wheel_stats_active)
+		tvec_stats_stop = ktime_get();
+	period = ktime_to_timespec(ktime_sub(tvec_stats_stop,
+					     tvec_stats_start));
+	ms = period.tv_nsec / 1000000;
+
+	seq_puts(m, "Timer Wheel Stats Version: v0.1\n");
+#ifdef CONFIG_TIMER_WHEEL_NOCASCADE
+	seq_printf(m, "Wheel: %d levels of %lu buckets, not cascading\n",
+		   LVL_DEPTH, LVL_SIZE);
+#else
+	seq_puts(m, "Wheel: cascading\n");
+#endif
+	seq_printf(m, "Sample period: %ld.%03ld s\n", period.tv_sec, ms);
+
+	for_each_online_cpu(cpu) {
+		struct tvec_base *base = per_cpu(tvec_bases, cpu);
+
+		spin_lock_irq(&base->lock);
+		st = base->stats;
+		spin_unlock_irq(&base->lock);
+
+		seq_printf(m, "\ncpu %d: %lu expired in %lu batches, "
+			   "%lu cascades\n", cpu, st.expired, st.batches,
+			   st.cascades);
+		for (last = TSTATS_HIST - 1; last > 0; last--)
+			if (st.latency[last] || st.batch[last] ||
+			    st.cascade[last])
+				break;
+		seq_printf(m, "  %-11s %12s %12s %12s\n", "value",
+			   "late", "batch", "cascade");
+		for (i = 0; i <= last; i++) {
+			if (i < 2)
+				snprintf(range, sizeof(range), "%d", i);
+			else if (i == TSTATS_HIST - 1)
+				snprintf(range, sizeof(range), ">=%lu",
+					 1UL << (i - 1));
+			else
+				snprintf(range, sizeof(range), "%lu-%lu",
+					 1UL << (i - 1), (1UL << i) - 1);
+			seq_printf(m, "  %-11s %12lu %12lu %12lu\n", range,
+				   st.latency[i], st.batch[i], st.cascade[i]);
+		}
+	}
+	mutex_unlock(&tvec_stats_mutex);
+
+	return 0;
+}
+
+static ssize_t tvec_stats_write(struct file *file, const char __user *buf,
+				size_t count, loff_t *offs)
+{
+	struct tvec_base *base;
+	char ctl[2];
+	int cpu;
+
+	if (count != 2 || *offs)
+		return -EINVAL;
+
+	if (copy_from_user(ctl, buf, count))
+		return -EFAULT;
+
+	mutex_lock(&tvec_stats_mutex);
+	switch (ctl[0]) {
+	case '0':
+		if (timer_wheel_stats_active) {
+			timer_wheel_stats_active = 0;
+			tvec_stats_stop = ktime_get();
+		}
+		break;
+	case '1':
+		if (!timer_wheel_stats_active) {
+			for_each_possible_cpu(cpu) {
+				base = per_cpu(tvec_bases, cpu);
+				spin_lock_irq(&base->lock);
+				memset(&base->stats, 0, sizeof(base->stats));
+				spin_unlock_irq(&base->lock);
+			}
+			tvec_stats_start = ktime_get();
+			smp_mb();
+			timer_wheel_stats_active = 1;
+		}
+		break;
+	default:
+		count = -EINVAL;
+	}
+	mutex_unlock(&tvec_stats_mutex);
+
+	return count;
+}
+
+static int tvec_stats_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, tvec_stats_show, NULL);
+}
+
+static const struct file_operations tvec_stats_fops = {
+	.open		= tvec_stats_open,
+	.read		= seq_read,
+	.write		= tvec_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init init_tvec_stats_procfs(void)
+{
+	if (!proc_create("timer_wheel_stats", 0644, NULL, &tvec_stats_fops))
+		return -ENOMEM;
+	return 0;
+}
+__initcall(init_tvec_stats_procfs);
+#endif /* CONFIG_TIMER_WHEEL_STATS */
+
 /**
  * msleep - sleep safely even with waitqueue interruptions
  * @msecs: Time in milliseconds to sleep for
@@ -5,6 +5,7 @@
  */
 #include <linux/ring_buffer.h>
 #include <linux/trace_clock.h>
+#include <linux/trace_mmap.h>
 #include <linux/spinlock.h>
 #include <linux/debugfs.h>
 #include <linux/uaccess.h>
@@ -19,7 +20,9 @@
 #include <linux/list.h>
 #include <linux/cpu.h>
 #include <linux/fs.h>
+#include <linux/mm.h>
 
+#include <asm/cacheflush.h>
 #include <asm/local.h>
 #include "trace.h"
 
@@ -380,6 +383,7 @@ struct buffer_page {
 	unsigned	 read;		/* index for next read */
 	local_t		 entries;	/* entries on this page */
 	unsigned long	 real_end;	/* real end of data */
+	unsigned	 id;		/* sub-buffer id while mapped */
 	struct buffer_data_page *page;	/* Actual data page */
 };
 
@@ -496,6 +500,10 @@ struct ring_buffer_per_cpu {
 	unsigned long			read;
 	u64				write_stamp;
 	u64				read_stamp;
+	/* mapping state, set under buffer->mutex and reader_lock */
+	int				mapped;
+	struct trace_buffer_meta	*meta_page;
+	struct buffer_page		**subbuf_ids;
 };
 
 struct ring_buffer {
@@ -1102,6 +1110,12 @@ static void rb_free_cpu_buffer(struct ring_buffer_per_cpu *cpu_buffer)
 
 	free_buffer_page(cpu_buffer->reader_page);
 
+	/* left over by a mapping that was not undone */
+	if (cpu_buffer->meta_page) {
+		free_page((unsigned long)cpu_buffer->meta_page);
+		kfree(cpu_buffer->subbuf_ids);
+	}
+
 	rb_head_page_deactivate(cpu_buffer);
 
 	if (head) {
@@ -1306,7 +1320,7 @@ out:
  *
  * Minimum size is 2 * BUF_PAGE_SIZE.
  *
- * Returns -1 on failure.
+ * Returns -EBUSY if any cpu buffer is mapped, -1 on other failures.
  */
 int ring_buffer_resize(struct ring_buffer *buffer, unsigned long size)
 {
@@ -1341,6 +1355,16 @@ int ring_buffer_resize(struct ring_buffer *buffer, unsigned long size)
 	synchronize_sched();
 
 	mutex_lock(&buffer->mutex);
+
+	/* the pages of a mapped buffer must stay where they are */
+	for_each_buffer_cpu(buffer, cpu) {
+		if (buffer->buffers[cpu]->mapped) {
+			mutex_unlock(&buffer->mutex);
+			atomic_dec(&buffer->record_disabled);
+			return -EBUSY;
+		}
+	}
+
 	get_online_cpus();
 
 	nr_pages = DIV_ROUND_UP(size, BUF_PAGE_SIZE);
@@ -3490,6 +3514,28 @@ unsigned long ring_buffer_size(struct ring_buffer *buffer)
 }
 EXPORT_SYMBOL_GPL(ring_buffer_size);
 
+/*
+ * Publish the range the reader of a mapped cpu buffer may consume,
+ * along with the buffer counters. Called with reader_lock held.
+ */
+static void rb_update_meta_page(struct ring_buffer_per_cpu *cpu_buffer)
+{
+	struct trace_buffer_meta *meta = cpu_buffer->meta_page;
+	struct buffer_page *reader = cpu_buffer->reader_page;
+
+	meta->reader.id = reader->id;
+	meta->reader.read = reader->read;
+	meta->reader.commit = rb_page_size(reader);
+
+	meta->entries = rb_num_of_entries(cpu_buffer);
+	meta->overrun = local_read(&cpu_buffer->overrun);
+	meta->read = cpu_buffer->read;
+
+	/* user space reads both pages through its own mapping */
+	flush_dcache_page(virt_to_page(reader->page));
+	flush_dcache_page(virt_to_page(meta));
+}
+
 static void
 rb_reset_cpu(struct ring_buffer_per_cpu *cpu_buffer)
 {
@@ -3526,6 +3572,10 @@ rb_reset_cpu(struct ring_buffer_per_cpu *cpu_buffer)
 	cpu_buffer->last_overrun = 0;
 
 	rb_head_page_activate(cpu_buffer);
+
+	/* nothing is left of the range the reader was given */
+	if (cpu_buffer->mapped)
+		rb_update_meta_page(cpu_buffer);
 }
 
 /**
@@ -3677,6 +3727,12 @@ int ring_buffer_swap_cpu(struct ring_buffer *buffer_a,
 	cpu_buffer_a = buffer_a->buffers[cpu];
 	cpu_buffer_b = buffer_b->buffers[cpu];
 
+	/* a mapping must keep reading the buffer it mapped */
+	if (cpu_buffer_a->mapped || cpu_buffer_b->mapped) {
+		ret = -EBUSY;
+		goto out;
+	}
+
 	if (atomic_read(&cpu_buffer_a->record_disabled))
 		goto out;
 
@@ -3784,6 +3840,10 @@ EXPORT_SYMBOL_GPL(ring_buffer_free_read_page);
  * When @full is set, the function will not return true unless
  * the writer is off the reader page.
  *
+ * While the cpu buffer is mapped (see ring_buffer_map()), its pages
+ * are never swapped out, so this always copies and @full never
+ * extracts anything.
+ *
  * Note: it is up to the calling functions to handle sleeps and wakeups.
  *  The ring buffer can be used anywhere in the kernel and can not
  *  blindly call wake_up. The layer that uses the ring buffer must be
@@ -3848,7 +3908,8 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 	 * Otherwise, we can simply swap the page with the one passed in.
 	 */
 	if (read || (len < (commit - read)) ||
-	    cpu_buffer->reader_page == cpu_buffer->commit_page) {
+	    cpu_buffer->reader_page == cpu_buffer->commit_page ||
+	    cpu_buffer->mapped) {
 		struct buffer_data_page *rpage = cpu_buffer->reader_page->page;
 		unsigned int rpos = read;
 		unsigned int pos = 0;
@@ -3956,6 +4017,246 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 }
 EXPORT_SYMBOL_GPL(ring_buffer_read_page);
 
+/**
+ * ring_buffer_map - prepare a cpu buffer for mapping to user space
+ * @buffer: the buffer to map
+ * @cpu: the cpu buffer to map
+ *
+ * Sets up the meta page and numbers the pages of the cpu buffer, the
+ * reader page first, so that ring_buffer_map_page() can find them. The
+ * pages stay in place until the last ring_buffer_unmap(): resizing the
+ * buffer and swapping the cpu buffer fail with -EBUSY meanwhile and
+ * ring_buffer_read_page() copies instead of swapping pages.
+ *
+ * Calls nest, each must be paired with a ring_buffer_unmap().
+ *
+ * Returns 0 on success or a negative error code.
+ */
+int ring_buffer_map(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct trace_buffer_meta *meta;
+	struct buffer_page **subbuf_ids;
+	struct buffer_page *bpage;
+	unsigned long flags;
+	unsigned id = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&buffer->mutex);
+
+	if (cpu_buffer->mapped) {
+		cpu_buffer->mapped++;
+		mutex_unlock(&buffer->mutex);
+		return 0;
+	}
+
+	meta = (void *)get_zeroed_page(GFP_KERNEL);
+	subbuf_ids = kcalloc(buffer->pages + 1, sizeof(*subbuf_ids),
+			     GFP_KERNEL);
+	if (!meta || !subbuf_ids) {
+		free_page((unsigned long)meta);
+		kfree(subbuf_ids);
+		mutex_unlock(&buffer->mutex);
+		return -ENOMEM;
+	}
+
+	meta->meta_page_size = PAGE_SIZE;
+	meta->meta_struct_len = sizeof(*meta);
+	meta->subbuf_size = PAGE_SIZE;
+	meta->nr_subbufs = buffer->pages + 1;
+
+	spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+
+	/* only the reader moves pages around, and we hold it off */
+	bpage = cpu_buffer->reader_page;
+	bpage->id = id;
+	subbuf_ids[id++] = bpage;
+
+	bpage = cpu_buffer->head_page;
+	do {
+		bpage->id = id;
+		subbuf_ids[id++] = bpage;
+		rb_inc_page(cpu_buffer, &bpage);
+	} while (bpage != cpu_buffer->head_page && id <= buffer->pages);
+
+	if (RB_WARN_ON(cpu_buffer, bpage != cpu_buffer->head_page ||
+		       id != buffer->pages + 1)) {
+		spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+		free_page((unsigned long)meta);
+		kfree(subbuf_ids);
+		mutex_unlock(&buffer->mutex);
+		return -EIO;
+	}
+
+	cpu_buffer->meta_page = meta;
+	cpu_buffer->subbuf_ids = subbuf_ids;
+	cpu_buffer->mapped = 1;
+
+	/* nothing is handed out before the first ring_buffer_map_get_reader() */
+	rb_update_meta_page(cpu_buffer);
+	meta->reader.commit = meta->reader.read;
+
+	spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	mutex_unlock(&buffer->mutex);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map);
+
+/**
+ * ring_buffer_unmap - release a mapping of a cpu buffer
+ * @buffer: the buffer to unmap
+ * @cpu: the cpu buffer to unmap
+ *
+ * Undoes a ring_buffer_map(). The meta page is freed by the last one,
+ * so the pages must no longer be mapped anywhere by then.
+ *
+ * Returns 0 on success or -ENODEV if @cpu is not mapped.
+ */
+int ring_buffer_unmap(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct trace_buffer_meta *meta;
+	struct buffer_page **subbuf_ids;
+	unsigned long flags;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&buffer->mutex);
+
+	if (!cpu_buffer->mapped) {
+		mutex_unlock(&buffer->mutex);
+		return -ENODEV;
+	}
+
+	if (cpu_buffer->mapped > 1) {
+		cpu_buffer->mapped--;
+		mutex_unlock(&buffer->mutex);
+		return 0;
+	}
+
+	spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+	meta = cpu_buffer->meta_page;
+	subbuf_ids = cpu_buffer->subbuf_ids;
+	cpu_buffer->meta_page = NULL;
+	cpu_buffer->subbuf_ids = NULL;
+	cpu_buffer->mapped = 0;
+	spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	mutex_unlock(&buffer->mutex);
+
+	free_page((unsigned long)meta);
+	kfree(subbuf_ids);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_unmap);
+
+/**
+ * ring_buffer_map_page - page to map at an offset of a cpu buffer
+ * @buffer: the mapped buffer
+ * @cpu: the mapped cpu buffer
+ * @pgoff: page offset into the mapping
+ *
+ * Offset 0 is the meta page (struct trace_buffer_meta), offset 1 + id
+ * the page with sub-buffer id @id. Must be called between
+ * ring_buffer_map() and ring_buffer_unmap().
+ *
+ * Returns the page or NULL if @pgoff is beyond the mapping.
+ */
+struct page *ring_buffer_map_page(struct ring_buffer *buffer, int cpu,
+				  unsigned long pgoff)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return NULL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	if (WARN_ON_ONCE(!cpu_buffer->mapped))
+		return NULL;
+
+	if (!pgoff)
+		return virt_to_page(cpu_buffer->meta_page);
+
+	if (pgoff > cpu_buffer->meta_page->nr_subbufs)
+		return NULL;
+
+	return virt_to_page(cpu_buffer->subbuf_ids[pgoff - 1]->page);
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map_page);
+
+/**
+ * ring_buffer_map_get_reader - hand the next events to a mapped reader
+ * @buffer: the mapped buffer
+ * @cpu: the mapped cpu buffer
+ *
+ * Consumes the events handed out by the previous call, from reader.read
+ * to reader.commit in the meta page, and publishes the next range. This
+ * is the rest of the reader page, or the next page swapped in from the
+ * ring once the reader page is done. The range is empty if there is
+ * nothing to read. Events lost to overwrite since the previous call
+ * are counted in reader.lost_events.
+ *
+ * Other consumers of the same cpu buffer (ring_buffer_consume(),
+ * ring_buffer_read_page()) take events away from the mapped reader.
+ *
+ * Returns 0 on success or -ENODEV if @cpu is not mapped.
+ */
+int ring_buffer_map_get_reader(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct trace_buffer_meta *meta;
+	struct buffer_page *reader;
+	unsigned long flags;
+	unsigned end;
+	int ret = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+
+	if (!cpu_buffer->mapped) {
+		ret = -ENODEV;
+		goto out_unlock;
+	}
+
+	meta = cpu_buffer->meta_page;
+	reader = cpu_buffer->reader_page;
+
+	/* the previous range is consumed, unless someone else got to it */
+	if (reader->id == meta->reader.id) {
+		end = min_t(unsigned, meta->reader.commit, rb_page_size(reader));
+		while (reader->read < end)
+			rb_advance_reader(cpu_buffer);
+	}
+
+	/* swaps in the next page if the reader page is done */
+	rb_get_reader_page(cpu_buffer);
+
+	rb_update_meta_page(cpu_buffer);
+	meta->reader.lost_events = cpu_buffer->lost_events;
+	cpu_buffer->lost_events = 0;
+
+ out_unlock:
+	spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map_get_reader);
+
 #ifdef CONFIG_TRACING
 static ssize_t
 rb_simple_read(struct file *filp, char __user *ubuf,
@@ -8,6 +8,7 @@
 #include <linux/kthread.h>
 #include <linux/module.h>
 #include <linux/time.h>
+#include <linux/trace_mmap.h>
 #include <asm/local.h>
 
 struct rb_page {
@@ -40,6 +41,10 @@ static int write_iteration = 50;
 module_param(write_iteration, uint, 0644);
 MODULE_PARM_DESC(write_iteration, "# of writes between timestamp readings");
 
+static unsigned int producer_rate;
+module_param(producer_rate, uint, 0644);
+MODULE_PARM_DESC(producer_rate, "events per millisec to write, 0 for flat out");
+
 static int producer_nice = 19;
 static int consumer_nice = 19;
 
@@ -58,7 +63,20 @@ MODULE_PARM_DESC(producer_fifo, "fifo prio for producer");
 module_param(consumer_fifo, uint, 0644);
 MODULE_PARM_DESC(consumer_fifo, "fifo prio for consumer");
 
-static int read_events;
+enum read_mode {
+	READ_EVENTS,
+	READ_PAGES,
+	READ_MAPPED,
+	NR_READ_MODES,
+};
+
+static const char *read_mode_names[NR_READ_MODES] = {
+	[READ_EVENTS]	= "events",
+	[READ_PAGES]	= "pages",
+	[READ_MAPPED]	= "mapped pages",
+};
+
+static int read_mode = NR_READ_MODES - 1;
 
 static int kill_test;
 
@@ -95,76 +113,84 @@ static enum event_status read_event(int cpu)
 	return EVENT_FOUND;
 }
 
-static enum event_status read_page(int cpu)
+/* check the events of @rpage from offset @start to @commit */
+static void read_page_events(struct rb_page *rpage, int start,
+			     unsigned long commit, int cpu)
 {
 	struct ring_buffer_event *event;
-	struct rb_page *rpage;
-	unsigned long commit;
-	void *bpage;
 	int *entry;
-	int ret;
 	int inc;
 	int i;
 
-	bpage = ring_buffer_alloc_read_page(buffer);
-	if (!bpage)
-		return EVENT_DROPPED;
+	for (i = start; i < commit && !kill_test; i += inc) {
 
-	ret = ring_buffer_read_page(buffer, &bpage, PAGE_SIZE, cpu, 1);
-	if (ret >= 0) {
-		rpage = bpage;
-		/* The commit may have missed event flags set, clear them */
-		commit = local_read(&rpage->commit) & 0xfffff;
-		for (i = 0; i < commit && !kill_test; i += inc) {
+		if (i >= (PAGE_SIZE - offsetof(struct rb_page, data))) {
+			KILL_TEST();
+			break;
+		}
 
-			if (i >= (PAGE_SIZE - offsetof(struct rb_page, data))) {
+		inc = -1;
+		event = (void *)&rpage->data[i];
+		switch (event->type_len) {
+		case RINGBUF_TYPE_PADDING:
+			/* failed writes may be discarded events */
+			if (!event->time_delta)
+				KILL_TEST();
+			inc = event->array[0] + 4;
+			break;
+		case RINGBUF_TYPE_TIME_EXTEND:
+			inc = 8;
+			break;
+		case 0:
+			entry = ring_buffer_event_data(event);
+			if (*entry != cpu) {
 				KILL_TEST();
 				break;
 			}
-
-			inc = -1;
-			event = (void *)&rpage->data[i];
-			switch (event->type_len) {
-			case RINGBUF_TYPE_PADDING:
-				/* failed writes may be discarded events */
-				if (!event->time_delta)
-					KILL_TEST();
-				inc = event->array[0] + 4;
-				break;
-			case RINGBUF_TYPE_TIME_EXTEND:
-				inc = 8;
-				break;
-			case 0:
-				entry = ring_buffer_event_data(event);
-				if (*entry != cpu) {
-					KILL_TEST();
-					break;
-				}
-				read++;
-				if (!event->array[0]) {
-					KILL_TEST();
-					break;
-				}
-				inc = event->array[0] + 4;
+			read++;
+			if (!event->array[0]) {
+				KILL_TEST();
 				break;
-			default:
-				entry = ring_buffer_event_data(event);
-				if (*entry != cpu) {
-					KILL_TEST();
-					break;
-				}
-				read++;
-				inc = ((event->type_len + 1) * 4);
 			}
-			if (kill_test)
-				break;
-
-			if (inc <= 0) {
+			inc = event->array[0] + 4;
+			break;
+		default:
+			entry = ring_buffer_event_data(event);
+			if (*entry != cpu) {
 				KILL_TEST();
 				break;
 			}
+			read++;
+			inc = ((event->type_len + 1) * 4);
+		}
+		if (kill_test)
+			break;
+
+		if (inc <= 0) {
+			KILL_TEST();
+			break;
 		}
 	}
+}
+
+static enum event_status read_page(int cpu)
+{
+	struct rb_page *rpage;
+	unsigned long commit;
+	void *bpage;
+	int ret;
+
+	bpage = ring_buffer_alloc_read_page(buffer);
+	if (!bpage)
+		return EVENT_DROPPED;
+
+	ret = ring_buffer_read_page(buffer, &bpage, PAGE_SIZE, cpu, 1);
+	if (ret >= 0) {
+		rpage = bpage;
+		/* The commit may have missed event flags set, clear them */
+		commit = local_read(&rpage->commit) & 0xfffff;
+		read_page_events(rpage, 0, commit, cpu);
+	}
 	ring_buffer_free_read_page(buffer, bpage);
 
 	if (ret < 0)
@@ -172,10 +198,57 @@ static enum event_status read_page(int cpu)
 	return EVENT_FOUND;
 }
 
+/* read the events in place, the way a reader mapping trace_pipe_raw does */
+static enum event_status read_mapped_page(int cpu)
+{
+	struct trace_buffer_meta *meta;
+	struct rb_page *rpage;
+
+	if (ring_buffer_map_get_reader(buffer, cpu) < 0)
+		return EVENT_DROPPED;
+
+	meta = page_address(ring_buffer_map_page(buffer, cpu, 0));
+	if (meta->reader.read == meta->reader.commit)
+		return EVENT_DROPPED;
+
+	rpage = page_address(ring_buffer_map_page(buffer, cpu,
+						  meta->reader.id + 1));
+	read_page_events(rpage, meta->reader.read, meta->reader.commit, cpu);
+
+	return EVENT_FOUND;
+}
+
+static int map_buffers(void)
+{
+	int cpu, undo;
+
+	for_each_online_cpu(cpu) {
+		if (ring_buffer_map(buffer, cpu) < 0) {
+			for_each_online_cpu(undo) {
+				if (undo == cpu)
+					break;
+				ring_buffer_unmap(buffer, undo);
+			}
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void unmap_buffers(void)
+{
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		ring_buffer_unmap(buffer, cpu);
+}
+
 static void ring_buffer_consumer(void)
 {
-	/* toggle between reading pages and events */
-	read_events ^= 1;
+	/* cycle through reading events, pages and mapped pages */
+	read_mode = (read_mode + 1) % NR_READ_MODES;
+	if (read_mode == READ_MAPPED && map_buffers() < 0)
+		read_mode = READ_EVENTS;
 
 	read = 0;
 	while (!reader_finish && !kill_test) {
@@ -188,10 +261,16 @@ static void ring_buffer_consumer(void)
 			for_each_online_cpu(cpu) {
 				enum event_status stat;
 
-				if (read_events)
+				switch (read_mode) {
+				case READ_EVENTS:
 					stat = read_event(cpu);
-				else
+					break;
+				case READ_PAGES:
 					stat = read_page(cpu);
+					break;
+				default:
+					stat = read_mapped_page(cpu);
+				}
 
 				if (kill_test)
 					break;
@@ -207,6 +286,9 @@ static void ring_buffer_consumer(void)
 		schedule();
 		__set_current_state(TASK_RUNNING);
 	}
+	__set_current_state(TASK_RUNNING);
+	if (read_mode == READ_MAPPED)
+		unmap_buffers();
 	reader_finish = 0;
 	complete(&read_done);
 }
@@ -222,6 +304,11 @@ static void ring_buffer_producer(void)
 	unsigned long hit = 0;
 	unsigned long avg;
 	int cnt = 0;
+	/* per second samples, the first (partial) second is not counted */
+	unsigned long last_hit = 0, last_read = 0, last_overruns = 0;
+	unsigned long min_hit = ULONG_MAX, min_read = ULONG_MAX;
+	long last_sec;
+	int secs = -1, lossy_secs = 0;
 
 	/*
 	 * Hammer the buffer for 10 secs (this may
@@ -229,6 +316,7 @@ static void ring_buffer_producer(void)
 	 */
 	trace_printk("Starting ring buffer hammer\n");
 	do_gettimeofday(&start_tv);
+	last_sec = start_tv.tv_sec;
 	do {
 		struct ring_buffer_event *event;
 		int *entry;
@@ -247,6 +335,35 @@ static void ring_buffer_producer(void)
 		}
 		do_gettimeofday(&end_tv);
 
+		/* hold back until the target rate catches up with us */
+		while (producer_rate && !kill_test) {
+			time = end_tv.tv_sec - start_tv.tv_sec;
+			time *= USEC_PER_SEC;
+			time += (long long)((long)end_tv.tv_usec -
+					    (long)start_tv.tv_usec);
+			if ((unsigned long long)(hit + missed) * USEC_PER_MSEC <=
+			    time * producer_rate)
+				break;
+			cond_resched();
+			do_gettimeofday(&end_tv);
+		}
+
+		if (end_tv.tv_sec != last_sec) {
+			unsigned long now_read = ACCESS_ONCE(read);
+			unsigned long now_overruns = ring_buffer_overruns(buffer);
+
+			if (secs++ >= 0) {
+				min_hit = min(min_hit, hit - last_hit);
+				min_read = min(min_read, now_read - last_read);
+				if (now_overruns != last_overruns)
+					lossy_secs++;
+			}
+			last_hit = hit;
+			last_read = now_read;
+			last_overruns = now_overruns;
+			last_sec = end_tv.tv_sec;
+		}
+
 		cnt++;
 		if (consumer && !(cnt % wakeup_interval))
 			wake_up_process(consumer);
@@ -317,12 +434,24 @@ static void ring_buffer_producer(void)
 		trace_printk("Read:     (reader disabled)\n");
 	else
 		trace_printk("Read:     %ld  (by %s)\n", read,
-			read_events ? "events" : "pages");
+			read_mode_names[read_mode]);
 	trace_printk("Entries:  %lld\n", entries);
 	trace_printk("Total:    %lld\n", entries + overruns + read);
 	trace_printk("Missed:   %ld\n", missed);
 	trace_printk("Hit:      %ld\n", hit);
 
+	if (secs > 0) {
+		if (producer_rate)
+			trace_printk("Target rate: %u entries per millisec\n",
+				     producer_rate);
+		trace_printk("Slowest second of %d: wrote %lu entries\n",
+			     secs, min_hit);
+		if (!disable_reader)
+			trace_printk("Slowest second of %d: read %lu entries\n",
+				     secs, min_read);
+		trace_printk("Seconds with overruns: %d\n", lossy_secs);
+	}
+
 	/* Convert time from usecs to millisecs */
 	do_div(time, USEC_PER_MSEC);
 	if (time)
@@ -32,6 +32,7 @@
 #include <linux/kdebug.h>
 #include <linux/string.h>
 #include <linux/rwsem.h>
+#include <linux/trace_mmap.h>
 #include <linux/slab.h>
 #include <linux/ctype.h>
 #include <linux/init.h>
@@ -2842,6 +2843,9 @@ int tracing_update_buffers(void)
 	return ret;
 }
 
+/* vmas mapping per_cpu/cpuN/trace_pipe_raw, see tracing_buffers_mmap() */
+static atomic_t tracing_buffers_mapped = ATOMIC_INIT(0);
+
 struct trace_option_dentry;
 
 static struct trace_option_dentry *
@@ -2877,6 +2881,12 @@ static int tracing_set_tracer(const char *buf)
 	if (t == current_trace)
 		goto out;
 
+	/* swapping in max_tr would pull the buffer from under the mappings */
+	if (t->use_max_tr && atomic_read(&tracing_buffers_mapped)) {
+		ret = -EBUSY;
+		goto out;
+	}
+
 	trace_branch_disable();
 	if (current_trace && current_trace->reset)
 		current_trace->reset(tr);
@@ -3907,11 +3917,112 @@ out:
 	return ret;
 }
 
+static void tracing_buffers_mmap_open(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_file->private_data;
+
+	/* the vma got split, its pages are mapped already */
+	WARN_ON(ring_buffer_map(info->tr->buffer, info->cpu));
+	atomic_inc(&tracing_buffers_mapped);
+}
+
+static void tracing_buffers_mmap_close(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_file->private_data;
+
+	WARN_ON(ring_buffer_unmap(info->tr->buffer, info->cpu));
+	atomic_dec(&tracing_buffers_mapped);
+}
+
+static const struct vm_operations_struct tracing_buffers_vmops = {
+	.open		= tracing_buffers_mmap_open,
+	.close		= tracing_buffers_mmap_close,
+};
+
+/*
+ * Map the meta page and the sub-buffers of the cpu buffer, laid out as
+ * described in <linux/trace_mmap.h>. The mapping is read only and the
+ * buffer can't be resized while it exists.
+ */
+static int tracing_buffers_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = filp->private_data;
+	unsigned long i, nr_pages = vma_pages(vma);
+	struct page *page;
+	int ret;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_DONTCOPY | VM_DONTEXPAND;
+
+	/* expand the buffer now, it can't be resized once mapped */
+	ret = tracing_update_buffers();
+	if (ret < 0)
+		return ret;
+
+	mutex_lock(&trace_types_lock);
+	if (current_trace->use_max_tr) {
+		mutex_unlock(&trace_types_lock);
+		return -EBUSY;
+	}
+	atomic_inc(&tracing_buffers_mapped);
+	mutex_unlock(&trace_types_lock);
+
+	ret = ring_buffer_map(info->tr->buffer, info->cpu);
+	if (ret)
+		goto out_dec;
+
+	for (i = 0; i < nr_pages; i++) {
+		page = ring_buffer_map_page(info->tr->buffer, info->cpu,
+					    vma->vm_pgoff + i);
+		if (!page) {
+			ret = -EINVAL;
+			break;
+		}
+		ret = vm_insert_page(vma, vma->vm_start + i * PAGE_SIZE, page);
+		if (ret)
+			break;
+	}
+	if (ret) {
+		/* the pages inserted so far are zapped by the caller */
+		ring_buffer_unmap(info->tr->buffer, info->cpu);
+		goto out_dec;
+	}
+
+	vma->vm_ops = &tracing_buffers_vmops;
+
+	return 0;
+
+ out_dec:
+	atomic_dec(&tracing_buffers_mapped);
+	return ret;
+}
+
+static long tracing_buffers_ioctl(struct file *filp, unsigned int cmd,
+				  unsigned long arg)
+{
+	struct ftrace_buffer_info *info = filp->private_data;
+	int ret;
+
+	if (cmd != TRACE_MMAP_IOCTL_GET_READER)
+		return -ENOTTY;
+
+	trace_access_lock(info->cpu);
+	ret = ring_buffer_map_get_reader(info->tr->buffer, info->cpu);
+	trace_access_unlock(info->cpu);
+
+	return ret;
+}
+
 static const struct file_operations tracing_buffers_fops = {
 	.open		= tracing_buffers_open,
 	.read		= tracing_buffers_read,
 	.release	= tracing_buffers_release,
 	.splice_read	= tracing_buffers_splice_read,
+	.mmap		= tracing_buffers_mmap,
+	.unlocked_ioctl	= tracing_buffers_ioctl,
+	.compat_ioctl	= tracing_buffers_ioctl,
 	.llseek		= no_llseek,
 };
 
@@ -41,6 +41,8 @@
 #include <linux/debug_locks.h>
 #include <linux/lockdep.h>
 #include <linux/idr.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include "workqueue_sched.h"
 
@@ -169,6 +171,29 @@ struct global_cwq {
 	struct worker		*first_idle;	/* L: first idle worker */
 } ____cacheline_aligned_in_smp;
 
+#ifdef CONFIG_WORKQUEUE_STATS
+enum {
+	WQ_STATS_HIST		= 24,		/* log2 usecs, up to 8s */
+	WQ_STATS_CONC		= 16,		/* concurrency levels */
+};
+
+/*
+ * Execution statistics of a cwq, shown in debugfs workqueue/stats.
+ * Times are in nsecs, histograms count values v in slot fls(v usecs)
+ * or min(v, WQ_STATS_CONC - 1) for the concurrency level.
+ */
+struct cwq_stats {
+	u64			executed;	/* works executed */
+	u64			latency_sum;	/* queueing to start */
+	u64			latency_max;
+	u64			runtime_sum;	/* start to end */
+	u64			runtime_max;
+	unsigned long		latency_hist[WQ_STATS_HIST];
+	unsigned long		runtime_hist[WQ_STATS_HIST];
+	unsigned long		conc_hist[WQ_STATS_CONC];
+};
+#endif
+
 /*
  * The per-CPU workqueue.  The lower WORK_STRUCT_FLAG_BITS of
  * work_struct->data are used for flags and thus cwqs need to be
@@ -184,6 +209,10 @@ struct cpu_workqueue_struct {
 	int			nr_active;	/* L: nr of active works */
 	int			max_active;	/* L: max active works */
 	struct list_head	delayed_works;	/* L: delayed works */
+#ifdef CONFIG_WORKQUEUE_STATS
+	int			nr_executing;	/* L: works being executed */
+	struct cwq_stats	stats;		/* L: execution statistics */
+#endif
 };
 
 /*
@@ -906,26 +935,27 @@ static inline struct list_head *gcwq_determine_ins_pos(struct global_cwq *gcwq,
 }
 
 /**
- * insert_work - insert a work into gcwq
+ * __insert_work - insert a work into gcwq without waking up a worker
  * @cwq: cwq @work belongs to
  * @work: work to insert
  * @head: insertion point
  * @extra_flags: extra WORK_STRUCT_* flags to set
  *
- * Insert @work which belongs to @cwq into @gcwq after @head.
- * @extra_flags is or'd to work_struct flags.
+ * Like insert_work() but leaves waking up a worker to the caller, which
+ * must do it the same way after inserting the last of its works.
  *
  * CONTEXT:
  * spin_lock_irq(gcwq->lock).
  */
-static void insert_work(struct cpu_workqueue_struct *cwq,
-			struct work_struct *work, struct list_head *head,
-			unsigned int extra_flags)
+static void __insert_work(struct cpu_workqueue_struct *cwq,
+			  struct work_struct *work, struct list_head *head,
+			  unsigned int extra_flags)
 {
-	struct global_cwq *gcwq = cwq->gcwq;
-
 	/* we own @work, set data and link */
 	set_work_cwq(work, cwq, extra_flags);
+#ifdef CONFIG_WORKQUEUE_STATS
+	work->queued_ns = local_clock();
+#endif
 
 	/*
 	 * Ensure that we get the right work->data if we see the
@@ -934,6 +964,28 @@ static void insert_work(struct cpu_workqueue_struct *cwq,
 	smp_wmb();
 
 	list_add_tail(&work->entry, head);
+}
+
+/**
+ * insert_work - insert a work into gcwq
+ * @cwq: cwq @work belongs to
+ * @work: work to insert
+ * @head: insertion point
+ * @extra_flags: extra WORK_STRUCT_* flags to set
+ *
+ * Insert @work which belongs to @cwq into @gcwq after @head.
+ * @extra_flags is or'd to work_struct flags.
+ *
+ * CONTEXT:
+ * spin_lock_irq(gcwq->lock).
+ */
+static void insert_work(struct cpu_workqueue_struct *cwq,
+			struct work_struct *work, struct list_head *head,
+			unsigned int extra_flags)
+{
+	struct global_cwq *gcwq = cwq->gcwq;
+
+	__insert_work(cwq, work, head, extra_flags);
 
 	/*
 	 * Ensure either worker_sched_deactivated() sees the above
@@ -978,13 +1030,47 @@ static bool is_chained_work(struct workqueue_struct *wq)
 	return false;
 }
 
+/**
+ * cwq_queue_work - activate or delay a work on its cwq
+ * @cwq: cwq to queue @work on
+ * @work: work to queue
+ *
+ * Account @work as in flight on @cwq and insert it into the gcwq
+ * worklist, or onto @cwq->delayed_works if @cwq already has max_active
+ * works active.  No worker is woken up, the caller is responsible for
+ * that once it has queued all its works.
+ *
+ * CONTEXT:
+ * spin_lock_irq(gcwq->lock).
+ */
+static void cwq_queue_work(struct cpu_workqueue_struct *cwq,
+			   struct work_struct *work)
+{
+	struct list_head *worklist;
+	unsigned int work_flags;
+
+	BUG_ON(!list_empty(&work->entry));
+
+	cwq->nr_in_flight[cwq->work_color]++;
+	work_flags = work_color_to_flags(cwq->work_color);
+
+	if (likely(cwq->nr_active < cwq->max_active)) {
+		trace_workqueue_activate_work(work);
+		cwq->nr_active++;
+		worklist = gcwq_determine_ins_pos(cwq->gcwq, cwq);
+	} else {
+		work_flags |= WORK_STRUCT_DELAYED;
+		worklist = &cwq->delayed_works;
+	}
+
+	__insert_work(cwq, work, worklist, work_flags);
+}
+
 static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 			 struct work_struct *work)
 {
 	struct global_cwq *gcwq;
 	struct cpu_workqueue_struct *cwq;
-	struct list_head *worklist;
-	unsigned int work_flags;
 	unsigned long flags;
 
 	debug_work_activate(work);
@@ -1034,21 +1120,13 @@ static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 	cwq = get_cwq(gcwq->cpu, wq);
 	trace_workqueue_queue_work(cpu, cwq, work);
 
-	BUG_ON(!list_empty(&work->entry));
+	cwq_queue_work(cwq, work);
 
-	cwq->nr_in_flight[cwq->work_color]++;
-	work_flags = work_color_to_flags(cwq->work_color);
-
-	if (likely(cwq->nr_active < cwq->max_active)) {
-		trace_workqueue_activate_work(work);
-		cwq->nr_active++;
-		worklist = gcwq_determine_ins_pos(gcwq, cwq);
-	} else {
-		work_flags |= WORK_STRUCT_DELAYED;
-		worklist = &cwq->delayed_works;
-	}
+	/* see insert_work() */
+	smp_mb();
 
-	insert_work(cwq, work, worklist, work_flags);
+	if (__need_more_worker(gcwq))
+		wake_up_worker(gcwq);
 
 	spin_unlock_irqrestore(&gcwq->lock, flags);
 }
@@ -1098,6 +1176,103 @@ queue_work_on(int cpu, struct workqueue_struct *wq, struct work_struct *work)
 }
 EXPORT_SYMBOL_GPL(queue_work_on);
 
+/**
+ * queue_work_batch_on - queue a batch of works on specific cpu
+ * @cpu: CPU number to execute the works on
+ * @wq: workqueue to use
+ * @works: array of works to queue
+ * @nr: number of entries in @works
+ *
+ * Equivalent to calling queue_work_on() for each of @works in order,
+ * but the gcwq lock is taken and a worker is woken up only once for the
+ * whole batch.  Works which are already pending are skipped.
+ *
+ * Non-reentrant workqueues may have to queue each work on the cpu it
+ * last ran on, so for those this falls back to queueing one by one.
+ *
+ * Returns the number of works which were queued.
+ *
+ * We queue the works to a specific CPU, the caller must ensure it
+ * can't go away.
+ */
+int queue_work_batch_on(int cpu, struct workqueue_struct *wq,
+			struct work_struct **works, int nr)
+{
+	struct global_cwq *gcwq;
+	struct cpu_workqueue_struct *cwq;
+	unsigned long flags;
+	int i, ret = 0;
+
+	if (wq->flags & WQ_NON_REENTRANT) {
+		for (i = 0; i < nr; i++)
+			ret += queue_work_on(cpu, wq, works[i]);
+		return ret;
+	}
+
+	/* if dying, only works from the same workqueue are allowed */
+	if (unlikely(wq->flags & WQ_DYING) &&
+	    WARN_ON_ONCE(!is_chained_work(wq)))
+		return 0;
+
+	if (wq->flags & WQ_UNBOUND)
+		gcwq = get_gcwq(WORK_CPU_UNBOUND);
+	else if (unlikely(cpu == WORK_CPU_UNBOUND))
+		gcwq = get_gcwq(raw_smp_processor_id());
+	else
+		gcwq = get_gcwq(cpu);
+	cwq = get_cwq(gcwq->cpu, wq);
+
+	spin_lock_irqsave(&gcwq->lock, flags);
+
+	for (i = 0; i < nr; i++) {
+		struct work_struct *work = works[i];
+
+		if (test_and_set_bit(WORK_STRUCT_PENDING_BIT,
+				     work_data_bits(work)))
+			continue;
+
+		debug_work_activate(work);
+		trace_workqueue_queue_work(cpu, cwq, work);
+		cwq_queue_work(cwq, work);
+		ret++;
+	}
+
+	/* see insert_work() */
+	smp_mb();
+
+	if (ret && __need_more_worker(gcwq))
+		wake_up_worker(gcwq);
+
+	spin_unlock_irqrestore(&gcwq->lock, flags);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(queue_work_batch_on);
+
+/**
+ * queue_work_batch - queue a batch of works on a workqueue
+ * @wq: workqueue to use
+ * @works: array of works to queue
+ * @nr: number of entries in @works
+ *
+ * Returns the number of works which were queued, works which were
+ * already pending are skipped.
+ *
+ * Like queue_work(), this queues the works to the CPU on which they
+ * were submitted.  See queue_work_batch_on() for details.
+ */
+int queue_work_batch(struct workqueue_struct *wq,
+		     struct work_struct **works, int nr)
+{
+	int ret;
+
+	ret = queue_work_batch_on(get_cpu(), wq, works, nr);
+	put_cpu();
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(queue_work_batch);
+
 static void delayed_work_timer_fn(unsigned long __data)
 {
 	struct delayed_work *dwork = (struct delayed_work *)__data;
@@ -1779,6 +1954,52 @@ static void cwq_dec_nr_in_flight(struct cpu_workqueue_struct *cwq, int color,
 		complete(&cwq->wq->first_flusher->done);
 }
 
+#ifdef CONFIG_WORKQUEUE_STATS
+static void wq_stats_hist_add(unsigned long *hist, u64 ns)
+{
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+
+	hist[min_t(int, fls64(us), WQ_STATS_HIST - 1)]++;
+}
+
+/* called with gcwq->lock held just before @work is executed */
+static u64 cwq_stats_start(struct cpu_workqueue_struct *cwq,
+			   struct work_struct *work)
+{
+	struct cwq_stats *st = &cwq->stats;
+	u64 now = local_clock();
+	/* local_clock() of unbound works may be skewed across cpus */
+	u64 latency = now > work->queued_ns ? now - work->queued_ns : 0;
+
+	st->latency_sum += latency;
+	st->latency_max = max(st->latency_max, latency);
+	wq_stats_hist_add(st->latency_hist, latency);
+
+	cwq->nr_executing++;
+	st->conc_hist[min(cwq->nr_executing, WQ_STATS_CONC - 1)]++;
+	return now;
+}
+
+/* called with gcwq->lock held after the work started at @start is done */
+static void cwq_stats_end(struct cpu_workqueue_struct *cwq, u64 start)
+{
+	struct cwq_stats *st = &cwq->stats;
+	u64 now = local_clock();
+	u64 runtime = now > start ? now - start : 0;
+
+	st->executed++;
+	st->runtime_sum += runtime;
+	st->runtime_max = max(st->runtime_max, runtime);
+	wq_stats_hist_add(st->runtime_hist, runtime);
+	cwq->nr_executing--;
+}
+#else
+static inline u64 cwq_stats_start(struct cpu_workqueue_struct *cwq,
+				  struct work_struct *work) { return 0; }
+static inline void cwq_stats_end(struct cpu_workqueue_struct *cwq,
+				 u64 start) { }
+#endif
+
 /**
  * process_one_work - process single work
  * @worker: self
@@ -1804,6 +2025,7 @@ __acquires(&gcwq->lock)
 	work_func_t f = work->func;
 	int work_color;
 	struct worker *collision;
+	u64 start;
 #ifdef CONFIG_LOCKDEP
 	/*
 	 * It is permissible to free the struct work_struct from
@@ -1859,6 +2081,8 @@ __acquires(&gcwq->lock)
 	if (unlikely(cpu_intensive))
 		worker_set_flags(worker, WORKER_CPU_INTENSIVE, true);
 
+	start = cwq_stats_start(cwq, work);
+
 	spin_unlock_irq(&gcwq->lock);
 
 	work_clear_pending(work);
@@ -1886,6 +2110,8 @@ __acquires(&gcwq->lock)
 
 	spin_lock_irq(&gcwq->lock);
 
+	cwq_stats_end(cwq, start);
+
 	/* clear cpu intensive status */
 	if (unlikely(cpu_intensive))
 		worker_clr_flags(worker, WORKER_CPU_INTENSIVE);
@@ -3801,3 +4027,147 @@ static int __init init_workqueues(void)
 	return 0;
 }
 early_initcall(init_workqueues);
+
+#ifdef CONFIG_WORKQUEUE_STATS
+static void wq_stats_show_hist(struct seq_file *m, const char *name,
+			       unsigned long *hist, int nr)
+{
+	int i, last = -1;
+
+	for (i = 0; i < nr; i++)
+		if (hist[i])
+			last = i;
+	if (last < 0)
+		return;
+
+	seq_printf(m, "  %-8s", name);
+	for (i = 0; i <= last; i++)
+		seq_printf(m, " %lu", hist[i]);
+	seq_putc(m, '\n');
+}
+
+static int wq_stats_show(struct seq_file *m, void *v)
+{
+	struct workqueue_struct *wq;
+	struct cwq_stats sum;
+	unsigned int cpu;
+	int i;
+
+	seq_puts(m, "# times in usecs; latency and runtime histograms count "
+		 "[0, 1), [1, 2), [2, 4), ... usecs,\n"
+		 "# concurrency counts works running on the same cpu "
+		 "at start: 1, 2, ...\n");
+	seq_printf(m, "# %-22s %10s %8s %8s %8s %8s %4s\n", "workqueue",
+		   "executed", "lat_avg", "lat_max", "run_avg", "run_max",
+		   "conc");
+
+	spin_lock(&workqueue_lock);
+
+	list_for_each_entry(wq, &workqueues, list) {
+		int conc_max = 0;
+
+		memset(&sum, 0, sizeof(sum));
+
+		for_each_cwq_cpu(cpu, wq) {
+			struct global_cwq *gcwq = get_gcwq(cpu);
+			struct cwq_stats *st = &get_cwq(gcwq->cpu, wq)->stats;
+
+			spin_lock_irq(&gcwq->lock);
+
+			sum.executed += st->executed;
+			sum.latency_sum += st->latency_sum;
+			sum.latency_max = max(sum.latency_max, st->latency_max);
+			sum.runtime_sum += st->runtime_sum;
+			sum.runtime_max = max(sum.runtime_max, st->runtime_max);
+			for (i = 0; i < WQ_STATS_HIST; i++) {
+				sum.latency_hist[i] += st->latency_hist[i];
+				sum.runtime_hist[i] += st->runtime_hist[i];
+			}
+			for (i = 0; i < WQ_STATS_CONC; i++)
+				sum.conc_hist[i] += st->conc_hist[i];
+
+			spin_unlock_irq(&gcwq->lock);
+		}
+
+		if (!sum.executed)
+			continue;
+
+		for (i = 1; i < WQ_STATS_CONC; i++)
+			if (sum.conc_hist[i])
+				conc_max = i;
+
+		seq_printf(m, "%-24s %10llu %8llu %8llu %8llu %8llu %3d%s\n",
+			   wq->name, (unsigned long long)sum.executed,
+			   div64_u64(sum.latency_sum, sum.executed * NSEC_PER_USEC),
+			   div_u64(sum.latency_max, NSEC_PER_USEC),
+			   div64_u64(sum.runtime_sum, sum.executed * NSEC_PER_USEC),
+			   div_u64(sum.runtime_max, NSEC_PER_USEC),
+			   conc_max, conc_max == WQ_STATS_CONC - 1 ? "+" : "");
+		wq_stats_show_hist(m, "latency", sum.latency_hist,
+				   WQ_STATS_HIST);
+		wq_stats_show_hist(m, "runtime", sum.runtime_hist,
+				   WQ_STATS_HIST);
+		/* slot 0 is never used, start at concurrency 1 */
+		wq_stats_show_hist(m, "conc", sum.conc_hist + 1,
+				   WQ_STATS_CONC - 1);
+	}
+
+	spin_unlock(&workqueue_lock);
+
+	return 0;
+}
+
+static int wq_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, wq_stats_show, NULL);
+}
+
+/* any write clears the statistics of all workqueues */
+static ssize_t wq_stats_write(struct file *file, const char __user *buf,
+			      size_t count, loff_t *ppos)
+{
+	struct workqueue_struct *wq;
+	unsigned int cpu;
+
+	spin_lock(&workqueue_lock);
+
+	list_for_each_entry(wq, &workqueues, list) {
+		for_each_cwq_cpu(cpu, wq) {
+			struct global_cwq *gcwq = get_gcwq(cpu);
+
+			spin_lock_irq(&gcwq->lock);
+			memset(&get_cwq(gcwq->cpu, wq)->stats, 0,
+			       sizeof(struct cwq_stats));
+			spin_unlock_irq(&gcwq->lock);
+		}
+	}
+
+	spin_unlock(&workqueue_lock);
+
+	return count;
+}
+
+static const struct file_operations wq_stats_fops = {
+	.open		= wq_stats_open,
+	.read		= seq_read,
+	.write		= wq_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init wq_stats_init(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("workqueue", NULL);
+	if (!dir)
+		return -ENOMEM;
+
+	if (!debugfs_create_file("stats", 0644, dir, NULL, &wq_stats_fops)) {
+		debugfs_remove(dir);
+		return -ENOMEM;
+	}
+	return 0;
+}
+fs_initcall(wq_stats_init);
+#endif /* CONFIG_WORKQUEUE_STATS */
@@ -31,6 +31,22 @@ static int ioremap_pte_range(pmd_t *pmd, unsigned long addr,
 	return 0;
 }
 
+#ifdef CONFIG_HAVE_ARCH_HUGE_VMAP
+static inline int ioremap_huge_pmd(pmd_t *pmd, unsigned long addr,
+		unsigned long end, phys_addr_t phys_addr, pgprot_t prot)
+{
+	return vmap_allow_huge && end - addr == PMD_SIZE &&
+	       IS_ALIGNED(phys_addr, PMD_SIZE) &&
+	       arch_vmap_pmd(pmd, addr, phys_addr, prot);
+}
+#else
+static inline int ioremap_huge_pmd(pmd_t *pmd, unsigned long addr,
+		unsigned long end, phys_addr_t phys_addr, pgprot_t prot)
+{
+	return 0;
+}
+#endif
+
 static inline int ioremap_pmd_range(pud_t *pud, unsigned long addr,
 		unsigned long end, phys_addr_t phys_addr, pgprot_t prot)
 {
@@ -43,6 +59,8 @@ static inline int ioremap_pmd_range(pud_t *pud, unsigned long addr,
 		return -ENOMEM;
 	do {
 		next = pmd_addr_end(addr, end);
+		if (ioremap_huge_pmd(pmd, addr, next, phys_addr + addr, prot))
+			continue;
 		if (ioremap_pte_range(pmd, addr, next, phys_addr + addr, prot))
 			return -ENOMEM;
 	} while (pmd++, addr = next, addr != end);
@@ -14,6 +14,8 @@
 #include <linux/backing-dev.h>
 #include <linux/sysctl.h>
 #include <linux/sysfs.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 #include "internal.h"
 
 #define CREATE_TRACE_POINTS
@@ -42,8 +44,23 @@ struct compact_control {
 	unsigned int order;		/* order a direct compactor needs */
 	int migratetype;		/* MOVABLE, RECLAIMABLE etc */
 	struct zone *zone;
+
+	/* kcompactd: free blocks of order wanted, and when to give up */
+	unsigned long free_target;
+	unsigned long end_time;
 };
 
+/* Free blocks of at least @order in @zone, counted in blocks of @order */
+static unsigned long zone_free_blocks(struct zone *zone, unsigned int order)
+{
+	unsigned long nr = 0;
+	unsigned int o;
+
+	for (o = order; o < MAX_ORDER; o++)
+		nr += zone->free_area[o].nr_free << (o - order);
+	return nr;
+}
+
 static unsigned long release_freepages(struct list_head *freelist)
 {
 	struct page *page, *next;
@@ -449,6 +466,14 @@ static int compact_finished(struct zone *zone,
 	if (cc->order == -1)
 		return COMPACT_CONTINUE;
 
+	/* kcompactd runs until its target is met or its time slice is over */
+	if (cc->free_target) {
+		if (zone_free_blocks(zone, cc->order) >= cc->free_target ||
+		    time_after(jiffies, cc->end_time))
+			return COMPACT_PARTIAL;
+		return COMPACT_CONTINUE;
+	}
+
 	/* Compaction run is not finished if the watermark is not met */
 	watermark = low_wmark_pages(zone);
 	watermark += (1 << cc->order);
@@ -527,6 +552,10 @@ static int compact_zone(struct zone *zone, struct compact_control *cc)
 	ret = compaction_suitable(zone, cc->order);
 	switch (ret) {
 	case COMPACT_PARTIAL:
+		/* kcompactd wants more than the one page that is free */
+		if (cc->free_target)
+			break;
+		/* fall through */
 	case COMPACT_SKIPPED:
 		/* Compaction is likely to fail */
 		return ret;
@@ -540,6 +569,15 @@ static int compact_zone(struct zone *zone, struct compact_control *cc)
 	cc->free_pfn = cc->migrate_pfn + zone->spanned_pages;
 	cc->free_pfn &= ~(pageblock_nr_pages-1);
 
+	/* kcompactd picks up where its previous time slice left off */
+	if (cc->free_target &&
+	    zone->kcompactd_migrate_pfn >= cc->migrate_pfn &&
+	    zone->kcompactd_migrate_pfn < zone->kcompactd_free_pfn &&
+	    zone->kcompactd_free_pfn <= cc->free_pfn) {
+		cc->migrate_pfn = zone->kcompactd_migrate_pfn;
+		cc->free_pfn = zone->kcompactd_free_pfn;
+	}
+
 	migrate_prep_local();
 
 	while ((ret = compact_finished(zone, cc)) == COMPACT_CONTINUE) {
@@ -583,6 +621,17 @@ out:
 	cc->nr_freepages -= release_freepages(&cc->freepages);
 	VM_BUG_ON(cc->nr_freepages != 0);
 
+	/* Remember the scanners for kcompactd, or start over after a pass */
+	if (cc->free_target) {
+		if (ret == COMPACT_COMPLETE) {
+			zone->kcompactd_migrate_pfn = 0;
+			zone->kcompactd_free_pfn = 0;
+		} else {
+			zone->kcompactd_migrate_pfn = cc->migrate_pfn;
+			zone->kcompactd_free_pfn = cc->free_pfn;
+		}
+	}
+
 	return ret;
 }
 
@@ -626,6 +675,7 @@ unsigned long try_to_compact_pages(struct zonelist *zonelist,
 	struct zoneref *z;
 	struct zone *zone;
 	int rc = COMPACT_SKIPPED;
+	u64 start;
 
 	/*
 	 * Check whether it is worth even starting compaction. The order check is
@@ -636,6 +686,7 @@ unsigned long try_to_compact_pages(struct zonelist *zonelist,
 		return rc;
 
 	count_vm_event(COMPACTSTALL);
+	start = local_clock();
 
 	/* Compact each zone in the list */
 	for_each_zone_zonelist_nodemask(zone, z, zonelist, high_zoneidx,
@@ -650,6 +701,8 @@ unsigned long try_to_compact_pages(struct zonelist *zonelist,
 			break;
 	}
 
+	count_vm_events(COMPACTSTALL_US,
+			div_u64(local_clock() - start, NSEC_PER_USEC));
 	return rc;
 }
 
@@ -724,6 +777,183 @@ int sysctl_extfrag_handler(struct ctl_table *table, int write,
 	return 0;
 }
 
+/*
+ * kcompactd compacts in the background so that high-order allocations find
+ * their pages free instead of compacting in the allocation path.  When
+ * kcompactd_order is set, it keeps kcompactd_free_target free blocks of that
+ * order in every zone.  It looks at the zones every KCOMPACTD_INTERVAL and
+ * whenever a high-order allocation enters the allocator slow path, and it
+ * spends at most kcompactd_cpu_budget percent of a CPU compacting.
+ */
+int sysctl_kcompactd_order;
+int sysctl_kcompactd_free_target = 16;
+int sysctl_kcompactd_cpu_budget = 10;
+
+#define KCOMPACTD_INTERVAL	HZ
+/* Longest stretch of compaction between two looks at the CPU budget */
+#define KCOMPACTD_SLICE		(HZ / 20 ? HZ / 20 : 1)
+/* How long a zone kcompactd failed to bring to target is left alone */
+#define KCOMPACTD_DEFER		(10 * HZ)
+
+static DECLARE_WAIT_QUEUE_HEAD(kcompactd_wait);
+static bool kcompactd_kicked;
+
+static bool kcompactd_should_stop(void)
+{
+	return kthread_should_stop() || freezing(current);
+}
+
+/* Sleep off the time slice just used to stay within the CPU budget */
+static void kcompactd_throttle(unsigned long used)
+{
+	int budget = ACCESS_ONCE(sysctl_kcompactd_cpu_budget);
+
+	if (budget >= 100 || !used)
+		return;
+	wait_event_freezable_timeout(kcompactd_wait, kthread_should_stop(),
+				     used * (100 - budget) / budget);
+}
+
+static void kcompactd_compact_zone(struct zone *zone, unsigned int order,
+				   unsigned long target)
+{
+	unsigned long spent = 0;
+
+	for ( ; ; ) {
+		struct compact_control cc = {
+			.nr_freepages = 0,
+			.nr_migratepages = 0,
+			.order = order,
+			.migratetype = MIGRATE_MOVABLE,
+			.zone = zone,
+			.sync = false,
+			.free_target = target,
+		};
+		unsigned long start = jiffies;
+		u64 clock = local_clock();
+		int ret;
+
+		INIT_LIST_HEAD(&cc.freepages);
+		INIT_LIST_HEAD(&cc.migratepages);
+		cc.end_time = start + KCOMPACTD_SLICE;
+
+		ret = compact_zone(zone, &cc);
+		count_vm_events(KCOMPACTD_US,
+				div_u64(local_clock() - clock, NSEC_PER_USEC));
+
+		if (zone_free_blocks(zone, order) >= target) {
+			count_vm_event(KCOMPACTD_SUCCESS);
+			return;
+		}
+
+		/*
+		 * Skipped, a full pass was not enough, or an interval's worth
+		 * of CPU time went by without reaching the target.
+		 */
+		spent += jiffies - start;
+		if (ret != COMPACT_PARTIAL || spent >= KCOMPACTD_INTERVAL) {
+			count_vm_event(KCOMPACTD_FAIL);
+			/* 0 means not deferred */
+			zone->kcompactd_defer_until = jiffies + KCOMPACTD_DEFER ?: 1;
+			return;
+		}
+
+		/* Out of time: pay for the slice, then carry on */
+		kcompactd_throttle(jiffies - start);
+		if (kcompactd_should_stop())
+			return;
+	}
+}
+
+static void kcompactd_do_work(void)
+{
+	unsigned int order = ACCESS_ONCE(sysctl_kcompactd_order);
+	unsigned long target = ACCESS_ONCE(sysctl_kcompactd_free_target);
+	bool drained = false;
+	struct zone *zone;
+
+	if (!order)
+		return;
+
+	for_each_populated_zone(zone) {
+		if (kcompactd_should_stop())
+			break;
+
+		if (zone->kcompactd_defer_until) {
+			if (time_before(jiffies, zone->kcompactd_defer_until))
+				continue;
+			/* Clear it before jiffies wraps and it looks ahead again */
+			zone->kcompactd_defer_until = 0;
+		}
+
+		if (zone_free_blocks(zone, order) >= target)
+			continue;
+
+		if (!drained) {
+			count_vm_event(KCOMPACTD_WAKE);
+			/* Flush pending updates to the LRU lists */
+			lru_add_drain_all();
+			drained = true;
+		}
+		kcompactd_compact_zone(zone, order, target);
+	}
+}
+
+static int kcompactd(void *unused)
+{
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		wait_event_freezable_timeout(kcompactd_wait,
+				kcompactd_kicked || kthread_should_stop(),
+				KCOMPACTD_INTERVAL);
+		kcompactd_kicked = false;
+		kcompactd_do_work();
+	}
+	return 0;
+}
+
+/*
+ * Called from the allocator slow path for a high-order allocation: have
+ * kcompactd look at the zones now rather than at its next interval.
+ */
+void wakeup_kcompactd(int order)
+{
+	if (!sysctl_kcompactd_order || kcompactd_kicked)
+		return;
+	if (!waitqueue_active(&kcompactd_wait))
+		return;
+
+	kcompactd_kicked = true;
+	wake_up_interruptible(&kcompactd_wait);
+}
+
+int sysctl_kcompactd_handler(struct ctl_table *table, int write,
+			void __user *buffer, size_t *length, loff_t *ppos)
+{
+	int ret;
+
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (!ret && write) {
+		kcompactd_kicked = true;
+		wake_up_interruptible(&kcompactd_wait);
+	}
+	return ret;
+}
+
+static int __init kcompactd_init(void)
+{
+	struct task_struct *task;
+
+	task = kthread_run(kcompactd, NULL, "kcompactd");
+	if (IS_ERR(task)) {
+		printk(KERN_ERR "Failed to start kcompactd\n");
+		return PTR_ERR(task);
+	}
+	return 0;
+}
+module_init(kcompactd_init)
+
 #if defined(CONFIG_SYSFS) && defined(CONFIG_NUMA)
 ssize_t sysfs_compact_node(struct sys_device *dev,
 			struct sysdev_attribute *attr,
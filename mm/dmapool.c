@@ -20,6 +20,17 @@
  * least 'size' bytes.  Free blocks are tracked in an unsorted singly-linked
  * list of free blocks within the page.  Used blocks aren't tracked, but we
  * keep a count of how many are currently allocated from each page.
+ *
+ * Pages are also indexed by dma address in a red-black tree, so that
+ * dma_pool_free() can find the page owning a block in O(log n), and pages
+ * that still have free blocks sit on a separate list so that allocation
+ * does not have to walk past full pages.  On top of that, each pool keeps
+ * a small per-cpu cache of free blocks: dma_pool_alloc() and
+ * dma_pool_free() only take the pool lock to move a batch of blocks
+ * between the cache and the pages.  Blocks sitting in a cache still count
+ * as in use for their page.  The caches are disabled when DMAPOOL_DEBUG is
+ * set, so that every free goes through the poisoning and double free
+ * checks.
  */
 
 #include <linux/device.h>
@@ -29,7 +40,9 @@
 #include <linux/list.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
 #include <linux/poison.h>
+#include <linux/rbtree.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
@@ -41,8 +54,20 @@
 #define DMAPOOL_DEBUG 1
 #endif
 
+#define	POOL_CACHE_SIZE		16
+#define	POOL_CACHE_BATCH	(POOL_CACHE_SIZE / 2)
+
+struct dma_pool_cache {		/* per-cpu stack of free blocks */
+	unsigned int avail;
+	void *vaddr[POOL_CACHE_SIZE];
+	dma_addr_t dma[POOL_CACHE_SIZE];
+};
+
 struct dma_pool {		/* the pool */
 	struct list_head page_list;
+	struct list_head avail_list;
+	struct rb_root page_tree;
+	struct dma_pool_cache __percpu *cache;
 	spinlock_t lock;
 	size_t size;
 	struct device *dev;
@@ -55,6 +80,8 @@ struct dma_pool {		/* the pool */
 
 struct dma_page {		/* cacheable header for 'allocation' bytes */
 	struct list_head page_list;
+	struct list_head avail;
+	struct rb_node node;
 	void *vaddr;
 	dma_addr_t dma;
 	unsigned int in_use;
@@ -65,6 +92,19 @@ struct dma_page {		/* cacheable header for 'allocation' bytes */
 
 static DEFINE_MUTEX(pools_lock);
 
+static unsigned int pool_cached_blocks(struct dma_pool *pool)
+{
+	unsigned int blocks = 0;
+	int cpu;
+
+	if (!pool->cache)
+		return 0;
+
+	for_each_possible_cpu(cpu)
+		blocks += per_cpu_ptr(pool->cache, cpu)->avail;
+	return blocks;
+}
+
 static ssize_t
 show_pools(struct device *dev, struct device_attribute *attr, char *buf)
 {
@@ -91,6 +131,7 @@ show_pools(struct device *dev, struct device_attribute *attr, char *buf)
 			pages++;
 			blocks += page->in_use;
 		}
+		blocks -= min(blocks, pool_cached_blocks(pool));
 		spin_unlock_irq(&pool->lock);
 
 		/* per-pool info, no real statistics yet */
@@ -167,12 +208,21 @@ struct dma_pool *dma_pool_create(const char *name, struct device *dev,
 	retval->dev = dev;
 
 	INIT_LIST_HEAD(&retval->page_list);
+	INIT_LIST_HEAD(&retval->avail_list);
+	retval->page_tree = RB_ROOT;
 	spin_lock_init(&retval->lock);
 	retval->size = size;
 	retval->boundary = boundary;
 	retval->allocation = allocation;
 	init_waitqueue_head(&retval->waitq);
 
+#ifdef	DMAPOOL_DEBUG
+	retval->cache = NULL;
+#else
+	/* the pool still works without a cache, just with more locking */
+	retval->cache = alloc_percpu(struct dma_pool_cache);
+#endif
+
 	if (dev) {
 		int ret;
 
@@ -185,6 +235,7 @@ struct dma_pool *dma_pool_create(const char *name, struct device *dev,
 		if (!ret)
 			list_add(&retval->pools, &dev->dma_pools);
 		else {
+			free_percpu(retval->cache);
 			kfree(retval);
 			retval = NULL;
 		}
@@ -212,6 +263,43 @@ static void pool_initialise_page(struct dma_pool *pool, struct dma_page *page)
 	} while (offset < pool->allocation);
 }
 
+static void pool_insert_page(struct dma_pool *pool, struct dma_page *page)
+{
+	struct rb_node **p = &pool->page_tree.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*p) {
+		struct dma_page *tmp;
+
+		parent = *p;
+		tmp = rb_entry(parent, struct dma_page, node);
+		if (page->dma < tmp->dma)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+
+	rb_link_node(&page->node, parent, p);
+	rb_insert_color(&page->node, &pool->page_tree);
+}
+
+static struct dma_page *pool_find_page(struct dma_pool *pool, dma_addr_t dma)
+{
+	struct rb_node *n = pool->page_tree.rb_node;
+
+	while (n) {
+		struct dma_page *page = rb_entry(n, struct dma_page, node);
+
+		if (dma < page->dma)
+			n = n->rb_left;
+		else if (dma >= page->dma + pool->allocation)
+			n = n->rb_right;
+		else
+			return page;
+	}
+	return NULL;
+}
+
 static struct dma_page *pool_alloc_page(struct dma_pool *pool, gfp_t mem_flags)
 {
 	struct dma_page *page;
@@ -227,6 +315,8 @@ static struct dma_page *pool_alloc_page(struct dma_pool *pool, gfp_t mem_flags)
 #endif
 		pool_initialise_page(pool, page);
 		list_add(&page->page_list, &pool->page_list);
+		list_add(&page->avail, &pool->avail_list);
+		pool_insert_page(pool, page);
 		page->in_use = 0;
 		page->offset = 0;
 	} else {
@@ -250,9 +340,197 @@ static void pool_free_page(struct dma_pool *pool, struct dma_page *page)
 #endif
 	dma_free_coherent(pool->dev, pool->allocation, page->vaddr, dma);
 	list_del(&page->page_list);
+	list_del(&page->avail);
+	rb_erase(&page->node, &pool->page_tree);
 	kfree(page);
 }
 
+/*
+ * Take the first free block of @page.  Called with pool->lock held, @page
+ * must have a free block.
+ */
+static void *pool_take_block(struct dma_pool *pool, struct dma_page *page,
+			     dma_addr_t *handle)
+{
+	unsigned int offset = page->offset;
+
+	page->in_use++;
+	page->offset = *(int *)(page->vaddr + offset);
+	if (page->offset >= pool->allocation)
+		list_del_init(&page->avail);
+	*handle = offset + page->dma;
+	return offset + page->vaddr;
+}
+
+/* Why pool_put_block() refused a block */
+enum {
+	POOL_FREE_OK,
+	POOL_FREE_BAD_DMA,
+	POOL_FREE_BAD_VADDR,
+	POOL_FREE_TWICE,
+};
+
+struct dma_pool_bad_free {	/* first block a cache flush refused */
+	void *vaddr;
+	dma_addr_t dma;
+	int why;
+	unsigned int count;
+};
+
+/*
+ * Complain about a block pool_put_block() refused.  Must be called
+ * without pool->lock held, printing may take long.
+ */
+static void pool_report_bad_free(struct dma_pool *pool, void *vaddr,
+				 dma_addr_t dma, int why)
+{
+	switch (why) {
+	case POOL_FREE_BAD_DMA:
+		if (pool->dev)
+			dev_err(pool->dev,
+				"dma_pool_free %s, %p/%lx (bad dma)\n",
+				pool->name, vaddr, (unsigned long)dma);
+		else
+			printk(KERN_ERR "dma_pool_free %s, %p/%lx (bad dma)\n",
+			       pool->name, vaddr, (unsigned long)dma);
+		break;
+	case POOL_FREE_BAD_VADDR:
+		if (pool->dev)
+			dev_err(pool->dev,
+				"dma_pool_free %s, %p (bad vaddr)/%Lx\n",
+				pool->name, vaddr, (unsigned long long)dma);
+		else
+			printk(KERN_ERR
+			       "dma_pool_free %s, %p (bad vaddr)/%Lx\n",
+			       pool->name, vaddr, (unsigned long long)dma);
+		break;
+	case POOL_FREE_TWICE:
+		if (pool->dev)
+			dev_err(pool->dev, "dma_pool_free %s, dma %Lx "
+				"already free\n", pool->name,
+				(unsigned long long)dma);
+		else
+			printk(KERN_ERR "dma_pool_free %s, dma %Lx "
+				"already free\n", pool->name,
+				(unsigned long long)dma);
+		break;
+	}
+}
+
+/*
+ * Give a block back to the page it came from.  Called with pool->lock
+ * held; the caller is responsible for waking up waiters, and for
+ * reporting the block after dropping the lock if it is refused.
+ * Returns POOL_FREE_OK or why the block was refused.
+ */
+static int pool_put_block(struct dma_pool *pool, void *vaddr, dma_addr_t dma)
+{
+	struct dma_page *page;
+	unsigned int offset;
+
+	page = pool_find_page(pool, dma);
+	if (!page)
+		return POOL_FREE_BAD_DMA;
+
+	offset = vaddr - page->vaddr;
+#ifdef	DMAPOOL_DEBUG
+	if ((dma - page->dma) != offset)
+		return POOL_FREE_BAD_VADDR;
+	{
+		unsigned int chain = page->offset;
+		while (chain < pool->allocation) {
+			if (chain != offset) {
+				chain = *(int *)(page->vaddr + chain);
+				continue;
+			}
+			return POOL_FREE_TWICE;
+		}
+	}
+	memset(vaddr, POOL_POISON_FREED, pool->size);
+#endif
+
+	if (page->offset >= pool->allocation)
+		list_add(&page->avail, &pool->avail_list);
+	page->in_use--;
+	*(int *)vaddr = page->offset;
+	page->offset = offset;
+	/*
+	 * Resist a temptation to do
+	 *    if (!is_page_busy(page)) pool_free_page(pool, page);
+	 * Better have a few empty pages hang around.
+	 */
+	return POOL_FREE_OK;
+}
+
+/*
+ * Top up @cache with up to POOL_CACHE_BATCH blocks from pages that already
+ * have free blocks; never allocates new pages.  Called with pool->lock held.
+ */
+static void pool_refill_cache(struct dma_pool *pool,
+			      struct dma_pool_cache *cache)
+{
+	while (cache->avail < POOL_CACHE_BATCH &&
+	       !list_empty(&pool->avail_list)) {
+		struct dma_page *page;
+
+		page = list_first_entry(&pool->avail_list, struct dma_page,
+					avail);
+		cache->vaddr[cache->avail] =
+			pool_take_block(pool, page, &cache->dma[cache->avail]);
+		cache->avail++;
+	}
+}
+
+/*
+ * Return the @nr least recently freed blocks of @cache to their pages.
+ * Called with interrupts disabled and without pool->lock held.  Refused
+ * blocks are counted in @bad, which also keeps the first of them, so
+ * that the caller can report it once interrupts are enabled again.
+ */
+static void pool_flush_cache(struct dma_pool *pool,
+			     struct dma_pool_cache *cache, unsigned int nr,
+			     struct dma_pool_bad_free *bad)
+{
+	unsigned int i;
+	int why;
+
+	spin_lock(&pool->lock);
+	for (i = 0; i < nr; i++) {
+		why = pool_put_block(pool, cache->vaddr[i], cache->dma[i]);
+		if (why != POOL_FREE_OK && !bad->count++) {
+			bad->vaddr = cache->vaddr[i];
+			bad->dma = cache->dma[i];
+			bad->why = why;
+		}
+	}
+	if (waitqueue_active(&pool->waitq))
+		wake_up_locked(&pool->waitq);
+	spin_unlock(&pool->lock);
+
+	cache->avail -= nr;
+	memmove(cache->vaddr, cache->vaddr + nr,
+		cache->avail * sizeof(cache->vaddr[0]));
+	memmove(cache->dma, cache->dma + nr,
+		cache->avail * sizeof(cache->dma[0]));
+}
+
+/* Report what pool_flush_cache() refused, without pool->lock held */
+static void pool_report_bad_flush(struct dma_pool *pool,
+				  struct dma_pool_bad_free *bad)
+{
+	if (!bad->count)
+		return;
+	pool_report_bad_free(pool, bad->vaddr, bad->dma, bad->why);
+	if (bad->count == 1)
+		return;
+	if (pool->dev)
+		dev_err(pool->dev, "dma_pool_free %s, %u more bad blocks\n",
+			pool->name, bad->count - 1);
+	else
+		printk(KERN_ERR "dma_pool_free %s, %u more bad blocks\n",
+		       pool->name, bad->count - 1);
+}
+
 /**
  * dma_pool_destroy - destroys a pool of dma memory blocks.
  * @pool: dma pool that will be destroyed
@@ -269,6 +547,23 @@ void dma_pool_destroy(struct dma_pool *pool)
 		device_remove_file(pool->dev, &dev_attr_pools);
 	mutex_unlock(&pools_lock);
 
+	if (pool->cache) {
+		struct dma_pool_bad_free bad = { .count = 0 };
+		unsigned long flags;
+		int cpu;
+
+		local_irq_save(flags);
+		for_each_possible_cpu(cpu) {
+			struct dma_pool_cache *cache;
+
+			cache = per_cpu_ptr(pool->cache, cpu);
+			pool_flush_cache(pool, cache, cache->avail, &bad);
+		}
+		local_irq_restore(flags);
+		pool_report_bad_flush(pool, &bad);
+		free_percpu(pool->cache);
+	}
+
 	while (!list_empty(&pool->page_list)) {
 		struct dma_page *page;
 		page = list_entry(pool->page_list.next,
@@ -284,6 +579,8 @@ void dma_pool_destroy(struct dma_pool *pool)
 				       pool->name, page->vaddr);
 			/* leak the still-in-use consistent memory */
 			list_del(&page->page_list);
+			list_del(&page->avail);
+			rb_erase(&page->node, &pool->page_tree);
 			kfree(page);
 		} else
 			pool_free_page(pool, page);
@@ -302,22 +599,41 @@ EXPORT_SYMBOL(dma_pool_destroy);
  * This returns the kernel virtual address of a currently unused block,
  * and reports its dma address through the handle.
  * If such a memory block can't be allocated, %NULL is returned.
+ *
+ * Recently freed blocks are handed out from a per-cpu cache first;
+ * otherwise the pool lock is taken and the cache is refilled in the
+ * same go.
  */
 void *dma_pool_alloc(struct dma_pool *pool, gfp_t mem_flags,
 		     dma_addr_t *handle)
 {
 	unsigned long flags;
 	struct dma_page *page;
-	size_t offset;
 	void *retval;
 
 	might_sleep_if(mem_flags & __GFP_WAIT);
 
+	if (pool->cache) {
+		struct dma_pool_cache *cache;
+
+		local_irq_save(flags);
+		cache = this_cpu_ptr(pool->cache);
+		if (cache->avail) {
+			cache->avail--;
+			retval = cache->vaddr[cache->avail];
+			*handle = cache->dma[cache->avail];
+			local_irq_restore(flags);
+			return retval;
+		}
+		local_irq_restore(flags);
+	}
+
 	spin_lock_irqsave(&pool->lock, flags);
  restart:
-	list_for_each_entry(page, &pool->page_list, page_list) {
-		if (page->offset < pool->allocation)
-			goto ready;
+	if (!list_empty(&pool->avail_list)) {
+		page = list_first_entry(&pool->avail_list, struct dma_page,
+					avail);
+		goto ready;
 	}
 	page = pool_alloc_page(pool, GFP_ATOMIC);
 	if (!page) {
@@ -339,33 +655,18 @@ void *dma_pool_alloc(struct dma_pool *pool, gfp_t mem_flags,
 	}
 
  ready:
-	page->in_use++;
-	offset = page->offset;
-	page->offset = *(int *)(page->vaddr + offset);
-	retval = offset + page->vaddr;
-	*handle = offset + page->dma;
+	retval = pool_take_block(pool, page, handle);
 #ifdef	DMAPOOL_DEBUG
 	memset(retval, POOL_POISON_ALLOCATED, pool->size);
 #endif
+	if (pool->cache)
+		pool_refill_cache(pool, this_cpu_ptr(pool->cache));
  done:
 	spin_unlock_irqrestore(&pool->lock, flags);
 	return retval;
 }
 EXPORT_SYMBOL(dma_pool_alloc);
 
-static struct dma_page *pool_find_page(struct dma_pool *pool, dma_addr_t dma)
-{
-	struct dma_page *page;
-
-	list_for_each_entry(page, &pool->page_list, page_list) {
-		if (dma < page->dma)
-			continue;
-		if (dma < (page->dma + pool->allocation))
-			return page;
-	}
-	return NULL;
-}
-
 /**
  * dma_pool_free - put block back into dma pool
  * @pool: the dma pool holding the block
@@ -374,74 +675,42 @@ static struct dma_page *pool_find_page(struct dma_pool *pool, dma_addr_t dma)
  *
  * Caller promises neither device nor driver will again touch this block
  * unless it is first re-allocated.
+ *
+ * The block normally goes to a per-cpu cache first, so a bad @dma is only
+ * reported once the cache is flushed back to the pool's pages.
  */
 void dma_pool_free(struct dma_pool *pool, void *vaddr, dma_addr_t dma)
 {
-	struct dma_page *page;
 	unsigned long flags;
-	unsigned int offset;
+	int why;
 
-	spin_lock_irqsave(&pool->lock, flags);
-	page = pool_find_page(pool, dma);
-	if (!page) {
-		spin_unlock_irqrestore(&pool->lock, flags);
-		if (pool->dev)
-			dev_err(pool->dev,
-				"dma_pool_free %s, %p/%lx (bad dma)\n",
-				pool->name, vaddr, (unsigned long)dma);
-		else
-			printk(KERN_ERR "dma_pool_free %s, %p/%lx (bad dma)\n",
-			       pool->name, vaddr, (unsigned long)dma);
-		return;
-	}
-
-	offset = vaddr - page->vaddr;
-#ifdef	DMAPOOL_DEBUG
-	if ((dma - page->dma) != offset) {
-		spin_unlock_irqrestore(&pool->lock, flags);
-		if (pool->dev)
-			dev_err(pool->dev,
-				"dma_pool_free %s, %p (bad vaddr)/%Lx\n",
-				pool->name, vaddr, (unsigned long long)dma);
-		else
-			printk(KERN_ERR
-			       "dma_pool_free %s, %p (bad vaddr)/%Lx\n",
-			       pool->name, vaddr, (unsigned long long)dma);
+	/*
+	 * Waiters in dma_pool_alloc() need to see the block, so only use
+	 * the cache when nobody is sleeping on the pool.
+	 */
+	if (pool->cache && !waitqueue_active(&pool->waitq)) {
+		struct dma_pool_bad_free bad = { .count = 0 };
+		struct dma_pool_cache *cache;
+
+		local_irq_save(flags);
+		cache = this_cpu_ptr(pool->cache);
+		if (cache->avail == POOL_CACHE_SIZE)
+			pool_flush_cache(pool, cache, POOL_CACHE_BATCH, &bad);
+		cache->vaddr[cache->avail] = vaddr;
+		cache->dma[cache->avail] = dma;
+		cache->avail++;
+		local_irq_restore(flags);
+		pool_report_bad_flush(pool, &bad);
 		return;
 	}
-	{
-		unsigned int chain = page->offset;
-		while (chain < pool->allocation) {
-			if (chain != offset) {
-				chain = *(int *)(page->vaddr + chain);
-				continue;
-			}
-			spin_unlock_irqrestore(&pool->lock, flags);
-			if (pool->dev)
-				dev_err(pool->dev, "dma_pool_free %s, dma %Lx "
-					"already free\n", pool->name,
-					(unsigned long long)dma);
-			else
-				printk(KERN_ERR "dma_pool_free %s, dma %Lx "
-					"already free\n", pool->name,
-					(unsigned long long)dma);
-			return;
-		}
-	}
-	memset(vaddr, POOL_POISON_FREED, pool->size);
-#endif
 
-	page->in_use--;
-	*(int *)vaddr = page->offset;
-	page->offset = offset;
-	if (waitqueue_active(&pool->waitq))
+	spin_lock_irqsave(&pool->lock, flags);
+	why = pool_put_block(pool, vaddr, dma);
+	if (why == POOL_FREE_OK && waitqueue_active(&pool->waitq))
 		wake_up_locked(&pool->waitq);
-	/*
-	 * Resist a temptation to do
-	 *    if (!is_page_busy(page)) pool_free_page(pool, page);
-	 * Better have a few empty pages hang around.
-	 */
 	spin_unlock_irqrestore(&pool->lock, flags);
+	if (why != POOL_FREE_OK)
+		pool_report_bad_free(pool, vaddr, dma, why);
 }
 EXPORT_SYMBOL(dma_pool_free);
 
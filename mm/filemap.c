@@ -523,6 +523,113 @@ int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 }
 EXPORT_SYMBOL_GPL(add_to_page_cache_lru);
 
+/**
+ * add_to_page_cache_lru_vec - add a batch of new pages to the page cache
+ * @pvec:	the pages, each with its file offset in ->index
+ * @mapping:	the pages' address_space
+ * @gfp_mask:	page allocation mode
+ *
+ * Does add_to_page_cache_lru() for every page in @pvec, but inserts them all
+ * into the radix tree under one acquisition of the tree_lock and moves them
+ * onto the LRU lists together.  Pages that could not be added, usually
+ * because their index is already cached, are removed from @pvec and
+ * released.  The pages left in @pvec are locked and in the page cache, and
+ * the caller still holds its reference to them.
+ *
+ * Returns the number of pages added.
+ */
+unsigned add_to_page_cache_lru_vec(struct pagevec *pvec,
+				struct address_space *mapping, gfp_t gfp_mask)
+{
+	enum lru_list lru = LRU_INACTIVE_FILE;
+	struct pagevec lru_pvec;
+	int err[PAGEVEC_SIZE];
+	unsigned i, nr;
+
+	/* See add_to_page_cache_lru() */
+	if (mapping_cap_swap_backed(mapping))
+		lru = LRU_INACTIVE_ANON;
+
+	for (i = 0; i < pagevec_count(pvec); i++) {
+		struct page *page = pvec->pages[i];
+
+		if (lru == LRU_INACTIVE_ANON)
+			SetPageSwapBacked(page);
+		__set_page_locked(page);
+		err[i] = mem_cgroup_cache_charge(page, current->mm,
+					gfp_mask & GFP_RECLAIM_MASK);
+		if (!err[i]) {
+			page_cache_get(page);
+			page->mapping = mapping;
+		}
+	}
+
+	/*
+	 * The preload only guarantees the nodes for a single insertion.  The
+	 * rest of the batch usually shares its leaf node, and the tree falls
+	 * back to atomic allocations for the others; should those fail too,
+	 * drop the lock to preload again.
+	 */
+	i = 0;
+	while (i < pagevec_count(pvec)) {
+		int error = radix_tree_preload(gfp_mask & ~__GFP_HIGHMEM);
+
+		if (error) {
+			for ( ; i < pagevec_count(pvec); i++)
+				if (!err[i])
+					err[i] = error;
+			break;
+		}
+
+		spin_lock_irq(&mapping->tree_lock);
+		for ( ; i < pagevec_count(pvec); i++) {
+			struct page *page = pvec->pages[i];
+
+			if (err[i])
+				continue;
+			error = radix_tree_insert(&mapping->page_tree,
+						  page->index, page);
+			if (error == -ENOMEM)
+				break;
+			err[i] = error;
+			if (error)
+				continue;
+			mapping->nrpages++;
+			__inc_zone_page_state(page, NR_FILE_PAGES);
+			if (PageSwapBacked(page))
+				__inc_zone_page_state(page, NR_SHMEM);
+		}
+		spin_unlock_irq(&mapping->tree_lock);
+		radix_tree_preload_end();
+	}
+
+	pagevec_init(&lru_pvec, 0);
+	for (i = 0, nr = 0; i < pagevec_count(pvec); i++) {
+		struct page *page = pvec->pages[i];
+
+		if (err[i]) {
+			if (page->mapping) {
+				page->mapping = NULL;
+				mem_cgroup_uncharge_cache_page(page);
+				page_cache_release(page);
+			}
+			__clear_page_locked(page);
+			page_cache_release(page);
+			continue;
+		}
+		pvec->pages[nr++] = page;
+		/* ____pagevec_lru_add() drops the reference again */
+		page_cache_get(page);
+		pagevec_add(&lru_pvec, page);
+	}
+	pvec->nr = nr;
+
+	if (pagevec_count(&lru_pvec))
+		____pagevec_lru_add(&lru_pvec, lru);
+	return nr;
+}
+EXPORT_SYMBOL_GPL(add_to_page_cache_lru_vec);
+
 #ifdef CONFIG_NUMA
 struct page *__page_cache_alloc(gfp_t gfp)
 {
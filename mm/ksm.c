@@ -78,36 +78,63 @@
  *    take 10 attempts to find a page in the unstable tree, once it is found,
  *    it is secured in the stable tree.  (When we scan a new page, we first
  *    compare it against the stable tree, and then against the unstable tree.)
+ *
+ * Both trees are sorted by the checksum of a page first, and only by its
+ * contents when the checksums are equal: so a search costs a memcmp only
+ * on the few nodes whose checksum collides with the page's, instead of one
+ * at every level of the tree.  When merge_across_nodes is turned off there
+ * is one stable and one unstable tree per NUMA node, and pages are only
+ * merged with pages on their own node.
+ *
+ * The mergeable mms are partitioned between one or more ksmd threads, each
+ * with its own scanning cursor.  They walk page tables and checksum pages
+ * in parallel, but serialize on ksm_tree_mutex for any work on the trees.
+ * A full scan is complete when every ksmd has been through its own mms:
+ * only then are the unstable trees flushed and the next full scan started.
  */
 
+struct ksm_scan;
+
 /**
  * struct mm_slot - ksm information per mm that is being scanned
  * @link: link to the mm_slots hash list
- * @mm_list: link into the mm_slots list, rooted in ksm_mm_head
+ * @mm_list: link into the mm_slots list, rooted in its scanner's mm_head
  * @rmap_list: head for this mm_slot's singly-linked list of rmap_items
  * @mm: the mm that this information is valid for
+ * @scan: the scanner this mm has been handed to
  */
 struct mm_slot {
 	struct hlist_node link;
 	struct list_head mm_list;
 	struct rmap_item *rmap_list;
 	struct mm_struct *mm;
+	struct ksm_scan *scan;
 };
 
 /**
  * struct ksm_scan - cursor for scanning
+ * @mm_head: head of the list of mm_slots this scanner is responsible for
  * @mm_slot: the current mm_slot we are scanning
  * @address: the next address inside that to be scanned
  * @rmap_list: link to the next rmap to be scanned in the rmap_list
- * @seqnr: count of completed full scans (needed when removing unstable node)
+ * @reap_list: rmap_items taken off their rmap_list, waiting to be freed
+ * @thread: the ksmd thread moving this cursor
+ * @nr_mm_slots: number of mm_slots on @mm_head
+ * @pages_scanned: number of pages this scanner has looked at
+ * @pass_done: done with the current full scan, waiting for the others
  *
- * There is only the one ksm_scan instance of this cursor structure.
+ * There is one ksm_scan cursor per ksmd thread.
  */
 struct ksm_scan {
+	struct mm_slot mm_head;
 	struct mm_slot *mm_slot;
 	unsigned long address;
 	struct rmap_item **rmap_list;
-	unsigned long seqnr;
+	struct rmap_item *reap_list;
+	struct task_struct *thread;
+	unsigned long nr_mm_slots;
+	unsigned long pages_scanned;
+	bool pass_done;
 };
 
 /**
@@ -115,11 +142,17 @@ struct ksm_scan {
  * @node: rb node of this ksm page in the stable tree
  * @hlist: hlist head of rmap_items using this ksm page
  * @kpfn: page frame number of this ksm page
+ * @checksum: checksum of this ksm page, the primary key of the tree
+ * @nid: index of the stable tree this node is linked into
  */
 struct stable_node {
 	struct rb_node node;
 	struct hlist_head hlist;
 	unsigned long kpfn;
+	u32 checksum;
+#ifdef CONFIG_NUMA
+	int nid;
+#endif
 };
 
 /**
@@ -129,6 +162,7 @@ struct stable_node {
  * @mm: the memory structure this rmap_item is pointing into
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
  * @oldchecksum: previous checksum of the page at that virtual address
+ * @nid: index of the unstable tree, when in the unstable tree
  * @node: rb node of this rmap_item in the unstable tree
  * @head: pointer to stable_node heading this list in the stable tree
  * @hlist: link into hlist of rmap_items hanging off that stable_node
@@ -139,6 +173,9 @@ struct rmap_item {
 	struct mm_struct *mm;
 	unsigned long address;		/* + low bits used for flags below */
 	unsigned int oldchecksum;	/* when unstable */
+#ifdef CONFIG_NUMA
+	int nid;			/* when node of unstable tree */
+#endif
 	union {
 		struct rb_node node;	/* when node of unstable tree */
 		struct {		/* when listed from stable tree */
@@ -152,20 +189,40 @@ struct rmap_item {
 #define UNSTABLE_FLAG	0x100	/* is a node of the unstable tree */
 #define STABLE_FLAG	0x200	/* is listed from the stable tree */
 
-/* The stable and unstable tree heads */
-static struct rb_root root_stable_tree = RB_ROOT;
-static struct rb_root root_unstable_tree = RB_ROOT;
+#ifdef CONFIG_NUMA
+#define NUMA(x)		(x)
+#define DO_NUMA(x)	do { (x); } while (0)
+#else
+#define NUMA(x)		(0)
+#define DO_NUMA(x)	do { } while (0)
+#endif
+
+/* The stable and unstable tree heads, one of each per NUMA node */
+static struct rb_root root_stable_tree[MAX_NUMNODES] = {
+	[0 ... MAX_NUMNODES - 1] = RB_ROOT
+};
+static struct rb_root root_unstable_tree[MAX_NUMNODES] = {
+	[0 ... MAX_NUMNODES - 1] = RB_ROOT
+};
 
 #define MM_SLOTS_HASH_SHIFT 10
 #define MM_SLOTS_HASH_HEADS (1 << MM_SLOTS_HASH_SHIFT)
 static struct hlist_head mm_slots_hash[MM_SLOTS_HASH_HEADS];
 
-static struct mm_slot ksm_mm_head = {
-	.mm_list = LIST_HEAD_INIT(ksm_mm_head.mm_list),
-};
-static struct ksm_scan ksm_scan = {
-	.mm_slot = &ksm_mm_head,
-};
+#define KSM_MAX_SCANNERS	32
+static struct ksm_scan ksm_scanners[KSM_MAX_SCANNERS];
+
+/* Number of ksmd threads in use, each with its share of the mm_slots */
+static unsigned int ksm_nr_scanners = 1;
+
+/* Number of those which are done with the current full scan */
+static unsigned int ksm_nr_scanners_done;
+
+/* Number of mm_slots, over all the scanners */
+static unsigned long ksm_nr_mm_slots;
+
+/* Count of completed full scans (needed when removing unstable node) */
+static unsigned long ksm_seqnr;
 
 static struct kmem_cache *rmap_item_cache;
 static struct kmem_cache *stable_node_cache;
@@ -181,7 +238,19 @@ static unsigned long ksm_pages_sharing;
 static unsigned long ksm_pages_unshared;
 
 /* The number of rmap_items in use: to calculate pages_volatile */
-static unsigned long ksm_rmap_items;
+static atomic_long_t ksm_rmap_items = ATOMIC_LONG_INIT(0);
+
+/* The number of times a page was added to the stable tree */
+static unsigned long ksm_pages_merged;
+
+/* Pages scanned and merged per second, over the last full scan */
+static unsigned long ksm_scan_rate;
+static unsigned long ksm_merge_rate;
+
+/* Where the current full scan started from, to work out those rates */
+static unsigned long ksm_scan_start_jiffies;
+static unsigned long ksm_scan_start_scanned;
+static unsigned long ksm_scan_start_merged;
 
 /* Number of pages ksmd should scan in one batch */
 static unsigned int ksm_thread_pages_to_scan = 100;
@@ -189,13 +258,23 @@ static unsigned int ksm_thread_pages_to_scan = 100;
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/* Whether pages may be merged with pages on other NUMA nodes */
+static unsigned int ksm_merge_across_nodes = 1;
+
 #define KSM_RUN_STOP	0
 #define KSM_RUN_MERGE	1
 #define KSM_RUN_UNMERGE	2
 static unsigned int ksm_run = KSM_RUN_STOP;
 
+/*
+ * Each ksmd holds ksm_thread_sem for read while it scans a batch of pages;
+ * taking it for write locks all of them out.  Within a batch, the stable
+ * and unstable trees, and the rmap_items linked into them, are protected
+ * by ksm_tree_mutex.
+ */
 static DECLARE_WAIT_QUEUE_HEAD(ksm_thread_wait);
-static DEFINE_MUTEX(ksm_thread_mutex);
+static DECLARE_RWSEM(ksm_thread_sem);
+static DEFINE_MUTEX(ksm_tree_mutex);
 static DEFINE_SPINLOCK(ksm_mmlist_lock);
 
 #define KSM_KMEM_CACHE(__struct, __flags) kmem_cache_create("ksm_"#__struct,\
@@ -240,13 +319,13 @@ static inline struct rmap_item *alloc_rmap_item(void)
 
 	rmap_item = kmem_cache_zalloc(rmap_item_cache, GFP_KERNEL);
 	if (rmap_item)
-		ksm_rmap_items++;
+		atomic_long_inc(&ksm_rmap_items);
 	return rmap_item;
 }
 
 static inline void free_rmap_item(struct rmap_item *rmap_item)
 {
-	ksm_rmap_items--;
+	atomic_long_dec(&ksm_rmap_items);
 	rmap_item->mm = NULL;	/* debug safety */
 	kmem_cache_free(rmap_item_cache, rmap_item);
 }
@@ -302,6 +381,14 @@ static inline int in_stable_tree(struct rmap_item *rmap_item)
 	return rmap_item->address & STABLE_FLAG;
 }
 
+/*
+ * Index of the stable and unstable trees a page at @kpfn belongs in.
+ */
+static inline int get_kpfn_nid(unsigned long kpfn)
+{
+	return ksm_merge_across_nodes ? 0 : NUMA(pfn_to_nid(kpfn));
+}
+
 /*
  * ksmd, and unmerge_and_remove_all_rmap_items(), must not touch an mm's
  * page tables after it has passed through ksm_exit() - which, if necessary,
@@ -458,7 +545,7 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node)
 		cond_resched();
 	}
 
-	rb_erase(&stable_node->node, &root_stable_tree);
+	rb_erase(&stable_node->node, &root_stable_tree[NUMA(stable_node->nid)]);
 	free_stable_node(stable_node);
 }
 
@@ -480,7 +567,7 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node)
  * a page to put something that might look like our key in page->mapping.
  *
  * include/linux/pagemap.h page_cache_get_speculative() is a good reference,
- * but this is different - made simpler by ksm_thread_mutex being held, but
+ * but this is different - made simpler by ksm_tree_mutex being held, but
  * interesting for assuming that no other use of the struct page could ever
  * put our expected_mapping into page->mapping (or a field of the union which
  * coincides with page->mapping).  The RCU calls are not for KSM at all, but
@@ -553,10 +640,11 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		 * if this rmap_item was inserted by this scan, rather
 		 * than left over from before.
 		 */
-		age = (unsigned char)(ksm_scan.seqnr - rmap_item->address);
+		age = (unsigned char)(ksm_seqnr - rmap_item->address);
 		BUG_ON(age > 1);
 		if (!age)
-			rb_erase(&rmap_item->node, &root_unstable_tree);
+			rb_erase(&rmap_item->node,
+				 &root_unstable_tree[NUMA(rmap_item->nid)]);
 
 		ksm_pages_unshared--;
 		rmap_item->address &= PAGE_MASK;
@@ -565,14 +653,40 @@ out:
 	cond_resched();		/* we're called from many long loops */
 }
 
-static void remove_trailing_rmap_items(struct mm_slot *mm_slot,
+/*
+ * A scanner may hold mmap_sem while it finds rmap_items to be freed, but
+ * must not take ksm_tree_mutex inside mmap_sem: so they are queued on its
+ * reap_list first, then removed from the trees once mmap_sem is dropped.
+ */
+static inline void reap_rmap_item(struct ksm_scan *scan,
+				  struct rmap_item *rmap_item)
+{
+	rmap_item->rmap_list = scan->reap_list;
+	scan->reap_list = rmap_item;
+}
+
+static void reap_rmap_items(struct ksm_scan *scan)
+{
+	if (!scan->reap_list)
+		return;
+
+	mutex_lock(&ksm_tree_mutex);
+	while (scan->reap_list) {
+		struct rmap_item *rmap_item = scan->reap_list;
+		scan->reap_list = rmap_item->rmap_list;
+		remove_rmap_item_from_tree(rmap_item);
+		free_rmap_item(rmap_item);
+	}
+	mutex_unlock(&ksm_tree_mutex);
+}
+
+static void remove_trailing_rmap_items(struct ksm_scan *scan,
 				       struct rmap_item **rmap_list)
 {
 	while (*rmap_list) {
 		struct rmap_item *rmap_item = *rmap_list;
 		*rmap_list = rmap_item->rmap_list;
-		remove_rmap_item_from_tree(rmap_item);
-		free_rmap_item(rmap_item);
+		reap_rmap_item(scan, rmap_item);
 	}
 }
 
@@ -608,9 +722,21 @@ static int unmerge_ksm_pages(struct vm_area_struct *vma,
 
 #ifdef CONFIG_SYSFS
 /*
- * Only called through the sysfs control interface:
+ * Put every cursor back at the start of its list, ready for a new full scan.
+ * Called with ksm_thread_sem held for write, and ksm_mmlist_lock.
  */
-static int unmerge_and_remove_all_rmap_items(void)
+static void reset_scanners(void)
+{
+	int i;
+
+	for (i = 0; i < KSM_MAX_SCANNERS; i++) {
+		ksm_scanners[i].mm_slot = &ksm_scanners[i].mm_head;
+		ksm_scanners[i].pass_done = false;
+	}
+	ksm_nr_scanners_done = 0;
+}
+
+static int unmerge_and_remove_rmap_items(struct ksm_scan *scan)
 {
 	struct mm_slot *mm_slot;
 	struct mm_struct *mm;
@@ -618,12 +744,12 @@ static int unmerge_and_remove_all_rmap_items(void)
 	int err = 0;
 
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = list_entry(ksm_mm_head.mm_list.next,
+	scan->mm_slot = list_entry(scan->mm_head.mm_list.next,
 						struct mm_slot, mm_list);
 	spin_unlock(&ksm_mmlist_lock);
 
-	for (mm_slot = ksm_scan.mm_slot;
-			mm_slot != &ksm_mm_head; mm_slot = ksm_scan.mm_slot) {
+	for (mm_slot = scan->mm_slot;
+			mm_slot != &scan->mm_head; mm_slot = scan->mm_slot) {
 		mm = mm_slot->mm;
 		down_read(&mm->mmap_sem);
 		for (vma = mm->mmap; vma; vma = vma->vm_next) {
@@ -637,34 +763,58 @@ static int unmerge_and_remove_all_rmap_items(void)
 				goto error;
 		}
 
-		remove_trailing_rmap_items(mm_slot, &mm_slot->rmap_list);
+		remove_trailing_rmap_items(scan, &mm_slot->rmap_list);
 
-		spin_lock(&ksm_mmlist_lock);
-		ksm_scan.mm_slot = list_entry(mm_slot->mm_list.next,
-						struct mm_slot, mm_list);
 		if (ksm_test_exit(mm)) {
+			spin_lock(&ksm_mmlist_lock);
+			scan->mm_slot = list_entry(mm_slot->mm_list.next,
+						struct mm_slot, mm_list);
 			hlist_del(&mm_slot->link);
 			list_del(&mm_slot->mm_list);
+			scan->nr_mm_slots--;
+			ksm_nr_mm_slots--;
 			spin_unlock(&ksm_mmlist_lock);
 
 			free_mm_slot(mm_slot);
 			clear_bit(MMF_VM_MERGEABLE, &mm->flags);
 			up_read(&mm->mmap_sem);
+			reap_rmap_items(scan);
 			mmdrop(mm);
 		} else {
-			spin_unlock(&ksm_mmlist_lock);
 			up_read(&mm->mmap_sem);
+			/* Reap while the cursor still pins the mm: see below */
+			reap_rmap_items(scan);
+
+			spin_lock(&ksm_mmlist_lock);
+			scan->mm_slot = list_entry(mm_slot->mm_list.next,
+						struct mm_slot, mm_list);
+			spin_unlock(&ksm_mmlist_lock);
 		}
 	}
-
-	ksm_scan.seqnr = 0;
 	return 0;
 
 error:
 	up_read(&mm->mmap_sem);
+	return err;
+}
+
+/*
+ * Only called through the sysfs control interface:
+ */
+static int unmerge_and_remove_all_rmap_items(void)
+{
+	int err = 0;
+	int i;
+
+	for (i = 0; i < ksm_nr_scanners && !err; i++)
+		err = unmerge_and_remove_rmap_items(&ksm_scanners[i]);
+
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = &ksm_mm_head;
+	reset_scanners();
 	spin_unlock(&ksm_mmlist_lock);
+
+	if (!err)
+		ksm_seqnr = 0;
 	return err;
 }
 #endif /* CONFIG_SYSFS */
@@ -976,6 +1126,8 @@ static struct page *try_to_merge_two_pages(struct rmap_item *rmap_item,
 
 /*
  * stable_tree_search - search for page inside the stable tree
+ * @page: the page that we are searching identical page to
+ * @checksum: checksum of @page
  *
  * This function checks if there is a page inside the stable tree
  * with identical content to the page that we are scanning right now.
@@ -983,10 +1135,11 @@ static struct page *try_to_merge_two_pages(struct rmap_item *rmap_item,
  * This function returns the stable tree node of identical content if found,
  * NULL otherwise.
  */
-static struct page *stable_tree_search(struct page *page)
+static struct page *stable_tree_search(struct page *page, u32 checksum)
 {
-	struct rb_node *node = root_stable_tree.rb_node;
+	struct rb_node *node;
 	struct stable_node *stable_node;
+	int nid;
 
 	stable_node = page_stable_node(page);
 	if (stable_node) {			/* ksm page forked */
@@ -994,12 +1147,23 @@ static struct page *stable_tree_search(struct page *page)
 		return page;
 	}
 
+	nid = get_kpfn_nid(page_to_pfn(page));
+	node = root_stable_tree[nid].rb_node;
+
 	while (node) {
 		struct page *tree_page;
 		int ret;
 
 		cond_resched();
 		stable_node = rb_entry(node, struct stable_node, node);
+		if (checksum != stable_node->checksum) {
+			if (checksum < stable_node->checksum)
+				node = node->rb_left;
+			else
+				node = node->rb_right;
+			continue;
+		}
+
 		tree_page = get_ksm_page(stable_node);
 		if (!tree_page)
 			return NULL;
@@ -1028,9 +1192,19 @@ static struct page *stable_tree_search(struct page *page)
  */
 static struct stable_node *stable_tree_insert(struct page *kpage)
 {
-	struct rb_node **new = &root_stable_tree.rb_node;
+	struct rb_node **new;
 	struct rb_node *parent = NULL;
 	struct stable_node *stable_node;
+	u32 checksum;
+	int nid;
+
+	/*
+	 * kpage is write-protected now, but may have changed since the
+	 * checksum in cmp_and_merge_page() was taken: so take it again.
+	 */
+	checksum = calc_checksum(kpage);
+	nid = get_kpfn_nid(page_to_pfn(kpage));
+	new = &root_stable_tree[nid].rb_node;
 
 	while (*new) {
 		struct page *tree_page;
@@ -1038,6 +1212,15 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 
 		cond_resched();
 		stable_node = rb_entry(*new, struct stable_node, node);
+		parent = *new;
+		if (checksum != stable_node->checksum) {
+			if (checksum < stable_node->checksum)
+				new = &parent->rb_left;
+			else
+				new = &parent->rb_right;
+			continue;
+		}
+
 		tree_page = get_ksm_page(stable_node);
 		if (!tree_page)
 			return NULL;
@@ -1045,7 +1228,6 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 		ret = memcmp_pages(kpage, tree_page);
 		put_page(tree_page);
 
-		parent = *new;
 		if (ret < 0)
 			new = &parent->rb_left;
 		else if (ret > 0)
@@ -1065,11 +1247,13 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 		return NULL;
 
 	rb_link_node(&stable_node->node, parent, new);
-	rb_insert_color(&stable_node->node, &root_stable_tree);
+	rb_insert_color(&stable_node->node, &root_stable_tree[nid]);
 
 	INIT_HLIST_HEAD(&stable_node->hlist);
 
 	stable_node->kpfn = page_to_pfn(kpage);
+	stable_node->checksum = checksum;
+	DO_NUMA(stable_node->nid = nid);
 	set_page_stable_node(kpage, stable_node);
 
 	return stable_node;
@@ -1095,8 +1279,13 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 					      struct page **tree_pagep)
 
 {
-	struct rb_node **new = &root_unstable_tree.rb_node;
+	struct rb_node **new;
 	struct rb_node *parent = NULL;
+	u32 checksum = rmap_item->oldchecksum;
+	int nid;
+
+	nid = get_kpfn_nid(page_to_pfn(page));
+	new = &root_unstable_tree[nid].rb_node;
 
 	while (*new) {
 		struct rmap_item *tree_rmap_item;
@@ -1105,6 +1294,15 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 
 		cond_resched();
 		tree_rmap_item = rb_entry(*new, struct rmap_item, node);
+		parent = *new;
+		if (checksum != tree_rmap_item->oldchecksum) {
+			if (checksum < tree_rmap_item->oldchecksum)
+				new = &parent->rb_left;
+			else
+				new = &parent->rb_right;
+			continue;
+		}
+
 		tree_page = get_mergeable_page(tree_rmap_item);
 		if (IS_ERR_OR_NULL(tree_page))
 			return NULL;
@@ -1117,9 +1315,17 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 			return NULL;
 		}
 
+		/*
+		 * If tree_page has been migrated to another NUMA node,
+		 * don't let it pull page over there with it.
+		 */
+		if (!ksm_merge_across_nodes && page_to_nid(tree_page) != nid) {
+			put_page(tree_page);
+			return NULL;
+		}
+
 		ret = memcmp_pages(page, tree_page);
 
-		parent = *new;
 		if (ret < 0) {
 			put_page(tree_page);
 			new = &parent->rb_left;
@@ -1133,9 +1339,10 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 	}
 
 	rmap_item->address |= UNSTABLE_FLAG;
-	rmap_item->address |= (ksm_scan.seqnr & SEQNR_MASK);
+	rmap_item->address |= (ksm_seqnr & SEQNR_MASK);
+	DO_NUMA(rmap_item->nid = nid);
 	rb_link_node(&rmap_item->node, parent, new);
-	rb_insert_color(&rmap_item->node, &root_unstable_tree);
+	rb_insert_color(&rmap_item->node, &root_unstable_tree[nid]);
 
 	ksm_pages_unshared++;
 	return NULL;
@@ -1157,6 +1364,7 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 		ksm_pages_sharing++;
 	else
 		ksm_pages_shared++;
+	ksm_pages_merged++;
 }
 
 /*
@@ -1167,20 +1375,23 @@ static void stable_tree_append(struct rmap_item *rmap_item,
  *
  * @page: the page that we are searching identical page to.
  * @rmap_item: the reverse mapping into the virtual address of this page
+ * @checksum: checksum of @page, taken before ksm_tree_mutex
+ *
+ * Called with ksm_tree_mutex held.
  */
-static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
+static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item,
+			       u32 checksum)
 {
 	struct rmap_item *tree_rmap_item;
 	struct page *tree_page = NULL;
 	struct stable_node *stable_node;
 	struct page *kpage;
-	unsigned int checksum;
 	int err;
 
 	remove_rmap_item_from_tree(rmap_item);
 
 	/* We first start with searching the page inside the stable tree */
-	kpage = stable_tree_search(page);
+	kpage = stable_tree_search(page, checksum);
 	if (kpage) {
 		err = try_to_merge_with_ksm_page(rmap_item, page, kpage);
 		if (!err) {
@@ -1202,7 +1413,6 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	 * don't want to insert it in the unstable tree, and we don't want
 	 * to waste our time searching for something identical to it there.
 	 */
-	checksum = calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
 		rmap_item->oldchecksum = checksum;
 		return;
@@ -1244,7 +1454,8 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	}
 }
 
-static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
+static struct rmap_item *get_next_rmap_item(struct ksm_scan *scan,
+					    struct mm_slot *mm_slot,
 					    struct rmap_item **rmap_list,
 					    unsigned long addr)
 {
@@ -1257,8 +1468,7 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 		if (rmap_item->address > addr)
 			break;
 		*rmap_list = rmap_item->rmap_list;
-		remove_rmap_item_from_tree(rmap_item);
-		free_rmap_item(rmap_item);
+		reap_rmap_item(scan, rmap_item);
 	}
 
 	rmap_item = alloc_rmap_item();
@@ -1272,45 +1482,126 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
-static struct rmap_item *scan_get_next_rmap_item(struct page **page)
+static unsigned long ksm_pages_scanned(void)
+{
+	unsigned long pages = 0;
+	int i;
+
+	for (i = 0; i < KSM_MAX_SCANNERS; i++)
+		pages += ksm_scanners[i].pages_scanned;
+	return pages;
+}
+
+/*
+ * Stale stable nodes are usually found and freed by get_ksm_page() when a
+ * search passes through them; but with the trees sorted by checksum, most
+ * searches look at very few nodes, so sweep the stable trees for stale nodes
+ * once per full scan.  Called with ksm_tree_mutex held.
+ */
+static void prune_stable_trees(void)
+{
+	int nid;
+
+	for (nid = 0; nid < nr_node_ids; nid++) {
+		struct rb_node *node = rb_first(&root_stable_tree[nid]);
+
+		while (node) {
+			struct stable_node *stable_node;
+			struct page *page;
+
+			stable_node = rb_entry(node, struct stable_node, node);
+			node = rb_next(node);
+			page = get_ksm_page(stable_node);
+			if (page)
+				put_page(page);
+			cond_resched();
+		}
+	}
+}
+
+/*
+ * ksm_finish_pass - note that @scan has been through all of its mm_slots.
+ *
+ * The last scanner to get here completes the full scan: it flushes the
+ * unstable trees and lets every scanner start on the next full scan.
+ */
+static void ksm_finish_pass(struct ksm_scan *scan)
+{
+	unsigned long scanned, elapsed;
+	int nid, i;
+
+	mutex_lock(&ksm_tree_mutex);
+	scan->pass_done = true;
+	if (++ksm_nr_scanners_done < ksm_nr_scanners) {
+		mutex_unlock(&ksm_tree_mutex);
+		return;
+	}
+
+	scanned = ksm_pages_scanned();
+	elapsed = max(jiffies - ksm_scan_start_jiffies, 1UL);
+	ksm_scan_rate = div_u64((u64)(scanned - ksm_scan_start_scanned) * HZ,
+				elapsed);
+	ksm_merge_rate = div_u64((u64)(ksm_pages_merged -
+				       ksm_scan_start_merged) * HZ, elapsed);
+	ksm_scan_start_jiffies = jiffies;
+	ksm_scan_start_scanned = scanned;
+	ksm_scan_start_merged = ksm_pages_merged;
+
+	prune_stable_trees();
+
+	for (nid = 0; nid < nr_node_ids; nid++)
+		root_unstable_tree[nid] = RB_ROOT;
+	ksm_seqnr++;
+
+	for (i = 0; i < ksm_nr_scanners; i++)
+		ksm_scanners[i].pass_done = false;
+	ksm_nr_scanners_done = 0;
+	mutex_unlock(&ksm_tree_mutex);
+
+	/*
+	 * A number of pages can hang around indefinitely on per-cpu
+	 * pagevecs, raised page count preventing write_protect_page
+	 * from merging them.  Though it doesn't really matter much,
+	 * it is puzzling to see some stuck in pages_volatile until
+	 * other activity jostles them out, and they also prevented
+	 * LTP's KSM test from succeeding deterministically; so drain
+	 * them here (here rather than on entry to ksm_do_scan(),
+	 * so we don't IPI too often when pages_to_scan is set low).
+	 */
+	lru_add_drain_all();
+
+	wake_up_interruptible(&ksm_thread_wait);
+}
+
+static struct rmap_item *scan_get_next_rmap_item(struct ksm_scan *scan,
+						 struct page **page)
 {
 	struct mm_struct *mm;
 	struct mm_slot *slot;
 	struct vm_area_struct *vma;
 	struct rmap_item *rmap_item;
 
-	if (list_empty(&ksm_mm_head.mm_list))
+	if (scan->pass_done)
 		return NULL;
 
-	slot = ksm_scan.mm_slot;
-	if (slot == &ksm_mm_head) {
-		/*
-		 * A number of pages can hang around indefinitely on per-cpu
-		 * pagevecs, raised page count preventing write_protect_page
-		 * from merging them.  Though it doesn't really matter much,
-		 * it is puzzling to see some stuck in pages_volatile until
-		 * other activity jostles them out, and they also prevented
-		 * LTP's KSM test from succeeding deterministically; so drain
-		 * them here (here rather than on entry to ksm_do_scan(),
-		 * so we don't IPI too often when pages_to_scan is set low).
-		 */
-		lru_add_drain_all();
-
-		root_unstable_tree = RB_ROOT;
-
+	slot = scan->mm_slot;
+	if (slot == &scan->mm_head) {
 		spin_lock(&ksm_mmlist_lock);
 		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
-		ksm_scan.mm_slot = slot;
+		scan->mm_slot = slot;
 		spin_unlock(&ksm_mmlist_lock);
 		/*
-		 * Although we tested list_empty() above, a racing __ksm_exit
-		 * of the last mm on the list may have removed it since then.
+		 * This scanner may have been handed no mms at all, or a
+		 * racing __ksm_exit may have removed the last one: either
+		 * way, it has nothing to do until the next full scan.
 		 */
-		if (slot == &ksm_mm_head)
+		if (slot == &scan->mm_head) {
+			ksm_finish_pass(scan);
 			return NULL;
+		}
 next_mm:
-		ksm_scan.address = 0;
-		ksm_scan.rmap_list = &slot->rmap_list;
+		scan->address = 0;
+		scan->rmap_list = &slot->rmap_list;
 	}
 
 	mm = slot->mm;
@@ -1318,60 +1609,58 @@ next_mm:
 	if (ksm_test_exit(mm))
 		vma = NULL;
 	else
-		vma = find_vma(mm, ksm_scan.address);
+		vma = find_vma(mm, scan->address);
 
 	for (; vma; vma = vma->vm_next) {
 		if (!(vma->vm_flags & VM_MERGEABLE))
 			continue;
-		if (ksm_scan.address < vma->vm_start)
-			ksm_scan.address = vma->vm_start;
+		if (scan->address < vma->vm_start)
+			scan->address = vma->vm_start;
 		if (!vma->anon_vma)
-			ksm_scan.address = vma->vm_end;
+			scan->address = vma->vm_end;
 
-		while (ksm_scan.address < vma->vm_end) {
+		while (scan->address < vma->vm_end) {
 			if (ksm_test_exit(mm))
 				break;
-			*page = follow_page(vma, ksm_scan.address, FOLL_GET);
+			*page = follow_page(vma, scan->address, FOLL_GET);
 			if (IS_ERR_OR_NULL(*page)) {
-				ksm_scan.address += PAGE_SIZE;
+				scan->address += PAGE_SIZE;
 				cond_resched();
 				continue;
 			}
 			if (PageAnon(*page) ||
 			    page_trans_compound_anon(*page)) {
-				flush_anon_page(vma, *page, ksm_scan.address);
+				flush_anon_page(vma, *page, scan->address);
 				flush_dcache_page(*page);
-				rmap_item = get_next_rmap_item(slot,
-					ksm_scan.rmap_list, ksm_scan.address);
+				rmap_item = get_next_rmap_item(scan, slot,
+					scan->rmap_list, scan->address);
 				if (rmap_item) {
-					ksm_scan.rmap_list =
+					scan->rmap_list =
 							&rmap_item->rmap_list;
-					ksm_scan.address += PAGE_SIZE;
+					scan->address += PAGE_SIZE;
 				} else
 					put_page(*page);
 				up_read(&mm->mmap_sem);
+				reap_rmap_items(scan);
 				return rmap_item;
 			}
 			put_page(*page);
-			ksm_scan.address += PAGE_SIZE;
+			scan->address += PAGE_SIZE;
 			cond_resched();
 		}
 	}
 
 	if (ksm_test_exit(mm)) {
-		ksm_scan.address = 0;
-		ksm_scan.rmap_list = &slot->rmap_list;
+		scan->address = 0;
+		scan->rmap_list = &slot->rmap_list;
 	}
 	/*
 	 * Nuke all the rmap_items that are above this current rmap:
 	 * because there were no VM_MERGEABLE vmas with such addresses.
 	 */
-	remove_trailing_rmap_items(slot, ksm_scan.rmap_list);
+	remove_trailing_rmap_items(scan, scan->rmap_list);
 
-	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = list_entry(slot->mm_list.next,
-						struct mm_slot, mm_list);
-	if (ksm_scan.address == 0) {
+	if (scan->address == 0) {
 		/*
 		 * We've completed a full scan of all vmas, holding mmap_sem
 		 * throughout, and found no VM_MERGEABLE: so do the same as
@@ -1381,77 +1670,129 @@ next_mm:
 		 * or when all VM_MERGEABLE areas have been unmapped (and
 		 * mmap_sem then protects against race with MADV_MERGEABLE).
 		 */
+		spin_lock(&ksm_mmlist_lock);
+		scan->mm_slot = list_entry(slot->mm_list.next,
+						struct mm_slot, mm_list);
 		hlist_del(&slot->link);
 		list_del(&slot->mm_list);
+		scan->nr_mm_slots--;
+		ksm_nr_mm_slots--;
 		spin_unlock(&ksm_mmlist_lock);
 
 		free_mm_slot(slot);
 		clear_bit(MMF_VM_MERGEABLE, &mm->flags);
 		up_read(&mm->mmap_sem);
+		/*
+		 * Other ksmds may still reach this mm through its rmap_items
+		 * in the unstable tree until they have been reaped.
+		 */
+		reap_rmap_items(scan);
 		mmdrop(mm);
 	} else {
-		spin_unlock(&ksm_mmlist_lock);
 		up_read(&mm->mmap_sem);
+		/*
+		 * Reap before moving the cursor on: __ksm_exit frees a slot
+		 * the cursor is not on and mmdrops its mm at once, while other
+		 * ksmds could still reach the mm through the rmap_items that
+		 * are waiting on our reap_list in the unstable tree.
+		 */
+		reap_rmap_items(scan);
+
+		spin_lock(&ksm_mmlist_lock);
+		scan->mm_slot = list_entry(slot->mm_list.next,
+						struct mm_slot, mm_list);
+		spin_unlock(&ksm_mmlist_lock);
 	}
 
 	/* Repeat until we've completed scanning the whole list */
-	slot = ksm_scan.mm_slot;
-	if (slot != &ksm_mm_head)
+	slot = scan->mm_slot;
+	if (slot != &scan->mm_head)
 		goto next_mm;
 
-	ksm_scan.seqnr++;
+	ksm_finish_pass(scan);
 	return NULL;
 }
 
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
+ * @scan - the cursor of this ksmd.
  * @scan_npages - number of pages we want to scan before we return.
  */
-static void ksm_do_scan(unsigned int scan_npages)
+static void ksm_do_scan(struct ksm_scan *scan, unsigned int scan_npages)
 {
 	struct rmap_item *rmap_item;
 	struct page *uninitialized_var(page);
 
 	while (scan_npages-- && likely(!freezing(current))) {
 		cond_resched();
-		rmap_item = scan_get_next_rmap_item(&page);
+		rmap_item = scan_get_next_rmap_item(scan, &page);
 		if (!rmap_item)
 			return;
-		if (!PageKsm(page) || !in_stable_tree(rmap_item))
-			cmp_and_merge_page(page, rmap_item);
+		scan->pages_scanned++;
+		if (!PageKsm(page) || !in_stable_tree(rmap_item)) {
+			u32 checksum = calc_checksum(page);
+
+			mutex_lock(&ksm_tree_mutex);
+			cmp_and_merge_page(page, rmap_item, checksum);
+			mutex_unlock(&ksm_tree_mutex);
+		}
 		put_page(page);
 	}
 }
 
-static int ksmd_should_run(void)
+static int ksmd_should_run(struct ksm_scan *scan)
 {
-	return (ksm_run & KSM_RUN_MERGE) && !list_empty(&ksm_mm_head.mm_list);
+	return (ksm_run & KSM_RUN_MERGE) && ksm_nr_mm_slots &&
+		scan - ksm_scanners < ksm_nr_scanners && !scan->pass_done;
 }
 
-static int ksm_scan_thread(void *nothing)
+static int ksm_scan_thread(void *arg)
 {
+	struct ksm_scan *scan = arg;
+
 	set_freezable();
 	set_user_nice(current, 5);
 
 	while (!kthread_should_stop()) {
-		mutex_lock(&ksm_thread_mutex);
-		if (ksmd_should_run())
-			ksm_do_scan(ksm_thread_pages_to_scan);
-		mutex_unlock(&ksm_thread_mutex);
+		down_read(&ksm_thread_sem);
+		if (ksmd_should_run(scan))
+			ksm_do_scan(scan, ksm_thread_pages_to_scan);
+		up_read(&ksm_thread_sem);
 
 		try_to_freeze();
 
-		if (ksmd_should_run()) {
+		if (ksmd_should_run(scan)) {
 			schedule_timeout_interruptible(
 				msecs_to_jiffies(ksm_thread_sleep_millisecs));
 		} else {
 			wait_event_freezable(ksm_thread_wait,
-				ksmd_should_run() || kthread_should_stop());
+				ksmd_should_run(scan) || kthread_should_stop());
 		}
 	}
 	return 0;
 }
 
+static int ksm_start_scanner(int i)
+{
+	struct task_struct *thread;
+
+	if (ksm_scanners[i].thread)
+		return 0;
+
+	if (i)
+		thread = kthread_run(ksm_scan_thread, &ksm_scanners[i],
+				     "ksmd/%d", i);
+	else
+		thread = kthread_run(ksm_scan_thread, &ksm_scanners[i],
+				     "ksmd");
+	if (IS_ERR(thread)) {
+		printk(KERN_ERR "ksm: creating kthread failed\n");
+		return PTR_ERR(thread);
+	}
+	ksm_scanners[i].thread = thread;
+	return 0;
+}
+
 int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 		unsigned long end, int advice, unsigned long *vm_flags)
 {
@@ -1495,9 +1836,26 @@ int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 	return 0;
 }
 
+/*
+ * Hand a new mm to the scanner with the fewest mms.
+ * Called with ksm_mmlist_lock held.
+ */
+static struct ksm_scan *ksm_pick_scanner(void)
+{
+	struct ksm_scan *scan = &ksm_scanners[0];
+	int i;
+
+	for (i = 1; i < ksm_nr_scanners; i++) {
+		if (ksm_scanners[i].nr_mm_slots < scan->nr_mm_slots)
+			scan = &ksm_scanners[i];
+	}
+	return scan;
+}
+
 int __ksm_enter(struct mm_struct *mm)
 {
 	struct mm_slot *mm_slot;
+	struct ksm_scan *scan;
 	int needs_wakeup;
 
 	mm_slot = alloc_mm_slot();
@@ -1505,16 +1863,20 @@ int __ksm_enter(struct mm_struct *mm)
 		return -ENOMEM;
 
 	/* Check ksm_run too?  Would need tighter locking */
-	needs_wakeup = list_empty(&ksm_mm_head.mm_list);
+	needs_wakeup = !ksm_nr_mm_slots;
 
 	spin_lock(&ksm_mmlist_lock);
 	insert_to_mm_slots_hash(mm, mm_slot);
+	scan = ksm_pick_scanner();
+	mm_slot->scan = scan;
 	/*
 	 * Insert just behind the scanning cursor, to let the area settle
 	 * down a little; when fork is followed by immediate exec, we don't
 	 * want ksmd to waste time setting up and tearing down an rmap_list.
 	 */
-	list_add_tail(&mm_slot->mm_list, &ksm_scan.mm_slot->mm_list);
+	list_add_tail(&mm_slot->mm_list, &scan->mm_slot->mm_list);
+	scan->nr_mm_slots++;
+	ksm_nr_mm_slots++;
 	spin_unlock(&ksm_mmlist_lock);
 
 	set_bit(MMF_VM_MERGEABLE, &mm->flags);
@@ -1542,14 +1904,16 @@ void __ksm_exit(struct mm_struct *mm)
 
 	spin_lock(&ksm_mmlist_lock);
 	mm_slot = get_mm_slot(mm);
-	if (mm_slot && ksm_scan.mm_slot != mm_slot) {
+	if (mm_slot && mm_slot->scan->mm_slot != mm_slot) {
 		if (!mm_slot->rmap_list) {
 			hlist_del(&mm_slot->link);
 			list_del(&mm_slot->mm_list);
+			mm_slot->scan->nr_mm_slots--;
+			ksm_nr_mm_slots--;
 			easy_to_free = 1;
 		} else {
 			list_move(&mm_slot->mm_list,
-				  &ksm_scan.mm_slot->mm_list);
+				  &mm_slot->scan->mm_slot->mm_list);
 		}
 	}
 	spin_unlock(&ksm_mmlist_lock);
@@ -1764,14 +2128,18 @@ static struct stable_node *ksm_check_stable_tree(unsigned long start_pfn,
 						 unsigned long end_pfn)
 {
 	struct rb_node *node;
+	int nid;
 
-	for (node = rb_first(&root_stable_tree); node; node = rb_next(node)) {
-		struct stable_node *stable_node;
+	for (nid = 0; nid < nr_node_ids; nid++) {
+		for (node = rb_first(&root_stable_tree[nid]); node;
+		     node = rb_next(node)) {
+			struct stable_node *stable_node;
 
-		stable_node = rb_entry(node, struct stable_node, node);
-		if (stable_node->kpfn >= start_pfn &&
-		    stable_node->kpfn < end_pfn)
-			return stable_node;
+			stable_node = rb_entry(node, struct stable_node, node);
+			if (stable_node->kpfn >= start_pfn &&
+			    stable_node->kpfn < end_pfn)
+				return stable_node;
+		}
 	}
 	return NULL;
 }
@@ -1787,13 +2155,13 @@ static int ksm_memory_callback(struct notifier_block *self,
 		/*
 		 * Keep it very simple for now: just lock out ksmd and
 		 * MADV_UNMERGEABLE while any memory is going offline.
-		 * mutex_lock_nested() is necessary because lockdep was alarmed
-		 * that here we take ksm_thread_mutex inside notifier chain
+		 * down_write_nested() is necessary because lockdep was alarmed
+		 * that here we take ksm_thread_sem inside notifier chain
 		 * mutex, and later take notifier chain mutex inside
-		 * ksm_thread_mutex to unlock it.   But that's safe because both
+		 * ksm_thread_sem to unlock it.   But that's safe because both
 		 * are inside mem_hotplug_mutex.
 		 */
-		mutex_lock_nested(&ksm_thread_mutex, SINGLE_DEPTH_NESTING);
+		down_write_nested(&ksm_thread_sem, SINGLE_DEPTH_NESTING);
 		break;
 
 	case MEM_OFFLINE:
@@ -1808,7 +2176,7 @@ static int ksm_memory_callback(struct notifier_block *self,
 		/* fallthrough */
 
 	case MEM_CANCEL_OFFLINE:
-		mutex_unlock(&ksm_thread_mutex);
+		up_write(&ksm_thread_sem);
 		break;
 	}
 	return NOTIFY_OK;
@@ -1897,7 +2265,7 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 	 * on the list for when ksmd may be set running again).
 	 */
 
-	mutex_lock(&ksm_thread_mutex);
+	down_write(&ksm_thread_sem);
 	if (ksm_run != flags) {
 		ksm_run = flags;
 		if (flags & KSM_RUN_UNMERGE) {
@@ -1912,7 +2280,7 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 			}
 		}
 	}
-	mutex_unlock(&ksm_thread_mutex);
+	up_write(&ksm_thread_sem);
 
 	if (flags & KSM_RUN_MERGE)
 		wake_up_interruptible(&ksm_thread_wait);
@@ -1921,6 +2289,102 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 }
 KSM_ATTR(run);
 
+static ssize_t scan_threads_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_nr_scanners);
+}
+
+static ssize_t scan_threads_store(struct kobject *kobj,
+				  struct kobj_attribute *attr,
+				  const char *buf, size_t count)
+{
+	LIST_HEAD(mm_slots);
+	struct mm_slot *mm_slot;
+	unsigned long nr;
+	int err, i;
+
+	err = strict_strtoul(buf, 10, &nr);
+	if (err || nr < 1 || nr > KSM_MAX_SCANNERS)
+		return -EINVAL;
+
+	/*
+	 * Threads which are no longer needed are not stopped: they just
+	 * wait in ksm_scan_thread() until they are wanted again.
+	 */
+	down_write(&ksm_thread_sem);
+	for (i = ksm_nr_scanners; i < nr; i++) {
+		err = ksm_start_scanner(i);
+		if (err) {
+			count = err;
+			goto out;
+		}
+	}
+
+	/*
+	 * Deal the mm_slots out again between the scanners in use, and
+	 * have each of them start from the beginning of its new list.
+	 */
+	spin_lock(&ksm_mmlist_lock);
+	for (i = 0; i < KSM_MAX_SCANNERS; i++) {
+		list_splice_init(&ksm_scanners[i].mm_head.mm_list, &mm_slots);
+		ksm_scanners[i].nr_mm_slots = 0;
+	}
+	ksm_nr_scanners = nr;
+	for (i = 0; !list_empty(&mm_slots); i = (i + 1) % nr) {
+		mm_slot = list_first_entry(&mm_slots, struct mm_slot, mm_list);
+		mm_slot->scan = &ksm_scanners[i];
+		list_move_tail(&mm_slot->mm_list,
+			       &ksm_scanners[i].mm_head.mm_list);
+		ksm_scanners[i].nr_mm_slots++;
+	}
+	reset_scanners();
+	spin_unlock(&ksm_mmlist_lock);
+out:
+	up_write(&ksm_thread_sem);
+
+	wake_up_interruptible(&ksm_thread_wait);
+
+	return count;
+}
+KSM_ATTR(scan_threads);
+
+#ifdef CONFIG_NUMA
+static ssize_t merge_across_nodes_show(struct kobject *kobj,
+				       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_merge_across_nodes);
+}
+
+static ssize_t merge_across_nodes_store(struct kobject *kobj,
+				       struct kobj_attribute *attr,
+				       const char *buf, size_t count)
+{
+	int err;
+	unsigned long knob;
+
+	err = strict_strtoul(buf, 10, &knob);
+	if (err || knob > 1)
+		return -EINVAL;
+
+	/*
+	 * The stable tree a ksm page belongs in depends on this setting,
+	 * so it can only be changed while no pages are shared.
+	 */
+	down_write(&ksm_thread_sem);
+	if (ksm_merge_across_nodes != knob) {
+		if (ksm_pages_shared)
+			err = -EBUSY;
+		else
+			ksm_merge_across_nodes = knob;
+	}
+	up_write(&ksm_thread_sem);
+
+	return err ? err : count;
+}
+KSM_ATTR(merge_across_nodes);
+#endif
+
 static ssize_t pages_shared_show(struct kobject *kobj,
 				 struct kobj_attribute *attr, char *buf)
 {
@@ -1947,8 +2411,9 @@ static ssize_t pages_volatile_show(struct kobject *kobj,
 {
 	long ksm_pages_volatile;
 
-	ksm_pages_volatile = ksm_rmap_items - ksm_pages_shared
-				- ksm_pages_sharing - ksm_pages_unshared;
+	ksm_pages_volatile = atomic_long_read(&ksm_rmap_items)
+				- ksm_pages_shared - ksm_pages_sharing
+				- ksm_pages_unshared;
 	/*
 	 * It was not worth any locking to calculate that statistic,
 	 * but it might therefore sometimes be negative: conceal that.
@@ -1962,19 +2427,55 @@ KSM_ATTR_RO(pages_volatile);
 static ssize_t full_scans_show(struct kobject *kobj,
 			       struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_scan.seqnr);
+	return sprintf(buf, "%lu\n", ksm_seqnr);
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t pages_scanned_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_scanned());
+}
+KSM_ATTR_RO(pages_scanned);
+
+static ssize_t pages_merged_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_merged);
+}
+KSM_ATTR_RO(pages_merged);
+
+static ssize_t scan_rate_show(struct kobject *kobj,
+			      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_scan_rate);
+}
+KSM_ATTR_RO(scan_rate);
+
+static ssize_t merge_rate_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_merge_rate);
+}
+KSM_ATTR_RO(merge_rate);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
 	&run_attr.attr,
+	&scan_threads_attr.attr,
+#ifdef CONFIG_NUMA
+	&merge_across_nodes_attr.attr,
+#endif
 	&pages_shared_attr.attr,
 	&pages_sharing_attr.attr,
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
 	&full_scans_attr.attr,
+	&pages_scanned_attr.attr,
+	&pages_merged_attr.attr,
+	&scan_rate_attr.attr,
+	&merge_rate_attr.attr,
 	NULL,
 };
 
@@ -1986,25 +2487,27 @@ static struct attribute_group ksm_attr_group = {
 
 static int __init ksm_init(void)
 {
-	struct task_struct *ksm_thread;
-	int err;
+	int err, i;
+
+	for (i = 0; i < KSM_MAX_SCANNERS; i++) {
+		INIT_LIST_HEAD(&ksm_scanners[i].mm_head.mm_list);
+		ksm_scanners[i].mm_slot = &ksm_scanners[i].mm_head;
+	}
+	ksm_scan_start_jiffies = jiffies;
 
 	err = ksm_slab_init();
 	if (err)
 		goto out;
 
-	ksm_thread = kthread_run(ksm_scan_thread, NULL, "ksmd");
-	if (IS_ERR(ksm_thread)) {
-		printk(KERN_ERR "ksm: creating kthread failed\n");
-		err = PTR_ERR(ksm_thread);
+	err = ksm_start_scanner(0);
+	if (err)
 		goto out_free;
-	}
 
 #ifdef CONFIG_SYSFS
 	err = sysfs_create_group(mm_kobj, &ksm_attr_group);
 	if (err) {
 		printk(KERN_ERR "ksm: register sysfs failed\n");
-		kthread_stop(ksm_thread);
+		kthread_stop(ksm_scanners[0].thread);
 		goto out_free;
 	}
 #else
@@ -2014,7 +2517,7 @@ static int __init ksm_init(void)
 
 #ifdef CONFIG_MEMORY_HOTREMOVE
 	/*
-	 * Choose a high priority since the callback takes ksm_thread_mutex:
+	 * Choose a high priority since the callback takes ksm_thread_sem:
 	 * later callbacks could only be taking locks which nest within that.
 	 */
 	hotplug_memory_notifier(ksm_memory_callback, 100);
@@ -2000,12 +2000,16 @@ EXPORT_SYMBOL(mem_cgroup_update_page_stat);
 
 /*
  * size of first charge trial. "32" comes from vmscan.c's magic value.
- * TODO: maybe necessary to use big numbers in big irons.
+ * A cpu that keeps charging the same memcg doubles its batch every time
+ * the stock runs dry, up to CHARGE_BATCH_MAX, as long as the memcg is far
+ * enough from its limit.
  */
 #define CHARGE_BATCH	32U
+#define CHARGE_BATCH_MAX	(8 * CHARGE_BATCH)
 struct memcg_stock_pcp {
 	struct mem_cgroup *cached; /* this never be root cgroup */
 	unsigned int nr_pages;
+	unsigned int batch;	/* pages charged ahead for "cached" */
 	struct work_struct work;
 	unsigned long flags;
 #define FLUSHING_CACHED_CHARGE	(0)
@@ -2014,25 +2018,51 @@ static DEFINE_PER_CPU(struct memcg_stock_pcp, memcg_stock);
 static DEFINE_MUTEX(percpu_charge_mutex);
 
 /*
- * Try to consume stocked charge on this cpu. If success, one page is consumed
- * from local stock and true is returned. If the stock is 0 or charges from a
- * cgroup which is not current target, returns false. This stock will be
- * refilled.
+ * Try to consume stocked charge on this cpu. If success, nr_pages are
+ * consumed from local stock and true is returned. If the stock is too small
+ * or charges from a cgroup which is not current target, returns false. This
+ * stock will be refilled.
  */
-static bool consume_stock(struct mem_cgroup *mem)
+static bool consume_stock(struct mem_cgroup *mem, unsigned int nr_pages)
 {
 	struct memcg_stock_pcp *stock;
 	bool ret = true;
 
 	stock = &get_cpu_var(memcg_stock);
-	if (mem == stock->cached && stock->nr_pages)
-		stock->nr_pages--;
+	if (mem == stock->cached && stock->nr_pages >= nr_pages)
+		stock->nr_pages -= nr_pages;
 	else /* need to call res_counter_charge */
 		ret = false;
 	put_cpu_var(memcg_stock);
 	return ret;
 }
 
+/*
+ * Returns how many pages to charge from res_counter for a charge of
+ * nr_pages to mem on this cpu: the local batch for mem, or nr_pages if that
+ * is larger.
+ */
+static unsigned int stock_batch(struct mem_cgroup *mem, unsigned int nr_pages)
+{
+	struct memcg_stock_pcp *stock = &get_cpu_var(memcg_stock);
+	unsigned int batch = CHARGE_BATCH;
+
+	if (stock->cached == mem)
+		batch = stock->batch;
+	put_cpu_var(memcg_stock);
+	return max(batch, nr_pages);
+}
+
+/* A batched charge hit the limit: stop charging ahead that much. */
+static void shrink_stock_batch(struct mem_cgroup *mem)
+{
+	struct memcg_stock_pcp *stock = &get_cpu_var(memcg_stock);
+
+	if (stock->cached == mem)
+		stock->batch = CHARGE_BATCH;
+	put_cpu_var(memcg_stock);
+}
+
 /*
  * Returns stocks cached in percpu to res_counter and reset cached information.
  */
@@ -2049,6 +2079,7 @@ static void drain_stock(struct memcg_stock_pcp *stock)
 		stock->nr_pages = 0;
 	}
 	stock->cached = NULL;
+	stock->batch = CHARGE_BATCH;
 }
 
 /*
@@ -2073,11 +2104,49 @@ static void refill_stock(struct mem_cgroup *mem, unsigned int nr_pages)
 	if (stock->cached != mem) { /* reset if necessary */
 		drain_stock(stock);
 		stock->cached = mem;
+	} else if (stock->batch < CHARGE_BATCH_MAX &&
+		   mem_cgroup_margin(mem) >=
+				2 * stock->batch * num_online_cpus()) {
+		/* the stock ran dry: charge more ahead next time */
+		stock->batch *= 2;
 	}
 	stock->nr_pages += nr_pages;
 	put_cpu_var(memcg_stock);
 }
 
+/*
+ * Return uncharged pages to the local stock when it caches mem, so that
+ * they serve the next charges on this cpu without a res_counter update.
+ * The stock keeps at most two batches, the excess goes back to
+ * res_counter.  Returns false if the caller has to uncharge res_counter.
+ */
+static bool uncharge_stock(struct mem_cgroup *mem, unsigned int nr_pages)
+{
+	struct memcg_stock_pcp *stock;
+	bool ret = false;
+
+	/* the stock is only ever touched from process context */
+	if (in_interrupt())
+		return false;
+
+	stock = &get_cpu_var(memcg_stock);
+	if (stock->cached == mem) {
+		stock->nr_pages += nr_pages;
+		if (stock->nr_pages > 2 * stock->batch) {
+			unsigned long bytes;
+
+			bytes = (stock->nr_pages - stock->batch) * PAGE_SIZE;
+			res_counter_uncharge(&mem->res, bytes);
+			if (do_swap_account)
+				res_counter_uncharge(&mem->memsw, bytes);
+			stock->nr_pages = stock->batch;
+		}
+		ret = true;
+	}
+	put_cpu_var(memcg_stock);
+	return ret;
+}
+
 /*
  * Tries to drain stocked charges in other cpus. This function is asynchronous
  * and just put a work per cpu for draining localy on each cpu. Caller can
@@ -2206,9 +2275,10 @@ enum {
 };
 
 static int mem_cgroup_do_charge(struct mem_cgroup *mem, gfp_t gfp_mask,
-				unsigned int nr_pages, bool oom_check)
+				unsigned int batch, unsigned int nr_pages,
+				bool oom_check)
 {
-	unsigned long csize = nr_pages * PAGE_SIZE;
+	unsigned long csize = batch * PAGE_SIZE;
 	struct mem_cgroup *mem_over_limit;
 	struct res_counter *fail_res;
 	unsigned long flags = 0;
@@ -2229,13 +2299,13 @@ static int mem_cgroup_do_charge(struct mem_cgroup *mem, gfp_t gfp_mask,
 	} else
 		mem_over_limit = mem_cgroup_from_res_counter(fail_res, res);
 	/*
-	 * nr_pages can be either a huge page (HPAGE_PMD_NR), a batch
-	 * of regular pages (CHARGE_BATCH), or a single regular page (1).
+	 * nr_pages can be either a huge page (HPAGE_PMD_NR) or a single
+	 * regular page (1), batch may be larger than that.
 	 *
-	 * Never reclaim on behalf of optional batching, retry with a
-	 * single page instead.
+	 * Never reclaim on behalf of optional batching, retry with the
+	 * requested size instead.
 	 */
-	if (nr_pages == CHARGE_BATCH)
+	if (batch > nr_pages)
 		return CHARGE_RETRY;
 
 	if (!(gfp_mask & __GFP_WAIT))
@@ -2284,7 +2354,7 @@ static int __mem_cgroup_try_charge(struct mm_struct *mm,
 				   struct mem_cgroup **memcg,
 				   bool oom)
 {
-	unsigned int batch = max(CHARGE_BATCH, nr_pages);
+	unsigned int batch = 0;
 	int nr_oom_retries = MEM_CGROUP_RECLAIM_RETRIES;
 	struct mem_cgroup *mem = NULL;
 	int ret;
@@ -2312,7 +2382,7 @@ again:
 		VM_BUG_ON(css_is_removed(&mem->css));
 		if (mem_cgroup_is_root(mem))
 			goto done;
-		if (nr_pages == 1 && consume_stock(mem))
+		if (consume_stock(mem, nr_pages))
 			goto done;
 		css_get(&mem->css);
 	} else {
@@ -2335,7 +2405,7 @@ again:
 			rcu_read_unlock();
 			goto done;
 		}
-		if (nr_pages == 1 && consume_stock(mem)) {
+		if (consume_stock(mem, nr_pages)) {
 			/*
 			 * It seems dagerous to access memcg without css_get().
 			 * But considering how consume_stok works, it's not
@@ -2355,6 +2425,10 @@ again:
 		rcu_read_unlock();
 	}
 
+	/* a failed batch leaves batch == nr_pages for the retries */
+	if (!batch)
+		batch = stock_batch(mem, nr_pages);
+
 	do {
 		bool oom_check;
 
@@ -2370,11 +2444,14 @@ again:
 			nr_oom_retries = MEM_CGROUP_RECLAIM_RETRIES;
 		}
 
-		ret = mem_cgroup_do_charge(mem, gfp_mask, batch, oom_check);
+		ret = mem_cgroup_do_charge(mem, gfp_mask, batch, nr_pages,
+					   oom_check);
 		switch (ret) {
 		case CHARGE_OK:
 			break;
 		case CHARGE_RETRY: /* not in OOM situation but retry */
+			if (batch > nr_pages)
+				shrink_stock_batch(mem);
 			batch = nr_pages;
 			css_put(&mem->css);
 			mem = NULL;
@@ -2968,11 +3045,11 @@ static void mem_cgroup_do_uncharge(struct mem_cgroup *mem,
 	 * because we want to do uncharge as soon as possible.
 	 */
 
-	if (!batch->do_batch || test_thread_flag(TIF_MEMDIE))
+	if (test_thread_flag(TIF_MEMDIE))
 		goto direct_uncharge;
 
-	if (nr_pages > 1)
-		goto direct_uncharge;
+	if (!batch->do_batch)
+		goto stock_uncharge;
 
 	/*
 	 * In typical case, batch->memcg == mem. This means we can
@@ -2980,12 +3057,21 @@ static void mem_cgroup_do_uncharge(struct mem_cgroup *mem,
 	 * If not, we uncharge res_counter ony by one.
 	 */
 	if (batch->memcg != mem)
-		goto direct_uncharge;
+		goto stock_uncharge;
 	/* remember freed charge and uncharge it later */
-	batch->nr_pages++;
+	batch->nr_pages += nr_pages;
 	if (uncharge_memsw)
-		batch->memsw_nr_pages++;
+		batch->memsw_nr_pages += nr_pages;
 	return;
+stock_uncharge:
+	/*
+	 * The stock holds memsw charges along with res ones, so it can take
+	 * the pages back unless this is a swapout, and unless someone waits
+	 * for the usage to go down.
+	 */
+	if (uncharge_memsw == do_swap_account && !atomic_read(&mem->oom_lock) &&
+	    uncharge_stock(mem, nr_pages))
+		return;
 direct_uncharge:
 	res_counter_uncharge(&mem->res, nr_pages * PAGE_SIZE);
 	if (uncharge_memsw)
@@ -3130,6 +3216,13 @@ void mem_cgroup_uncharge_end(void)
 	 * This "batch->memcg" is valid without any css_get/put etc...
 	 * bacause we hide charges behind us.
 	 */
+	if (batch->nr_pages &&
+	    batch->memsw_nr_pages == (do_swap_account ? batch->nr_pages : 0) &&
+	    !atomic_read(&batch->memcg->oom_lock) &&
+	    uncharge_stock(batch->memcg, batch->nr_pages)) {
+		batch->memcg = NULL;
+		return;
+	}
 	if (batch->nr_pages)
 		res_counter_uncharge(&batch->memcg->res,
 				     batch->nr_pages * PAGE_SIZE);
@@ -4970,6 +5063,7 @@ mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 			struct memcg_stock_pcp *stock =
 						&per_cpu(memcg_stock, cpu);
 			INIT_WORK(&stock->work, drain_local_stock);
+			stock->batch = CHARGE_BATCH;
 		}
 		hotcpu_notifier(memcg_cpu_hotplug_callback, 0);
 	} else {
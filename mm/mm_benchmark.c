@@ -0,0 +1,392 @@
+/*
+ * mm/mm_benchmark.c - memory allocator and mapping benchmarks
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Loading the module runs the benchmarks named in the "tests" parameter,
+ * or all of them, and prints their results to the kernel log:
+ *
+ * dmapool	fills a dma pool with an increasing number of blocks and
+ *		reports the average cost of an allocation, of a free in
+ *		scattered address order, and of an alloc/free pair once
+ *		the pool is populated.
+ *
+ * vmalloc	keeps a growing number of vmalloc areas alive, frees every
+ *		other one of them so that the address space is full of
+ *		holes too small for the next allocations, and reports the
+ *		average cost of vmalloc(), of a vmalloc()/vfree() pair
+ *		among the live areas, and of vfree().
+ *
+ * vmap_huge	copies within a buffer from vmalloc(), which maps PMD_SIZE
+ *		aligned chunks with a single entry where the architecture
+ *		supports it, and within a buffer of the same size built
+ *		with vmap() out of individually allocated pages, which is
+ *		always mapped with ptes.  Each buffer is copied once
+ *		sequentially and once a cache line per page in a scattered
+ *		page order, which is dominated by TLB misses.
+ */
+
+#define pr_fmt(fmt) "mm_benchmark: " fmt
+
+#include <linux/device.h>
+#include <linux/dma-mapping.h>
+#include <linux/dmapool.h>
+#include <linux/err.h>
+#include <linux/gfp.h>
+#include <linux/hrtimer.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+static char *tests;
+module_param(tests, charp, 0444);
+MODULE_PARM_DESC(tests, "comma separated benchmarks to run (default all)");
+
+static u64 ns_per_op(ktime_t start, unsigned int ops)
+{
+	return div_u64(ktime_to_ns(ktime_sub(ktime_get(), start)), ops);
+}
+
+#ifdef CONFIG_HAS_DMA
+static unsigned int dmapool_block_size = 64;
+module_param(dmapool_block_size, uint, 0444);
+MODULE_PARM_DESC(dmapool_block_size, "size of the pool blocks (default 64)");
+
+static unsigned int dmapool_max_blocks = 65536;
+module_param(dmapool_max_blocks, uint, 0444);
+MODULE_PARM_DESC(dmapool_max_blocks,
+		 "largest number of live blocks (default 65536)");
+
+static unsigned int dmapool_pair_loops = 100000;
+module_param(dmapool_pair_loops, uint, 0444);
+MODULE_PARM_DESC(dmapool_pair_loops,
+		 "alloc/free pairs per pool size (default 100000)");
+
+struct dmapool_bench_block {
+	void *vaddr;
+	dma_addr_t dma;
+};
+
+static int dmapool_bench_run(struct dma_pool *pool,
+			     struct dmapool_bench_block *blocks,
+			     unsigned int nr)
+{
+	u64 alloc_ns, free_ns, pair_ns;
+	ktime_t start;
+	unsigned int i, j;
+
+	start = ktime_get();
+	for (i = 0; i < nr; i++) {
+		blocks[i].vaddr = dma_pool_alloc(pool, GFP_KERNEL,
+						 &blocks[i].dma);
+		if (!blocks[i].vaddr)
+			goto out_free;
+	}
+	alloc_ns = ns_per_op(start, nr);
+
+	start = ktime_get();
+	for (i = 0; i < dmapool_pair_loops; i++) {
+		j = (i * 7919) & (nr - 1);
+		dma_pool_free(pool, blocks[j].vaddr, blocks[j].dma);
+		blocks[j].vaddr = dma_pool_alloc(pool, GFP_KERNEL,
+						 &blocks[j].dma);
+		if (!blocks[j].vaddr) {
+			blocks[j] = blocks[nr - 1];
+			i = nr - 1;
+			goto out_free;
+		}
+	}
+	pair_ns = ns_per_op(start, dmapool_pair_loops);
+
+	/* nr is a power of two, so an odd stride visits every block */
+	start = ktime_get();
+	for (i = 0; i < nr; i++) {
+		j = (i * 7919) & (nr - 1);
+		dma_pool_free(pool, blocks[j].vaddr, blocks[j].dma);
+	}
+	free_ns = ns_per_op(start, nr);
+
+	pr_info("dmapool: %6u blocks: alloc %4llu ns, free %4llu ns, "
+		"alloc+free %4llu ns\n", nr,
+		(unsigned long long)alloc_ns, (unsigned long long)free_ns,
+		(unsigned long long)pair_ns);
+	return 0;
+
+out_free:
+	while (i--)
+		dma_pool_free(pool, blocks[i].vaddr, blocks[i].dma);
+	return -ENOMEM;
+}
+
+static int dmapool_bench(void)
+{
+	struct dmapool_bench_block *blocks;
+	struct dma_pool *pool;
+	struct device *dev;
+	unsigned int nr;
+	int ret = 0;
+
+	if (!dmapool_block_size || dmapool_max_blocks < 64 ||
+	    !dmapool_pair_loops)
+		return -EINVAL;
+
+	dev = root_device_register("mm_benchmark");
+	if (IS_ERR(dev))
+		return PTR_ERR(dev);
+	dev->coherent_dma_mask = DMA_BIT_MASK(32);
+	dev->dma_mask = &dev->coherent_dma_mask;
+
+	blocks = vmalloc(dmapool_max_blocks * sizeof(*blocks));
+	if (!blocks) {
+		ret = -ENOMEM;
+		goto out_dev;
+	}
+
+	pool = dma_pool_create("mm_benchmark", dev, dmapool_block_size, 0, 0);
+	if (!pool) {
+		ret = -ENOMEM;
+		goto out_blocks;
+	}
+
+	for (nr = 64; nr <= dmapool_max_blocks && !ret; nr <<= 1)
+		ret = dmapool_bench_run(pool, blocks, nr);
+
+	dma_pool_destroy(pool);
+out_blocks:
+	vfree(blocks);
+out_dev:
+	root_device_unregister(dev);
+	return ret;
+}
+#endif
+
+static unsigned int vmalloc_max_areas = 8192;
+module_param(vmalloc_max_areas, uint, 0444);
+MODULE_PARM_DESC(vmalloc_max_areas,
+		 "largest number of live areas (default 8192)");
+
+static unsigned int vmalloc_pair_loops = 10000;
+module_param(vmalloc_pair_loops, uint, 0444);
+MODULE_PARM_DESC(vmalloc_pair_loops,
+		 "vmalloc/vfree pairs per step (default 10000)");
+
+static int vmalloc_bench_run(void **areas, unsigned int nr)
+{
+	u64 alloc_ns, pair_ns, free_ns;
+	ktime_t start;
+	unsigned int i, live;
+	void *p;
+
+	/* one page areas, then every other one freed: one page holes */
+	start = ktime_get();
+	for (i = 0; i < nr; i++) {
+		areas[i] = vmalloc(PAGE_SIZE);
+		if (!areas[i])
+			goto out_free;
+	}
+	alloc_ns = ns_per_op(start, nr);
+
+	for (i = 0; i < nr; i += 2) {
+		vfree(areas[i]);
+		areas[i] = NULL;
+	}
+
+	/* two page areas never fit the holes left among the live ones */
+	start = ktime_get();
+	for (i = 0; i < vmalloc_pair_loops; i++) {
+		p = vmalloc(2 * PAGE_SIZE);
+		if (!p)
+			goto out_free;
+		vfree(p);
+	}
+	pair_ns = ns_per_op(start, vmalloc_pair_loops);
+
+	start = ktime_get();
+	for (i = 1, live = 0; i < nr; i += 2, live++) {
+		vfree(areas[i]);
+		areas[i] = NULL;
+	}
+	free_ns = ns_per_op(start, live);
+
+	pr_info("vmalloc: %5u areas: vmalloc %6llu ns, "
+		"vmalloc+vfree %6llu ns among %5u, vfree %6llu ns\n", nr,
+		(unsigned long long)alloc_ns, (unsigned long long)pair_ns,
+		live, (unsigned long long)free_ns);
+	return 0;
+
+out_free:
+	for (i = 0; i < nr; i++)
+		vfree(areas[i]);
+	return -ENOMEM;
+}
+
+static int vmalloc_bench(void)
+{
+	void **areas;
+	unsigned int nr;
+	int ret = 0;
+
+	if (vmalloc_max_areas < 256 || !vmalloc_pair_loops)
+		return -EINVAL;
+
+	areas = vzalloc(vmalloc_max_areas * sizeof(*areas));
+	if (!areas)
+		return -ENOMEM;
+
+	for (nr = 256; nr <= vmalloc_max_areas && !ret; nr <<= 1)
+		ret = vmalloc_bench_run(areas, nr);
+
+	vfree(areas);
+	return ret;
+}
+
+static unsigned int vmap_huge_size_mb = 32;
+module_param(vmap_huge_size_mb, uint, 0444);
+MODULE_PARM_DESC(vmap_huge_size_mb, "buffer size in megabytes (default 32)");
+
+static unsigned int vmap_huge_loops = 8;
+module_param(vmap_huge_loops, uint, 0444);
+MODULE_PARM_DESC(vmap_huge_loops, "passes over each buffer (default 8)");
+
+#define VMAP_HUGE_CHUNK		64
+#define VMAP_HUGE_STRIDE	97	/* prime: i * STRIDE % nr visits all */
+
+static void vmap_huge_bench_run(const char *name, char *buf,
+				unsigned long size)
+{
+	unsigned long half = size / 2, nr = half >> PAGE_SHIFT, i;
+	u64 seq_ns, scatter_ns;
+	ktime_t start;
+	unsigned int l;
+
+	/* the data copied is irrelevant, only the mapping matters */
+	memset(buf, 0x5a, size);
+
+	start = ktime_get();
+	for (l = 0; l < vmap_huge_loops; l++)
+		memcpy(buf + half, buf, half);
+	seq_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	for (l = 0; l < vmap_huge_loops; l++) {
+		for (i = 0; i < nr; i++) {
+			unsigned long src = (i * VMAP_HUGE_STRIDE % nr) <<
+					    PAGE_SHIFT;
+			unsigned long dst = ((nr - 1 - i) * VMAP_HUGE_STRIDE %
+					     nr) << PAGE_SHIFT;
+
+			memcpy(buf + half + dst, buf + src, VMAP_HUGE_CHUNK);
+		}
+		cond_resched();
+	}
+	scatter_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	pr_info("vmap_huge: %-7s sequential %6llu MB/s, "
+		"scattered %4llu ns per page\n", name,
+		div64_u64((u64)half * vmap_huge_loops * NSEC_PER_SEC,
+			  max_t(u64, seq_ns, 1) << 20),
+		div64_u64(scatter_ns, (u64)nr * vmap_huge_loops));
+}
+
+static int vmap_huge_bench(void)
+{
+	unsigned long size = (unsigned long)vmap_huge_size_mb << 20;
+	unsigned int nr_pages = size >> PAGE_SHIFT, i;
+	struct page **pages;
+	void *buf;
+	int ret = -ENOMEM;
+
+	if (!vmap_huge_size_mb || !vmap_huge_loops ||
+	    size < 2 * VMAP_HUGE_STRIDE * PAGE_SIZE)
+		return -EINVAL;
+
+	buf = vmalloc(size);
+	if (!buf)
+		return -ENOMEM;
+	vmap_huge_bench_run("vmalloc", buf, size);
+	vfree(buf);
+
+	pages = vzalloc(nr_pages * sizeof(*pages));
+	if (!pages)
+		return -ENOMEM;
+	for (i = 0; i < nr_pages; i++) {
+		pages[i] = alloc_page(GFP_KERNEL | __GFP_HIGHMEM);
+		if (!pages[i])
+			goto out_free;
+	}
+
+	buf = vmap(pages, nr_pages, VM_MAP, PAGE_KERNEL);
+	if (!buf)
+		goto out_free;
+	vmap_huge_bench_run("vmap", buf, size);
+	vunmap(buf);
+	ret = 0;
+
+out_free:
+	for (i = 0; i < nr_pages && pages[i]; i++)
+		__free_page(pages[i]);
+	vfree(pages);
+	return ret;
+}
+
+static const struct {
+	const char *name;
+	int (*run)(void);
+} mm_benchmarks[] = {
+#ifdef CONFIG_HAS_DMA
+	{ "dmapool",		dmapool_bench },
+#endif
+	{ "vmalloc",		vmalloc_bench },
+	{ "vmap_huge",		vmap_huge_bench },
+};
+
+static bool mm_benchmark_wanted(const char *name)
+{
+	size_t len = strlen(name);
+	const char *p = tests;
+
+	if (!p || !*p)
+		return true;
+
+	while ((p = strstr(p, name)) != NULL) {
+		if ((p == tests || p[-1] == ',') &&
+		    (p[len] == ',' || p[len] == '\0'))
+			return true;
+		p += len;
+	}
+	return false;
+}
+
+static int __init mm_benchmark_init(void)
+{
+	int i, ret;
+
+	for (i = 0; i < ARRAY_SIZE(mm_benchmarks); i++) {
+		if (!mm_benchmark_wanted(mm_benchmarks[i].name))
+			continue;
+
+		ret = mm_benchmarks[i].run();
+		if (ret) {
+			pr_err("%s failed: %d\n", mm_benchmarks[i].name, ret);
+			return ret;
+		}
+	}
+	return 0;
+}
+
+static void __exit mm_benchmark_exit(void)
+{
+}
+
+module_init(mm_benchmark_init);
+module_exit(mm_benchmark_exit);
+MODULE_DESCRIPTION("memory allocator and mapping benchmarks");
+MODULE_LICENSE("GPL");
@@ -110,6 +110,7 @@ static int read_pages(struct address_space *mapping, struct file *filp,
 		struct list_head *pages, unsigned nr_pages)
 {
 	struct blk_plug plug;
+	struct pagevec pvec;
 	unsigned page_idx;
 	int ret;
 
@@ -122,14 +123,21 @@ static int read_pages(struct address_space *mapping, struct file *filp,
 		goto out;
 	}
 
+	pagevec_init(&pvec, 0);
 	for (page_idx = 0; page_idx < nr_pages; page_idx++) {
 		struct page *page = list_to_page(pages);
+		unsigned i;
+
 		list_del(&page->lru);
-		if (!add_to_page_cache_lru(page, mapping,
-					page->index, GFP_KERNEL)) {
-			mapping->a_ops->readpage(filp, page);
+		if (pagevec_add(&pvec, page) && page_idx < nr_pages - 1)
+			continue;
+
+		add_to_page_cache_lru_vec(&pvec, mapping, GFP_KERNEL);
+		for (i = 0; i < pagevec_count(&pvec); i++) {
+			mapping->a_ops->readpage(filp, pvec.pages[i]);
+			page_cache_release(pvec.pages[i]);
 		}
-		page_cache_release(page);
+		pagevec_reinit(&pvec);
 	}
 	ret = 0;
 
@@ -33,6 +33,69 @@
 
 /*** Page table manipulation functions ***/
 
+#ifdef CONFIG_HAVE_ARCH_HUGE_VMAP
+int vmap_allow_huge __read_mostly = 1;
+
+static int __init set_nohugevmap(char *str)
+{
+	vmap_allow_huge = 0;
+	return 0;
+}
+early_param("nohugevmap", set_nohugevmap);
+
+/*
+ * Only the vmalloc area proper gets PMD sized mappings: other ranges, such
+ * as a separate module area, need not be kept in sync the same way.
+ */
+static inline int vmap_huge_range(unsigned long start, unsigned long end)
+{
+	return vmap_allow_huge && start >= VMALLOC_START && end <= VMALLOC_END;
+}
+
+/*
+ * Map the PMD_SIZE chunk at addr with a single entry if the pages backing
+ * it are one naturally aligned physically contiguous block.
+ */
+static int vmap_huge_pmd(pmd_t *pmd, unsigned long addr, unsigned long end,
+		pgprot_t prot, struct page **pages, int *nr)
+{
+	const unsigned int nr_pages = PMD_SIZE >> PAGE_SHIFT;
+	unsigned long pfn;
+	unsigned int i;
+
+	if (end - addr != PMD_SIZE || !vmap_huge_range(addr, end))
+		return 0;
+
+	pfn = page_to_pfn(pages[*nr]);
+	if (pfn & (nr_pages - 1))
+		return 0;
+	for (i = 1; i < nr_pages; i++)
+		if (page_to_pfn(pages[*nr + i]) != pfn + i)
+			return 0;
+
+	if (!arch_vmap_pmd(pmd, addr, PFN_PHYS(pfn), prot))
+		return 0;
+	*nr += nr_pages;
+	return 1;
+}
+
+static inline int vunmap_huge_pmd(pmd_t *pmd, unsigned long addr)
+{
+	return arch_vunmap_pmd(pmd, addr);
+}
+#else
+static inline int vmap_huge_pmd(pmd_t *pmd, unsigned long addr,
+		unsigned long end, pgprot_t prot, struct page **pages, int *nr)
+{
+	return 0;
+}
+
+static inline int vunmap_huge_pmd(pmd_t *pmd, unsigned long addr)
+{
+	return 0;
+}
+#endif
+
 static void vunmap_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end)
 {
 	pte_t *pte;
@@ -52,6 +115,8 @@ static void vunmap_pmd_range(pud_t *pud, unsigned long addr, unsigned long end)
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		if (vunmap_huge_pmd(pmd, addr))
+			continue;
 		if (pmd_none_or_clear_bad(pmd))
 			continue;
 		vunmap_pte_range(pmd, addr, next);
@@ -124,6 +189,8 @@ static int vmap_pmd_range(pud_t *pud, unsigned long addr,
 		return -ENOMEM;
 	do {
 		next = pmd_addr_end(addr, end);
+		if (vmap_huge_pmd(pmd, addr, next, prot, pages, nr))
+			continue;
 		if (vmap_pte_range(pmd, addr, next, prot, pages, nr))
 			return -ENOMEM;
 	} while (pmd++, addr = next, addr != end);
@@ -221,6 +288,10 @@ struct page *vmalloc_to_page(const void *vmalloc_addr)
 			if (!pmd_none(*pmd)) {
 				pte_t *ptep, pte;
 
+#ifdef CONFIG_HAVE_ARCH_HUGE_VMAP
+				if (arch_vmap_pmd_page(pmd, addr, &page))
+					return page;
+#endif
 				ptep = pte_offset_map(pmd, addr);
 				pte = *ptep;
 				if (pte_present(pte))
@@ -253,6 +324,8 @@ struct vmap_area {
 	unsigned long va_start;
 	unsigned long va_end;
 	unsigned long flags;
+	unsigned long gap;		/* free space below va_start */
+	unsigned long subtree_gap;	/* largest gap in this subtree */
 	struct rb_node rb_node;		/* address sorted rbtree */
 	struct list_head list;		/* address sorted list */
 	struct list_head purge_list;	/* "lazy purge" list */
@@ -264,12 +337,6 @@ static DEFINE_SPINLOCK(vmap_area_lock);
 static LIST_HEAD(vmap_area_list);
 static struct rb_root vmap_area_root = RB_ROOT;
 
-/* The vmap cache globals are protected by vmap_area_lock */
-static struct rb_node *free_vmap_cache;
-static unsigned long cached_hole_size;
-static unsigned long cached_vstart;
-static unsigned long cached_align;
-
 static unsigned long vmap_area_pcpu_hole;
 
 static struct vmap_area *__find_vmap_area(unsigned long addr)
@@ -291,6 +358,33 @@ static struct vmap_area *__find_vmap_area(unsigned long addr)
 	return NULL;
 }
 
+/*
+ * Each vmap_area records the gap between itself and the area below it (or
+ * address 0 for the lowest one), and the largest such gap in its subtree,
+ * so that alloc_vmap_area() can skip subtrees with no hole big enough.
+ */
+static inline unsigned long vmap_subtree_gap(struct rb_node *node)
+{
+	return node ? rb_entry(node, struct vmap_area, rb_node)->subtree_gap : 0;
+}
+
+static void vmap_area_augment_cb(struct rb_node *node, void *unused)
+{
+	struct vmap_area *va = rb_entry(node, struct vmap_area, rb_node);
+
+	va->subtree_gap = max3(va->gap, vmap_subtree_gap(node->rb_left),
+			       vmap_subtree_gap(node->rb_right));
+}
+
+/* The gap below @va has changed: fix up subtree_gap up to the root */
+static void vmap_area_gap_update(struct vmap_area *va)
+{
+	struct rb_node *node;
+
+	for (node = &va->rb_node; node; node = rb_parent(node))
+		vmap_area_augment_cb(node, NULL);
+}
+
 static void __insert_vmap_area(struct vmap_area *va)
 {
 	struct rb_node **p = &vmap_area_root.rb_node;
@@ -319,8 +413,112 @@ static void __insert_vmap_area(struct vmap_area *va)
 		struct vmap_area *prev;
 		prev = rb_entry(tmp, struct vmap_area, rb_node);
 		list_add_rcu(&va->list, &prev->list);
-	} else
+		va->gap = va->va_start - prev->va_end;
+	} else {
 		list_add_rcu(&va->list, &vmap_area_list);
+		va->gap = va->va_start;
+	}
+	rb_augment_insert(&va->rb_node, vmap_area_augment_cb, NULL);
+
+	/* the new area has eaten into the gap below the next one */
+	tmp = rb_next(&va->rb_node);
+	if (tmp) {
+		struct vmap_area *next;
+		next = rb_entry(tmp, struct vmap_area, rb_node);
+		next->gap = next->va_start - va->va_end;
+		vmap_area_gap_update(next);
+	}
+}
+
+/*
+ * Does [@gap_start, @gap_end) have room for @size bytes aligned to @align,
+ * within @vstart and @vend?  If so, return the address in @addrp.
+ */
+static bool vmap_hole_fits(unsigned long gap_start, unsigned long gap_end,
+			   unsigned long size, unsigned long align,
+			   unsigned long vstart, unsigned long vend,
+			   unsigned long *addrp)
+{
+	unsigned long addr = ALIGN(max(gap_start, vstart), align);
+
+	if (addr < vstart || addr + size - 1 < addr)
+		return false;
+	if (addr + size > gap_end || addr + size > vend)
+		return false;
+	*addrp = addr;
+	return true;
+}
+
+/*
+ * Find the lowest hole with room for @size bytes aligned to @align within
+ * @vstart and @vend: walk the busy area tree in address order, but only
+ * into subtrees holding a gap of at least @size.  Returns 0 and the address
+ * in @addrp, or -EBUSY.  Called with vmap_area_lock held.
+ */
+static int find_vmap_lowest_hole(unsigned long size, unsigned long align,
+				 unsigned long vstart, unsigned long vend,
+				 unsigned long *addrp)
+{
+	struct rb_node *n = vmap_area_root.rb_node;
+	struct vmap_area *va;
+	unsigned long gap_start;
+
+	if (size > vend || vstart + size - 1 < vstart)
+		return -EBUSY;
+
+	if (!n)
+		return vmap_hole_fits(0, vend, size, align,
+				      vstart, vend, addrp) ? 0 : -EBUSY;
+
+	if (vmap_subtree_gap(n) < size)
+		goto check_highest;
+
+	va = rb_entry(n, struct vmap_area, rb_node);
+	while (true) {
+		/* Visit the left subtree if it may hold a hole that fits */
+		if (va->va_start >= vstart + size &&
+		    vmap_subtree_gap(n->rb_left) >= size) {
+			n = n->rb_left;
+			va = rb_entry(n, struct vmap_area, rb_node);
+			continue;
+		}
+
+check_current:
+		/* Every hole from here on starts too high */
+		gap_start = va->va_start - va->gap;
+		if (gap_start > vend - size)
+			return -EBUSY;
+		if (va->gap >= size &&
+		    vmap_hole_fits(gap_start, va->va_start, size, align,
+				   vstart, vend, addrp))
+			return 0;
+
+		/* Visit the right subtree if it may hold a hole that fits */
+		if (vmap_subtree_gap(n->rb_right) >= size) {
+			n = n->rb_right;
+			va = rb_entry(n, struct vmap_area, rb_node);
+			continue;
+		}
+
+		/* Go back up to the next area above this subtree */
+		while (true) {
+			struct rb_node *prev = n;
+
+			n = rb_parent(n);
+			if (!n)
+				goto check_highest;
+			if (prev == n->rb_left) {
+				va = rb_entry(n, struct vmap_area, rb_node);
+				goto check_current;
+			}
+		}
+	}
+
+check_highest:
+	/* Last chance: the space above the highest area */
+	va = rb_entry(rb_last(&vmap_area_root), struct vmap_area, rb_node);
+	return vmap_hole_fits(va->va_end, vend, size, align,
+			      vstart, vend, addrp) ? 0 : -EBUSY;
 }
 
 static void purge_vmap_area_lazy(void);
@@ -335,10 +533,8 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 				int node, gfp_t gfp_mask)
 {
 	struct vmap_area *va;
-	struct rb_node *n;
 	unsigned long addr;
 	int purged = 0;
-	struct vmap_area *first;
 
 	BUG_ON(!size);
 	BUG_ON(size & ~PAGE_MASK);
@@ -351,84 +547,13 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 
 retry:
 	spin_lock(&vmap_area_lock);
-	/*
-	 * Invalidate cache if we have more permissive parameters.
-	 * cached_hole_size notes the largest hole noticed _below_
-	 * the vmap_area cached in free_vmap_cache: if size fits
-	 * into that hole, we want to scan from vstart to reuse
-	 * the hole instead of allocating above free_vmap_cache.
-	 * Note that __free_vmap_area may update free_vmap_cache
-	 * without updating cached_hole_size or cached_align.
-	 */
-	if (!free_vmap_cache ||
-			size < cached_hole_size ||
-			vstart < cached_vstart ||
-			align < cached_align) {
-nocache:
-		cached_hole_size = 0;
-		free_vmap_cache = NULL;
-	}
-	/* record if we encounter less permissive parameters */
-	cached_vstart = vstart;
-	cached_align = align;
-
-	/* find starting point for our search */
-	if (free_vmap_cache) {
-		first = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
-		addr = ALIGN(first->va_end, align);
-		if (addr < vstart)
-			goto nocache;
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-	} else {
-		addr = ALIGN(vstart, align);
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-		n = vmap_area_root.rb_node;
-		first = NULL;
-
-		while (n) {
-			struct vmap_area *tmp;
-			tmp = rb_entry(n, struct vmap_area, rb_node);
-			if (tmp->va_end >= addr) {
-				first = tmp;
-				if (tmp->va_start <= addr)
-					break;
-				n = n->rb_left;
-			} else
-				n = n->rb_right;
-		}
-
-		if (!first)
-			goto found;
-	}
-
-	/* from the starting point, walk areas until a suitable hole is found */
-	while (addr + size > first->va_start && addr + size <= vend) {
-		if (addr + cached_hole_size < first->va_start)
-			cached_hole_size = first->va_start - addr;
-		addr = ALIGN(first->va_end, align);
-		if (addr + size - 1 < addr)
-			goto overflow;
-
-		n = rb_next(&first->rb_node);
-		if (n)
-			first = rb_entry(n, struct vmap_area, rb_node);
-		else
-			goto found;
-	}
-
-found:
-	if (addr + size > vend)
+	if (find_vmap_lowest_hole(size, align, vstart, vend, &addr))
 		goto overflow;
 
 	va->va_start = addr;
 	va->va_end = addr + size;
 	va->flags = 0;
 	__insert_vmap_area(va);
-	free_vmap_cache = &va->rb_node;
 	spin_unlock(&vmap_area_lock);
 
 	BUG_ON(va->va_start & (align-1));
@@ -461,25 +586,23 @@ static void rcu_free_va(struct rcu_head *head)
 
 static void __free_vmap_area(struct vmap_area *va)
 {
+	struct rb_node *next, *deepest;
+
 	BUG_ON(RB_EMPTY_NODE(&va->rb_node));
 
-	if (free_vmap_cache) {
-		if (va->va_end < cached_vstart) {
-			free_vmap_cache = NULL;
-		} else {
-			struct vmap_area *cache;
-			cache = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
-			if (va->va_start <= cache->va_start) {
-				free_vmap_cache = rb_prev(&va->rb_node);
-				/*
-				 * We don't try to update cached_hole_size or
-				 * cached_align, but it won't go very wrong.
-				 */
-			}
-		}
-	}
+	next = rb_next(&va->rb_node);
+	deepest = rb_augment_erase_begin(&va->rb_node);
 	rb_erase(&va->rb_node, &vmap_area_root);
 	RB_CLEAR_NODE(&va->rb_node);
+	rb_augment_erase_end(deepest, vmap_area_augment_cb, NULL);
+
+	/* the gap below the next area now reaches down to ours */
+	if (next) {
+		struct vmap_area *next_va;
+		next_va = rb_entry(next, struct vmap_area, rb_node);
+		next_va->gap = next_va->va_start - (va->va_start - va->gap);
+		vmap_area_gap_update(next_va);
+	}
 	list_del_rcu(&va->list);
 
 	/*
@@ -1557,6 +1680,51 @@ EXPORT_SYMBOL(vmap);
 static void *__vmalloc_node(unsigned long size, unsigned long align,
 			    gfp_t gfp_mask, pgprot_t prot,
 			    int node, void *caller);
+
+#ifdef CONFIG_HAVE_ARCH_HUGE_VMAP
+#define VMALLOC_HUGE_ORDER	(PMD_SHIFT - PAGE_SHIFT)
+
+/*
+ * Back the PMD_SIZE aligned chunk of @area starting at page @i with one
+ * high order block, so that vmap_huge_pmd() can map it with a single entry.
+ * This is opportunistic: no retrying, and the caller falls back to order-0
+ * pages.  Returns the number of pages filled in.
+ */
+static unsigned int vmalloc_huge_chunk(struct vm_struct *area, unsigned int i,
+				       gfp_t gfp_mask, int node)
+{
+	const unsigned int nr_pages = 1U << VMALLOC_HUGE_ORDER;
+	unsigned long addr = (unsigned long)area->addr + i * PAGE_SIZE;
+	struct page *page;
+	unsigned int j;
+
+	if (VMALLOC_HUGE_ORDER >= MAX_ORDER || (addr & ~PMD_MASK) ||
+	    area->nr_pages - i < nr_pages ||
+	    !vmap_huge_range(addr, addr + PMD_SIZE))
+		return 0;
+
+	gfp_mask |= __GFP_NOWARN | __GFP_NORETRY;
+	if (node < 0)
+		page = alloc_pages(gfp_mask, VMALLOC_HUGE_ORDER);
+	else
+		page = alloc_pages_node(node, gfp_mask, VMALLOC_HUGE_ORDER);
+	if (!page)
+		return 0;
+
+	/* __vunmap() frees the pages one at a time */
+	split_page(page, VMALLOC_HUGE_ORDER);
+	for (j = 0; j < nr_pages; j++)
+		area->pages[i + j] = page + j;
+	return nr_pages;
+}
+#else
+static inline unsigned int vmalloc_huge_chunk(struct vm_struct *area,
+				unsigned int i, gfp_t gfp_mask, int node)
+{
+	return 0;
+}
+#endif
+
 static void *__vmalloc_area_node(struct vm_struct *area, gfp_t gfp_mask,
 				 pgprot_t prot, int node, void *caller)
 {
@@ -1564,6 +1732,7 @@ static void *__vmalloc_area_node(struct vm_struct *area, gfp_t gfp_mask,
 	struct page **pages;
 	unsigned int nr_pages, array_size, i;
 	gfp_t nested_gfp = (gfp_mask & GFP_RECLAIM_MASK) | __GFP_ZERO;
+	bool huge = true;
 
 	nr_pages = (area->size - PAGE_SIZE) >> PAGE_SHIFT;
 	array_size = (nr_pages * sizeof(struct page *));
@@ -1589,6 +1758,18 @@ static void *__vmalloc_area_node(struct vm_struct *area, gfp_t gfp_mask,
 		struct page *page;
 		gfp_t tmp_mask = gfp_mask | __GFP_NOWARN;
 
+		if (huge) {
+			unsigned int nr = vmalloc_huge_chunk(area, i,
+							     gfp_mask, node);
+
+			if (nr) {
+				i += nr - 1;
+				continue;
+			}
+			/* don't hammer the allocator once it has failed */
+			huge = false;
+		}
+
 		if (node < 0)
 			page = alloc_page(tmp_mask);
 		else
@@ -1641,6 +1822,12 @@ void *__vmalloc_node_range(unsigned long size, unsigned long align,
 	if (!size || (size >> PAGE_SHIFT) > totalram_pages)
 		return NULL;
 
+#ifdef CONFIG_HAVE_ARCH_HUGE_VMAP
+	/* let vmalloc_huge_chunk() line up with PMD boundaries */
+	if (size >= PMD_SIZE && vmap_huge_range(start, end))
+		align = max(align, PMD_SIZE);
+#endif
+
 	area = __get_vm_area_node(size, align, VM_ALLOC | VM_UNLIST,
 				  start, end, node, gfp_mask, caller);
 
@@ -43,6 +43,7 @@
 #include <linux/sysctl.h>
 #include <linux/oom.h>
 #include <linux/prefetch.h>
+#include <linux/seq_file.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -113,8 +114,22 @@ struct scan_control {
 	 * are scanned.
 	 */
 	nodemask_t	*nodemask;
+
+	/*
+	 * Bitmask of the LRU lists shrink_zone() may scan, see
+	 * LRU_ANON_MASK and LRU_FILE_MASK.  0 means all of them.
+	 */
+	unsigned int lru_mask;
 };
 
+#define LRU_ANON_MASK	(BIT(LRU_INACTIVE_ANON) | BIT(LRU_ACTIVE_ANON))
+#define LRU_FILE_MASK	(BIT(LRU_INACTIVE_FILE) | BIT(LRU_ACTIVE_FILE))
+
+static inline bool scan_lru(struct scan_control *sc, enum lru_list l)
+{
+	return !sc->lru_mask || (sc->lru_mask & BIT(l));
+}
+
 #define lru_to_page(_head) (list_entry((_head)->prev, struct page, lru))
 
 #ifdef ARCH_HAS_PREFETCH
@@ -151,6 +166,10 @@ struct scan_control {
 int vm_swappiness = 60;
 long vm_total_pages;	/* The total number of pages which the VM controls */
 
+/* Number of kswapd workers per node, see kswapd_threads_sysctl_handler() */
+int kswapd_threads = 1;
+static DEFINE_MUTEX(kswapd_threads_mutex);
+
 static LIST_HEAD(shrinker_list);
 static DECLARE_RWSEM(shrinker_rwsem);
 
@@ -1944,6 +1963,9 @@ restart:
 	nr_reclaimed = 0;
 	nr_scanned = sc->nr_scanned;
 	get_scan_count(zone, sc, nr, priority);
+	for_each_evictable_lru(l)
+		if (!scan_lru(sc, l))
+			nr[l] = 0;
 
 	while (nr[LRU_INACTIVE_ANON] || nr[LRU_ACTIVE_FILE] ||
 					nr[LRU_INACTIVE_FILE]) {
@@ -1974,7 +1996,7 @@ restart:
 	 * Even if we did not try to evict anon pages at all, we want to
 	 * rebalance the anon lru active/inactive ratio.
 	 */
-	if (inactive_anon_is_low(zone, sc))
+	if (scan_lru(sc, LRU_ACTIVE_ANON) && inactive_anon_is_low(zone, sc))
 		shrink_active_list(SWAP_CLUSTER_MAX, zone, sc, priority, 0);
 
 	/* reclaim/compaction might need reclaim to continue */
@@ -2092,6 +2114,7 @@ static unsigned long do_try_to_free_pages(struct zonelist *zonelist,
 	struct zoneref *z;
 	struct zone *zone;
 	unsigned long writeback_threshold;
+	u64 stall_start = local_clock();
 
 	get_mems_allowed();
 	delayacct_freepages_start();
@@ -2157,6 +2180,10 @@ out:
 	delayacct_freepages_end();
 	put_mems_allowed();
 
+	if (scanning_global_lru(sc))
+		count_vm_events(ALLOCSTALL_US,
+			div_u64(local_clock() - stall_start, NSEC_PER_USEC));
+
 	if (sc->nr_reclaimed)
 		return sc->nr_reclaimed;
 
@@ -2591,6 +2618,8 @@ loop_again:
 			break;
 	}
 out:
+	pgdat->kswapd[0].nr_scanned += total_scanned;
+	pgdat->kswapd[0].nr_reclaimed += sc.nr_reclaimed;
 
 	/*
 	 * order-0: All zones must meet high watermark for a balanced node
@@ -2793,9 +2822,153 @@ static int kswapd(void *p)
 		 * after returning from the refrigerator
 		 */
 		if (!ret) {
+			unsigned long start = jiffies;
+
 			trace_mm_vmscan_kswapd_wake(pgdat->node_id, order);
 			order = balance_pgdat(pgdat, order, &classzone_idx);
+			pgdat->kswapd[0].run_time += jiffies - start;
+		}
+	}
+	return 0;
+}
+
+/*
+ * The LRU lists of a node are split into (zone, anon/file) slots, and each
+ * kswapd helper worker reclaims from its share of the slots in parallel
+ * with kswapd itself.  With more helpers than slots, the surplus helpers
+ * double up on a slot rather than idling, which still spreads the work of
+ * isolating and freeing pages over more CPUs.
+ */
+static bool kswapd_worker_owns(struct kswapd_worker *worker, int slot,
+			       int nr_slots)
+{
+	int nr_helpers = min(ACCESS_ONCE(kswapd_threads) - 1, nr_slots);
+
+	if (nr_helpers <= 0)
+		return false;
+	return slot % nr_helpers == (worker->id - 1) % nr_helpers;
+}
+
+/*
+ * Order-0 reclaim from the slots owned by a helper, until the zones it
+ * scans are above their high watermark or it stops making progress.
+ * Returns the number of pages reclaimed.
+ */
+static unsigned long kswapd_shrink_slots(struct kswapd_worker *worker)
+{
+	pg_data_t *pgdat = worker->pgdat;
+	unsigned long total_scanned = 0;
+	int priority, nr_slots = 0;
+	int i;
+	struct scan_control sc = {
+		.gfp_mask = GFP_KERNEL,
+		.may_writepage = !laptop_mode,
+		.may_unmap = 1,
+		.may_swap = 1,
+		.nr_to_reclaim = ULONG_MAX,
+		.swappiness = vm_swappiness,
+		.order = 0,
+		.mem_cgroup = NULL,
+	};
+
+	for (i = 0; i < pgdat->nr_zones; i++)
+		if (populated_zone(pgdat->node_zones + i))
+			nr_slots += 2;
+
+	for (priority = DEF_PRIORITY; priority >= 0; priority--) {
+		unsigned long nr_reclaimed = sc.nr_reclaimed;
+		bool balanced = true;
+		int slot = 0;
+
+		for (i = 0; i < pgdat->nr_zones; i++) {
+			struct zone *zone = pgdat->node_zones + i;
+			int file;
+
+			if (!populated_zone(zone))
+				continue;
+
+			for (file = 0; file < 2; file++, slot++) {
+				if (!kswapd_worker_owns(worker, slot, nr_slots))
+					continue;
+
+				if (zone->all_unreclaimable &&
+				    priority != DEF_PRIORITY)
+					continue;
+
+				if (zone_watermark_ok_safe(zone, 0,
+						high_wmark_pages(zone), 0, 0))
+					continue;
+
+				balanced = false;
+				sc.nr_scanned = 0;
+				sc.lru_mask = file ? LRU_FILE_MASK : LRU_ANON_MASK;
+				shrink_zone(priority, zone, &sc);
+				total_scanned += sc.nr_scanned;
+			}
 		}
+
+		if (balanced || kthread_should_stop() || freezing(current))
+			break;
+
+		/* Keep the priority low while reclaim is making progress */
+		if (sc.nr_reclaimed - nr_reclaimed >= SWAP_CLUSTER_MAX)
+			priority = DEF_PRIORITY + 1;
+		else if (total_scanned && priority < DEF_PRIORITY - 2)
+			congestion_wait(BLK_RW_ASYNC, HZ/10);
+
+		if (total_scanned > SWAP_CLUSTER_MAX * 2 &&
+		    total_scanned > sc.nr_reclaimed + sc.nr_reclaimed / 2)
+			sc.may_writepage = 1;
+
+		cond_resched();
+	}
+
+	worker->nr_scanned += total_scanned;
+	worker->nr_reclaimed += sc.nr_reclaimed;
+	return sc.nr_reclaimed;
+}
+
+/*
+ * A kswapd helper worker sleeps on the node's kswapd wait queue, so it is
+ * woken together with kswapd, and leaves the watermark bookkeeping, slab
+ * shrinking and high-order balancing to kswapd.
+ */
+static int kswapd_helper(void *p)
+{
+	struct kswapd_worker *worker = p;
+	pg_data_t *pgdat = worker->pgdat;
+	struct task_struct *tsk = current;
+	struct reclaim_state reclaim_state = {
+		.reclaimed_slab = 0,
+	};
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+
+	lockdep_set_current_reclaim_state(GFP_KERNEL);
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(tsk, cpumask);
+	current->reclaim_state = &reclaim_state;
+
+	tsk->flags |= PF_MEMALLOC | PF_SWAPWRITE | PF_KSWAPD;
+	set_freezable();
+
+	for ( ; ; ) {
+		unsigned long start;
+		DEFINE_WAIT(wait);
+
+		prepare_to_wait(&pgdat->kswapd_wait, &wait, TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop() && !freezing(current))
+			schedule();
+		finish_wait(&pgdat->kswapd_wait, &wait);
+
+		if (try_to_freeze())
+			continue;
+		if (kthread_should_stop())
+			break;
+
+		start = jiffies;
+		kswapd_shrink_slots(worker);
+		worker->run_time += jiffies - start;
 	}
 	return 0;
 }
@@ -2912,42 +3085,85 @@ unsigned long shrink_all_memory(unsigned long nr_to_reclaim)
 static int __devinit cpu_callback(struct notifier_block *nfb,
 				  unsigned long action, void *hcpu)
 {
-	int nid;
+	int nid, i;
 
 	if (action == CPU_ONLINE || action == CPU_ONLINE_FROZEN) {
+		mutex_lock(&kswapd_threads_mutex);
 		for_each_node_state(nid, N_HIGH_MEMORY) {
 			pg_data_t *pgdat = NODE_DATA(nid);
 			const struct cpumask *mask;
 
 			mask = cpumask_of_node(pgdat->node_id);
 
-			if (cpumask_any_and(cpu_online_mask, mask) < nr_cpu_ids)
-				/* One of our CPUs online: restore mask */
-				set_cpus_allowed_ptr(pgdat->kswapd, mask);
+			if (cpumask_any_and(cpu_online_mask, mask) >= nr_cpu_ids)
+				continue;
+
+			/* One of our CPUs online: restore mask */
+			for (i = 0; i < MAX_KSWAPD_THREADS; i++)
+				if (pgdat->kswapd[i].task)
+					set_cpus_allowed_ptr(pgdat->kswapd[i].task,
+							     mask);
 		}
+		mutex_unlock(&kswapd_threads_mutex);
 	}
 	return NOTIFY_OK;
 }
 
 /*
- * This kswapd start function will be called by init and node-hot-add.
- * On node-hot-add, kswapd will moved to proper cpus if cpus are hot-added.
+ * Start or stop kswapd workers until @nr_threads of them run on the node.
+ * Called with kswapd_threads_mutex held. Returns 0 or the error of the
+ * first worker that could not be started.
  */
-int kswapd_run(int nid)
+static int kswapd_update_workers(int nid, int nr_threads)
 {
 	pg_data_t *pgdat = NODE_DATA(nid);
-	int ret = 0;
+	int i;
 
-	if (pgdat->kswapd)
-		return 0;
+	for (i = MAX_KSWAPD_THREADS - 1; i >= nr_threads; i--) {
+		struct kswapd_worker *worker = &pgdat->kswapd[i];
+
+		if (worker->task) {
+			kthread_stop(worker->task);
+			worker->task = NULL;
+		}
+	}
 
-	pgdat->kswapd = kthread_run(kswapd, pgdat, "kswapd%d", nid);
-	if (IS_ERR(pgdat->kswapd)) {
-		/* failure at boot is fatal */
-		BUG_ON(system_state == SYSTEM_BOOTING);
-		printk("Failed to start kswapd on node %d\n",nid);
-		ret = -1;
+	for (i = 0; i < nr_threads; i++) {
+		struct kswapd_worker *worker = &pgdat->kswapd[i];
+		struct task_struct *task;
+
+		if (worker->task)
+			continue;
+
+		worker->pgdat = pgdat;
+		worker->id = i;
+		if (!i)
+			task = kthread_run(kswapd, pgdat, "kswapd%d", nid);
+		else
+			task = kthread_run(kswapd_helper, worker, "kswapd%d:%d",
+					   nid, i);
+		if (IS_ERR(task)) {
+			/* failure at boot is fatal */
+			BUG_ON(!i && system_state == SYSTEM_BOOTING);
+			printk("Failed to start kswapd on node %d\n",nid);
+			return PTR_ERR(task);
+		}
+		worker->task = task;
 	}
+	return 0;
+}
+
+/*
+ * This kswapd start function will be called by init and node-hot-add.
+ * On node-hot-add, kswapd will moved to proper cpus if cpus are hot-added.
+ */
+int kswapd_run(int nid)
+{
+	int ret;
+
+	mutex_lock(&kswapd_threads_mutex);
+	ret = kswapd_update_workers(nid, kswapd_threads);
+	mutex_unlock(&kswapd_threads_mutex);
 	return ret;
 }
 
@@ -2956,10 +3172,62 @@ int kswapd_run(int nid)
  */
 void kswapd_stop(int nid)
 {
-	struct task_struct *kswapd = NODE_DATA(nid)->kswapd;
+	mutex_lock(&kswapd_threads_mutex);
+	kswapd_update_workers(nid, 0);
+	mutex_unlock(&kswapd_threads_mutex);
+}
 
-	if (kswapd)
-		kthread_stop(kswapd);
+int kswapd_threads_sysctl_handler(ctl_table *table, int write,
+	void __user *buffer, size_t *length, loff_t *ppos)
+{
+	int ret, err, nid;
+
+	mutex_lock(&kswapd_threads_mutex);
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (!ret && write) {
+		/* keep going on the other nodes, report the first failure */
+		for_each_node_state(nid, N_HIGH_MEMORY) {
+			err = kswapd_update_workers(nid, kswapd_threads);
+			if (err && !ret)
+				ret = err;
+		}
+	}
+	mutex_unlock(&kswapd_threads_mutex);
+	return ret;
+}
+
+/*
+ * Reclaim throughput of every kswapd worker, appended to /proc/vmstat:
+ * pages scanned and reclaimed, pages reclaimed per second spent reclaiming,
+ * and the percentage of scanned pages that were reclaimed.
+ */
+void kswapd_stat_show(struct seq_file *m)
+{
+	int nid, i;
+
+	for_each_node_state(nid, N_HIGH_MEMORY) {
+		pg_data_t *pgdat = NODE_DATA(nid);
+
+		for (i = 0; i < MAX_KSWAPD_THREADS; i++) {
+			struct kswapd_worker *worker = &pgdat->kswapd[i];
+			unsigned long scanned = worker->nr_scanned;
+			unsigned long reclaimed = worker->nr_reclaimed;
+			unsigned int msecs = jiffies_to_msecs(worker->run_time);
+
+			if (!worker->task && !scanned)
+				continue;
+
+			seq_printf(m, "kswapd%d_%d_scanned %lu\n"
+				   "kswapd%d_%d_reclaimed %lu\n"
+				   "kswapd%d_%d_reclaim_rate %llu\n"
+				   "kswapd%d_%d_efficiency %llu\n",
+				   nid, i, scanned, nid, i, reclaimed,
+				   nid, i, msecs ? div_u64((u64)reclaimed *
+						MSEC_PER_SEC, msecs) : 0ULL,
+				   nid, i, scanned ? div64_u64((u64)reclaimed *
+						100, scanned) : 0ULL);
+		}
+	}
 }
 
 static int __init kswapd_init(void)
@@ -17,6 +17,7 @@
 #include <linux/vmstat.h>
 #include <linux/sched.h>
 #include <linux/math64.h>
+#include <linux/swap.h>
 #include <linux/writeback.h>
 #include <linux/compaction.h>
 
@@ -753,6 +754,7 @@ const char * const vmstat_text[] = {
 	"kswapd_skip_congestion_wait",
 	"pageoutrun",
 	"allocstall",
+	"allocstall_us",
 
 	"pgrotated",
 
@@ -761,8 +763,13 @@ const char * const vmstat_text[] = {
 	"compact_pages_moved",
 	"compact_pagemigrate_failed",
 	"compact_stall",
+	"compact_stall_us",
 	"compact_fail",
 	"compact_success",
+	"kcompactd_wake",
+	"kcompactd_success",
+	"kcompactd_fail",
+	"kcompactd_us",
 #endif
 
 #ifdef CONFIG_HUGETLB_PAGE
@@ -1108,6 +1115,10 @@ static int vmstat_show(struct seq_file *m, void *arg)
 	unsigned long off = l - (unsigned long *)m->private;
 
 	seq_printf(m, "%s %lu\n", vmstat_text[off], *l);
+
+	/* per-worker kswapd throughput follows the fixed counters */
+	if (off == ARRAY_SIZE(vmstat_text) - 1)
+		kswapd_stat_show(m);
 	return 0;
 }
 
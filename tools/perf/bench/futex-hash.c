@@ -0,0 +1,146 @@
+/*
+ *
+ * futex-hash.c
+ *
+ * hash: Benchmark for the futex hash table
+ *
+ * Every thread issues FUTEX_WAIT calls on futexes of its own whose value
+ * never matches, so each call returns at once after hashing the key and
+ * taking the bucket lock: the throughput shows how well the hash spreads
+ * the keys and how much the threads contend for bucket locks.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+#include "futex.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+static unsigned int nthreads;
+static unsigned int nfutexes = 1024;
+static unsigned int runtime = 10;
+static bool shared;
+
+static volatile int done;
+static int futex_flag;
+
+struct worker {
+	pthread_t thread;
+	u_int32_t *futexes;
+	unsigned long ops;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify number of threads (default: online CPUs)"),
+	OPT_UINTEGER('f', "futexes", &nfutexes,
+		     "Specify number of futexes per thread"),
+	OPT_UINTEGER('r', "runtime", &runtime,
+		     "Specify runtime in seconds"),
+	OPT_BOOLEAN('S', "shared", &shared,
+		    "Use shared futexes instead of private ones"),
+	OPT_END()
+};
+
+static const char * const bench_futex_hash_usage[] = {
+	"perf bench futex hash <options>",
+	NULL
+};
+
+static void *worker(void *arg)
+{
+	struct worker *w = arg;
+	unsigned int i;
+
+	while (!done) {
+		for (i = 0; i < nfutexes; i++) {
+			/* the futex word is 0: returns EWOULDBLOCK at once */
+			futex_wait(&w->futexes[i], 1234, NULL, futex_flag);
+			w->ops++;
+		}
+	}
+	return NULL;
+}
+
+static void toggle_done(int sig __used)
+{
+	done = 1;
+}
+
+int bench_futex_hash(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	unsigned long total = 0;
+	struct worker *w;
+	unsigned int i;
+	double secs;
+
+	argc = parse_options(argc, argv, options, bench_futex_hash_usage, 0);
+	if (argc)
+		usage_with_options(bench_futex_hash_usage, options);
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nfutexes || !runtime)
+		usage_with_options(bench_futex_hash_usage, options);
+	if (!shared)
+		futex_flag = FUTEX_PRIVATE_FLAG;
+
+	w = calloc(nthreads, sizeof(*w));
+	if (!w)
+		die("calloc");
+
+	signal(SIGALRM, toggle_done);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nthreads; i++) {
+		w[i].futexes = calloc(nfutexes, sizeof(*w[i].futexes));
+		if (!w[i].futexes)
+			die("calloc");
+		if (pthread_create(&w[i].thread, NULL, worker, &w[i]))
+			die("pthread_create");
+	}
+	alarm(runtime);
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(w[i].thread, NULL);
+		total += w[i].ops;
+		free(w[i].futexes);
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+	secs = diff.tv_sec + diff.tv_usec / 1e6;
+	free(w);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u threads hashing %u %s futexes each for %u secs\n\n",
+		       nthreads, nfutexes, shared ? "shared" : "private",
+		       runtime);
+		printf(" %14.0f ops/sec\n", total / secs);
+		printf(" %14.0f ops/sec per thread\n", total / secs / nthreads);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.0f\n", total / secs);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
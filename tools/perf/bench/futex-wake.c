@@ -0,0 +1,168 @@
+/*
+ *
+ * futex-wake.c
+ *
+ * wake: Benchmark for futex wait/wake round trips
+ *
+ * Pairs of threads pass a token back and forth through a futex word of
+ * their own: each side waits until the word says it's its turn, flips it
+ * and wakes the other side.  Reports round trips per second over all the
+ * pairs.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+#include "futex.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+static unsigned int npairs;
+static unsigned int runtime = 10;
+static bool shared;
+
+static volatile int done;
+static int futex_flag;
+
+struct pair {
+	pthread_t thread[2];
+	u_int32_t word;
+	unsigned long round_trips;
+} __attribute__((aligned(64)));
+
+struct side {
+	struct pair *pair;
+	u_int32_t me;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('p', "pairs", &npairs,
+		     "Specify number of thread pairs (default: online CPUs / 2)"),
+	OPT_UINTEGER('r', "runtime", &runtime,
+		     "Specify runtime in seconds"),
+	OPT_BOOLEAN('S', "shared", &shared,
+		    "Use shared futexes instead of private ones"),
+	OPT_END()
+};
+
+static const char * const bench_futex_wake_usage[] = {
+	"perf bench futex wake <options>",
+	NULL
+};
+
+static void *side(void *arg)
+{
+	struct side *s = arg;
+	struct pair *p = s->pair;
+	/* wake up now and then to notice the end of the run */
+	struct timespec timeout = { .tv_sec = 0, .tv_nsec = 100000000 };
+	u_int32_t val;
+
+	while (!done) {
+		val = *(volatile u_int32_t *)&p->word;
+		if (val != s->me) {
+			futex_wait(&p->word, val, &timeout, futex_flag);
+			continue;
+		}
+		if (s->me)
+			p->round_trips++;
+		__sync_synchronize();
+		p->word = !s->me;
+		futex_wake(&p->word, 1, futex_flag);
+	}
+	/* let the other side out as well */
+	p->word = !s->me;
+	futex_wake(&p->word, 1, futex_flag);
+	return NULL;
+}
+
+static void toggle_done(int sig __used)
+{
+	done = 1;
+}
+
+int bench_futex_wake(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	unsigned long total = 0;
+	struct pair *pairs;
+	struct side *sides;
+	unsigned int i, j;
+	double secs;
+
+	argc = parse_options(argc, argv, options, bench_futex_wake_usage, 0);
+	if (argc)
+		usage_with_options(bench_futex_wake_usage, options);
+
+	if (!npairs)
+		npairs = sysconf(_SC_NPROCESSORS_ONLN) / 2 ?: 1;
+	if (!runtime)
+		usage_with_options(bench_futex_wake_usage, options);
+	if (!shared)
+		futex_flag = FUTEX_PRIVATE_FLAG;
+
+	if (posix_memalign((void **)&pairs, 64, npairs * sizeof(*pairs)))
+		die("posix_memalign");
+	memset(pairs, 0, npairs * sizeof(*pairs));
+	sides = calloc(2 * npairs, sizeof(*sides));
+	if (!sides)
+		die("calloc");
+
+	signal(SIGALRM, toggle_done);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < npairs; i++) {
+		for (j = 0; j < 2; j++) {
+			struct side *s = &sides[2 * i + j];
+
+			s->pair = &pairs[i];
+			s->me = j;
+			if (pthread_create(&pairs[i].thread[j], NULL, side, s))
+				die("pthread_create");
+		}
+	}
+	alarm(runtime);
+
+	for (i = 0; i < npairs; i++) {
+		pthread_join(pairs[i].thread[0], NULL);
+		pthread_join(pairs[i].thread[1], NULL);
+		total += pairs[i].round_trips;
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+	secs = diff.tv_sec + diff.tv_usec / 1e6;
+	free(sides);
+	free(pairs);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u pairs of threads, %s futexes, %u secs\n\n",
+		       npairs, shared ? "shared" : "private", runtime);
+		printf(" %14.0f round trips/sec\n", total / secs);
+		printf(" %14lf usecs/round trip per pair\n",
+		       total ? secs * 1e6 * npairs / total : 0);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.0f\n", total / secs);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
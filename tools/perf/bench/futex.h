@@ -0,0 +1,36 @@
+/*
+ * futex.h
+ *
+ * Glibc provides no futex() wrapper, these are shared by the futex
+ * benchmarks.
+ */
+
+#ifndef _FUTEX_H
+#define _FUTEX_H
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <linux/futex.h>
+
+static inline int
+futex(u_int32_t *uaddr, int op, u_int32_t val, struct timespec *timeout,
+      int opflags)
+{
+	return syscall(SYS_futex, uaddr, op | opflags, val, timeout, NULL, 0);
+}
+
+static inline int
+futex_wait(u_int32_t *uaddr, u_int32_t val, struct timespec *timeout,
+	   int opflags)
+{
+	return futex(uaddr, FUTEX_WAIT, val, timeout, opflags);
+}
+
+static inline int
+futex_wake(u_int32_t *uaddr, int nr_wake, int opflags)
+{
+	return futex(uaddr, FUTEX_WAKE, nr_wake, NULL, opflags);
+}
+
+#endif /* _FUTEX_H */
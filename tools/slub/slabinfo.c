@@ -39,6 +39,8 @@ struct slabinfo {
 	unsigned long cpuslab_flush, deactivate_full, deactivate_empty;
 	unsigned long deactivate_to_head, deactivate_to_tail;
 	unsigned long deactivate_remote_frees, order_fallback;
+	unsigned long cpu_partial_alloc, cpu_partial_free, cpu_partial_drain;
+	int cpu_partial;
 	int numa[MAX_NODES];
 	int numa_partial[MAX_NODES];
 } slabinfo[MAX_SLABS];
@@ -293,7 +295,7 @@ int line = 0;
 static void first_line(void)
 {
 	if (show_activity)
-		printf("Name                   Objects      Alloc       Free   %%Fast Fallb O\n");
+		printf("Name                   Objects      Alloc       Free   %%Fast   %%CpuP Fallb O\n");
 	else
 		printf("Name                   Objects Objsize    Space "
 			"Slabs/Part/Cpu  O/S O %%Fr %%Ef Flg\n");
@@ -412,6 +414,29 @@ static const char *onoff(int x)
 	return "Off";
 }
 
+/*
+ * Percentage of cpu slab refills that were satisfied from the per cpu
+ * partial list instead of the node partial list or the page allocator.
+ */
+static unsigned long cpu_partial_alloc_rate(struct slabinfo *s)
+{
+	unsigned long refills = s->cpu_partial_alloc + s->alloc_from_partial +
+				s->alloc_slab;
+
+	return refills ? s->cpu_partial_alloc * 100 / refills : 0;
+}
+
+/*
+ * Percentage of frees to full slabs that put the slab on the per cpu
+ * partial list instead of the node partial list.
+ */
+static unsigned long cpu_partial_free_rate(struct slabinfo *s)
+{
+	unsigned long adds = s->cpu_partial_free + s->free_add_partial;
+
+	return adds ? s->cpu_partial_free * 100 / adds : 0;
+}
+
 static void slab_stats(struct slabinfo *s)
 {
 	unsigned long total_alloc;
@@ -452,6 +477,11 @@ static void slab_stats(struct slabinfo *s)
 		s->alloc_from_partial * 100 / total_alloc,
 		s->free_remove_partial * 100 / total_free);
 
+	printf("Cpu partial list     %8lu %8lu %3lu %3lu\n",
+		s->cpu_partial_alloc, s->cpu_partial_free,
+		s->cpu_partial_alloc * 100 / total_alloc,
+		s->cpu_partial_free * 100 / total_free);
+
 	printf("RemoteObj/SlabFrozen %8lu %8lu %3lu %3lu\n",
 		s->deactivate_remote_frees, s->free_frozen,
 		s->deactivate_remote_frees * 100 / total_alloc,
@@ -459,6 +489,12 @@ static void slab_stats(struct slabinfo *s)
 
 	printf("Total                %8lu %8lu\n\n", total_alloc, total_free);
 
+	if (s->cpu_partial_alloc || s->cpu_partial_free)
+		printf("Cpu partial hits: alloc %lu%% free %lu%% "
+			"(limit %d objects, %lu drains)\n",
+			cpu_partial_alloc_rate(s), cpu_partial_free_rate(s),
+			s->cpu_partial, s->cpu_partial_drain);
+
 	if (s->cpuslab_flush)
 		printf("Flushes %8lu\n", s->cpuslab_flush);
 
@@ -573,11 +609,12 @@ static void slabcache(struct slabinfo *s)
 		total_alloc = s->alloc_fastpath + s->alloc_slowpath;
 		total_free = s->free_fastpath + s->free_slowpath;
 
-		printf("%-21s %8ld %10ld %10ld %3ld %3ld %5ld %1d\n",
+		printf("%-21s %8ld %10ld %10ld %3ld %3ld %3ld %3ld %5ld %1d\n",
 			s->name, s->objects,
 			total_alloc, total_free,
 			total_alloc ? (s->alloc_fastpath * 100 / total_alloc) : 0,
 			total_free ? (s->free_fastpath * 100 / total_free) : 0,
+			cpu_partial_alloc_rate(s), cpu_partial_free_rate(s),
 			s->order_fallback, s->order);
 	}
 	else
@@ -1190,6 +1227,10 @@ static void read_slab_dir(void)
 			slab->deactivate_to_tail = get_obj("deactivate_to_tail");
 			slab->deactivate_remote_frees = get_obj("deactivate_remote_frees");
 			slab->order_fallback = get_obj("order_fallback");
+			slab->cpu_partial = get_obj("cpu_partial");
+			slab->cpu_partial_alloc = get_obj("cpu_partial_alloc");
+			slab->cpu_partial_free = get_obj("cpu_partial_free");
+			slab->cpu_partial_drain = get_obj("cpu_partial_drain");
 			chdir("..");
 			if (slab->name[0] == ':')
 				alias_targets++;
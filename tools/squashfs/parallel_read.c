@@ -0,0 +1,165 @@
+/*
+ * parallel_read - read a file with several threads at once
+ *
+ * Splits the file into one contiguous range per reader and reads all
+ * ranges concurrently, then reports the aggregate throughput.  Meant for
+ * comparing the squashfs threads= mount options on a large file, e.g.
+ *
+ *	mount -o loop,threads=percpu image.sqsh /mnt
+ *	parallel_read -d -j 4 /mnt/large-file
+ *
+ * Licensed under the terms of the GNU GPL License version 2.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define DEFAULT_CHUNK	(128 * 1024)
+#define MAX_READERS	256
+
+struct reader {
+	pthread_t	thread;
+	int		fd;
+	off_t		start;
+	off_t		end;
+	size_t		chunk;
+	off_t		bytes;
+	int		err;
+};
+
+static void *reader_fn(void *arg)
+{
+	struct reader *r = arg;
+	char *buf = malloc(r->chunk);
+	off_t pos = r->start;
+	ssize_t n;
+
+	if (!buf) {
+		r->err = ENOMEM;
+		return NULL;
+	}
+
+	while (pos < r->end) {
+		size_t len = r->chunk;
+
+		if ((off_t)len > r->end - pos)
+			len = r->end - pos;
+		n = pread(r->fd, buf, len, pos);
+		if (n < 0) {
+			r->err = errno;
+			break;
+		}
+		if (n == 0)
+			break;
+		pos += n;
+		r->bytes += n;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static void drop_caches(void)
+{
+	int fd;
+
+	sync();
+	fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if (fd < 0 || write(fd, "3\n", 2) != 2)
+		fprintf(stderr, "warning: could not drop caches: %s\n",
+			strerror(errno));
+	if (fd >= 0)
+		close(fd);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d] [-j readers] [-c chunk_kb] file\n"
+		"  -d  drop the page cache before reading\n"
+		"  -j  number of parallel readers (default 1)\n"
+		"  -c  read size in KiB (default %d)\n",
+		prog, DEFAULT_CHUNK / 1024);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct reader readers[MAX_READERS];
+	int nr_readers = 1, drop = 0, opt, i, fd;
+	size_t chunk = DEFAULT_CHUNK;
+	struct timeval t0, t1;
+	struct stat st;
+	off_t total = 0, per;
+	double secs;
+
+	while ((opt = getopt(argc, argv, "dj:c:")) != -1) {
+		switch (opt) {
+		case 'd':
+			drop = 1;
+			break;
+		case 'j':
+			nr_readers = atoi(optarg);
+			break;
+		case 'c':
+			chunk = (size_t)atoi(optarg) * 1024;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1 || nr_readers < 1 ||
+	    nr_readers > MAX_READERS || chunk == 0)
+		usage(argv[0]);
+
+	if (drop)
+		drop_caches();
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	per = st.st_size / nr_readers;
+	memset(readers, 0, sizeof(readers));
+
+	gettimeofday(&t0, NULL);
+	for (i = 0; i < nr_readers; i++) {
+		readers[i].fd = fd;
+		readers[i].chunk = chunk;
+		readers[i].start = per * i;
+		readers[i].end = (i == nr_readers - 1) ?
+					st.st_size : per * (i + 1);
+		if (pthread_create(&readers[i].thread, NULL, reader_fn,
+				   &readers[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	for (i = 0; i < nr_readers; i++) {
+		pthread_join(readers[i].thread, NULL);
+		if (readers[i].err)
+			fprintf(stderr, "reader %d: %s\n", i,
+				strerror(readers[i].err));
+		total += readers[i].bytes;
+	}
+	gettimeofday(&t1, NULL);
+
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+	printf("%d readers, %lld bytes in %.3f s, %.2f MiB/s\n",
+		nr_readers, (long long)total, secs,
+		secs > 0 ? total / secs / (1024 * 1024) : 0.0);
+
+	close(fd);
+	return 0;
+}
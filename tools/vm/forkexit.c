@@ -0,0 +1,161 @@
+/*
+ * forkexit - fork/exit microbenchmark for memory cgroup charging
+ *
+ * Runs one or more workers that fork children in a loop.  Each child
+ * touches a number of anonymous pages, so that they get charged to its
+ * memory cgroup, and exits, which uncharges them again.  Reports forks per
+ * second, e.g. for a memory cgroup created beforehand:
+ *
+ *	forkexit -c /sys/fs/cgroup/memory/bench -j 4 -p 64 -t 10
+ *
+ * Licensed under the terms of the GNU GPL License version 2.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static long page_size;
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int join_cgroup(const char *path)
+{
+	char tasks[4096];
+	FILE *f;
+
+	snprintf(tasks, sizeof(tasks), "%s/tasks", path);
+	f = fopen(tasks, "w");
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", tasks, strerror(errno));
+		return -1;
+	}
+	fprintf(f, "%d\n", getpid());
+	if (fclose(f)) {
+		fprintf(stderr, "%s: %s\n", tasks, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static void child(int pages)
+{
+	char *p;
+	int i;
+
+	p = mmap(NULL, pages * page_size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		_exit(1);
+	for (i = 0; i < pages; i++)
+		p[i * page_size] = 1;
+	_exit(0);
+}
+
+/* Fork children until the deadline, then report the count in the status */
+static void worker(int pages, double deadline, int fd)
+{
+	unsigned long forks = 0;
+	int status;
+	pid_t pid;
+
+	while (now() < deadline) {
+		pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			break;
+		}
+		if (!pid)
+			child(pages);
+		if (waitpid(pid, &status, 0) < 0) {
+			perror("waitpid");
+			break;
+		}
+		forks++;
+	}
+	if (write(fd, &forks, sizeof(forks)) != sizeof(forks))
+		_exit(1);
+	_exit(0);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-c cgroup] [-j workers] [-p pages] [-t seconds]\n",
+		name);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	const char *cgroup = NULL;
+	int workers = 1, pages = 16, seconds = 5;
+	unsigned long total = 0, forks;
+	double start, elapsed;
+	int pipefd[2];
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "c:j:p:t:")) != -1) {
+		switch (opt) {
+		case 'c':
+			cgroup = optarg;
+			break;
+		case 'j':
+			workers = atoi(optarg);
+			break;
+		case 'p':
+			pages = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (workers < 1 || pages < 0 || seconds < 1)
+		usage(argv[0]);
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (cgroup && join_cgroup(cgroup))
+		return 1;
+	if (pipe(pipefd)) {
+		perror("pipe");
+		return 1;
+	}
+
+	start = now();
+	for (i = 0; i < workers; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (!pid)
+			worker(pages, start + seconds, pipefd[1]);
+	}
+	for (i = 0; i < workers; i++)
+		wait(NULL);
+	elapsed = now() - start;
+
+	close(pipefd[1]);
+	while (read(pipefd[0], &forks, sizeof(forks)) == sizeof(forks))
+		total += forks;
+
+	printf("%d workers, %d pages per child: %lu forks in %.2fs, "
+	       "%.0f forks/s\n", workers, pages, total, elapsed,
+	       total / elapsed);
+	return 0;
+}
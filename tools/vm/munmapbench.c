@@ -0,0 +1,152 @@
+/*
+ * munmapbench - mmap/munmap microbenchmark for TLB shootdown cost
+ *
+ * Runs 1 to N threads of one process that map a few anonymous pages,
+ * touch them, optionally split the mapping into several vmas with
+ * mprotect(), and unmap it again.  All threads share the mm, so every
+ * munmap has to flush the TLB on all the CPUs the process runs on.
+ * Reports munmaps per second and the average munmap latency for each
+ * thread count, e.g.:
+ *
+ *	munmapbench -j 4 -p 8 -v 4 -t 5
+ *
+ * Licensed under the terms of the GNU GPL License version 2.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+static long page_size;
+static int pages = 4, vmas = 1;
+static volatile int stop;
+
+struct worker {
+	pthread_t thread;
+	unsigned long munmaps;
+	double munmap_time;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker(void *arg)
+{
+	struct worker *w = arg;
+	size_t size = pages * page_size;
+	double start;
+	char *p;
+	int i;
+
+	while (!stop) {
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) {
+			perror("mmap");
+			break;
+		}
+		for (i = 0; i < pages; i++)
+			p[i * page_size] = 1;
+		/* alternate the protection of the tail: @vmas vmas */
+		for (i = 1; i < vmas && i < pages; i++)
+			mprotect(p + i * page_size, size - i * page_size,
+				 i & 1 ? PROT_READ : PROT_READ | PROT_WRITE);
+
+		start = now();
+		if (munmap(p, size)) {
+			perror("munmap");
+			break;
+		}
+		w->munmap_time += now() - start;
+		w->munmaps++;
+	}
+	return NULL;
+}
+
+static int run(int threads, int seconds)
+{
+	struct worker *w;
+	unsigned long total = 0;
+	double start, elapsed, munmap_time = 0;
+	int i;
+
+	w = calloc(threads, sizeof(*w));
+	if (!w) {
+		perror("calloc");
+		return -1;
+	}
+
+	stop = 0;
+	start = now();
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&w[i].thread, NULL, worker, &w[i])) {
+			perror("pthread_create");
+			threads = i;
+			break;
+		}
+	}
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < threads; i++) {
+		pthread_join(w[i].thread, NULL);
+		total += w[i].munmaps;
+		munmap_time += w[i].munmap_time;
+	}
+	elapsed = now() - start;
+	free(w);
+
+	printf("%d threads, %d pages, %d vmas: %10.0f munmaps/s, "
+	       "%7.2f us per munmap\n", threads, pages, vmas,
+	       total / elapsed, total ? munmap_time * 1e6 / total : 0);
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-j max threads] [-p pages] [-v vmas] [-t seconds]\n",
+		name);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	int threads = 4, seconds = 5;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "j:p:v:t:")) != -1) {
+		switch (opt) {
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'p':
+			pages = atoi(optarg);
+			break;
+		case 'v':
+			vmas = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (threads < 1 || pages < 1 || vmas < 1 || seconds < 1)
+		usage(argv[0]);
+
+	page_size = sysconf(_SC_PAGESIZE);
+	for (i = 1; i <= threads; i++)
+		if (run(i, seconds))
+			return 1;
+	return 0;
+}
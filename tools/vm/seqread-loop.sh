@@ -0,0 +1,75 @@
+#!/bin/sh
+#
+# seqread-loop.sh - sequential read benchmark on a tmpfs backed loop device
+#
+# Creates a file in tmpfs, attaches it to a loop device and reads the whole
+# device sequentially with a cold page cache, so that every page goes
+# through readahead and mpage_readpages().  Reports the read throughput
+# and, when the kernel has CONFIG_LOCK_STAT, how often the page cache
+# tree_lock and the LRU lock were taken and contended during the read.
+#
+#	seqread-loop.sh [-s size_mb] [-b block_size] [-r runs]
+#
+# Must be run as root.  Licensed under the terms of the GNU GPL License
+# version 2.
+
+size_mb=512
+bs=1M
+runs=3
+
+while getopts "s:b:r:" opt; do
+	case $opt in
+	s) size_mb=$OPTARG ;;
+	b) bs=$OPTARG ;;
+	r) runs=$OPTARG ;;
+	*) echo "usage: $0 [-s size_mb] [-b block_size] [-r runs]" >&2
+	   exit 2 ;;
+	esac
+done
+
+dir=$(mktemp -d /tmp/seqread.XXXXXX) || exit 1
+loop=
+
+cleanup()
+{
+	[ -n "$loop" ] && losetup -d "$loop"
+	umount "$dir" 2>/dev/null
+	rmdir "$dir"
+}
+trap cleanup EXIT
+
+mount -t tmpfs -o size=$((size_mb + 16))m seqread "$dir" || exit 1
+dd if=/dev/zero of="$dir/image" bs=1M count="$size_mb" 2>/dev/null || exit 1
+loop=$(losetup -f --show "$dir/image") || exit 1
+
+# /proc/lock_stat lines are "class: con-bounces contentions ... acquisitions"
+lock_stat()
+{
+	awk -v class="$1" '$1 == class ":" {
+		contended += $3; acquired += $(NF - 3)
+	} END { printf "%d %d", acquired, contended }' /proc/lock_stat
+}
+
+run=1
+while [ $run -le "$runs" ]; do
+	blockdev --flushbufs "$loop"
+	echo 3 > /proc/sys/vm/drop_caches
+	[ -w /proc/lock_stat ] && echo 0 > /proc/lock_stat
+
+	start=$(date +%s%N)
+	dd if="$loop" of=/dev/null bs="$bs" 2>/dev/null || exit 1
+	end=$(date +%s%N)
+
+	msecs=$(( (end - start) / 1000000 ))
+	[ $msecs -eq 0 ] && msecs=1
+	printf "run %d: %d MB in %d ms, %d MB/s" $run "$size_mb" $msecs \
+		$((size_mb * 1000 / msecs))
+	if [ -r /proc/lock_stat ]; then
+		set -- $(lock_stat "&(&mapping->tree_lock)->rlock")
+		printf ", tree_lock %d/%d" "$1" "$2"
+		set -- $(lock_stat "&(&zone->lru_lock)->rlock")
+		printf ", lru_lock %d/%d" "$1" "$2"
+	fi
+	echo
+	run=$((run + 1))
+done